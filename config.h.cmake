@@ -13,6 +13,7 @@
 #cmakedefine HAVE_STDLIB_H
 #cmakedefine HAVE_SYSLOG_H
 #cmakedefine HAVE_SYS_IOCTL_H
+#cmakedefine HAVE_SYS_EVENTFD_H
 #cmakedefine HAVE_SYS_FILIO_H
 #cmakedefine HAVE_SYS_PARAM_H
 #cmakedefine HAVE_SYS_RESOURCE_H
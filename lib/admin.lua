@@ -76,6 +76,26 @@ function read_query(packet)
 				b.connected_clients  -- currently connected clients
 			}
 		end
+	elseif query:lower() == "select * from connections" then
+		fields = { 
+			{ name = "id", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "client",
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "state",
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "event_thread",
+			  type = proxy.MYSQL_TYPE_LONG },
+		}
+
+		for _, con in ipairs(proxy.global.connections()) do
+			rows[#rows + 1] = {
+				con.id,
+				con.client,       -- nil for listening sockets
+				con.state,
+				con.event_thread  -- nil if the connection isn't handled by a event-thread
+			}
+		end
 	elseif query:lower() == "select * from help" then
 		fields = { 
 			{ name = "command", 
@@ -85,6 +105,7 @@ function read_query(packet)
 		}
 		rows[#rows + 1] = { "SELECT * FROM help", "shows this help" }
 		rows[#rows + 1] = { "SELECT * FROM backends", "lists the backends and their state" }
+		rows[#rows + 1] = { "SELECT * FROM connections", "lists the connections and their state" }
 	else
 		set_error("use 'SELECT * FROM help' to see the supported commands")
 		return proxy.PROXY_SEND_RESULT
@@ -50,7 +50,7 @@ function resultset_to_string( res )
 	local field_count = #fields
 
 	local row_count = 0
-	for row in res.rows do
+	for row in res.cursor do
 		local o
 		local cols = {}
 
@@ -326,14 +326,14 @@ function read_query_result(inj)
 		-- the first SHOW SESSION STATUS
 		baseline = {}
 		
-		for row in res.rows do
+		for row in res.cursor do
 			-- 1 is the key, 2 is the value
 			baseline[row[1]] = row[2]
 		end
 	elseif inj.id == 3 then
 		local delta_counters = { }
 		
-		for row in res.rows do
+		for row in res.cursor do
 			if baseline[row[1]] then
 				local num1 = tonumber(baseline[row[1]])
 				local num2 = tonumber(row[2])
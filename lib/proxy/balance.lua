@@ -50,6 +50,7 @@ function idle_ro()
 		-- pick a slave which has some idling connections
 		if s.type == proxy.BACKEND_TYPE_RO and 
 		   s.state ~= proxy.BACKEND_STATE_DOWN and 
+		   not s.is_lagging and
 		   conns.cur_idle_connections > 0 then
 			if max_conns == -1 or 
 			   s.connected_clients < max_conns then
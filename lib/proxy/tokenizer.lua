@@ -31,11 +31,18 @@ module("proxy.tokenizer", package.seeall)
 -- * turn constants into ?
 -- * turn tokens into uppercase
 --
+-- the tokens of tokenize() are normalized in C, a table of tokens
+-- is normalized in Lua
+--
 -- @param tokens a array of tokens
 -- @return normalized SQL query
 -- 
 -- @see tokenize
 function normalize(tokens)
+	if type(tokens) == "userdata" then
+		return tokenizer.normalize(tokens)
+	end
+
 	-- we use a string-stack here and join them at the end
 	-- see http://www.lua.org/pil/11.6.html for more
 	--
@@ -100,6 +107,20 @@ function normalize(tokens)
 	return table.concat(stack)
 end
 
+---
+-- get the fingerprint of a query
+--
+-- queries with the same normalized query have the same fingerprint. 
+-- It is computed without building the normalized query.
+--
+-- @param query a SQL query or the tokens of tokenize()
+-- @return the fingerprint as 16 hex-digits
+--
+-- @see normalize
+function fingerprint(query)
+	return tokenizer.fingerprint(query)
+end
+
 ---
 -- call the included tokenizer
 --
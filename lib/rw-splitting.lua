@@ -98,6 +98,7 @@ function connect_server()
 			break
 		elseif s.type == proxy.BACKEND_TYPE_RO and
 		       s.state ~= proxy.BACKEND_STATE_DOWN and
+		       not s.is_lagging and
 		       cur_idle < pool.min_idle_connections then
 			proxy.connection.backend_ndx = i
 			break
@@ -4,6 +4,24 @@
 #include <string.h>
 
 #include "sql-tokenizer.h"
+#include "sql-tokenizer-keywords.h"
+
+/**
+ * seeds we try before we give up on finding a perfect hash
+ */
+#define MAX_SEEDS 10000
+
+typedef struct {
+	gchar *name;      /**< the keyword in lower-case */
+	gsize name_len;
+	gint token_id;
+	guint64 hash;
+} keyword;
+
+typedef struct {
+	GPtrArray *keywords;
+	guint32 displacement;
+} bucket;
 
 gboolean trav(gpointer _a, gpointer _b, gpointer _udata) {
 	gboolean *is_first = _udata;
@@ -19,9 +37,111 @@ gboolean trav(gpointer _a, gpointer _b, gpointer _udata) {
 	return FALSE;
 }
 
+gboolean collect(gpointer _a, gpointer _b, gpointer _udata) {
+	GPtrArray *keywords = _udata;
+	keyword *kw;
+
+	kw = g_new0(keyword, 1);
+	kw->name = g_ascii_strdown(_a, -1);
+	kw->name_len = strlen(kw->name);
+	kw->token_id = GPOINTER_TO_INT(_b);
+
+	g_ptr_array_add(keywords, kw);
+
+	return FALSE;
+}
+
+/**
+ * place the biggest buckets first, they are the hardest to place
+ */
+static gint bucket_cmp(gconstpointer _a, gconstpointer _b) {
+	const bucket *a = *(const bucket **)_a;
+	const bucket *b = *(const bucket **)_b;
+
+	return b->keywords->len - a->keywords->len;
+}
+
+/**
+ * try to find the displacements for a seed
+ *
+ * @return TRUE if each keyword got a slot of its own
+ */
+static gboolean place(GPtrArray *keywords, guint32 seed, guint32 slots_len, bucket *buckets, guint32 buckets_len, keyword **slots) {
+	GPtrArray *sorted;
+	gboolean is_placed = TRUE;
+	guint i, j, k;
+
+	memset(slots, 0, slots_len * sizeof(*slots));
+
+	for (i = 0; i < buckets_len; i++) {
+		g_ptr_array_set_size(buckets[i].keywords, 0);
+		buckets[i].displacement = 0;
+	}
+
+	for (i = 0; i < keywords->len; i++) {
+		keyword *kw = keywords->pdata[i];
+
+		kw->hash = sql_keywords_hash(seed, kw->name, kw->name_len);
+
+		g_ptr_array_add(buckets[(kw->hash >> 32) & (buckets_len - 1)].keywords, kw);
+	}
+
+	sorted = g_ptr_array_new();
+	for (i = 0; i < buckets_len; i++) {
+		g_ptr_array_add(sorted, &buckets[i]);
+	}
+	g_ptr_array_sort(sorted, bucket_cmp);
+
+	for (i = 0; is_placed && i < sorted->len; i++) {
+		bucket *b = sorted->pdata[i];
+		guint32 d;
+
+		if (b->keywords->len == 0) break;
+
+		is_placed = FALSE;
+
+		for (d = 0; !is_placed && d < slots_len; d++) {
+			is_placed = TRUE;
+
+			for (j = 0; is_placed && j < b->keywords->len; j++) {
+				keyword *kw = b->keywords->pdata[j];
+				guint32 slot = ((guint32)kw->hash ^ d) & (slots_len - 1);
+
+				if (slots[slot]) is_placed = FALSE;
+
+				/* two keywords of the bucket may want the same slot */
+				for (k = 0; is_placed && k < j; k++) {
+					keyword *other = b->keywords->pdata[k];
+
+					if ((((guint32)other->hash ^ d) & (slots_len - 1)) == slot) is_placed = FALSE;
+				}
+			}
+
+			if (!is_placed) continue;
+
+			b->displacement = d;
+
+			for (j = 0; j < b->keywords->len; j++) {
+				keyword *kw = b->keywords->pdata[j];
+
+				slots[((guint32)kw->hash ^ d) & (slots_len - 1)] = kw;
+			}
+		}
+	}
+
+	g_ptr_array_free(sorted, TRUE);
+
+	return is_placed;
+}
+
 int main() {
 	GTree *tokens;
+	GPtrArray *keywords;
 	gboolean is_first = TRUE;
+	keyword **slots;
+	bucket *buckets;
+	guint32 slots_len, buckets_len;
+	guint32 seed;
 	gint i;
 
 	tokens = g_tree_new((GCompareFunc)g_ascii_strcasecmp);
@@ -34,6 +154,7 @@ int main() {
 	}
 
 	/* traverse the tree and output all keywords in a sorted way */
+	printf("#include \"sql-tokenizer-keywords.h\"\n\n");
 	printf("static int sql_keywords[] = {");
 	g_tree_foreach(tokens, trav, &is_first);
 	printf("\n};\n");
@@ -41,6 +162,77 @@ int main() {
 	printf("int *sql_keywords_get() { return sql_keywords; }\n");
 	printf("int sql_keywords_get_count() { return sizeof(sql_keywords) / sizeof(sql_keywords[0]); }\n");
 
+	/* the perfect hash: twice as many slots as keywords and about 2 keywords per bucket */
+	keywords = g_ptr_array_new();
+	g_tree_foreach(tokens, collect, keywords);
+
+	for (slots_len = 1; slots_len < keywords->len * 2; slots_len <<= 1);
+	buckets_len = slots_len / 4;
+
+	slots = g_new0(keyword *, slots_len);
+	buckets = g_new0(bucket, buckets_len);
+	for (i = 0; i < (gint)buckets_len; i++) {
+		buckets[i].keywords = g_ptr_array_new();
+	}
+
+	for (i = 0; i < (gint)keywords->len; i++) {
+		keyword *kw = keywords->pdata[i];
+
+		if (kw->name_len >= SQL_KEYWORDS_NAME_SIZE) {
+			g_error("%s: the keyword %s is longer than SQL_KEYWORDS_NAME_SIZE", G_STRLOC, kw->name);
+		}
+	}
+
+	for (seed = 0; seed < MAX_SEEDS; seed++) {
+		if (place(keywords, seed, slots_len, buckets, buckets_len, slots)) break;
+	}
+
+	if (seed == MAX_SEEDS) {
+		g_error("%s: found no perfect hash for the %u keywords", G_STRLOC, keywords->len);
+	}
+
+	printf("\nstatic const sql_keywords_slot_t sql_keywords_slots[] = {");
+	for (i = 0; i < (gint)slots_len; i++) {
+		keyword *kw = slots[i];
+
+		if (kw) {
+			printf("%s\n\t{ \"%s\", %"G_GSIZE_FORMAT", %d }", i ? "," : "", kw->name, kw->name_len, kw->token_id);
+		} else {
+			printf("%s\n\t{ \"\", 0, 0 }", i ? "," : "");
+		}
+	}
+	printf("\n};\n");
+
+	printf("\nstatic const guint32 sql_keywords_displacements[] = {");
+	for (i = 0; i < (gint)buckets_len; i++) {
+		printf("%s\n\t%u", i ? "," : "", buckets[i].displacement);
+	}
+	printf("\n};\n");
+
+	printf("\nstatic const sql_keywords_hash_t sql_keywords_hash_table = {\n"
+			"\t%u,\n"
+			"\tsql_keywords_slots,\n"
+			"\t%u,\n"
+			"\tsql_keywords_displacements,\n"
+			"\t%u\n"
+			"};\n",
+			seed, slots_len - 1, buckets_len - 1);
+	printf("const sql_keywords_hash_t *sql_keywords_hash_get() { return &sql_keywords_hash_table; }\n");
+
+	for (i = 0; i < (gint)buckets_len; i++) {
+		g_ptr_array_free(buckets[i].keywords, TRUE);
+	}
+	g_free(buckets);
+	g_free(slots);
+
+	for (i = 0; i < (gint)keywords->len; i++) {
+		keyword *kw = keywords->pdata[i];
+
+		g_free(kw->name);
+		g_free(kw);
+	}
+	g_ptr_array_free(keywords, TRUE);
+
 	g_tree_destroy(tokens);
 
 	return 0;
@@ -1,7 +1,42 @@
 #ifndef __SQL_TOKENIZER_KEYWORDS_H__
 #define __SQL_TOKENIZER_KEYWORDS_H__
 
+#include <glib.h>
+
+/**
+ * size of the keyword names in the hash-table
+ *
+ * the names are padded with NULs to compare them a word at a time
+ */
+#define SQL_KEYWORDS_NAME_SIZE 32
+
+/**
+ * a slot of the perfect hash-table of the keywords
+ */
+typedef struct {
+	gchar name[SQL_KEYWORDS_NAME_SIZE]; /**< the keyword in lower-case, empty if the slot is free */
+	gsize name_len;
+	int token_id;
+} sql_keywords_slot_t;
+
+/**
+ * a perfect hash over the keywords, generated by sql-tokenizer-gen
+ *
+ * the upper 32 bits of sql_keywords_hash() pick a displacement, the lower 32 bits
+ * XORed with it pick the slot
+ */
+typedef struct {
+	guint32 seed;
+	const sql_keywords_slot_t *slots;
+	guint32 slots_mask;          /**< number of slots - 1, the number of slots is a power of 2 */
+	const guint32 *displacements;
+	guint32 displacements_mask;  /**< number of displacements - 1, the number of displacements is a power of 2 */
+} sql_keywords_hash_t;
+
 int *sql_keywords_get(void);
 int sql_keywords_get_count(void);
 
+const sql_keywords_hash_t *sql_keywords_hash_get(void);
+guint64 sql_keywords_hash(guint32 seed, const gchar *name, gsize name_len);
+
 #endif
@@ -27,13 +27,25 @@
 
 #include "sql-tokenizer.h"
 
+/**
+ * a token as the scripts see it
+ *
+ * only points to the token in the token list, the text of the token is
+ * turned into a lua-string when the script reads it
+ */
+typedef struct {
+	sql_tokens *tokens;
+	gsize ndx;
+} sql_tokenizer_lua_token;
+
 static int proxy_tokenize_token_get(lua_State *L) {
-	sql_token *token = *(sql_token **)luaL_checkself(L); 
+	sql_tokenizer_lua_token *lua_token = luaL_checkself(L); 
+	sql_token *token = sql_tokens_index(lua_token->tokens, lua_token->ndx);
 	size_t keysize;
 	const char *key = luaL_checklstring(L, 2, &keysize);
 
 	if (strleq(key, keysize, C("text"))) {
-		lua_pushlstring(L, S(token->text));
+		lua_pushlstring(L, sql_token_get_text(lua_token->tokens, token), token->text_len);
 		return 1;
 	} else if (strleq(key, keysize, C("token_id"))) {
 		lua_pushinteger(L, token->token_id);
@@ -63,29 +75,28 @@ int sql_tokenizer_lua_token_getmetatable(lua_State *L) {
  *
  */
 static int proxy_tokenize_get(lua_State *L) {
-	GPtrArray *tokens = *(GPtrArray **)luaL_checkself(L); 
+	sql_tokens *tokens = *(sql_tokens **)luaL_checkself(L); 
 	int ndx = luaL_checkinteger(L, 2);
-	sql_token *token;
-	sql_token **token_p;
+	sql_tokenizer_lua_token *lua_token;
 
-	if (tokens->len > G_MAXINT) {
+	if (sql_tokens_get_len(tokens) > G_MAXINT) {
 		return 0;
 	}
 
 	/* lua uses 1 is starting index */
-	if (ndx < 1 || ndx > (int)tokens->len) {
+	if (ndx < 1 || ndx > (int)sql_tokens_get_len(tokens)) {
 		return 0;
 	}
 
-	token = tokens->pdata[ndx - 1];
-	if (NULL == token) {
+	if (sql_tokens_index(tokens, ndx - 1)->is_unset) {
 		lua_pushnil(L);
 
 		return 1;
 	}
 
-	token_p = lua_newuserdata(L, sizeof(token));                          /* (sp += 1) */
-	*token_p = token;
+	lua_token = lua_newuserdata(L, sizeof(*lua_token));                          /* (sp += 1) */
+	lua_token->tokens = tokens;
+	lua_token->ndx = ndx - 1;
 
 	sql_tokenizer_lua_token_getmetatable(L);
 	lua_setmetatable(L, -2);             /* tie the metatable to the udata   (sp -= 1) */
@@ -96,44 +107,41 @@ static int proxy_tokenize_get(lua_State *L) {
 /**
  * a settor for the tokens
  *
- * only allow to unset a token in the tokens array to free its memory
+ * only allow to unset a token in the tokens array
+ *
+ * the tokens share their memory, it is freed with the tokens array
  */
 static int proxy_tokenize_set(lua_State *L) {
-	GPtrArray *tokens = *(GPtrArray **)luaL_checkself(L); 
+	sql_tokens *tokens = *(sql_tokens **)luaL_checkself(L); 
 	int ndx = luaL_checkinteger(L, 2);
-	sql_token *token;
 
 	luaL_checktype(L, 3, LUA_TNIL); /* for now we can only use = nil */
 
-	if (tokens->len > G_MAXINT) {
+	if (sql_tokens_get_len(tokens) > G_MAXINT) {
 		return 0;
 	}
 
 	/* lua uses 1 is starting index */
-	if (ndx < 1 || ndx > (int)tokens->len) {
+	if (ndx < 1 || ndx > (int)sql_tokens_get_len(tokens)) {
 		return 0;
 	}
 
-	token = tokens->pdata[ndx - 1];
-	if (NULL != token) {
-		sql_token_free(token);
-		tokens->pdata[ndx - 1] = NULL;
-	}
+	sql_tokens_index(tokens, ndx - 1)->is_unset = TRUE;
 
 	return 0;
 }
 
 
 static int proxy_tokenize_len(lua_State *L) {
-	GPtrArray *tokens = *(GPtrArray **)luaL_checkself(L); 
+	sql_tokens *tokens = *(sql_tokens **)luaL_checkself(L); 
 
-	lua_pushinteger(L, tokens->len);
+	lua_pushinteger(L, sql_tokens_get_len(tokens));
 
 	return 1;
 }
 
 static int proxy_tokenize_gc(lua_State *L) {
-	GPtrArray *tokens = *(GPtrArray **)luaL_checkself(L); 
+	sql_tokens *tokens = *(sql_tokens **)luaL_checkself(L); 
 
 	sql_tokens_free(tokens);
 
@@ -158,8 +166,8 @@ static int sql_tokenizer_lua_getmetatable(lua_State *L) {
 int proxy_tokenize(lua_State *L) {
 	size_t str_len;
 	const char *str = luaL_checklstring(L, 1, &str_len);
-	GPtrArray *tokens = sql_tokens_new();
-	GPtrArray **tokens_p;
+	sql_tokens *tokens = sql_tokens_new();
+	sql_tokens **tokens_p;
 
 	sql_tokenizer(tokens, str, str_len);
 
@@ -172,6 +180,78 @@ int proxy_tokenize(lua_State *L) {
 	return 1;
 }
 
+/**
+ * get the tokens of the first argument
+ *
+ * a query is tokenized on the fly, the caller has to free *tmp_tokens
+ */
+static sql_tokens *proxy_tokenize_checktokens(lua_State *L, sql_tokens **tmp_tokens) {
+	*tmp_tokens = NULL;
+
+	if (lua_type(L, 1) == LUA_TSTRING) {
+		size_t str_len;
+		const char *str = lua_tolstring(L, 1, &str_len);
+
+		*tmp_tokens = sql_tokens_new();
+		sql_tokenizer(*tmp_tokens, str, str_len);
+
+		return *tmp_tokens;
+	} else if (lua_type(L, 1) == LUA_TUSERDATA && lua_getmetatable(L, 1)) {
+		gboolean is_tokens;
+
+		sql_tokenizer_lua_getmetatable(L);
+		is_tokens = lua_rawequal(L, -1, -2);
+		lua_pop(L, 2);
+
+		if (is_tokens) return *(sql_tokens **)lua_touserdata(L, 1);
+	}
+
+	luaL_typerror(L, 1, "string or tokens");
+
+	return NULL;
+}
+
+/**
+ * normalize a query or the tokens of tokenize()
+ *
+ * @see sql_tokens_normalize()
+ */
+static int proxy_tokens_normalize(lua_State *L) {
+	sql_tokens *tmp_tokens;
+	sql_tokens *tokens = proxy_tokenize_checktokens(L, &tmp_tokens);
+	GString *normalized = g_string_sized_new(64);
+
+	sql_tokens_normalize(tokens, normalized);
+	if (tmp_tokens) sql_tokens_free(tmp_tokens);
+
+	lua_pushlstring(L, S(normalized));
+	g_string_free(normalized, TRUE);
+
+	return 1;
+}
+
+/**
+ * get the fingerprint of a query or the tokens of tokenize()
+ *
+ * queries that only differ in their constants, comments, whitespace and the case of the keywords 
+ * have the same fingerprint. A lua_Number can't hold 64bit, the fingerprint is returned as 
+ * 16 hex-digits.
+ *
+ * @see sql_tokens_fingerprint()
+ */
+static int proxy_tokens_fingerprint(lua_State *L) {
+	sql_tokens *tmp_tokens;
+	sql_tokens *tokens = proxy_tokenize_checktokens(L, &tmp_tokens);
+	gchar fingerprint[sizeof("0123456789abcdef")];
+
+	g_snprintf(fingerprint, sizeof(fingerprint), "%016"G_GINT64_MODIFIER"x", sql_tokens_fingerprint(tokens));
+	if (tmp_tokens) sql_tokens_free(tmp_tokens);
+
+	lua_pushlstring(L, fingerprint, sizeof(fingerprint) - 1);
+
+	return 1;
+}
+
 /*
 ** Assumes the table is on top of the stack.
 */
@@ -190,6 +270,8 @@ static void set_info (lua_State *L) {
 
 static const struct luaL_reg mysql_tokenizerlib[] = {
 	{"tokenize", proxy_tokenize},
+	{"normalize", proxy_tokens_normalize},
+	{"fingerprint", proxy_tokens_fingerprint},
 	{NULL, NULL},
 };
 
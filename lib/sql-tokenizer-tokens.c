@@ -1,4 +1,5 @@
 #include "sql-tokenizer.h"
+#include "sql-tokenizer-keywords.h"
 
 #define S(x) { #x, sizeof(#x) - 1 }
 
@@ -303,3 +304,22 @@ int sql_token_get_last_id() {
 	return (sizeof(token_names)/sizeof(token_names[0])) - 1; /* the last one is not a token */
 }
 
+
+/**
+ * hash a keyword candidate for the perfect hash of the keywords
+ *
+ * a FNV-1a over the bytes with bit 5 set, upper- and lower-case letters hash the same.
+ * The hash is computed byte by byte to be the same on the host that runs the
+ * sql-tokenizer-gen and the one that runs the tokenizer.
+ */
+guint64 sql_keywords_hash(guint32 seed, const gchar *name, gsize name_len) {
+	guint64 h = G_GUINT64_CONSTANT(14695981039346656037) ^ seed;
+	gsize i;
+
+	for (i = 0; i < name_len; i++) {
+		h ^= (guchar)name[i] | 0x20;
+		h *= G_GUINT64_CONSTANT(1099511628211);
+	}
+
+	return h;
+}
@@ -316,21 +316,47 @@ typedef enum {
 	TK_LAST_TOKEN
 } sql_token_id;
 
+/**
+ * a token of a token list
+ *
+ * the text of the token lives in the text-buffer of its token list
+ *
+ * @see sql_token_get_text()
+ */
 typedef struct {
 	sql_token_id token_id;
-	GString *text;
+	gboolean is_unset;  /**< removed from the token list by a script */
+	gsize text_offset;  /**< offset of the text in the text-buffer of the token list */
+	gsize text_len;
 } sql_token;
 
+/**
+ * a token list
+ *
+ * the tokens are stored one after another and their texts share one buffer. Tokenizing
+ * a query only allocates when one of them has to grow.
+ */
+typedef struct {
+	GArray *tokens;   /**< array of sql_token */
+	GString *text;    /**< the NUL-terminated texts of the tokens */
+} sql_tokens;
+
 /** @defgroup sql SQL Tokenizer
  * 
  * SQL tokenizer
  *
  * @code
  *   #define C(s) s, sizeof(s) - 1
- *   GPtrArray *tokens = sql_tokens_new();
+ *   sql_tokens *tokens = sql_tokens_new();
  *
  *   if (0 == sql_tokenizer(tokens, C("SELECT 1 FROM tbl"))) {
- *      work_with_the_tokens();
+ *      gsize i;
+ *
+ *      for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+ *         sql_token *token = sql_tokens_index(tokens, i);
+ *
+ *         work_with_the_token(token->token_id, sql_token_get_text(tokens, token));
+ *      }
  *   }
  *
  *   sql_tokens_free(tokens);
@@ -339,19 +365,6 @@ typedef struct {
 
 /*@{*/
 
-/**
- * create a new sql-token
- * @internal       only used to drive the test-cases 
- *
- * @return         a empty SQL token
- */
-sql_token *sql_token_new(void);
-
-/**
- * free a sql-token
- */
-void sql_token_free(sql_token *token);
-
 /**
  * get the name for a token-id
  */
@@ -387,23 +400,100 @@ sql_token_id sql_token_get_id_len(const gchar *name, size_t name_len);
  * @return 0 on success
  *
  */
-int sql_tokenizer(GPtrArray *tokens, const gchar *str, gsize len);
+int sql_tokenizer(sql_tokens *tokens, const gchar *str, gsize len);
 
 /**
  * create a empty token list
  *
- * @note a token list is a GPtrArray *
- *
  * @return a empty token list 
  */
-GPtrArray * sql_tokens_new(void);
+sql_tokens *sql_tokens_new(void);
 
 /**
  * free a token-stream
  *
  * @param tokens   a token list to free
  */
-void sql_tokens_free(GPtrArray *tokens);
+void sql_tokens_free(sql_tokens *tokens);
+
+/**
+ * get the number of tokens in a token list
+ */
+gsize sql_tokens_get_len(sql_tokens *tokens);
+
+/**
+ * get a token of a token list
+ *
+ * @param tokens   a token list
+ * @param ndx      index of the token, has to be smaller than sql_tokens_get_len()
+ * @return         the token, valid until the token list is changed or freed
+ */
+sql_token *sql_tokens_index(sql_tokens *tokens, gsize ndx);
+
+/**
+ * get the text of a token
+ *
+ * @param tokens   the token list of the token
+ * @param token    a token
+ * @return         the NUL-terminated text of the token, its length is token->text_len
+ */
+const gchar *sql_token_get_text(sql_tokens *tokens, sql_token *token);
+
+/**
+ * normalize a token-stream
+ *
+ * - remove comments
+ * - quote literals
+ * - turn constants into ?
+ * - turn tokens into uppercase
+ *
+ * same as normalize() of proxy.tokenizer, COMMIT, ROLLBACK, BEGIN and START TRANSACTION stay
+ * keywords if they start the statement
+ *
+ * @param tokens     a token list
+ * @param normalized a string to append the normalized query to, NULL to only get the fingerprint
+ * @return the fingerprint of the normalized query
+ * @see sql_tokens_fingerprint()
+ */
+guint64 sql_tokens_normalize(sql_tokens *tokens, GString *normalized);
+
+/**
+ * get the fingerprint of a token-stream
+ *
+ * the fingerprint is the 64bit FNV-1a hash of the normalized query. It is computed in one pass
+ * over the tokens without building the normalized query.
+ *
+ * @param tokens     a token list
+ * @return the fingerprint of the normalized query
+ */
+guint64 sql_tokens_fingerprint(sql_tokens *tokens);
+
+/**
+ * check if a statement is a read that may run on a read-only backend
+ *
+ * a SELECT is a read unless it
+ * - locks rows (FOR UPDATE, LOCK IN SHARE MODE)
+ * - writes (SELECT ... INTO OUTFILE)
+ * - asks for the LAST_INSERT_ID() or @@insert_id of the previous write
+ *
+ * @param tokens          a token list
+ * @param calc_found_rows set to TRUE if the statement is a SELECT SQL_CALC_FOUND_ROWS, may be NULL
+ * @return TRUE if the statement is a read
+ */
+gboolean sql_tokens_is_read(sql_tokens *tokens, gboolean *calc_found_rows);
+
+/**
+ * check if a statement leaves state in the session of the connection
+ *
+ * - SET, except SET autocommit which is tracked through the server-status
+ * - USE, LOCK TABLES, PREPARE, HANDLER and CREATE TEMPORARY TABLE
+ * - GET_LOCK() and user variables
+ * - a statement that starts with a executable comment, we can't look into it
+ *
+ * @param tokens          a token list
+ * @return TRUE if the statement may leave session state
+ */
+gboolean sql_tokens_has_session_state(sql_tokens *tokens);
 
 int sql_token_get_last_id();
 
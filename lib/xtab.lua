@@ -354,7 +354,7 @@ function read_query_result(inj)
         print_debug ('getting columns resultset from xtab ' .. inj.id )
         local col_query = ''
         
-        for row in inj.resultset.rows do
+        for row in inj.resultset.cursor do
             col_query = col_query .. row[1]
         end
         
@@ -30,6 +30,7 @@
  * @li @c --admin-lua-script specifies the lua script to load that exposes handles the SQL statements
  * @li @c --admin-username   username
  * @li @c --admin-password   password
+ * @li @c --admin-reuseport  accept in each event-thread on its own @c SO_REUSEPORT listen-socket
  *
  * @section plugin-admin-implementation Implementation
  *
@@ -106,6 +107,8 @@ struct chassis_plugin_config {
 	gchar *admin_username;            /**< login username */
 	gchar *admin_password;            /**< login password */
 
+	gint reuseport;                   /**< give each event-thread its own SO_REUSEPORT listen-socket */
+
 	network_mysqld_con *listen_con;
 };
 
@@ -476,7 +479,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(server_read_query) {
  */
 NETWORK_MYSQLD_PLUGIN_PROTO(admin_disconnect_client) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	lua_scope  *sc = con->srv->priv->sc;
+	lua_scope  *sc = con->sc;
 
 	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
 	
@@ -543,6 +546,7 @@ static GOptionEntry * network_mysqld_admin_plugin_get_options(chassis_plugin_con
 		{ "admin-username",           0, 0, G_OPTION_ARG_STRING, NULL, "username to allow to log in", "<string>" },
 		{ "admin-password",           0, 0, G_OPTION_ARG_STRING, NULL, "password to allow to log in", "<string>" },
 		{ "admin-lua-script",         0, 0, G_OPTION_ARG_FILENAME, NULL, "script to execute by the admin plugin", "<filename>" },
+		{ "admin-reuseport",          0, 0, G_OPTION_ARG_NONE, NULL, "accept in each event-thread on its own SO_REUSEPORT listen-socket (default: disabled)", NULL },
 		
 		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
 	};
@@ -552,6 +556,7 @@ static GOptionEntry * network_mysqld_admin_plugin_get_options(chassis_plugin_con
 	config_entries[i++].arg_data = &(config->admin_username);
 	config_entries[i++].arg_data = &(config->admin_password);
 	config_entries[i++].arg_data = &(config->lua_script);
+	config_entries[i++].arg_data = &(config->reuseport);
 
 	return config_entries;
 }
@@ -591,6 +596,7 @@ static int network_mysqld_admin_plugin_apply_config(chassis *chas, chassis_plugi
 	config->listen_con = con;
 	
 	listen_sock = network_socket_new();
+	listen_sock->reuseport = config->reuseport;
 	con->server = listen_sock;
 
 	/* set the plugin hooks as we want to apply them to the new connections too later */
@@ -609,9 +615,9 @@ static int network_mysqld_admin_plugin_apply_config(chassis *chas, chassis_plugi
 	/**
 	 * call network_mysqld_con_accept() with this connection when we are done
 	 */
-	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
-	event_base_set(chas->event_base, &(listen_sock->event));
-	event_add(&(listen_sock->event), NULL);
+	if (0 != network_mysqld_con_listen(chas, con)) {
+		return -1;
+	}
 
 	return 0;
 }
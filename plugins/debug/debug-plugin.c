@@ -122,7 +122,7 @@ int plugin_debug_con_handle_stmt(chassis *chas, network_mysqld_con *con, GString
 			network_mysqld_con_send_resultset(con->client, fields, rows);
 		} else {
 			MYSQL_FIELD *field = NULL;
-			lua_State *L = chas->priv->sc->L;
+			lua_State *L = con->sc->L; /* we hold the lock of the connection's lua-scope */
 
 			if (0 == luaL_loadstring(L, s->str + NET_HEADER_SIZE + 1) &&
 			    0 == lua_pcall(L, 0, 1, 0)) {
@@ -420,9 +420,9 @@ static int network_mysqld_debug_plugin_apply_config(chassis *chas, chassis_plugi
 	/**
 	 * call network_mysqld_con_accept() with this connection when we are done
 	 */
-	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
-	event_base_set(chas->event_base, &(listen_sock->event));
-	event_add(&(listen_sock->event), NULL);
+	if (0 != network_mysqld_con_listen(chas, con)) {
+		return -1;
+	}
 
 	return 0;
 }
@@ -417,7 +417,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(server_read_query) {
  */
 NETWORK_MYSQLD_PLUGIN_PROTO(master_disconnect_client) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	lua_scope  *sc = con->srv->priv->sc;
+	lua_scope  *sc = con->sc;
 
 	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
 	
@@ -583,9 +583,9 @@ static int network_mysqld_master_plugin_apply_config(chassis *chas, chassis_plug
 	/**
 	 * call network_mysqld_con_accept() with this connection when we are done
 	 */
-	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
-	event_base_set(chas->event_base, &(listen_sock->event));
-	event_add(&(listen_sock->event), NULL);
+	if (0 != network_mysqld_con_listen(chas, con)) {
+		return -1;
+	}
 
 	return 0;
 }
@@ -134,6 +134,8 @@ typedef int socklen_t;
 
 #include "network-conn-pool.h"
 #include "network-conn-pool-lua.h"
+#include "network-conn-pool-manager.h"
+#include "network-backend-health.h"
 
 #include "sys-pedantic.h"
 #include "network-injection.h"
@@ -149,6 +151,8 @@ typedef int socklen_t;
 #include "chassis-timings.h"
 #include "chassis-gtimeval.h"
 
+#include "sql-tokenizer.h"
+
 #define C(x) x, sizeof(x) - 1
 #define S(x) x->str, x->len
 
@@ -182,9 +186,36 @@ struct chassis_plugin_config {
 					       - this safes a round-trip, but we also don't cleanup the connection
 					       - another name could be "fast-pool-connect", but that's too friendly
 					       */
+	gchar *pool_reset;                /**< how a connection from the pool is cleaned up: auto, reset-connection or change-user */
 
 	gint start_proxy;
 
+	gint reuseport;                   /**< give each event-thread its own SO_REUSEPORT listen-socket */
+
+	gchar *balance;                   /**< how to balance the load over the backends */
+
+	gint backend_resolve_interval;    /**< seconds until the hostnames of the backends are resolved again */
+
+	gint pool_min_idle_connections;   /**< idling connections the pool manager opens for pool_username */
+	gint pool_max_idle_connections;   /**< idling connections above it are closed by the pool manager, 0 for no limit */
+	gchar *pool_username;             /**< user the pool manager authenticates the idling connections as */
+	gchar *pool_password;
+	gint pool_max_lifetime;           /**< seconds until a idling connection is closed, 0 for no limit */
+
+	gint transaction_pooling;         /**< put the server connection back into the pool at the end of each transaction */
+	gint read_write_splitting;        /**< send the reads outside of transactions to the read-only backends */
+
+	gint health_check_interval;       /**< seconds between the probes of a backend, 0 to disable the health checker */
+	gint health_check_max_backoff;    /**< max. seconds between the probes of a DOWN backend */
+	gint health_check_rise;           /**< successful probes in a row that mark a DOWN backend as UP */
+	gint health_check_fall;           /**< failed probes in a row that mark a backend as DOWN */
+	gchar *health_check_query;        /**< query the probes send as pool_username, COM_PING if not set */
+
+	gint max_replication_lag;         /**< RO backends that lag more seconds aren't chosen, 0 for no limit */
+
+	network_connection_pool_manager *pool_manager;
+	network_backends_health *health;
+
 	network_mysqld_con *listen_con;
 };
 
@@ -271,7 +302,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_co
 				/**
 				 * replace the result-set the server sent us 
 				 */
-				while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+				while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) network_queue_chunk_free(packet);
 				
 				/**
 				 * we are a response to the client packet, hence one packet id more 
@@ -325,7 +356,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_co
 					break;
 				}
 
-				while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+				while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) network_queue_chunk_free(packet);
 
 				break;
 			default:
@@ -333,7 +364,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_co
 				g_message("%s.%d: return-code for read_query_result() was neither PROXY_SEND_RESULT or PROXY_IGNORE_RESULT, will ignore the result",
 						__FILE__, __LINE__);
 
-				while ((packet = g_queue_pop_head(send_sock->send_queue->chunks))) g_string_free(packet, TRUE);
+				while ((packet = g_queue_pop_head(send_sock->send_queue->chunks))) network_queue_chunk_free(packet);
 
 				break;
 			}
@@ -481,7 +512,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_handshake) {
 
 	challenge = network_mysqld_auth_challenge_new();
 	if (network_mysqld_proto_get_auth_challenge(&packet, challenge)) {
- 		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+ 		network_queue_chunk_free(g_queue_pop_tail(recv_sock->recv_queue->chunks));
 
 		network_mysqld_auth_challenge_free(challenge);
 
@@ -501,7 +532,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_handshake) {
 		/* the client overwrote and wants to send its own packet
 		 * it is already in the queue */
 
- 		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+ 		network_queue_chunk_free(g_queue_pop_tail(recv_sock->recv_queue->chunks));
 
 		return NETWORK_SOCKET_ERROR;
 	default:
@@ -516,7 +547,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_handshake) {
 
 	g_string_free(challenge_packet, TRUE);
 
-	g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+	network_queue_chunk_free(g_queue_pop_tail(recv_sock->recv_queue->chunks));
 
 	/* copy the pack to the client */
 	con->state = CON_STATE_SEND_HANDSHAKE;
@@ -686,11 +717,21 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 		 * we send a COM_CHANGE_USER to reauth the connection and remove
 		 * all temp-tables and session-variables
 		 *
+		 * if the client authed as the same user with the same password
+		 * a COM_RESET_CONNECTION is enough to cleanup the connection and
+		 * if no session state was left, we can skip the cleanup completly
+		 *
 		 * for performance reasons this extra reauth can be disabled. But
 		 * that leaves temp-tables on the connection.
 		 */
 		if (con->server->is_authed) {
+			network_backend_reset_t reset = NETWORK_BACKEND_RESET_NONE;
+
 			if (config->pool_change_user) {
+				reset = network_backend_get_reset(st->backend, con->client, con->server);
+			}
+
+			if (reset == NETWORK_BACKEND_RESET_CHANGE_USER) {
 				GString *com_change_user = g_string_new(NULL);
 
 				/* copy incl. the nul */
@@ -717,10 +758,20 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 
 				g_string_free(com_change_user, TRUE);
 			
+				g_atomic_int_inc(&(st->backend->pool->change_user_resets));
+
+				con->state = CON_STATE_SEND_AUTH;
+			} else if (reset == NETWORK_BACKEND_RESET_CONNECTION) {
+				network_mysqld_queue_append(send_sock, send_sock->send_queue, C("\037")); /* COM_RESET_CONNECTION */
+
+				g_atomic_int_inc(&(st->backend->pool->connection_resets));
+
 				con->state = CON_STATE_SEND_AUTH;
 			} else {
 				GString *auth_resp;
 
+				if (config->pool_change_user) g_atomic_int_inc(&(st->backend->pool->skipped_resets));
+
 				/* check if the username and client-scramble are the same as in the previous authed
 				 * connection */
 
@@ -745,6 +796,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 
 					ok_packet = network_mysqld_ok_packet_new();
 					ok_packet->server_status = SERVER_STATUS_AUTOCOMMIT;
+					st->server_status = ok_packet->server_status;
 
 					network_mysqld_proto_append_ok_packet(auth_resp, ok_packet);
 					
@@ -770,7 +822,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 	}
 
 	if (free_client_packet) {
-		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+		network_queue_chunk_free(g_queue_pop_tail(recv_sock->recv_queue->chunks));
 	} else {
 		/* just remove the link to the packet, the packet itself is part of the next queue already */
 		g_queue_pop_tail(recv_sock->recv_queue->chunks);
@@ -867,10 +919,50 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth_result(network_mysqld_con
 }
 
 
+/**
+ * get the server-status of a OK or EOF packet
+ *
+ * @param s a packet including its network-header
+ * @return 0 on success, -1 if it is neither a OK nor a EOF packet
+ */
+static int proxy_get_server_status(GString *s, guint16 *server_status) {
+	network_packet packet;
+	guint8 status = 0;
+	int err = 0;
+
+	packet.data = s;
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+	if (err) return -1;
+
+	if (status == MYSQLD_PACKET_OK) {
+		network_mysqld_ok_packet_t *ok_packet = network_mysqld_ok_packet_new();
+
+		err = err || network_mysqld_proto_get_ok_packet(&packet, ok_packet);
+		if (!err) *server_status = ok_packet->server_status;
+
+		network_mysqld_ok_packet_free(ok_packet);
+	} else if (status == MYSQLD_PACKET_EOF && s->len - NET_HEADER_SIZE < 9) {
+		network_mysqld_eof_packet_t *eof_packet = network_mysqld_eof_packet_new();
+
+		err = err || network_mysqld_proto_get_eof_packet(&packet, eof_packet);
+		if (!err) *server_status = eof_packet->server_status;
+
+		network_mysqld_eof_packet_free(eof_packet);
+	} else {
+		err = 1;
+	}
+
+	return err ? -1 : 0;
+}
+
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth_result) {
 	GString *packet;
 	GList *chunk;
 	network_socket *recv_sock, *send_sock;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
 
 	recv_sock = con->server;
 	send_sock = con->client;
@@ -881,10 +973,19 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth_result) {
 	/* send the auth result to the client */
 	if (con->server->is_authed) {
 		/**
-		 * we injected a COM_CHANGE_USER above and have to correct to 
+		 * we injected a COM_CHANGE_USER or COM_RESET_CONNECTION above and have to correct to 
 		 * packet-id now 
 		 */
 		packet->str[3] = 2;
+
+		/* the connection is clean again */
+		if (con->auth_result_state == MYSQLD_PACKET_OK) con->server->has_session_state = FALSE;
+	}
+
+	/* the transaction-pooling needs the server-status before the first query */
+	if (con->auth_result_state == MYSQLD_PACKET_OK &&
+	    0 != proxy_get_server_status(packet, &(st->server_status))) {
+		st->server_status = SERVER_STATUS_AUTOCOMMIT;
 	}
 
 	/**
@@ -914,7 +1015,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth_result) {
 		 * chunk->packet is not forwarded, free it
 		 */
 
-		g_string_free(packet, TRUE);
+		network_queue_chunk_free(packet);
 		
 		break;
 	case PROXY_NO_DECISION:
@@ -1087,6 +1188,317 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query(network_mysqld_con *con)
 	return PROXY_NO_DECISION;
 }
 
+/**
+ * track the queries that are pending on the backend for the load-balancing
+ *
+ * @see proxy_backend_query_finished()
+ */
+static void proxy_backend_query_start(network_mysqld_con_lua_t *st) {
+	/* the previous query had no response (COM_STMT_CLOSE, ...) */
+	if (st->query_backend) network_backend_query_done(st->query_backend);
+
+	st->query_backend = st->backend;
+	st->ts_query_sent = chassis_get_rel_microseconds();
+
+	if (st->query_backend) network_backend_query_start(st->query_backend);
+}
+
+/**
+ * the result of the query is received, add its latency to the backend
+ *
+ * the injection isn't used for the start time as the queued queries are 
+ * only sent when the previous one is done
+ */
+static void proxy_backend_query_finished(network_mysqld_con_lua_t *st, injection *inj) {
+	guint64 ts_done;
+
+	if (!st->query_backend) return;
+
+	ts_done = inj ? inj->ts_read_query_result_last : chassis_get_rel_microseconds();
+
+	network_backend_update_latency(st->query_backend, chassis_calc_rel_microseconds(st->ts_query_sent, ts_done));
+	network_backend_query_done(st->query_backend);
+	st->query_backend = NULL;
+}
+
+/**
+ * check if the command leaves session state on the server connection
+ *
+ * prepared statements, user and session variables, temporary tables, locks, ... are
+ * bound to the server connection. A server connection that has them isn't shared with
+ * other clients in transaction pooling. The autocommit mode is tracked through the
+ * server-status instead.
+ *
+ * @param command     the command byte and its payload, without the network header
+ * @see sql_tokens_has_session_state()
+ */
+static gboolean proxy_command_has_session_state(const char *command, gsize command_len) {
+	sql_tokens *tokens;
+	gboolean has_session_state;
+
+	if (command_len == 0) return FALSE;
+
+	switch ((guchar)command[0]) {
+	case COM_QUERY:
+		break;
+	case COM_STMT_PREPARE:
+	case COM_CHANGE_USER:
+	case COM_SET_OPTION:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+
+	tokens = sql_tokens_new();
+
+	/* if we can't tokenize it, we can't tell */
+	if (0 != sql_tokenizer(tokens, command + 1, command_len - 1)) {
+		sql_tokens_free(tokens);
+
+		return TRUE;
+	}
+
+	has_session_state = sql_tokens_has_session_state(tokens);
+
+	sql_tokens_free(tokens);
+
+	return has_session_state;
+}
+
+/**
+ * remember if a command sent to the server connection may have left session state
+ *
+ * the state stays until the connection is reset
+ */
+static void proxy_track_session_state(network_socket *server, const char *command, gsize command_len) {
+	if (server->has_session_state) return;
+
+	server->has_session_state = proxy_command_has_session_state(command, command_len);
+}
+
+/**
+ * decide which type of backend can execute the command
+ *
+ * A SELECT outside of a transaction can go to a read-only backend if sql_tokens_is_read()
+ * agrees. A SELECT SQL_CALC_FOUND_ROWS keeps its server connection for the FOUND_ROWS()
+ * that follows.
+ *
+ * @param command     the command byte and its payload, without the network header
+ * @return BACKEND_TYPE_RO if the command is a read, BACKEND_TYPE_RW otherwise
+ */
+static backend_type_t proxy_command_get_backend_type(network_mysqld_con *con, const char *command, gsize command_len) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	backend_type_t type = BACKEND_TYPE_RW;
+	sql_tokens *tokens;
+	gboolean calc_found_rows;
+
+	if (!con->config->read_write_splitting) return BACKEND_TYPE_RW;
+	if (command_len == 0 || command[0] != COM_QUERY) return BACKEND_TYPE_RW;
+	if (st->server_status & SERVER_STATUS_IN_TRANS) return BACKEND_TYPE_RW;
+	if (!(st->server_status & SERVER_STATUS_AUTOCOMMIT)) return BACKEND_TYPE_RW;
+
+	tokens = sql_tokens_new();
+
+	if (0 != sql_tokenizer(tokens, command + 1, command_len - 1)) {
+		sql_tokens_free(tokens);
+
+		return BACKEND_TYPE_RW;
+	}
+
+	if (sql_tokens_is_read(tokens, &calc_found_rows)) type = BACKEND_TYPE_RO;
+
+	if (calc_found_rows) st->keep_server = TRUE;
+
+	sql_tokens_free(tokens);
+
+	return type;
+}
+
+/**
+ * move the server connection into the pool if it can be shared
+ *
+ * used in transaction pooling at the end of each command: the connection is shared
+ * unless we are in a transaction, autocommit is off or the session holds state
+ *
+ * @return TRUE if the server connection was moved into the pool
+ */
+static gboolean proxy_transaction_pooling_release(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	if (!con->config->transaction_pooling) return FALSE;
+	if (!con->server || !con->server->is_authed || !st->backend) return FALSE;
+	if (st->query_backend) return FALSE; /* the result is still on its way */
+	if (st->keep_server) {
+		/* only for the next command */
+		st->keep_server = FALSE;
+
+		return FALSE;
+	}
+	if (con->server->has_session_state) return FALSE;
+	if (st->server_status & SERVER_STATUS_IN_TRANS) return FALSE;
+	if (!(st->server_status & SERVER_STATUS_AUTOCOMMIT)) return FALSE;
+
+	network_connection_pool_lua_add_connection(con);
+
+	return TRUE;
+}
+
+/**
+ * take a idling server connection of the client's user from the backends of a type
+ *
+ * @return the connection or NULL if the user has no idling connection on them
+ */
+static network_socket *proxy_transaction_pooling_get(network_mysqld_con *con, backend_type_t type, network_backend_t **backend_p, gint *backend_ndx_p) {
+	chassis_private *g = con->srv->priv;
+	network_backend_t *backend;
+	network_socket *sock = NULL;
+	gint backend_ndx = -1;
+	guint i;
+
+	if ((backend = network_backends_choose(g->backends, type, &backend_ndx))) {
+		sock = network_connection_pool_get_authed(backend->pool, con->client->response, con->client->default_db);
+	}
+
+	/* the connections of the user may idle on another backend */
+	for (i = 0; !sock && i < network_backends_count(g->backends); i++) {
+		backend = network_backends_get(g->backends, i);
+
+		if (backend->type != type || backend->state == BACKEND_STATE_DOWN) continue;
+		if (network_backend_is_lagging(backend)) continue;
+
+		backend_ndx = i;
+		sock = network_connection_pool_get_authed(backend->pool, con->client->response, con->client->default_db);
+	}
+
+	if (sock) {
+		*backend_p = backend;
+		*backend_ndx_p = backend_ndx;
+	}
+
+	return sock;
+}
+
+/**
+ * stop waiting for a idling server connection
+ */
+static void proxy_transaction_pooling_cancel(network_mysqld_con_lua_t *st) {
+	guint i;
+
+	if (!st->pool_waiters) return;
+
+	for (i = 0; i < st->pool_waiters->len; i++) {
+		network_connection_pool_waiter_cancel(st->pool_waiters->pdata[i]);
+	}
+	g_ptr_array_set_size(st->pool_waiters, 0);
+}
+
+/**
+ * a connection that fits the waiting client went back into a pool
+ *
+ * called in the event-thread of the client while its timer waits for the network-timeout
+ */
+static void proxy_transaction_pooling_wakeup(gpointer user_data) {
+	network_mysqld_con *con = user_data;
+
+	event_del(&(con->client->event));
+
+	network_mysqld_con_handle(-1, EV_TIMEOUT, con);
+}
+
+/**
+ * queue the client in the pools of the backends it can take a connection from
+ *
+ * the waiters of the previous wait are cancelled, the first pool that gets a fitting connection wakes the client up
+ */
+static void proxy_transaction_pooling_wait(network_mysqld_con *con, backend_type_t type) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	guint i;
+
+	proxy_transaction_pooling_cancel(st);
+
+	if (!st->pool_waiters) st->pool_waiters = g_ptr_array_new();
+
+	for (i = 0; i < network_backends_count(g->backends); i++) {
+		network_backend_t *backend = network_backends_get(g->backends, i);
+
+		if (backend->type != BACKEND_TYPE_RW && backend->type != type) continue;
+		if (backend->state == BACKEND_STATE_DOWN) continue;
+
+		g_ptr_array_add(st->pool_waiters, network_connection_pool_wait(backend->pool,
+					con->client->response, con->client->default_db,
+					proxy_transaction_pooling_wakeup, con));
+	}
+}
+
+/**
+ * take a idling server connection for the next command of the client
+ *
+ * a read takes a connection from a read-only backend if the user has one idling there,
+ * the read/write backends are the fallback
+ *
+ * @param type  the type of backend the command can run on, see proxy_command_get_backend_type()
+ * @return NETWORK_SOCKET_SUCCESS if con->server is set or the command doesn't need one,
+ *         NETWORK_SOCKET_WAIT_FOR_EVENT if all connections of the user are busy,
+ *         NETWORK_SOCKET_ERROR if we waited longer than the network-timeout
+ */
+static network_socket_retval_t proxy_transaction_pooling_acquire(network_mysqld_con *con, backend_type_t type) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_backend_t *backend = NULL;
+	network_socket *sock = NULL;
+	GString *packet;
+	gint backend_ndx = -1;
+
+	packet = g_queue_peek_head(con->client->recv_queue->chunks);
+
+	/* no need to get a connection just to close it */
+	if (packet && packet->len > NET_HEADER_SIZE && packet->str[NET_HEADER_SIZE] == COM_QUIT) {
+		con->state = CON_STATE_CLOSE_CLIENT;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	if (type == BACKEND_TYPE_RO) sock = proxy_transaction_pooling_get(con, BACKEND_TYPE_RO, &backend, &backend_ndx);
+
+	if (!sock) sock = proxy_transaction_pooling_get(con, BACKEND_TYPE_RW, &backend, &backend_ndx);
+
+	if (!sock) {
+		guint64 now = chassis_get_rel_microseconds();
+
+		if (st->ts_wait_for_server == 0) st->ts_wait_for_server = now;
+
+		if (now - st->ts_wait_for_server < (guint64)con->srv->network_timeout * G_USEC_PER_SEC) {
+			/* queue up before we look again: a connection that went back into a pool in between wakes us up */
+			proxy_transaction_pooling_wait(con, type);
+
+			if (type == BACKEND_TYPE_RO) sock = proxy_transaction_pooling_get(con, BACKEND_TYPE_RO, &backend, &backend_ndx);
+
+			if (!sock) sock = proxy_transaction_pooling_get(con, BACKEND_TYPE_RW, &backend, &backend_ndx);
+
+			if (!sock) return NETWORK_SOCKET_WAIT_FOR_EVENT;
+		} else {
+			proxy_transaction_pooling_cancel(st);
+
+			g_critical("%s: no idling server connection for user '%s' after %ld seconds, closing the client connection",
+					G_STRLOC,
+					con->client->response->username->str,
+					con->srv->network_timeout);
+
+			return NETWORK_SOCKET_ERROR;
+		}
+	}
+
+	proxy_transaction_pooling_cancel(st);
+	st->ts_wait_for_server = 0;
+
+	con->server = sock;
+	st->backend = backend;
+	st->backend_ndx = backend_ndx;
+	g_atomic_int_inc(&(backend->connected_clients));
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
 /**
  * gets called after a query has been read
  *
@@ -1107,6 +1519,28 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 	recv_sock = con->client;
 	st->injected.sent_resultset = 0;
 
+	if (con->config->transaction_pooling) {
+		packet = g_queue_peek_head(recv_sock->recv_queue->chunks);
+
+		/* classify the command only once, we may have to wait for a connection and come back here */
+		if (st->ts_wait_for_server == 0) {
+			st->command_backend_type = BACKEND_TYPE_RW;
+
+			if (packet && packet->len > NET_HEADER_SIZE) {
+				st->command_backend_type = proxy_command_get_backend_type(con, packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+			}
+		}
+
+		if (con->server == NULL) {
+			network_socket_retval_t acquire_ret;
+
+			/* wait before we call the script, it would see the query again and again */
+			if (NETWORK_SOCKET_SUCCESS != (acquire_ret = proxy_transaction_pooling_acquire(con, st->command_backend_type))) return acquire_ret;
+
+			if (con->state != CON_STATE_READ_QUERY) return NETWORK_SOCKET_SUCCESS;
+		}
+	}
+
 	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::enter_lua");
 	ret = proxy_lua_read_query(con);
 	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::leave_lua");
@@ -1128,6 +1562,11 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 	case PROXY_SEND_QUERY:
 		send_sock = con->server;
 
+		packet = g_queue_peek_head(recv_sock->recv_queue->chunks);
+		if (packet && packet->len > NET_HEADER_SIZE) {
+			proxy_track_session_state(send_sock, packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+		}
+
 		/* no injection, pass on the chunks as is */
 		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
 			network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet);
@@ -1158,7 +1597,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 				is_first_packet = FALSE;
 			}
 
-			g_string_free(packet, TRUE);
+			network_queue_chunk_free(packet);
 		}
 
 		break; }
@@ -1170,10 +1609,12 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 
 		send_sock = con->server;
 
+		proxy_track_session_state(send_sock, S(inj->query));
+
 		network_mysqld_queue_reset(send_sock);
 		network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
 
-		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) network_queue_chunk_free(packet);
 
 		break; }
 	default:
@@ -1181,6 +1622,8 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 	}
 
 	if (proxy_query) {
+		proxy_backend_query_start(st);
+
 		con->state = CON_STATE_SEND_QUERY;
 	} else {
 		GList *cur;
@@ -1249,6 +1692,8 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result) {
 	if (st->injected.queries->length == 0) {
 		/* we have nothing more to send, let's see what the next state is */
 
+		proxy_transaction_pooling_release(con);
+
 		con->state = CON_STATE_READ_QUERY;
 
 		return NETWORK_SOCKET_SUCCESS;
@@ -1272,11 +1717,15 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result) {
 	g_assert(inj);
 	g_assert(send_sock);
 
+	proxy_track_session_state(send_sock, S(inj->query));
+
 	network_mysqld_queue_reset(send_sock);
 	network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
 
 	network_mysqld_con_reset_command_response_state(con);
 
+	proxy_backend_query_start(st);
+
 	con->state = CON_STATE_SEND_QUERY;
 
 	return NETWORK_SOCKET_SUCCESS;
@@ -1325,6 +1774,15 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result) {
 
 	con->resultset_is_finished = is_finished;
 
+	/* COM_QUERY and COM_STMT_EXECUTE track it in their result, the other commands end in a OK or EOF packet */
+	if (is_finished &&
+	    con->parse.command != COM_QUERY &&
+	    con->parse.command != COM_STMT_EXECUTE &&
+	    con->parse.command != COM_STMT_PREPARE && /* the prepare-OK has no server-status */
+	    con->parse.command != COM_STATISTICS) {
+		proxy_get_server_status(packet.data, &(st->server_status));
+	}
+
 	/* copy the packet over to the send-queue if we don't need it */
 	if (!con->resultset_is_needed) {
 		network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, g_queue_pop_tail(recv_sock->recv_queue->chunks));
@@ -1359,6 +1817,15 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result) {
 			inj->ts_read_query_result_last = chassis_get_rel_microseconds();
 			/* g_get_current_time(&(inj->ts_read_query_result_last)); */
 		}
+
+		if (con->parse.command == COM_QUERY || con->parse.command == COM_STMT_EXECUTE) {
+			network_mysqld_com_query_result_t *com_query = con->parse.data;
+
+			/* a ERR packet has no server-status, keep the connection then */
+			st->server_status = (com_query->query_status == MYSQLD_PACKET_OK) ? com_query->server_status : 0;
+		}
+
+		proxy_backend_query_finished(st, inj);
 		
 		network_mysqld_queue_reset(recv_sock); /* reset the packet-id checks as the server-side is finished */
 
@@ -1487,8 +1954,6 @@ static network_mysqld_lua_stmt_ret proxy_lua_connect_server(network_mysqld_con *
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 	chassis_private *g = con->srv->priv;
-	guint min_connected_clients = G_MAXUINT;
-	guint i;
 	gboolean use_pooled_connection = FALSE;
 	network_backend_t *cur;
 
@@ -1552,7 +2017,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 	}
 
 	/* protect the typecast below */
-	g_assert_cmpint(g->backends->backends->len, <, G_MAXINT);
+	g_assert_cmpint(network_backends_count(g->backends), <, G_MAXINT);
 
 	/**
 	 * if the current backend is down, ignore it 
@@ -1560,7 +2025,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 	cur = network_backends_get(g->backends, st->backend_ndx);
 
 	if (cur) {
-		if (cur->state == BACKEND_STATE_DOWN) {
+		if (cur->state == BACKEND_STATE_DOWN || !network_backend_is_resolved(cur)) {
 			st->backend_ndx = -1;
 		}
 	}
@@ -1580,25 +2045,10 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 		/**
 		 * we can choose between different back addresses 
 		 *
-		 * prefer SQF (shorted queue first) to load all backends equally
+		 * prefer the less loaded of two random read/write backends
+		 * which aren't down to load all backends equally
 		 */ 
-
-		for (i = 0; i < network_backends_count(g->backends); i++) {
-			cur = network_backends_get(g->backends, i);
-	
-			/**
-			 * skip backends which are down or not writable
-			 */	
-			if (cur->state == BACKEND_STATE_DOWN ||
-			    cur->type != BACKEND_TYPE_RW) continue;
-	
-			if (cur->connected_clients < min_connected_clients) {
-				st->backend_ndx = i;
-				min_connected_clients = cur->connected_clients;
-			}
-		}
-
-		if ((cur = network_backends_get(g->backends, st->backend_ndx))) {
+		if ((cur = network_backends_choose(g->backends, BACKEND_TYPE_RW, &(st->backend_ndx)))) {
 			st->backend = cur;
 		}
 	} else if (NULL == st->backend) {
@@ -1618,9 +2068,10 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 	 */
 	if (NULL == con->server) {
 		con->server = network_socket_new();
-		network_address_copy(con->server->dst, st->backend->addr);
+		con->server->recv_slices = TRUE;
+		network_address_copy(con->server->dst, network_backend_get_address(st->backend));
 	
-		st->backend->connected_clients++;
+		g_atomic_int_inc(&(st->backend->connected_clients));
 
 		switch(network_socket_connect(con->server)) {
 		case NETWORK_SOCKET_ERROR_RETRY:
@@ -1683,6 +2134,12 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_init) {
 	st = network_mysqld_con_lua_new();
 
 	con->plugin_con_state = st;
+
+	/* we forward the packets as they are, no need to copy them out of the recv-buffer */
+	con->client->recv_slices = TRUE;
+
+	/* rows of resultsets the scripts don't want to see skip the read_query_result hook */
+	con->resultset_fast_forward = TRUE;
 	
 	con->state = CON_STATE_CONNECT_SERVER;
 
@@ -1768,10 +2225,13 @@ static network_mysqld_lua_stmt_ret proxy_lua_disconnect_client(network_mysqld_co
  */
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	lua_scope  *sc = con->srv->priv->sc;
+	lua_scope  *sc = con->sc;
 	gboolean use_pooled_connection = FALSE;
 
 	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
+
+	/* the client may have closed the connection while it waited for a server connection */
+	proxy_transaction_pooling_cancel(st);
 	
 	/**
 	 * let the lua-level decide if we want to keep the connection in the pool
@@ -1793,7 +2253,11 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client) {
 	 * check if one of the backends has to many open connections
 	 */
 
-	if (use_pooled_connection &&
+	/* in transaction pooling a clean connection is shared anyway */
+	if (con->state == CON_STATE_CLOSE_CLIENT &&
+	    proxy_transaction_pooling_release(con)) {
+		use_pooled_connection = FALSE;
+	} else if (use_pooled_connection &&
 	    con->state == CON_STATE_CLOSE_CLIENT) {
 		/* move the connection to the connection pool
 		 *
@@ -1803,7 +2267,13 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client) {
 		network_connection_pool_lua_add_connection(con);
 	} else if (st->backend) {
 		/* we have backend assigned and want to close the connection to it */
-		st->backend->connected_clients--;
+		g_atomic_int_add(&(st->backend->connected_clients), -1);
+	}
+
+	if (st->query_backend) {
+		/* the connection got closed while the query was pending */
+		network_backend_query_done(st->query_backend);
+		st->query_backend = NULL;
 	}
 
 #ifdef HAVE_LUA_H
@@ -1864,7 +2334,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_local_infile_data) {
 		 * - free the received packets early
 		 * - send a OK later 
 		 */
-		while ((s = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(s, TRUE);
+		while ((s = g_queue_pop_head(recv_sock->recv_queue->chunks))) network_queue_chunk_free(s);
 	}
 
 	if (query_result == 1) { /* we have everything, send it to the backend */
@@ -1967,6 +2437,11 @@ chassis_plugin_config * network_mysqld_proxy_plugin_new(void) {
 	config->start_proxy     = 1;
 	config->pool_change_user = 1; /* issue a COM_CHANGE_USER to cleanup the connection 
 					 when we get back the connection from the pool */
+	config->backend_resolve_interval = NETWORK_BACKENDS_RESOLVE_INTERVAL;
+	config->health_check_interval = 2;
+	config->health_check_max_backoff = 32;
+	config->health_check_rise = 2;
+	config->health_check_fall = 3;
 
 	return config;
 }
@@ -1999,6 +2474,14 @@ void network_mysqld_proxy_plugin_free(chassis_plugin_config *config) {
 	}
 
 	if (config->lua_script) g_free(config->lua_script);
+	if (config->balance) g_free(config->balance);
+	if (config->pool_reset) g_free(config->pool_reset);
+	if (config->pool_username) g_free(config->pool_username);
+	if (config->pool_password) g_free(config->pool_password);
+	if (config->health_check_query) g_free(config->health_check_query);
+
+	network_connection_pool_manager_free(config->pool_manager);
+	network_backends_health_free(config->health);
 
 	g_free(config);
 }
@@ -2025,6 +2508,27 @@ static GOptionEntry * network_mysqld_proxy_plugin_get_options(chassis_plugin_con
 		{ "no-proxy",                 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, NULL, "don't start the proxy-module (default: enabled)", NULL },
 		
 		{ "proxy-pool-no-change-user", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, NULL, "don't use CHANGE_USER to reset the connection coming from the pool (default: enabled)", NULL },
+		{ "proxy-pool-reset",         0, 0, G_OPTION_ARG_STRING, NULL, "how to reset the connection coming from the pool: auto, reset-connection or change-user (default: auto)", "<policy>" },
+
+		{ "proxy-reuseport",          0, 0, G_OPTION_ARG_NONE, NULL, "accept in each event-thread on its own SO_REUSEPORT listen-socket (default: disabled)", NULL },
+
+		{ "proxy-balance",            0, 0, G_OPTION_ARG_STRING, NULL, "how to balance the load over the backends: sqf, wrr, least-queries or ewma (default: sqf)", "<policy>" },
+		{ "proxy-backend-resolve-interval", 0, 0, G_OPTION_ARG_INT, NULL, "resolve the hostnames of the backends again after <sec> seconds, 0 to resolve them only once (default: 60)", "<sec>" },
+
+		{ "proxy-pool-min-idle-connections", 0, 0, G_OPTION_ARG_INT, NULL, "idling connections to keep open to each backend for --proxy-pool-username (default: 0)", "<num>" },
+		{ "proxy-pool-max-idle-connections", 0, 0, G_OPTION_ARG_INT, NULL, "close the idling connections of a user above this limit (default: 0, no limit)", "<num>" },
+		{ "proxy-pool-username",      0, 0, G_OPTION_ARG_STRING, NULL, "username to open the idling connections with (default: not set)", "<user>" },
+		{ "proxy-pool-password",      0, 0, G_OPTION_ARG_STRING, NULL, "password of --proxy-pool-username (default: empty)", "<password>" },
+		{ "proxy-pool-max-lifetime",  0, 0, G_OPTION_ARG_INT, NULL, "close idling connections after about <sec> seconds in the pool (default: 0, no limit)", "<sec>" },
+		{ "proxy-transaction-pooling", 0, 0, G_OPTION_ARG_NONE, NULL, "share the server connections between the clients at transaction boundaries (default: disabled)", NULL },
+		{ "proxy-read-write-splitting", 0, 0, G_OPTION_ARG_NONE, NULL, "send the reads outside of transactions to the read-only backends, only for clients of --proxy-pool-username, implies --proxy-transaction-pooling (default: disabled)", NULL },
+
+		{ "proxy-health-check-interval", 0, 0, G_OPTION_ARG_INT, NULL, "probe each backend every <sec> seconds, 0 to disable the health checks (default: 2)", "<sec>" },
+		{ "proxy-health-check-max-backoff", 0, 0, G_OPTION_ARG_INT, NULL, "back off the probes of a down backend up to <sec> seconds (default: 32)", "<sec>" },
+		{ "proxy-health-check-rise",  0, 0, G_OPTION_ARG_INT, NULL, "successful probes in a row that mark a down backend as up (default: 2)", "<num>" },
+		{ "proxy-health-check-fall",  0, 0, G_OPTION_ARG_INT, NULL, "failed probes in a row that mark a backend as down (default: 3)", "<num>" },
+		{ "proxy-health-check-query", 0, 0, G_OPTION_ARG_STRING, NULL, "query the probes send as --proxy-pool-username (default: COM_PING)", "<query>" },
+		{ "proxy-max-replication-lag", 0, 0, G_OPTION_ARG_INT, NULL, "don't send reads to read-only backends that lag more than <sec> seconds (default: 0, no limit)", "<sec>" },
 		
 		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
 	};
@@ -2040,6 +2544,23 @@ static GOptionEntry * network_mysqld_proxy_plugin_get_options(chassis_plugin_con
 	config_entries[i++].arg_data = &(config->lua_script);
 	config_entries[i++].arg_data = &(config->start_proxy);
 	config_entries[i++].arg_data = &(config->pool_change_user);
+	config_entries[i++].arg_data = &(config->pool_reset);
+	config_entries[i++].arg_data = &(config->reuseport);
+	config_entries[i++].arg_data = &(config->balance);
+	config_entries[i++].arg_data = &(config->backend_resolve_interval);
+	config_entries[i++].arg_data = &(config->pool_min_idle_connections);
+	config_entries[i++].arg_data = &(config->pool_max_idle_connections);
+	config_entries[i++].arg_data = &(config->pool_username);
+	config_entries[i++].arg_data = &(config->pool_password);
+	config_entries[i++].arg_data = &(config->pool_max_lifetime);
+	config_entries[i++].arg_data = &(config->transaction_pooling);
+	config_entries[i++].arg_data = &(config->read_write_splitting);
+	config_entries[i++].arg_data = &(config->health_check_interval);
+	config_entries[i++].arg_data = &(config->health_check_max_backoff);
+	config_entries[i++].arg_data = &(config->health_check_rise);
+	config_entries[i++].arg_data = &(config->health_check_fall);
+	config_entries[i++].arg_data = &(config->health_check_query);
+	config_entries[i++].arg_data = &(config->max_replication_lag);
 
 	return config_entries;
 }
@@ -2073,6 +2594,7 @@ int network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_confi
 	config->listen_con = con;
 	
 	listen_sock = network_socket_new();
+	listen_sock->reuseport = config->reuseport;
 	con->server = listen_sock;
 
 	/* set the plugin hooks as we want to apply them to the new connections too later */
@@ -2087,6 +2609,19 @@ int network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_confi
 	}
 	g_message("proxy listening on port %s", config->address);
 
+	if (0 != network_backends_set_balance(g->backends, config->balance)) {
+		g_critical("%s: --proxy-balance=%s is unknown, use sqf, wrr, least-queries or ewma", 
+				G_STRLOC, config->balance);
+		return -1;
+	}
+
+	if (config->backend_resolve_interval < 0) {
+		g_critical("%s: --proxy-backend-resolve-interval can't be negative", 
+				G_STRLOC);
+		return -1;
+	}
+	g->backends->resolve_interval = config->backend_resolve_interval;
+
 	for (i = 0; config->backend_addresses && config->backend_addresses[i]; i++) {
 		if (-1 == network_backends_add(g->backends, config->backend_addresses[i],
 				BACKEND_TYPE_RW)) {
@@ -2101,16 +2636,94 @@ int network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_confi
 		}
 	}
 
+	/* the reads take the idling connections of the read-only backends, the connections are only swapped at transaction boundaries */
+	if (config->read_write_splitting) config->transaction_pooling = 1;
+
+	if (config->max_replication_lag < 0) {
+		g_critical("%s: --proxy-max-replication-lag can't be negative", 
+				G_STRLOC);
+		return -1;
+	}
+
+	if (config->pool_min_idle_connections < 0 || config->pool_max_idle_connections < 0 || config->pool_max_lifetime < 0) {
+		g_critical("%s: --proxy-pool-min-idle-connections, --proxy-pool-max-idle-connections and --proxy-pool-max-lifetime can't be negative", 
+				G_STRLOC);
+		return -1;
+	}
+
+	for (i = 0; i < network_backends_count(g->backends); i++) {
+		network_backend_t *backend = network_backends_get(g->backends, i);
+
+		backend->pool->min_idle_connections = config->pool_min_idle_connections;
+		backend->pool->max_idle_connections = config->pool_max_idle_connections;
+		backend->pool->max_lifetime = config->pool_max_lifetime;
+		backend->max_replication_lag = config->max_replication_lag;
+
+		if (0 != network_backend_set_reset_policy(backend, config->pool_reset)) {
+			g_critical("%s: --proxy-pool-reset=%s is unknown, use auto, reset-connection or change-user", 
+					G_STRLOC, config->pool_reset);
+			return -1;
+		}
+	}
+
+	if (config->pool_min_idle_connections && !config->pool_username) {
+		g_message("%s: --proxy-pool-min-idle-connections needs --proxy-pool-username to open connections", 
+				G_STRLOC);
+	}
+
+	/* we can't open connections to the read-only backends for the clients, only the pool manager fills their pools */
+	if (config->read_write_splitting && config->read_only_backend_addresses && config->read_only_backend_addresses[0]) {
+		if (!config->pool_username || !config->pool_min_idle_connections) {
+			g_warning("%s: --proxy-read-write-splitting needs --proxy-pool-username and --proxy-pool-min-idle-connections to use the read-only backends, all reads go to the read/write backends", 
+					G_STRLOC);
+		} else {
+			g_message("%s: --proxy-read-write-splitting only sends the reads of the clients that log in as '%s' to the read-only backends", 
+					G_STRLOC, config->pool_username);
+		}
+	}
+
+	/* keep the pools between min- and max-idle-connections and the idling connections alive */
+	config->pool_manager = network_connection_pool_manager_new(chas, g->backends);
+	network_connection_pool_manager_set_auth(config->pool_manager, config->pool_username, config->pool_password);
+
+	if (0 != network_connection_pool_manager_start(config->pool_manager)) {
+		return -1;
+	}
+
+	if (config->health_check_interval < 0 || config->health_check_max_backoff < 0 ||
+	    config->health_check_rise < 0 || config->health_check_fall < 0) {
+		g_critical("%s: --proxy-health-check-interval, --proxy-health-check-max-backoff, --proxy-health-check-rise and --proxy-health-check-fall can't be negative", 
+				G_STRLOC);
+		return -1;
+	}
+
+	if (config->max_replication_lag && (!config->pool_username || !config->health_check_interval)) {
+		g_message("%s: --proxy-max-replication-lag needs --proxy-pool-username and the health checker to sample the lag", 
+				G_STRLOC);
+	}
+
+	/* probe the backends in the background instead of waking up the DOWN ones after 4 sec */
+	if (config->health_check_interval) {
+		config->health = network_backends_health_new(chas, g->backends);
+		network_backends_health_set_interval(config->health, config->health_check_interval, config->health_check_max_backoff);
+		network_backends_health_set_thresholds(config->health, config->health_check_rise, config->health_check_fall);
+		network_backends_health_set_auth(config->health, config->pool_username, config->pool_password);
+		network_backends_health_set_query(config->health, config->health_check_query);
+
+		if (0 != network_backends_health_start(config->health)) {
+			return -1;
+		}
+	}
+
 	/* load the script and setup the global tables */
 	network_mysqld_lua_setup_global(chas->priv->sc->L, g);
 
 	/**
 	 * call network_mysqld_con_accept() with this connection when we are done
 	 */
-
-	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
-	event_base_set(chas->event_base, &(listen_sock->event));
-	event_add(&(listen_sock->event), NULL);
+	if (0 != network_mysqld_con_listen(chas, con)) {
+		return -1;
+	}
 
 	return 0;
 }
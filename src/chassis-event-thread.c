@@ -33,6 +33,10 @@
 #include <sys/socket.h>	/* for SOCK_STREAM and AF_UNIX/AF_INET */
 #endif
 
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
 #ifdef WIN32
 #include <winsock2.h>
 #define WIN32_LEAN_AND_MEAN
@@ -91,36 +95,163 @@ void chassis_event_op_apply(chassis_event_op_t *op, struct event_base *event_bas
 			event_add(op->ev, NULL);
 		}
 		break;
+	case CHASSIS_EVENT_OP_ACTIVE:
+		event_base_set(event_base, op->ev);
+		event_active(op->ev, EV_TIMEOUT, 1);
+		break;
 	case CHASSIS_EVENT_OP_UNSET:
 		g_assert_not_reached();
 		break;
 	}
 }
 
+GPrivate *tls_event_base_key = NULL;
+GPrivate *tls_event_thread_key = NULL;
+
+/**
+ * wake up a event-thread
+ *
+ * @see chassis_event_thread_drain_notify()
+ */
+static void chassis_event_thread_notify(chassis_event_thread_t *event_thread) {
+#ifdef HAVE_SYS_EVENTFD_H
+	guint64 one = 1;
+
+	if (sizeof(one) != write(event_thread->notify_send_fd, &one, sizeof(one))) {
+		g_critical("%s: write(eventfd) failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+	}
+#else
+	send(event_thread->notify_send_fd, C("."), 0); /* ping the event handler */
+#endif
+}
+
+/**
+ * reset the wakeup-fd of a event-thread
+ *
+ * the notify-fd is non-blocking, we just read until it is empty
+ */
+static void chassis_event_thread_drain_notify(chassis_event_thread_t *event_thread) {
+#ifdef HAVE_SYS_EVENTFD_H
+	guint64 cnt;
+
+	while (read(event_thread->notify_fd, &cnt, sizeof(cnt)) > 0);
+#else
+	char ping[1024];
+
+	while (recv(event_thread->notify_fd, ping, sizeof(ping), 0) > 0);
+#endif
+}
+
+/**
+ * push a event-op to the op-queue of a event-thread
+ *
+ * multiple threads may push at the same time, only the owning thread pops
+ *
+ * @return TRUE if the queue was empty and the thread has to be woken up
+ */
+static gboolean chassis_event_thread_push_op(chassis_event_thread_t *event_thread, chassis_event_op_t *op) {
+	gpointer head;
+
+	do {
+		head = g_atomic_pointer_get(&(event_thread->ops));
+		op->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange(&(event_thread->ops), head, op));
+
+	return (head == NULL);
+}
+
+/**
+ * take all the event-ops from the op-queue of a event-thread
+ *
+ * @return the ops in the order they were pushed
+ */
+static chassis_event_op_t *chassis_event_thread_pop_ops(chassis_event_thread_t *event_thread) {
+	chassis_event_op_t *op, *ops = NULL;
+	gpointer head;
+
+	do {
+		head = g_atomic_pointer_get(&(event_thread->ops));
+	} while (head && !g_atomic_pointer_compare_and_exchange(&(event_thread->ops), head, NULL));
+
+	/* the queue is a stack, reverse it */
+	for (op = head; op; ) {
+		chassis_event_op_t *next = op->next;
+
+		op->next = ops;
+		ops = op;
+
+		op = next;
+	}
+
+	return ops;
+}
+
 /**
  * add an event asynchronously with optional timeout
  *
- * the event is added to the global event-queue and a fd-notification is
- * sent allowing any of the event-threads to handle it
+ * the event is added to the least loaded event-thread 
  *
- * @see network_mysqld_con_handle()
+ * @see chassis_event_add_to_thread()
  */
 void chassis_event_add(chassis *chas, struct event *ev) {
 	chassis_event_add_timeout(chas, ev, 0);
 }
 
 void chassis_event_add_timeout(chassis *chas, struct event *ev, long timeout) {
+	chassis_event_add_to_thread(chas, NULL, ev, timeout);
+}
+
+/**
+ * add an event to a event-thread with optional timeout
+ *
+ * if we are the event-thread already, the event is added directly. Otherwise
+ * it is sent through the op-queue of the event-thread which is only woken up 
+ * if it hasn't been woken up already. 
+ *
+ * @param event_thread the event-thread to handle the event, NULL for the least loaded one
+ *
+ * @see network_mysqld_con_handle()
+ */
+void chassis_event_add_to_thread(chassis *chas, chassis_event_thread_t *event_thread, struct event *ev, long timeout) {
 	chassis_event_op_t *op = chassis_event_op_new();
 
+	if (!event_thread) event_thread = chassis_event_threads_get_least_loaded(chas->threads);
+
 	op->type = CHASSIS_EVENT_OP_ADD;
 	op->ev   = ev;
 	op->timeout = timeout;
-	g_async_queue_push(chas->threads->event_queue, op);
 
-	send(chas->threads->event_notify_fds[1], C("."), 0); /* ping the event handler */
+	if (event_thread == g_private_get(tls_event_thread_key)) {
+		chassis_event_op_apply(op, event_thread->event_base);
+
+		chassis_event_op_free(op);
+	} else if (chassis_event_thread_push_op(event_thread, op)) {
+		chassis_event_thread_notify(event_thread);
+	}
 }
 
-GPrivate *tls_event_base_key = NULL;
+/**
+ * fire a event in a event-thread right away
+ *
+ * the event's callback is called with EV_TIMEOUT by the event-thread. Like with
+ * chassis_event_add_to_thread() the event has to stay valid until then.
+ *
+ * @see network_connection_pool_wait()
+ */
+void chassis_event_active_in_thread(chassis G_GNUC_UNUSED *chas, chassis_event_thread_t *event_thread, struct event *ev) {
+	chassis_event_op_t *op = chassis_event_op_new();
+
+	op->type = CHASSIS_EVENT_OP_ACTIVE;
+	op->ev   = ev;
+
+	if (event_thread == g_private_get(tls_event_thread_key)) {
+		chassis_event_op_apply(op, event_thread->event_base);
+
+		chassis_event_op_free(op);
+	} else if (chassis_event_thread_push_op(event_thread, op)) {
+		chassis_event_thread_notify(event_thread);
+	}
+}
 
 /**
  * add a event to the current thread 
@@ -148,34 +279,28 @@ void chassis_event_add_local(chassis G_GNUC_UNUSED *chas, struct event *ev) {
 }
 
 /**
- * handled events sent through the global event-queue 
- *
- * each event-thread has its own listener on the event-queue and 
- * calls chassis_event_handle() with its own event-base
+ * handle the events sent through the op-queue of a event-thread
  *
- * @see chassis_event_add()
+ * @see chassis_event_add_to_thread()
  */
 void chassis_event_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
 	chassis_event_thread_t *event_thread = user_data;
 	struct event_base *event_base = event_thread->event_base;
-	chassis *chas = event_thread->chas;
 	chassis_event_op_t *op;
-	char ping[1024];
-	guint received = 0;
-	gssize removed;
 
-	while ((op = g_async_queue_try_pop(chas->threads->event_queue))) {
+	/* reset the wakeup-fd before we take the ops: everything pushed 
+	 * after that wakes us up again */
+	chassis_event_thread_drain_notify(event_thread);
+
+	op = chassis_event_thread_pop_ops(event_thread);
+	while (op) {
+		chassis_event_op_t *next = op->next;
+
 		chassis_event_op_apply(op, event_base);
 
 		chassis_event_op_free(op);
 
-		received++;
-	}
-
-	/* the pipe has one . per event, remove as many as we received */
-	while (received > 0 && 
-	       (removed = recv(event_thread->notify_fd, ping, MIN(received, sizeof(ping)), 0)) > 0) {
-		received -= removed;
+		op = next;
 	}
 }
 
@@ -186,6 +311,8 @@ chassis_event_thread_t *chassis_event_thread_new() {
 	chassis_event_thread_t *event_thread;
 
 	event_thread = g_new0(chassis_event_thread_t, 1);
+	event_thread->notify_fd = -1;
+	event_thread->notify_send_fd = -1;
 
 	return event_thread;
 }
@@ -193,19 +320,36 @@ chassis_event_thread_t *chassis_event_thread_new() {
 /**
  * free the data-structures for a event-thread
  *
- * joins the event-thread, closes notification-pipe and free's the event-base
+ * joins the event-thread, closes the wakeup-fds, frees the pending event-ops and the event-base
  */
 void chassis_event_thread_free(chassis_event_thread_t *event_thread) {
-	gboolean is_thread = (event_thread->thr != NULL);
+	gboolean is_thread;
+	chassis_event_op_t *op;
 
 	if (!event_thread) return;
 
+	is_thread = (event_thread->thr != NULL);
+
 	if (event_thread->thr) g_thread_join(event_thread->thr);
 
 	if (event_thread->notify_fd != -1) {
 		event_del(&(event_thread->notify_fd_event));
 		closesocket(event_thread->notify_fd);
 	}
+	if (event_thread->notify_send_fd != -1 &&
+	    event_thread->notify_send_fd != event_thread->notify_fd) {
+		closesocket(event_thread->notify_send_fd);
+	}
+
+	/* free the events that are still in the queue */
+	op = chassis_event_thread_pop_ops(event_thread);
+	while (op) {
+		chassis_event_op_t *next = op->next;
+
+		chassis_event_op_free(op);
+
+		op = next;
+	}
 
 	/* we don't want to free the global event-base */
 	if (is_thread && event_thread->event_base) event_base_free(event_thread->event_base);
@@ -222,38 +366,31 @@ void chassis_event_thread_set_event_base(chassis_event_thread_t G_GNUC_UNUSED *e
 	g_private_set(tls_event_base_key, event_base);
 }
 
+/**
+ * get the event-thread of the calling thread
+ *
+ * @return NULL if the calling thread isn't a event-thread
+ */
+chassis_event_thread_t *chassis_event_thread_self(void) {
+	if (!tls_event_thread_key) return NULL;
+
+	return g_private_get(tls_event_thread_key);
+}
+
 /**
  * create the event-threads handler
  *
- * provides the event-queue that is contains the event_ops from the event-threads
- * and notifies all the idling event-threads for the new event-ops to process
+ * each event-thread brings its own op-queue and wakeup-fd, see chassis_event_threads_init_thread()
  */
 chassis_event_threads_t *chassis_event_threads_new() {
 	chassis_event_threads_t *threads;
 
 	tls_event_base_key = g_private_new(NULL);
+	tls_event_thread_key = g_private_new(NULL);
 
 	threads = g_new0(chassis_event_threads_t, 1);
 
-	/* create the ping-fds
-	 *
-	 * the event-thread write a byte to the ping-pipe to trigger a fd-event when
-	 * something is available in the event-async-queues
-	 */
-	if (0 != evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, threads->event_notify_fds)) {
-		int err;
-#ifdef WIN32
-		err = WSAGetLastError();
-#else
-		err = errno;
-#endif
-		g_error("%s: evutil_socketpair() failed: %s (%d)", 
-				G_STRLOC,
-				g_strerror(err),
-				err);
-	}
 	threads->event_threads = g_ptr_array_new();
-	threads->event_queue = g_async_queue_new();
 
 	return threads;
 }
@@ -261,11 +398,10 @@ chassis_event_threads_t *chassis_event_threads_new() {
 /**
  * free all event-threads
  *
- * frees all the registered event-threads and event-queue
+ * frees all the registered event-threads
  */
 void chassis_event_threads_free(chassis_event_threads_t *threads) {
 	guint i;
-	chassis_event_op_t *op;
 
 	if (!threads) return;
 
@@ -278,21 +414,6 @@ void chassis_event_threads_free(chassis_event_threads_t *threads) {
 
 	g_ptr_array_free(threads->event_threads, TRUE);
 
-	/* free the events that are still in the queue */
-	while ((op = g_async_queue_try_pop(threads->event_queue))) {
-		chassis_event_op_free(op);
-	}
-	g_async_queue_unref(threads->event_queue);
-
-	/* close the notification pipe */
-	if (threads->event_notify_fds[0] != -1) {
-		closesocket(threads->event_notify_fds[0]);
-	}
-	if (threads->event_notify_fds[1] != -1) {
-		closesocket(threads->event_notify_fds[1]);
-	}
-
-
 	g_free(threads);
 }
 
@@ -300,38 +421,77 @@ void chassis_event_threads_free(chassis_event_threads_t *threads) {
  * add a event-thread to the event-threads handler
  */
 void chassis_event_threads_add(chassis_event_threads_t *threads, chassis_event_thread_t *thread) {
+	thread->index = threads->event_threads->len;
 	g_ptr_array_add(threads->event_threads, thread);
 }
 
+/**
+ * get the event-thread that owns the fewest connections
+ *
+ * @see network_mysqld_add_connection()
+ */
+chassis_event_thread_t *chassis_event_threads_get_least_loaded(chassis_event_threads_t *threads) {
+	chassis_event_thread_t *least_loaded = NULL;
+	gint least_connections = G_MAXINT;
+	guint i;
+
+	for (i = 0; i < threads->event_threads->len; i++) {
+		chassis_event_thread_t *event_thread = threads->event_threads->pdata[i];
+		gint connections = g_atomic_int_get(&(event_thread->connections));
+
+		if (connections < least_connections) {
+			least_loaded = event_thread;
+			least_connections = connections;
+		}
+	}
+
+	g_assert(least_loaded); /* the main-thread is always there */
+
+	return least_loaded;
+}
 
 /**
- * setup the notification-fd of a event-thread
+ * setup the wakeup-fd of a event-thread
  *
- * all event-threads listen on the same notification pipe
+ * each event-thread has its own wakeup-fd: a eventfd where available, a 
+ * socketpair otherwise. Other threads only write to it when they push the 
+ * first event-op into the empty op-queue.
  *
  * @see chassis_event_handle()
  */ 
-int chassis_event_threads_init_thread(chassis_event_threads_t *threads, chassis_event_thread_t *event_thread, chassis *chas) {
-#ifdef WIN32
-	LPWSAPROTOCOL_INFO lpProtocolInfo;
-#endif
+int chassis_event_threads_init_thread(chassis_event_threads_t G_GNUC_UNUSED *threads, chassis_event_thread_t *event_thread, chassis *chas) {
 	event_thread->event_base = event_base_new();
 	event_thread->chas = chas;
-#ifdef WIN32
-	lpProtocolInfo = g_malloc(sizeof(WSAPROTOCOL_INFO));
-	if (SOCKET_ERROR == WSADuplicateSocket(threads->event_notify_fds[0], GetCurrentProcessId(), lpProtocolInfo)) {
-		g_error("%s: Could not duplicate socket: %s (%d)", G_STRLOC, g_strerror(WSAGetLastError()), WSAGetLastError());
-	}
-	event_thread->notify_fd = WSASocket(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, lpProtocolInfo, 0, 0);
-	if (INVALID_SOCKET == event_thread->notify_fd) {
-		g_error("%s: Could not create duplicated socket: %s (%d)", G_STRLOC, g_strerror(WSAGetLastError()), WSAGetLastError());
+
+#ifdef HAVE_SYS_EVENTFD_H
+	if (-1 == (event_thread->notify_fd = eventfd(0, EFD_NONBLOCK))) {
+		g_error("%s: eventfd() failed: %s (%d)", 
+				G_STRLOC,
+				g_strerror(errno),
+				errno);
 	}
-	g_free(lpProtocolInfo);
+	event_thread->notify_send_fd = event_thread->notify_fd;
+#else
+	{
+		int notify_fds[2];
+
+		if (0 != evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, notify_fds)) {
+			int err;
+#ifdef WIN32
+			err = WSAGetLastError();
 #else
-	event_thread->notify_fd = dup(threads->event_notify_fds[0]);
+			err = errno;
 #endif
-#if 0
-	evutil_make_socket_nonblocking(event_thread->notify_fd);
+			g_error("%s: evutil_socketpair() failed: %s (%d)", 
+					G_STRLOC,
+					g_strerror(err),
+					err);
+		}
+		event_thread->notify_fd = notify_fds[0];
+		event_thread->notify_send_fd = notify_fds[1];
+
+		evutil_make_socket_nonblocking(event_thread->notify_fd);
+	}
 #endif
 
 	event_set(&(event_thread->notify_fd_event), event_thread->notify_fd, EV_READ | EV_PERSIST, chassis_event_handle, event_thread);
@@ -347,6 +507,7 @@ int chassis_event_threads_init_thread(chassis_event_threads_t *threads, chassis_
  */
 void *chassis_event_thread_loop(chassis_event_thread_t *event_thread) {
 	chassis_event_thread_set_event_base(event_thread, event_thread->event_base);
+	g_private_set(tls_event_thread_key, event_thread);
 
 	/**
 	 * check once a second if we need to shutdown the proxy
@@ -30,24 +30,24 @@
 /**
  * event operations
  *
- * event-ops are sent through the async-queues
+ * event-ops are sent through the op-queues of the event-threads
  */
 
-typedef struct {
+typedef struct chassis_event_op_t {
 	enum {
 		CHASSIS_EVENT_OP_UNSET,
-		CHASSIS_EVENT_OP_ADD
+		CHASSIS_EVENT_OP_ADD,
+		CHASSIS_EVENT_OP_ACTIVE
 	} type;
 
 	struct event *ev;
 	long	timeout;	/* opt. timeout in s */
+
+	struct chassis_event_op_t *next; /**< next op in the op-queue of the event-thread */
 } chassis_event_op_t;
 
 CHASSIS_API chassis_event_op_t *chassis_event_op_new();
 CHASSIS_API void chassis_event_op_free(chassis_event_op_t *e);
-CHASSIS_API void chassis_event_add(chassis *chas, struct event *ev);
-CHASSIS_API void chassis_event_add_timeout(chassis *chas, struct event *ev, long timeout);
-CHASSIS_API void chassis_event_add_local(chassis *chas, struct event *ev);
 
 /**
  * a event-thread
@@ -55,25 +55,38 @@ CHASSIS_API void chassis_event_add_local(chassis *chas, struct event *ev);
 typedef struct {
 	chassis *chas;
 
-	int notify_fd;
+	int notify_fd;                 /**< wakeup-fd we listen on, a eventfd if available */
+	int notify_send_fd;            /**< wakeup-fd other threads write to, same as notify_fd for a eventfd */
 	struct event notify_fd_event;
 
+	volatile gpointer ops;         /**< lock-free stack of chassis_event_op_t's pushed by other threads */
+
+	volatile gint connections;     /**< connections owned by this thread */
+
+	guint index;                   /**< position in chassis_event_threads_t::event_threads */
+
 	GThread *thr;
 
 	struct event_base *event_base;
+
+	struct lua_scope *sc; /**< the thread's own lua-scope if chassis::lua_per_thread is set, owned by the plugins' chassis_private */
 } chassis_event_thread_t;
 
+CHASSIS_API void chassis_event_add(chassis *chas, struct event *ev);
+CHASSIS_API void chassis_event_add_timeout(chassis *chas, struct event *ev, long timeout);
+CHASSIS_API void chassis_event_add_to_thread(chassis *chas, chassis_event_thread_t *event_thread, struct event *ev, long timeout);
+CHASSIS_API void chassis_event_add_local(chassis *chas, struct event *ev);
+CHASSIS_API void chassis_event_active_in_thread(chassis *chas, chassis_event_thread_t *event_thread, struct event *ev);
+
 CHASSIS_API chassis_event_thread_t *chassis_event_thread_new();
 CHASSIS_API void chassis_event_thread_free(chassis_event_thread_t *e);
 CHASSIS_API void chassis_event_handle(int event_fd, short events, void *user_data);
 CHASSIS_API void chassis_event_thread_set_event_base(chassis_event_thread_t *e, struct event_base *event_base);
 CHASSIS_API void *chassis_event_thread_loop(chassis_event_thread_t *);
+CHASSIS_API chassis_event_thread_t *chassis_event_thread_self(void);
 
 struct chassis_event_threads_t {
  	GPtrArray *event_threads;
-
-	GAsyncQueue *event_queue;
-	int event_notify_fds[2];
 };
 
 CHASSIS_API chassis_event_threads_t *chassis_event_threads_new();
@@ -81,5 +94,6 @@ CHASSIS_API void chassis_event_threads_free(chassis_event_threads_t *threads);
 CHASSIS_API int chassis_event_threads_init_thread(chassis_event_threads_t *threads, chassis_event_thread_t *event_thread, chassis *chas);
 CHASSIS_API void chassis_event_threads_add(chassis_event_threads_t *threads, chassis_event_thread_t *thread);
 CHASSIS_API void chassis_event_threads_start(chassis_event_threads_t *threads);
+CHASSIS_API chassis_event_thread_t *chassis_event_threads_get_least_loaded(chassis_event_threads_t *threads);
 
 #endif
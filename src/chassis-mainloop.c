@@ -256,6 +256,23 @@ int chassis_mainloop(void *_chas) {
 
 	g_assert(chas->event_base);
 
+	if (chas->event_thread_count < 1) chas->event_thread_count = 1;
+
+	/* create the event-threads
+	 *
+	 * - setup the wakeup-fds and the events notification
+	 *
+	 * they are created before the plugins are set up, so the plugins can add events
+	 * to each of them (like the SO_REUSEPORT listen-sockets), but only started 
+	 * afterwards
+	 * */
+	for (i = 1; i < (guint)chas->event_thread_count; i++) { /* we already have 1 event-thread running, the main-thread */
+		chassis_event_thread_t *event_thread;
+	
+		event_thread = chassis_event_thread_new();
+		chassis_event_threads_init_thread(chas->threads, event_thread, chas);
+		chassis_event_threads_add(chas->threads, event_thread);
+	}
 
 	/* setup all plugins all plugins */
 	for (i = 0; i < chas->modules->len; i++) {
@@ -323,21 +340,6 @@ int chassis_mainloop(void *_chas) {
 	}
 #endif
 
-	if (chas->event_thread_count < 1) chas->event_thread_count = 1;
-
-	/* create the event-threads
-	 *
-	 * - dup the async-queue-ping-fds
-	 * - setup the events notification
-	 * */
-	for (i = 1; i < (guint)chas->event_thread_count; i++) { /* we already have 1 event-thread running, the main-thread */
-		chassis_event_thread_t *event_thread;
-	
-		event_thread = chassis_event_thread_new();
-		chassis_event_threads_init_thread(chas->threads, event_thread, chas);
-		chassis_event_threads_add(chas->threads, event_thread);
-	}
-
 	/* start the event threads */
 	if (chas->event_thread_count > 1) {
 		chassis_event_threads_start(chas->threads);
@@ -73,6 +73,7 @@ struct chassis {
 
 	/* network-io threads */
 	gint event_thread_count;
+	gboolean lua_per_thread;                  /**< give each event-thread its own lua-scope */
 
 	chassis_event_threads_t *threads;
 
@@ -80,6 +81,7 @@ struct chassis {
 
 	long network_timeout;
 	long network_retries;
+	gint network_read_buffer_size;            /**< size of the buffer the sockets recv() into, 0 for the default */
 };
 
 CHASSIS_API chassis *chassis_init(void) G_GNUC_DEPRECATED;
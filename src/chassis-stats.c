@@ -25,6 +25,7 @@
 
 #include <glib.h>
 #include "chassis-stats.h"
+#include "glib-ext-pool.h"
 
 chassis_stats_t *chassis_global_stats = NULL;
 
@@ -65,6 +66,9 @@ GHashTable* chassis_stats_get(chassis_stats_t *stats){
 	ADD_ALLOC_STAT(lua_mem);
 	ADD_STAT(lua_mem_bytes);
 	ADD_STAT(lua_mem_bytes_max);
+
+	/* the object pools of the connections */
+	g_pools_get_stats(stats_hash);
 	
 #undef N
 #undef STR
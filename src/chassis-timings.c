@@ -22,15 +22,19 @@
 
 #include "chassis-timings.h"
 #include "glib-ext.h"
+#include "glib-ext-pool.h"
 
 #define MICROS_IN_SEC 1000000
 
 chassis_timestamps_global_t *chassis_timestamps_global = NULL;
 
+static GPool chassis_timestamp_pool = G_POOL_INIT("chassis_timestamp", chassis_timestamp_t);
+static GPool chassis_timestamps_pool = G_POOL_INIT("chassis_timestamps", chassis_timestamps_t);
+
 chassis_timestamp_t *chassis_timestamp_new(void) {
 	chassis_timestamp_t *ts;
 
-	ts = g_new0(chassis_timestamp_t, 1);
+	ts = g_pool_alloc0(&chassis_timestamp_pool);
 
 	return ts;
 }
@@ -49,13 +53,13 @@ void chassis_timestamp_init_now(chassis_timestamp_t *ts,
 }
 
 void chassis_timestamp_free(chassis_timestamp_t *ts) {
-	g_free(ts);
+	g_pool_free(&chassis_timestamp_pool, ts);
 }
 
 chassis_timestamps_t *chassis_timestamps_new(void) {
 	chassis_timestamps_t *ts;
 
-	ts = g_new0(chassis_timestamps_t, 1);
+	ts = g_pool_alloc0(&chassis_timestamps_pool);
 	ts->timestamps = g_queue_new();
 
 	return ts;
@@ -66,7 +70,7 @@ void chassis_timestamps_free(chassis_timestamps_t *ts) {
 
 	while ((t = g_queue_pop_head(ts->timestamps))) chassis_timestamp_free(t);
 	g_queue_free(ts->timestamps);
-	g_free(ts);
+	g_pool_free(&chassis_timestamps_pool, ts);
 }
 
 void chassis_timestamps_add(chassis_timestamps_t *ts,
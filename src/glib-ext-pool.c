@@ -0,0 +1,234 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+#include "glib-ext-pool.h"
+
+/**
+ * the free-list of a thread
+ *
+ * the free objects are linked through their first pointer. The counters are only
+ * written by the owning thread, g_pools_get_stats() sums them up.
+ */
+typedef struct {
+	GPool *pool;
+
+	gpointer head;
+	guint len;
+
+	volatile guint allocs;
+	volatile guint frees;
+	volatile guint hits;
+} GPoolThreadCache;
+
+static GStaticMutex pools_mutex = G_STATIC_MUTEX_INIT;
+static GPool *pools = NULL; /**< the registered pools */
+
+/**
+ * release a free-list to the slice allocator
+ */
+static void g_pool_release(GPool *pool, gpointer head) {
+	while (head) {
+		gpointer obj = head;
+
+		head = *(gpointer *)obj;
+
+		g_slice_free1(pool->size, obj);
+	}
+}
+
+/**
+ * release the free-list of a thread when it exits
+ */
+static void g_pool_thread_cache_free(gpointer _cache) {
+	GPoolThreadCache *cache = _cache;
+	GPool *pool = cache->pool;
+
+	/* keep the counters of the thread for the stats */
+	g_static_mutex_lock(&(pool->depot_mutex));
+	pool->thread_caches = g_slist_remove(pool->thread_caches, cache);
+	pool->allocs += cache->allocs;
+	pool->frees  += cache->frees;
+	pool->hits   += cache->hits;
+	g_static_mutex_unlock(&(pool->depot_mutex));
+
+	g_pool_release(pool, cache->head);
+
+	g_free(cache);
+}
+
+static void g_pool_register(GPool *pool) {
+	if (g_atomic_int_get(&(pool->is_registered))) return;
+
+	g_static_mutex_lock(&pools_mutex);
+	if (!pool->is_registered) {
+		pool->next = pools;
+		pools = pool;
+
+		g_atomic_int_set(&(pool->is_registered), 1);
+	}
+	g_static_mutex_unlock(&pools_mutex);
+}
+
+static GPoolThreadCache *g_pool_get_thread_cache(GPool *pool) {
+	GPoolThreadCache *cache;
+
+	if (G_LIKELY(NULL != (cache = g_static_private_get(&(pool->thread_cache))))) return cache;
+
+	g_pool_register(pool);
+
+	cache = g_new0(GPoolThreadCache, 1);
+	cache->pool = pool;
+
+	g_static_mutex_lock(&(pool->depot_mutex));
+	pool->thread_caches = g_slist_prepend(pool->thread_caches, cache);
+	g_static_mutex_unlock(&(pool->depot_mutex));
+
+	g_static_private_set(&(pool->thread_cache), cache, g_pool_thread_cache_free);
+
+	return cache;
+}
+
+/**
+ * get a zero'ed object from the pool
+ *
+ * @see g_pool_free
+ */
+gpointer g_pool_alloc0(GPool *pool) {
+	GPoolThreadCache *cache = g_pool_get_thread_cache(pool);
+	gpointer obj;
+
+	if (!cache->head && g_atomic_int_get(&(pool->depot_len)) > 0) {
+		/* take a full free-list from the depot */
+		g_static_mutex_lock(&(pool->depot_mutex));
+		if (pool->depot) {
+			cache->head = pool->depot->data;
+			cache->len  = G_POOL_THREAD_CACHE_SIZE;
+
+			pool->depot = g_slist_delete_link(pool->depot, pool->depot);
+			g_atomic_int_add(&(pool->depot_len), -1);
+		}
+		g_static_mutex_unlock(&(pool->depot_mutex));
+	}
+
+	if (cache->head) {
+		obj = cache->head;
+
+		cache->head = *(gpointer *)obj;
+		cache->len--;
+
+		memset(obj, 0, pool->size);
+
+		cache->hits++;
+	} else {
+		obj = g_slice_alloc0(pool->size);
+	}
+
+	cache->allocs++;
+
+	return obj;
+}
+
+/**
+ * give a object back to the pool
+ *
+ * the object may have been allocated in another thread
+ */
+void g_pool_free(GPool *pool, gpointer obj) {
+	GPoolThreadCache *cache;
+
+	if (!obj) return;
+
+	cache = g_pool_get_thread_cache(pool);
+
+	if (cache->len >= G_POOL_THREAD_CACHE_SIZE) {
+		gpointer head = cache->head;
+
+		/* hand the full free-list to the depot */
+		g_static_mutex_lock(&(pool->depot_mutex));
+		if (pool->depot_len < G_POOL_DEPOT_SIZE) {
+			pool->depot = g_slist_prepend(pool->depot, head);
+			g_atomic_int_inc(&(pool->depot_len));
+
+			head = NULL;
+		}
+		g_static_mutex_unlock(&(pool->depot_mutex));
+
+		/* the depot is full */
+		if (head) g_pool_release(pool, head);
+
+		cache->head = NULL;
+		cache->len = 0;
+	}
+
+	*(gpointer *)obj = cache->head;
+	cache->head = obj;
+	cache->len++;
+
+	cache->frees++;
+}
+
+/**
+ * add the stats of all pools that were used to the hash
+ *
+ * for each pool we add:
+ *
+ * - <name>_pool_alloc
+ * - <name>_pool_free
+ * - <name>_pool_hits (allocations that were served from a free-list)
+ *
+ * @see chassis_stats_get()
+ */
+void g_pools_get_stats(GHashTable *stats_hash) {
+	GPool *pool;
+
+	g_static_mutex_lock(&pools_mutex);
+	for (pool = pools; pool; pool = pool->next) {
+		guint allocs, frees, hits;
+		GSList *node;
+
+		/* the counters of the running threads are read without a lock, they may be slightly behind */
+		g_static_mutex_lock(&(pool->depot_mutex));
+		allocs = pool->allocs;
+		frees  = pool->frees;
+		hits   = pool->hits;
+
+		for (node = pool->thread_caches; node; node = node->next) {
+			GPoolThreadCache *cache = node->data;
+
+			allocs += cache->allocs;
+			frees  += cache->frees;
+			hits   += cache->hits;
+		}
+		g_static_mutex_unlock(&(pool->depot_mutex));
+
+		g_hash_table_insert(stats_hash, g_strdup_printf("%s_pool_alloc", pool->name), GUINT_TO_POINTER(allocs));
+		g_hash_table_insert(stats_hash, g_strdup_printf("%s_pool_free", pool->name), GUINT_TO_POINTER(frees));
+		g_hash_table_insert(stats_hash, g_strdup_printf("%s_pool_hits", pool->name), GUINT_TO_POINTER(hits));
+	}
+	g_static_mutex_unlock(&pools_mutex);
+}
+
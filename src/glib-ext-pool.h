@@ -0,0 +1,82 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _GLIB_EXT_POOL_H_
+#define _GLIB_EXT_POOL_H_
+
+#include <glib.h>
+
+#include "chassis-exports.h"
+
+/**
+ * objects a thread keeps in its own free-list before it hands them to the depot
+ */
+#define G_POOL_THREAD_CACHE_SIZE 64
+
+/**
+ * free-lists the depot of a pool keeps, the objects of additional free-lists are released
+ */
+#define G_POOL_DEPOT_SIZE 64
+
+/**
+ * a pool of fixed-size objects
+ *
+ * each thread allocates from and frees to its own free-list, which is a simple
+ * pointer-pop and pointer-push. If the free-list of a thread is full, it is moved
+ * as a whole to the depot of the pool where another thread can pick it up when
+ * its free-list is empty. As connections are usually accepted in one thread and
+ * closed in another one, the depot moves the objects back to where they are needed.
+ *
+ * pools are declared statically:
+ *
+ *   static GPool network_socket_pool = G_POOL_INIT("network_socket", network_socket);
+ *
+ * and register themselves for g_pools_get_stats() on first use.
+ */
+typedef struct GPool {
+	const gchar *name;
+	gsize size;
+
+	GStaticPrivate thread_cache; /**< the free-list of the current thread */
+
+	GStaticMutex depot_mutex;
+	GSList *depot;               /**< full free-lists handed in by the threads */
+	volatile gint depot_len;
+
+	volatile gint is_registered;
+
+	GSList *thread_caches;       /**< the free-lists of the running threads, protected by the depot_mutex */
+
+	guint allocs;                /**< objects handed out by threads that exited, protected by the depot_mutex */
+	guint frees;                 /**< objects given back by threads that exited, protected by the depot_mutex */
+	guint hits;                  /**< objects that were taken from a free-list by threads that exited, protected by the depot_mutex */
+
+	struct GPool *next;          /**< next registered pool */
+} GPool;
+
+#define G_POOL_INIT(name, type) { name, sizeof(type) > sizeof(gpointer) ? sizeof(type) : sizeof(gpointer), G_STATIC_PRIVATE_INIT, G_STATIC_MUTEX_INIT, NULL, 0, 0, NULL, 0, 0, 0, NULL }
+
+CHASSIS_API gpointer g_pool_alloc0(GPool *pool);
+CHASSIS_API void g_pool_free(GPool *pool, gpointer obj);
+
+CHASSIS_API void g_pools_get_stats(GHashTable *stats_hash);
+
+#endif
@@ -34,7 +34,7 @@
 
 #include "chassis-exports.h"
 
-typedef struct {
+typedef struct lua_scope {
 #ifdef HAVE_LUA_H
 	lua_State *L;
 	int L_ref;
@@ -0,0 +1,548 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "lua-env.h"
+#include "lua-shared-table.h"
+
+/**
+ * don't follow tables deeper than this when copying them into the shared scope
+ *
+ * protects us against self-referencing tables
+ */
+#define LUA_SHARED_TABLE_MAX_DEPTH 32
+
+/* convert a stack index to positive */
+#define abs_index(L, i)         ((i) > 0 || (i) <= LUA_REGISTRYINDEX ? (i) : \
+		                                        lua_gettop(L) + (i) + 1)
+
+/**
+ * the userdata we hand out to the other lua-states
+ */
+typedef struct {
+	lua_shared_tables_t *shared;
+
+	int ref; /**< reference to the table in the registry of the shared scope */
+} lua_shared_table_t;
+
+static int lua_shared_table_getmetatable(lua_State *L);
+
+lua_shared_tables_t *lua_shared_tables_new(lua_scope *sc) {
+	lua_shared_tables_t *shared;
+
+	shared = g_new0(lua_shared_tables_t, 1);
+	shared->sc = sc;
+	shared->garbage = g_async_queue_new();
+
+	return shared;
+}
+
+/**
+ * free the shared tables
+ *
+ * has to be called after all lua-states that reference shared tables are closed
+ * and before the shared lua-scope is freed
+ */
+void lua_shared_tables_free(lua_shared_tables_t *shared) {
+	if (!shared) return;
+
+	/* the refs die with the lua-scope */
+	while (g_async_queue_try_pop(shared->garbage));
+	g_async_queue_unref(shared->garbage);
+
+	g_free(shared);
+}
+
+/**
+ * a value of the shared scope on its way out to another lua-state
+ *
+ * it is taken from the shared scope with its lock held and only pushed onto the other
+ * lua-state after the lock is released
+ */
+typedef struct {
+	int type;          /**< LUA_TNIL, LUA_TBOOLEAN, LUA_TNUMBER, LUA_TSTRING or LUA_TTABLE */
+
+	int b;
+	lua_Number n;
+	GString *s;
+	int ref;           /**< the table in the registry of the shared scope */
+} lua_shared_value_t;
+
+/**
+ * a access to a shared table that runs with the lock of the shared scope held
+ *
+ * @see lua_shared_tables_call_locked()
+ */
+typedef struct {
+	lua_CFunction func;  /**< runs on the lua-state of the shared scope, the op is its only argument */
+
+	lua_State *L;        /**< the lua-state that accesses the shared table, only read in func */
+	lua_shared_table_t *st;
+
+	int bad_t;           /**< the lua-type of a key or value that can't be shared, 0 if all are fine */
+	gboolean bad_is_key;
+
+	lua_shared_value_t val;
+	GArray *snapshot;    /**< key/value pairs of lua_shared_value_t's for __call */
+	size_t len;
+} lua_shared_table_op_t;
+
+/**
+ * run a op on the shared scope in protected mode
+ *
+ * releases the refs of the collected shared tables before the op: the __gc handler can't
+ * do it itself as the GC may run while we already hold the lock.
+ */
+static int lua_shared_tables_run(lua_State *S) {
+	lua_shared_table_op_t *op = lua_touserdata(S, 1);
+	lua_shared_tables_t *shared = op->st->shared;
+	gpointer ref;
+
+	while ((ref = g_async_queue_try_pop(shared->garbage))) {
+		luaL_unref(S, LUA_REGISTRYINDEX, GPOINTER_TO_INT(ref));
+	}
+
+	luaL_checkstack(S, 2 * LUA_SHARED_TABLE_MAX_DEPTH + LUA_MINSTACK, "shared table is nested too deep");
+
+	lua_pushcfunction(S, op->func);
+	lua_pushlightuserdata(S, op);
+	lua_call(S, 1, 0);
+
+	return 0;
+}
+
+/**
+ * run a op with the lock of the shared scope held
+ *
+ * the op runs via lua_cpcall(): a error in the shared scope (like a failed allocation) can't
+ * longjmp over the unlock. The op only reads op->L, it must not raise errors in it either:
+ * the values for op->L are pushed by the caller after the lock is released.
+ *
+ * @return 0 on success, -1 if the op raised a error
+ */
+static int lua_shared_tables_call_locked(lua_shared_tables_t *shared, lua_shared_table_op_t *op) {
+	lua_State *S = shared->sc->L;
+	int ret;
+
+	LOCK_LUA(shared->sc);
+	if (0 != (ret = lua_cpcall(S, lua_shared_tables_run, op))) {
+		g_critical("%s: accessing the shared table failed: %s",
+				G_STRLOC,
+				lua_isstring(S, -1) ? lua_tostring(S, -1) : "(no error message)");
+		lua_pop(S, 1);
+	}
+	UNLOCK_LUA(shared->sc);
+
+	return ret ? -1 : 0;
+}
+
+/**
+ * prepare a op on the shared table at the index 1 of L
+ *
+ * the metatable of the shared tables and the stack space for the copies are set up in L
+ * before the lock is taken, the op can read L without raising errors then
+ */
+static void lua_shared_table_op_init(lua_shared_table_op_t *op, lua_State *L, lua_CFunction func) {
+	memset(op, 0, sizeof(*op));
+
+	op->func = func;
+	op->L = L;
+	op->st = luaL_checkself(L);
+	op->val.type = LUA_TNIL;
+
+	luaL_checkstack(L, 2 * LUA_SHARED_TABLE_MAX_DEPTH + LUA_MINSTACK, "shared table is nested too deep");
+	lua_shared_table_getmetatable(L);
+	lua_pop(L, 1);
+}
+
+/**
+ * copy a value from L into the shared scope
+ *
+ * tables are deep-copied, shared tables are resolved to the table they point to
+ *
+ * on success the value is pushed onto the stack of the shared scope
+ *
+ * @return 0 on success, the lua-type that can't be shared otherwise
+ */
+static int lua_shared_table_copy_in(lua_State *L, int ndx, lua_shared_tables_t *shared, int depth) {
+	lua_State *S = shared->sc->L;
+	int t;
+
+	ndx = abs_index(L, ndx);
+
+	switch ((t = lua_type(L, ndx))) {
+	case LUA_TNIL:
+		lua_pushnil(S);
+		break;
+	case LUA_TBOOLEAN:
+		lua_pushboolean(S, lua_toboolean(L, ndx));
+		break;
+	case LUA_TNUMBER:
+		lua_pushnumber(S, lua_tonumber(L, ndx));
+		break;
+	case LUA_TSTRING: {
+		size_t s_len;
+		const char *s = lua_tolstring(L, ndx, &s_len);
+
+		lua_pushlstring(S, s, s_len);
+		break; }
+	case LUA_TTABLE:
+		if (depth > LUA_SHARED_TABLE_MAX_DEPTH) return t;
+
+		lua_newtable(S);
+
+		lua_pushnil(L);
+		while (lua_next(L, ndx) != 0) {
+			int bad_t;
+
+			if (0 != (bad_t = lua_shared_table_copy_in(L, -2, shared, depth + 1))) {
+				lua_pop(L, 2); /* key and value */
+				lua_pop(S, 1); /* the new table */
+
+				return bad_t;
+			}
+			if (0 != (bad_t = lua_shared_table_copy_in(L, -1, shared, depth + 1))) {
+				lua_pop(L, 2);
+				lua_pop(S, 2); /* the new table and the key */
+
+				return bad_t;
+			}
+			lua_rawset(S, -3);
+
+			lua_pop(L, 1); /* keep the key for lua_next() */
+		}
+		break;
+	case LUA_TUSERDATA: {
+		lua_shared_table_t *st;
+		int is_shared_table;
+
+		/* only our own shared tables can be referenced */
+		if (0 == lua_getmetatable(L, ndx)) return t;
+		lua_shared_table_getmetatable(L);
+		is_shared_table = lua_rawequal(L, -1, -2);
+		lua_pop(L, 2);
+
+		if (!is_shared_table) return t;
+
+		st = lua_touserdata(L, ndx);
+		if (st->shared != shared) return t;
+
+		lua_rawgeti(S, LUA_REGISTRYINDEX, st->ref);
+		break; }
+	default:
+		return t;
+	}
+
+	return 0;
+}
+
+/**
+ * take a value of the shared scope to push it onto another lua-state later
+ *
+ * tables are referenced in the registry of the shared scope, the ref is handed to the shared table
+ * that is pushed for it. Has to be called with the lock held.
+ *
+ * @return 0 on success, -1 if the value can't be shared (and val is set to nil)
+ */
+static int lua_shared_value_take(lua_State *S, int ndx, lua_shared_value_t *val) {
+	val->type = lua_type(S, ndx);
+
+	switch (val->type) {
+	case LUA_TNIL:
+		break;
+	case LUA_TBOOLEAN:
+		val->b = lua_toboolean(S, ndx);
+		break;
+	case LUA_TNUMBER:
+		val->n = lua_tonumber(S, ndx);
+		break;
+	case LUA_TSTRING: {
+		size_t s_len;
+		const char *s = lua_tolstring(S, ndx, &s_len);
+
+		val->s = g_string_new_len(s, s_len);
+		break; }
+	case LUA_TTABLE:
+		lua_pushvalue(S, ndx);
+		val->ref = luaL_ref(S, LUA_REGISTRYINDEX);
+		break;
+	default:
+		val->type = LUA_TNIL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * drop a taken value that isn't pushed, has to be called with the lock held
+ */
+static void lua_shared_value_clear(lua_State *S, lua_shared_value_t *val) {
+	if (val->s) g_string_free(val->s, TRUE);
+	if (val->type == LUA_TTABLE) luaL_unref(S, LUA_REGISTRYINDEX, val->ref);
+
+	val->s = NULL;
+	val->type = LUA_TNIL;
+}
+
+/**
+ * push a taken value onto L, the lock isn't held anymore
+ *
+ * tables are returned as shared tables
+ */
+static void lua_shared_value_push(lua_State *L, lua_shared_tables_t *shared, lua_shared_value_t *val) {
+	switch (val->type) {
+	case LUA_TBOOLEAN:
+		lua_pushboolean(L, val->b);
+		break;
+	case LUA_TNUMBER:
+		lua_pushnumber(L, val->n);
+		break;
+	case LUA_TSTRING:
+		lua_pushlstring(L, val->s->str, val->s->len);
+		g_string_free(val->s, TRUE);
+		val->s = NULL;
+		break;
+	case LUA_TTABLE:
+		lua_shared_table_push(L, shared, val->ref);
+		break;
+	default:
+		lua_pushnil(L);
+		break;
+	}
+}
+
+static int lua_shared_table_get_locked(lua_State *S) {
+	lua_shared_table_op_t *op = lua_touserdata(S, 1);
+
+	lua_rawgeti(S, LUA_REGISTRYINDEX, op->st->ref);
+
+	if (0 != (op->bad_t = lua_shared_table_copy_in(op->L, 2, op->st->shared, 1))) return 0;
+
+	lua_rawget(S, -2);
+	lua_shared_value_take(S, -1, &(op->val));
+
+	return 0;
+}
+
+static int lua_shared_table_get(lua_State *L) {
+	lua_shared_table_op_t op;
+
+	lua_shared_table_op_init(&op, L, lua_shared_table_get_locked);
+
+	if (0 != lua_shared_tables_call_locked(op.st->shared, &op)) {
+		return luaL_error(L, "reading the shared table failed");
+	}
+	if (op.bad_t) {
+		return luaL_error(L, "a %s can't be used as key of a shared table", lua_typename(L, op.bad_t));
+	}
+
+	lua_shared_value_push(L, op.st->shared, &(op.val));
+
+	return 1;
+}
+
+static int lua_shared_table_set_locked(lua_State *S) {
+	lua_shared_table_op_t *op = lua_touserdata(S, 1);
+
+	lua_rawgeti(S, LUA_REGISTRYINDEX, op->st->ref);
+
+	if (0 != (op->bad_t = lua_shared_table_copy_in(op->L, 2, op->st->shared, 1))) {
+		op->bad_is_key = TRUE;
+		return 0;
+	}
+	if (0 != (op->bad_t = lua_shared_table_copy_in(op->L, 3, op->st->shared, 1))) return 0;
+
+	lua_rawset(S, -3);
+
+	return 0;
+}
+
+static int lua_shared_table_set(lua_State *L) {
+	lua_shared_table_op_t op;
+
+	luaL_checkany(L, 3);
+	if (lua_isnil(L, 2)) {
+		return luaL_error(L, "shared table index is nil");
+	}
+
+	lua_shared_table_op_init(&op, L, lua_shared_table_set_locked);
+
+	if (0 != lua_shared_tables_call_locked(op.st->shared, &op)) {
+		return luaL_error(L, "writing the shared table failed");
+	}
+	if (op.bad_t) {
+		return luaL_error(L, op.bad_is_key ? "a %s can't be used as key of a shared table" : "a %s can't be stored in a shared table",
+				lua_typename(L, op.bad_t));
+	}
+
+	return 0;
+}
+
+static int lua_shared_table_len_locked(lua_State *S) {
+	lua_shared_table_op_t *op = lua_touserdata(S, 1);
+
+	lua_rawgeti(S, LUA_REGISTRYINDEX, op->st->ref);
+	op->len = lua_objlen(S, -1);
+
+	return 0;
+}
+
+static int lua_shared_table_len(lua_State *L) {
+	lua_shared_table_op_t op;
+
+	lua_shared_table_op_init(&op, L, lua_shared_table_len_locked);
+
+	if (0 != lua_shared_tables_call_locked(op.st->shared, &op)) {
+		return luaL_error(L, "reading the shared table failed");
+	}
+
+	lua_pushinteger(L, op.len);
+
+	return 1;
+}
+
+static int lua_shared_table_call_locked(lua_State *S) {
+	lua_shared_table_op_t *op = lua_touserdata(S, 1);
+
+	lua_rawgeti(S, LUA_REGISTRYINDEX, op->st->ref);
+
+	lua_pushnil(S);
+	while (lua_next(S, -2) != 0) {
+		lua_shared_value_t kv[2];
+
+		memset(kv, 0, sizeof(kv));
+
+		if (0 == lua_shared_value_take(S, -2, &kv[0]) &&
+		    0 == lua_shared_value_take(S, -1, &kv[1])) {
+			g_array_append_vals(op->snapshot, kv, 2);
+		} else {
+			lua_shared_value_clear(S, &kv[0]);
+		}
+		lua_pop(S, 1); /* keep the key for lua_next() */
+	}
+
+	return 0;
+}
+
+/**
+ * return a iterator over a snapshot of the shared table
+ *
+ *   for k, v in proxy.global.foo() do ... end
+ */
+static int lua_shared_table_call(lua_State *L) {
+	lua_shared_table_op_t op;
+	guint i;
+
+	lua_shared_table_op_init(&op, L, lua_shared_table_call_locked);
+	op.snapshot = g_array_new(FALSE, TRUE, sizeof(lua_shared_value_t));
+
+	if (0 != lua_shared_tables_call_locked(op.st->shared, &op)) {
+		/* the refs of the tables we took are collected with the next access */
+		for (i = 0; i < op.snapshot->len; i++) {
+			lua_shared_value_t *val = &g_array_index(op.snapshot, lua_shared_value_t, i);
+
+			if (val->s) g_string_free(val->s, TRUE);
+			if (val->type == LUA_TTABLE) g_async_queue_push(op.st->shared->garbage, GINT_TO_POINTER(val->ref));
+		}
+		g_array_free(op.snapshot, TRUE);
+
+		return luaL_error(L, "reading the shared table failed");
+	}
+
+	lua_getglobal(L, "next");
+	lua_newtable(L);
+
+	for (i = 0; i < op.snapshot->len; i += 2) {
+		lua_shared_value_push(L, op.st->shared, &g_array_index(op.snapshot, lua_shared_value_t, i));
+		lua_shared_value_push(L, op.st->shared, &g_array_index(op.snapshot, lua_shared_value_t, i + 1));
+		lua_rawset(L, -3);
+	}
+	g_array_free(op.snapshot, TRUE);
+
+	lua_pushnil(L);
+
+	return 3; /* next, snapshot, nil */
+}
+
+static int lua_shared_table_gc(lua_State *L) {
+	lua_shared_table_t *st = luaL_checkself(L);
+
+	if (st->ref > 0) {
+		g_async_queue_push(st->shared->garbage, GINT_TO_POINTER(st->ref));
+	}
+
+	return 0;
+}
+
+static int lua_shared_table_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", lua_shared_table_get },
+		{ "__newindex", lua_shared_table_set },
+		{ "__len", lua_shared_table_len },
+		{ "__call", lua_shared_table_call },
+		{ "__gc", lua_shared_table_gc },
+		{ NULL, NULL },
+	};
+	return proxy_getmetatable(L, methods);
+}
+
+/**
+ * push a shared table onto the stack of L
+ *
+ * @param ref reference into the registry of the shared scope, owned by the shared table from now on
+ */
+int lua_shared_table_push(lua_State *L, lua_shared_tables_t *shared, int ref) {
+	lua_shared_table_t *st;
+
+	st = lua_newuserdata(L, sizeof(*st));
+	st->shared = shared;
+	st->ref = ref;
+
+	lua_shared_table_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+/**
+ * forward all unknown fields of the table at ndx to a shared table
+ *
+ * fields that are set in the local table directly (like proxy.global.backends)
+ * stay local, everything else is read from and written to the shared table
+ */
+void lua_shared_table_forward(lua_State *L, int ndx, lua_shared_tables_t *shared, int ref) {
+	ndx = abs_index(L, ndx);
+
+	lua_newtable(L);
+
+	lua_shared_table_push(L, shared, ref);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -3, "__index");
+	lua_setfield(L, -2, "__newindex");
+
+	lua_setmetatable(L, ndx);
+}
@@ -0,0 +1,60 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __LUA_SHARED_TABLE_H__
+#define __LUA_SHARED_TABLE_H__
+
+#include <glib.h>
+#include <lua.h>
+
+#include "lua-scope.h"
+
+#include "network-exports.h"
+
+/**
+ * tables that live in one lua-scope and are accessed from other lua-states
+ *
+ * with per-thread lua-states each event-thread has its own lua_State, but
+ * proxy.global has to be the same for all of them. The table itself stays
+ * in the shared lua-scope, the other lua-states only get a userdata that
+ * copies the values in and out under the lock of the shared lua-scope.
+ *
+ * - strings, numbers and booleans are copied
+ * - tables are deep-copied into the shared scope on assignment and are returned as
+ *   shared tables again
+ * - functions, userdata and threads can't be shared
+ *
+ * As Lua 5.1 doesn't know about __pairs, a shared table can be called to
+ * get a snapshot to iterate over:
+ *
+ *   for k, v in proxy.global.foo() do ... end
+ */
+typedef struct {
+	lua_scope *sc;        /**< the lua-scope the shared tables live in */
+
+	GAsyncQueue *garbage; /**< refs of collected shared tables, released on the next access */
+} lua_shared_tables_t;
+
+NETWORK_API lua_shared_tables_t *lua_shared_tables_new(lua_scope *sc);
+NETWORK_API void lua_shared_tables_free(lua_shared_tables_t *shared);
+
+NETWORK_API int lua_shared_table_push(lua_State *L, lua_shared_tables_t *shared, int ref);
+NETWORK_API void lua_shared_table_forward(lua_State *L, int ndx, lua_shared_tables_t *shared, int ref);
+
+#endif
@@ -131,6 +131,7 @@ typedef struct {
 	gint max_files_number;
 
 	gint event_thread_count;
+	gboolean lua_per_thread;
 
 	gchar *log_level;
 	gchar *log_filename;
@@ -143,6 +144,7 @@ typedef struct {
 
 	long network_timeout;
 	long network_retries;
+	gint network_read_buffer_size;
 } chassis_frontend_t;
 
 /**
@@ -246,6 +248,9 @@ int chassis_frontend_set_chassis_options(chassis_frontend_t *frontend, chassis_o
 	chassis_options_add(opts,
 		"event-threads",            0, 0, G_OPTION_ARG_INT, &(frontend->event_thread_count), "number of event-handling threads (default: 1)", NULL);
 
+	chassis_options_add(opts,
+		"lua-per-thread",           0, 0, G_OPTION_ARG_NONE, &(frontend->lua_per_thread), "give each event-thread its own Lua state, proxy.global is shared", NULL);
+
 	chassis_options_add(opts,
 		"lua-path",                 0, 0, G_OPTION_ARG_STRING, &(frontend->lua_path), "set the LUA_PATH", "<...>");
 
@@ -262,6 +267,11 @@ int chassis_frontend_set_chassis_options(chassis_frontend_t *frontend, chassis_o
 		&(frontend->network_retries), "sets number of retries before a "
 		"connection is considered dead (default: 3)", 0);
 
+	chassis_options_add(opts,
+		"network-read-buffer-size", 0, 0, G_OPTION_ARG_INT,
+		&(frontend->network_read_buffer_size), "size in bytes of the buffer each "
+		"connection reads into (default: 16384)", "<bytes>");
+
 	return 0;	
 }
 
@@ -574,6 +584,12 @@ int main_cmdline(int argc, char **argv) {
 		GOTO_EXIT(EXIT_FAILURE);
 	}
 
+	if (frontend->network_read_buffer_size < 0) {
+		g_critical("--network-read-buffer-size has to be >= 0, is %d", frontend->network_read_buffer_size);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+
 	/* make sure that he max-thread-count isn't negative */
 	if (frontend->event_thread_count < 1) {
 		g_critical("--event-threads has to be >= 1, is %d", frontend->event_thread_count);
@@ -582,6 +598,7 @@ int main_cmdline(int argc, char **argv) {
 	}
 
 	srv->event_thread_count = frontend->event_thread_count;
+	srv->lua_per_thread = frontend->lua_per_thread;
 	
 #ifndef _WIN32	
 	signal(SIGPIPE, SIG_IGN);
@@ -651,6 +668,7 @@ int main_cmdline(int argc, char **argv) {
 			frontend->network_timeout: CHASSIS_DEFAULT_NET_TIMEOUT;
 	srv->network_retries = frontend->network_retries ?
 			frontend->network_retries: CHASSIS_NET_TIMEOUT_LIMIT;
+	srv->network_read_buffer_size = frontend->network_read_buffer_size;
 
 #undef CHASSIS_DEFAULT_NET_TIMEOUT
 #undef CHASSIS_NET_TIMEOUT_LIMIT
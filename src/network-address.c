@@ -50,14 +50,17 @@
 
 #include "network-address.h"
 #include "glib-ext.h"
+#include "glib-ext-pool.h"
 
 #define C(x) x, sizeof(x) - 1
 #define S(x) x->str, x->len
 
+static GPool network_address_pool = G_POOL_INIT("network_address", network_address);
+
 network_address *network_address_new() {
 	network_address *addr;
 
-	addr = g_new0(network_address, 1);
+	addr = g_pool_alloc0(&network_address_pool);
 	addr->len = sizeof(addr->addr.common);
 	addr->name = g_string_new(NULL);
 
@@ -95,7 +98,7 @@ void network_address_free(network_address *addr) {
 #endif /* WIN32 */
 
 	g_string_free(addr->name, TRUE);
-	g_free(addr);
+	g_pool_free(&network_address_pool, addr);
 }
 
 void network_address_reset(network_address *addr) {
@@ -264,6 +267,50 @@ gint network_address_set_address(network_address *addr, const gchar *address) {
 	return network_address_set_address_ip(addr, address, 3306);
 }
 
+/**
+ * check if network_address_set_address() has to ask the resolver for the address
+ *
+ * unix-sockets, numeric IPs and the any-address are set without a DNS lookup
+ *
+ * @param address  the address string as accepted by network_address_set_address()
+ * @return TRUE if the host-part of the address is a hostname
+ */
+gboolean network_address_is_hostname(const gchar *address) {
+	gchar *host;
+	gboolean is_hostname = TRUE;
+	const gchar *s;
+
+	if (address[0] == '/') return FALSE;
+
+	if (NULL != (s = strchr(address, ':'))) {
+		host = g_strndup(address, s - address);
+	} else {
+		host = g_strdup(address);
+	}
+
+	if (host[0] == '\0' || 0 == strcmp("0.0.0.0", host)) {
+		is_hostname = FALSE;
+	} else {
+#ifdef HAVE_GETADDRINFO
+		struct addrinfo *ai = NULL, hint;
+
+		memset(&hint, 0, sizeof (hint));
+		hint.ai_family = PF_INET;
+		hint.ai_flags = AI_NUMERICHOST; /* never asks the resolver */
+
+		if (0 == getaddrinfo(host, NULL, &hint, &ai)) {
+			is_hostname = FALSE;
+			freeaddrinfo(ai);
+		}
+#else
+		if (INADDR_NONE != inet_addr(host)) is_hostname = FALSE;
+#endif
+	}
+
+	g_free(host);
+
+	return is_hostname;
+}
 
 gint network_address_refresh_name(network_address *addr) {
 	/* resolve the peer-addr if we haven't done so yet */
@@ -0,0 +1,202 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "glib-ext.h"
+
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-backend-connector.h"
+
+#define S(x) x->str, x->len
+
+/**
+ * create a connector
+ *
+ * @param owner      the pool manager or health checker the connector works for
+ * @param owner_free called with the owner when the last reference is gone
+ */
+network_backend_connector *network_backend_connector_new(chassis *chas, gpointer owner, GDestroyNotify owner_free) {
+	network_backend_connector *connector;
+
+	connector = g_new0(network_backend_connector, 1);
+	connector->chas = chas;
+	connector->owner = owner;
+	connector->owner_free = owner_free;
+	connector->ref_count = 1;
+
+	return connector;
+}
+
+void network_backend_connector_ref(network_backend_connector *connector) {
+	g_atomic_int_inc(&(connector->ref_count));
+}
+
+/**
+ * release a reference, the last one frees the owner and the connector
+ */
+void network_backend_connector_unref(network_backend_connector *connector) {
+	if (!g_atomic_int_dec_and_test(&(connector->ref_count))) return;
+
+	if (connector->owner_free) connector->owner_free(connector->owner);
+
+	if (connector->username) g_string_free(connector->username, TRUE);
+	if (connector->hashed_password) g_string_free(connector->hashed_password, TRUE);
+
+	g_free(connector);
+}
+
+/**
+ * set the user the connections authenticate as
+ *
+ * @param username the username, NULL to unset it
+ * @param password the password in plain-text, may be NULL
+ */
+void network_backend_connector_set_auth(network_backend_connector *connector, const gchar *username, const gchar *password) {
+	if (connector->username) {
+		g_string_free(connector->username, TRUE);
+		connector->username = NULL;
+	}
+	if (connector->hashed_password) {
+		g_string_free(connector->hashed_password, TRUE);
+		connector->hashed_password = NULL;
+	}
+
+	if (!username) return;
+
+	connector->username = g_string_new(username);
+	connector->hashed_password = g_string_new(NULL);
+
+	if (password && *password) {
+		network_mysqld_proto_password_hash(connector->hashed_password, password, strlen(password));
+	}
+}
+
+/**
+ * run a connection that has its plugin-hooks set in the event-thread
+ *
+ * the connection holds a reference on the connector, its con_cleanup has to release it
+ */
+void network_backend_connector_start(network_backend_connector *connector, network_mysqld_con *con, chassis_event_thread_t *event_thread) {
+	network_backend_connector_ref(connector);
+
+	network_mysqld_add_connection_to_thread(connector->chas, con, event_thread);
+
+	con->state = CON_STATE_CONNECT_SERVER;
+
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+/**
+ * connect to the backend, call it again from con_connect_server until it doesn't ask for a retry
+ *
+ * @return NETWORK_SOCKET_SUCCESS once connected, NETWORK_SOCKET_ERROR_RETRY while the connect() is pending
+ */
+network_socket_retval_t network_backend_connector_connect(network_mysqld_con *con, network_backend_t *backend) {
+	if (con->server) {
+		/* the 2nd round */
+		return network_socket_connect_finish(con->server);
+	}
+
+	con->server = network_socket_new();
+	network_address_copy(con->server->dst, network_backend_get_address(backend));
+
+	return network_socket_connect(con->server);
+}
+
+/**
+ * decode the handshake of the backend and remove it from the recv-queue
+ *
+ * @return the challenge, NULL if the backend sent a ERR packet or something we can't decode
+ */
+network_mysqld_auth_challenge *network_backend_connector_read_handshake(network_socket *sock) {
+	network_mysqld_auth_challenge *challenge;
+	network_packet packet;
+	guint8 status = 0;
+	int err = 0;
+
+	packet.data = g_queue_peek_tail(sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	challenge = network_mysqld_auth_challenge_new();
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+	err = err || (status == MYSQLD_PACKET_ERR); /* too many connections, host is blocked, ... */
+	err = err || network_mysqld_proto_get_auth_challenge(&packet, challenge);
+
+	network_queue_chunk_free(g_queue_pop_tail(sock->recv_queue->chunks));
+
+	if (err) {
+		network_mysqld_auth_challenge_free(challenge);
+
+		return NULL;
+	}
+
+	return challenge;
+}
+
+/**
+ * queue the auth-response of the configured user
+ *
+ * the socket takes over the challenge and keeps the response, the pool looks the connection up by its username
+ *
+ * @param capabilities added to the capabilities every connection asks for
+ */
+void network_backend_connector_send_auth(network_backend_connector *connector, network_socket *sock, network_mysqld_auth_challenge *challenge, guint32 capabilities) {
+	network_mysqld_auth_response *auth;
+	GString *auth_packet;
+
+	auth = network_mysqld_auth_response_new();
+	auth->capabilities    = CLIENT_LONG_PASSWORD |
+		CLIENT_LONG_FLAG |
+		CLIENT_PROTOCOL_41 |
+		CLIENT_TRANSACTIONS |
+		CLIENT_SECURE_CONNECTION |
+		capabilities;
+	auth->charset         = challenge->charset;
+	auth->max_packet_size = 16 * 1024 * 1024;
+
+	g_string_assign_len(auth->username, S(connector->username));
+	if (connector->hashed_password->len) {
+		network_mysqld_proto_password_scramble(auth->response, S(challenge->challenge), S(connector->hashed_password));
+	}
+
+	auth_packet = g_string_new(NULL);
+	network_mysqld_proto_append_auth_response(auth_packet, auth);
+
+	network_mysqld_queue_append(sock, sock->send_queue, S(auth_packet));
+
+	g_string_free(auth_packet, TRUE);
+
+	if (sock->challenge) network_mysqld_auth_challenge_free(sock->challenge);
+	if (sock->response) network_mysqld_auth_response_free(sock->response);
+
+	sock->challenge = challenge;
+	sock->response = auth;
+}
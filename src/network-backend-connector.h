@@ -0,0 +1,65 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+
+#ifndef _NETWORK_BACKEND_CONNECTOR_H_
+#define _NETWORK_BACKEND_CONNECTOR_H_
+
+#include <glib.h>
+
+#include "network-mysqld.h"
+#include "network-backend.h"
+#include "chassis-event-thread.h"
+
+#include "network-exports.h"
+
+/**
+ * opens connections to the backends that have no client
+ *
+ * the pool manager and the health checker open their own connections to the backends:
+ * they connect, answer the handshake with a configured user and run the rest of the
+ * protocol in their plugin-hooks.
+ *
+ * The connector is shared by the timers of its owner and the connections it opened, each of
+ * them holds a reference. The owner is freed with the last reference.
+ */
+typedef struct {
+	chassis *chas;
+
+	GString *username;         /**< the user the connections authenticate as, NULL if none is set */
+	GString *hashed_password;
+
+	volatile gint ref_count;   /**< one for the owner, one for each timer and open connection */
+
+	gpointer owner;
+	GDestroyNotify owner_free; /**< frees the owner with the last reference */
+} network_backend_connector;
+
+NETWORK_API network_backend_connector *network_backend_connector_new(chassis *chas, gpointer owner, GDestroyNotify owner_free);
+NETWORK_API void network_backend_connector_ref(network_backend_connector *connector);
+NETWORK_API void network_backend_connector_unref(network_backend_connector *connector);
+NETWORK_API void network_backend_connector_set_auth(network_backend_connector *connector, const gchar *username, const gchar *password);
+NETWORK_API void network_backend_connector_start(network_backend_connector *connector, network_mysqld_con *con, chassis_event_thread_t *event_thread);
+NETWORK_API network_socket_retval_t network_backend_connector_connect(network_mysqld_con *con, network_backend_t *backend);
+NETWORK_API network_mysqld_auth_challenge *network_backend_connector_read_handshake(network_socket *sock);
+NETWORK_API void network_backend_connector_send_auth(network_backend_connector *connector, network_socket *sock, network_mysqld_auth_challenge *challenge, guint32 capabilities);
+
+#endif
@@ -0,0 +1,650 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "glib-ext.h"
+
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-backend-health.h"
+#include "network-backend-connector.h"
+#include "chassis-event-thread.h"
+#include "chassis-gtimeval.h"
+#include "chassis-mainloop.h"
+#include "chassis-timings.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * the probes of a backend
+ *
+ * only used in the event-thread of the health checker
+ */
+typedef struct {
+	guint rise;              /**< successful probes in a row */
+	guint fall;              /**< failed probes in a row */
+	backend_state_t state;   /**< the state we left the backend in, the counters restart if someone else changed it */
+
+	gint check_at;           /**< second the next probe is due */
+	guint backoff;           /**< seconds between the probes of the DOWN backend, 0 if it isn't DOWN */
+
+	network_mysqld_con *con; /**< the running probe, NULL if there is none */
+	gint started_at;         /**< second the running probe was started */
+
+	gint auth_retry_at;      /**< the backend refused our user, second we authenticate again */
+	guint auth_backoff;      /**< seconds between the refused auths, 0 if the last one worked */
+
+	gint lag_retry_at;       /**< SHOW SLAVE STATUS failed, second we ask for the replication lag again */
+	guint lag_backoff;       /**< seconds between the SHOW SLAVE STATUS that failed, 0 if the last one worked */
+} network_backend_health_check;
+
+struct network_backends_health {
+	chassis *chas;
+	network_backends_t *backends;
+
+	guint interval;          /**< seconds between the probes of a backend that isn't DOWN */
+	guint max_backoff;       /**< max. seconds between the probes of a DOWN backend */
+	guint rise;              /**< successful probes in a row that mark a DOWN backend as UP */
+	guint fall;              /**< failed probes in a row that mark a backend as DOWN */
+
+	network_backend_connector *connector; /**< the timer and the running probes hold a ref on it */
+
+	GString *query;          /**< query to send after the auth, COM_PING if NULL */
+
+
+	GArray *checks;          /**< network_backend_health_check of each backend by its index */
+
+	struct event ev;
+	chassis_event_thread_t *event_thread;
+};
+
+/**
+ * the state of a probe connection
+ */
+typedef struct {
+	network_backends_health *health;
+	guint backend_ndx;
+
+	gboolean is_healthy;     /**< the probe got as far as we wanted */
+	gboolean is_lag_probe;   /**< the probe sent SHOW SLAVE STATUS */
+} network_backends_health_con;
+
+static gint network_backends_health_now(void) {
+	return chassis_get_rel_microseconds() / G_USEC_PER_SEC;
+}
+
+/**
+ * back off from a request that failed on a backend
+ *
+ * @param backoff the seconds of the last backoff, 0 if the request didn't fail before
+ * @return second to send the request again
+ */
+static gint network_backends_health_retry_at(guint *backoff) {
+	*backoff = *backoff ? MIN(*backoff * 2, NETWORK_BACKENDS_HEALTH_MAX_RETRY) : NETWORK_BACKENDS_HEALTH_MIN_RETRY;
+
+	return network_backends_health_now() + *backoff;
+}
+
+/**
+ * free the health checker once the connector released its last reference
+ */
+static void network_backends_health_release(gpointer _health) {
+	network_backends_health *health = _health;
+
+	if (health->query) g_string_free(health->query, TRUE);
+
+	g_array_free(health->checks, TRUE);
+
+	g_free(health);
+}
+
+network_backends_health *network_backends_health_new(chassis *chas, network_backends_t *backends) {
+	network_backends_health *health;
+
+	health = g_new0(network_backends_health, 1);
+	health->chas = chas;
+	health->backends = backends;
+	health->interval = 2;
+	health->max_backoff = 32;
+	health->rise = 2;
+	health->fall = 3;
+	health->checks = g_array_new(FALSE, TRUE, sizeof(network_backend_health_check));
+	health->connector = network_backend_connector_new(chas, health, network_backends_health_release);
+
+	return health;
+}
+
+/**
+ * release the health checker
+ *
+ * the timer and the running probes hold a reference of their own
+ */
+void network_backends_health_free(network_backends_health *health) {
+	if (!health) return;
+
+	network_backend_connector_unref(health->connector);
+}
+
+/**
+ * set the seconds between the probes
+ *
+ * @param interval    seconds between the probes of a backend that isn't DOWN
+ * @param max_backoff the probes of a DOWN backend back off from interval up to max_backoff seconds
+ */
+void network_backends_health_set_interval(network_backends_health *health, guint interval, guint max_backoff) {
+	health->interval = MAX(interval, 1);
+	health->max_backoff = MAX(max_backoff, health->interval);
+}
+
+/**
+ * set how many probes in a row decide about the state of a backend
+ */
+void network_backends_health_set_thresholds(network_backends_health *health, guint rise, guint fall) {
+	health->rise = MAX(rise, 1);
+	health->fall = MAX(fall, 1);
+}
+
+/**
+ * set the user the probes authenticate as
+ *
+ * @param username the username, NULL to only read the handshake
+ * @param password the password in plain-text, may be NULL
+ */
+void network_backends_health_set_auth(network_backends_health *health, const gchar *username, const gchar *password) {
+	network_backend_connector_set_auth(health->connector, username, password);
+}
+
+/**
+ * set the query the authenticated probes send
+ *
+ * @param query the query, NULL to send a COM_PING
+ */
+void network_backends_health_set_query(network_backends_health *health, const gchar *query) {
+	if (health->query) {
+		g_string_free(health->query, TRUE);
+		health->query = NULL;
+	}
+
+	if (query) health->query = g_string_new(query);
+}
+
+/**
+ * count the result of a probe and update the state of the backend
+ *
+ * @return seconds until the next probe of the backend
+ */
+guint network_backends_health_probe_done(network_backends_health *health, guint backend_ndx, gboolean is_healthy) {
+	network_backend_health_check *check;
+	network_backend_t *backend = network_backends_get(health->backends, backend_ndx);
+	gint now = network_backends_health_now();
+
+	/* the backend was added after the last run of the timer */
+	if (backend_ndx >= health->checks->len) {
+		g_array_set_size(health->checks, backend_ndx + 1);
+	}
+
+	check = &g_array_index(health->checks, network_backend_health_check, backend_ndx);
+	check->con = NULL;
+
+	/* the proxy marked it as DOWN or a script changed the state */
+	if (backend->state != check->state) {
+		check->rise = 0;
+		check->fall = 0;
+	}
+
+	if (is_healthy) {
+		check->rise++;
+		check->fall = 0;
+
+		if (backend->state == BACKEND_STATE_UNKNOWN ||
+		    (backend->state == BACKEND_STATE_DOWN && check->rise >= health->rise)) {
+			if (backend->state == BACKEND_STATE_DOWN) {
+				g_message("%s: backend %s is up again",
+						G_STRLOC,
+						network_backend_get_address(backend)->name->str);
+			}
+
+			backend->state = BACKEND_STATE_UP;
+			chassis_gtime_testset_now(&backend->state_since, NULL);
+		}
+	} else {
+		check->rise = 0;
+		check->fall++;
+
+		if (backend->state != BACKEND_STATE_DOWN && check->fall >= health->fall) {
+			g_message("%s: backend %s failed %u probes in a row, marking it as down",
+					G_STRLOC,
+					network_backend_get_address(backend)->name->str,
+					check->fall);
+
+			backend->state = BACKEND_STATE_DOWN;
+			chassis_gtime_testset_now(&backend->state_since, NULL);
+		}
+	}
+
+	if (backend->state == BACKEND_STATE_DOWN) {
+		check->backoff = check->backoff ? MIN(check->backoff * 2, health->max_backoff) : health->interval;
+
+		/* a DOWN backend that passes a probe is probed again soon to let it rise */
+		check->check_at = now + (is_healthy ? health->interval : check->backoff);
+	} else {
+		check->backoff = 0;
+		check->check_at = now + health->interval;
+	}
+
+	check->state = backend->state;
+
+	return check->check_at - now;
+}
+
+NETWORK_MYSQLD_PLUGIN_PROTO(health_connect_server) {
+	network_backends_health_con *st = con->plugin_con_state;
+	network_backend_t *backend = network_backends_get(st->health->backends, st->backend_ndx);
+
+	switch (network_backend_connector_connect(con, backend)) {
+	case NETWORK_SOCKET_SUCCESS:
+		con->state = CON_STATE_READ_HANDSHAKE;
+		break;
+	case NETWORK_SOCKET_ERROR_RETRY:
+		/* wait until the socket is writable */
+		return NETWORK_SOCKET_ERROR_RETRY;
+	default:
+		g_debug("%s: probing %s failed: %s",
+				G_STRLOC,
+				con->server->dst->name->str, g_strerror(errno));
+
+		con->state = CON_STATE_ERROR;
+		break;
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * the backend is alive if it sends a handshake, authenticate if we have a user
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(health_read_handshake) {
+	network_backends_health_con *st = con->plugin_con_state;
+	network_backends_health *health = st->health;
+	network_backend_health_check *check = &g_array_index(health->checks, network_backend_health_check, st->backend_ndx);
+	network_socket *recv_sock = con->server;
+	network_mysqld_auth_challenge *challenge;
+
+	challenge = network_backend_connector_read_handshake(recv_sock);
+	if (!challenge) {
+		g_debug("%s: %s didn't send a valid handshake",
+				G_STRLOC,
+				recv_sock->dst->name->str);
+
+		con->state = CON_STATE_ERROR;
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	if (NULL == health->connector->username ||
+	    (check->auth_backoff > 0 && network_backends_health_now() < check->auth_retry_at)) {
+		network_backend_t *backend = network_backends_get(health->backends, st->backend_ndx);
+
+		network_mysqld_auth_challenge_free(challenge);
+
+		/* without the auth we can't sample the lag, don't keep a old sample around */
+		g_atomic_int_set(&(backend->replication_lag), NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN);
+
+		st->is_healthy = TRUE;
+		con->state = CON_STATE_CLOSE_SERVER;
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	network_backend_connector_send_auth(health->connector, recv_sock, challenge, 0);
+
+	con->state = CON_STATE_SEND_AUTH;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * get the Seconds_Behind_Master from the result-set of SHOW SLAVE STATUS
+ *
+ * @param lag set to the lag, NETWORK_BACKEND_REPLICATION_STOPPED if it is NULL and
+ *            NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN if the backend isn't a slave
+ * @return 0 on success, -1 on a parse-error
+ */
+static int network_backends_health_get_replication_lag(GQueue *chunks, gint *lag) {
+	network_mysqld_proto_fielddefs_t *fields;
+	network_mysqld_lenenc_type lenenc_type;
+	network_packet packet;
+	GList *chunk;
+	guint lag_ndx, i;
+	int err = 0;
+
+	fields = network_mysqld_proto_fielddefs_new();
+	chunk = network_mysqld_proto_get_fielddefs(chunks->head, fields);
+	if (!chunk) {
+		network_mysqld_proto_fielddefs_free(fields);
+		return -1;
+	}
+
+	for (lag_ndx = 0; lag_ndx < fields->len; lag_ndx++) {
+		network_mysqld_proto_fielddef_t *field = fields->pdata[lag_ndx];
+
+		if (field->name && (0 == strcmp(field->name, "Seconds_Behind_Master") ||
+		                    0 == strcmp(field->name, "Seconds_Behind_Source"))) break;
+	}
+
+	if (lag_ndx == fields->len) {
+		network_mysqld_proto_fielddefs_free(fields);
+		return -1;
+	}
+
+	network_mysqld_proto_fielddefs_free(fields);
+
+	/* the row, a backend that isn't a slave sends none */
+	chunk = chunk->next;
+	if (!chunk) return -1;
+
+	packet.data = chunk->data;
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+	if (err) return -1;
+
+	if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_EOF) {
+		*lag = NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN;
+		return 0;
+	}
+
+	for (i = 0; !err && i < lag_ndx; i++) {
+		guint64 field_len;
+
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		if (!err && lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_NULL) {
+			err = err || network_mysqld_proto_skip(&packet, 1);
+		} else {
+			err = err || network_mysqld_proto_get_lenenc_int(&packet, &field_len);
+			err = err || network_mysqld_proto_skip(&packet, field_len);
+		}
+	}
+
+	err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+	if (err) return -1;
+
+	if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_NULL) {
+		*lag = NETWORK_BACKEND_REPLICATION_STOPPED;
+	} else {
+		GString *value = g_string_new(NULL);
+
+		err = err || network_mysqld_proto_get_lenenc_gstring(&packet, value);
+		if (!err) *lag = MIN(g_ascii_strtoull(value->str, NULL, 10), NETWORK_BACKEND_REPLICATION_STOPPED - 1);
+
+		g_string_free(value, TRUE);
+	}
+
+	return err ? -1 : 0;
+}
+
+/**
+ * send the COM_PING or the query, SHOW SLAVE STATUS to a RO backend
+ *
+ * a backend that refuses our user is still alive, we only read its handshakes until we retry the auth
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(health_read_auth_result) {
+	network_backends_health_con *st = con->plugin_con_state;
+	network_backends_health *health = st->health;
+	network_backend_health_check *check = &g_array_index(health->checks, network_backend_health_check, st->backend_ndx);
+	network_backend_t *backend = network_backends_get(health->backends, st->backend_ndx);
+	network_socket *recv_sock = con->server;
+
+	network_queue_chunk_free(g_queue_pop_tail(recv_sock->recv_queue->chunks));
+
+	if (con->auth_result_state != MYSQLD_PACKET_OK) {
+		/* wrong password, max_connections, a backend that is still starting up, ... */
+		check->auth_retry_at = network_backends_health_retry_at(&(check->auth_backoff));
+
+		if (check->auth_backoff == NETWORK_BACKENDS_HEALTH_MIN_RETRY) {
+			g_critical("%s: %s refused the health-checks of user '%s', only checking its handshake for %u seconds",
+					G_STRLOC,
+					recv_sock->dst->name->str,
+					health->connector->username->str,
+					check->auth_backoff);
+		}
+
+		g_atomic_int_set(&(backend->replication_lag), NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN);
+
+		st->is_healthy = TRUE;
+		con->state = CON_STATE_CLOSE_SERVER;
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	check->auth_backoff = 0;
+
+	network_mysqld_queue_reset(recv_sock);
+
+	if (backend->type == BACKEND_TYPE_RO &&
+	    (check->lag_backoff == 0 || network_backends_health_now() >= check->lag_retry_at)) {
+		/* it answers the ping too */
+		network_mysqld_queue_append(recv_sock, recv_sock->send_queue, C("\003SHOW SLAVE STATUS"));
+
+		st->is_lag_probe = TRUE;
+	} else if (health->query) {
+		GString *com_query = g_string_sized_new(health->query->len + 1);
+
+		g_string_append_c(com_query, COM_QUERY);
+		g_string_append_len(com_query, S(health->query));
+
+		network_mysqld_queue_append(recv_sock, recv_sock->send_queue, S(com_query));
+
+		g_string_free(com_query, TRUE);
+	} else {
+		network_mysqld_queue_append(recv_sock, recv_sock->send_queue, C("\016")); /* COM_PING */
+	}
+
+	con->state = CON_STATE_SEND_QUERY;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * the backend is healthy if the query didn't fail, a RO backend updates its replication lag
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(health_read_query_result) {
+	network_backends_health_con *st = con->plugin_con_state;
+	network_backends_health *health = st->health;
+	network_backend_health_check *check = &g_array_index(health->checks, network_backend_health_check, st->backend_ndx);
+	network_backend_t *backend = network_backends_get(health->backends, st->backend_ndx);
+	network_socket *recv_sock = con->server;
+	GQueue *chunks = recv_sock->recv_queue->chunks;
+	network_packet packet;
+	GString *chunk;
+	guint8 status;
+	int is_finished;
+	int err = 0;
+
+	packet.data = g_queue_peek_tail(chunks);
+	packet.offset = 0;
+
+	is_finished = network_mysqld_proto_get_query_result(&packet, con);
+	if (is_finished == -1) {
+		con->state = CON_STATE_ERROR;
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	if (is_finished == 0) return NETWORK_SOCKET_SUCCESS; /* wait for more */
+
+	packet.data = g_queue_peek_head(chunks);
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+
+	st->is_healthy = !err && status != MYSQLD_PACKET_ERR;
+
+	if (st->is_lag_probe) {
+		gint lag = NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN;
+
+		if (!err && status == MYSQLD_PACKET_ERR) {
+			/* most likely the REPLICATION CLIENT privilege is missing, the backend is alive anyway.
+			 * Its lag is unknown until the next SHOW SLAVE STATUS works */
+			check->lag_retry_at = network_backends_health_retry_at(&(check->lag_backoff));
+
+			if (check->lag_backoff == NETWORK_BACKENDS_HEALTH_MIN_RETRY) {
+				g_critical("%s: SHOW SLAVE STATUS failed on %s, its replication lag is unknown, asking again in %u seconds",
+						G_STRLOC,
+						recv_sock->dst->name->str,
+						check->lag_backoff);
+			}
+
+			st->is_healthy = TRUE;
+		} else if (st->is_healthy && 0 != network_backends_health_get_replication_lag(chunks, &lag)) {
+			g_debug("%s: can't decode the result of SHOW SLAVE STATUS of %s",
+					G_STRLOC,
+					recv_sock->dst->name->str);
+		} else if (st->is_healthy) {
+			check->lag_backoff = 0;
+		}
+
+		g_atomic_int_set(&(backend->replication_lag), lag);
+	}
+
+	while ((chunk = g_queue_pop_head(chunks))) network_queue_chunk_free(chunk);
+	recv_sock->recv_queue->len = 0;
+
+	con->state = CON_STATE_CLOSE_SERVER;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+NETWORK_MYSQLD_PLUGIN_PROTO(health_cleanup) {
+	network_backends_health_con *st = con->plugin_con_state;
+
+	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
+
+	network_backends_health_probe_done(st->health, st->backend_ndx, st->is_healthy);
+	network_backend_connector_unref(st->health->connector);
+
+	g_free(st);
+
+	con->plugin_con_state = NULL;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * open a probe connection to the backend in the event-thread of the health checker
+ */
+static void network_backends_health_probe(network_backends_health *health, guint backend_ndx) {
+	network_backend_health_check *check = &g_array_index(health->checks, network_backend_health_check, backend_ndx);
+	network_backends_health_con *st;
+	network_mysqld_con *con;
+
+	st = g_new0(network_backends_health_con, 1);
+	st->health = health;
+	st->backend_ndx = backend_ndx;
+
+	con = network_mysqld_con_new();
+	con->plugin_con_state = st;
+
+	con->plugins.con_connect_server    = health_connect_server;
+	con->plugins.con_read_handshake    = health_read_handshake;
+	con->plugins.con_read_auth_result  = health_read_auth_result;
+	con->plugins.con_read_query_result = health_read_query_result;
+	con->plugins.con_cleanup           = health_cleanup;
+
+	/* the probe may finish right away */
+	check->con = con;
+	check->started_at = network_backends_health_now();
+
+	network_backend_connector_start(health->connector, con, health->event_thread);
+}
+
+static void network_backends_health_timer_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_backends_health *health = user_data;
+	gint now;
+	guint i;
+
+	if (chassis_is_shutdown()) {
+		network_backend_connector_unref(health->connector);
+
+		return;
+	}
+
+	/* the backends are only added, the new ones are probed right away */
+	if (health->checks->len < network_backends_count(health->backends)) {
+		g_array_set_size(health->checks, network_backends_count(health->backends));
+	}
+
+	now = network_backends_health_now();
+
+	for (i = 0; i < health->checks->len; i++) {
+		network_backend_health_check *check = &g_array_index(health->checks, network_backend_health_check, i);
+		network_backend_t *backend = network_backends_get(health->backends, i);
+
+		if (check->con) {
+			if (now - check->started_at < NETWORK_BACKENDS_HEALTH_TIMEOUT) continue;
+
+			/* the backend doesn't answer: close the probe, the cleanup counts it as failed */
+			check->con->state = CON_STATE_ERROR;
+			network_mysqld_con_handle(-1, 0, check->con);
+		}
+
+		if (check->check_at > now) continue;
+		if (!network_backend_is_resolved(backend)) continue;
+
+		network_backends_health_probe(health, i);
+	}
+
+	evtimer_set(&(health->ev), network_backends_health_timer_handle, health);
+	chassis_event_add_to_thread(health->chas, health->event_thread, &(health->ev), NETWORK_BACKENDS_HEALTH_TICK);
+}
+
+/**
+ * start the timer of the health checker in the first event-thread
+ *
+ * @return 0 on success, -1 if there are no event-threads
+ */
+int network_backends_health_start(network_backends_health *health) {
+	chassis *chas = health->chas;
+
+	if (!chas->threads || chas->threads->event_threads->len == 0) {
+		g_critical("%s: the event-threads aren't setup yet", G_STRLOC);
+		return -1;
+	}
+
+	health->event_thread = chas->threads->event_threads->pdata[0];
+
+	/* the DOWN backends wait for the probes now */
+	health->backends->has_health_checker = TRUE;
+
+	network_backend_connector_ref(health->connector);
+
+	evtimer_set(&(health->ev), network_backends_health_timer_handle, health);
+	chassis_event_add_to_thread(chas, health->event_thread, &(health->ev), NETWORK_BACKENDS_HEALTH_TICK);
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_BACKEND_HEALTH_H_
+#define _NETWORK_BACKEND_HEALTH_H_
+
+#include <glib.h>
+
+#include "network-mysqld.h"
+#include "network-backend.h"
+
+#include "network-exports.h"
+
+/**
+ * seconds between two runs of the health checker
+ */
+#define NETWORK_BACKENDS_HEALTH_TICK 1
+
+/**
+ * seconds a probe may take before it counts as failed
+ */
+#define NETWORK_BACKENDS_HEALTH_TIMEOUT 5
+
+/**
+ * seconds until a backend that refused the user of the probes or failed SHOW SLAVE STATUS is
+ * asked again, doubled after each failure up to NETWORK_BACKENDS_HEALTH_MAX_RETRY
+ */
+#define NETWORK_BACKENDS_HEALTH_MIN_RETRY 30
+#define NETWORK_BACKENDS_HEALTH_MAX_RETRY 1800
+
+/**
+ * probes the backends in the background and marks them UP and DOWN
+ *
+ * A timer in the first event-thread opens a connection to each backend that is due and reads
+ * its handshake. With a username it also authenticates and sends a COM_PING or the
+ * configured query. A backend that refuses the user is only checked by its handshake until
+ * the auth is retried after a backoff. The clients never wait for a probe.
+ *
+ * The authenticated probes of a RO backend send a SHOW SLAVE STATUS instead and update its
+ * replication_lag. network_backends_choose() skips the RO backends that lag more than their
+ * max_replication_lag. If SHOW SLAVE STATUS fails on a backend, its lag is unknown and it is
+ * asked again after a backoff.
+ *
+ * - a backend is marked DOWN after fall failed probes in a row. The probes of a DOWN
+ *   backend back off exponentially from the interval up to max_backoff seconds.
+ * - a DOWN backend is marked UP again after rise successful probes in a row, a backend
+ *   in the UNKNOWN state after the first one
+ *
+ * A backend that the proxy marked as DOWN because a connect() of a client failed stays
+ * DOWN until the probes see it rise again. While the health checker runs
+ * network_backends_check() doesn't wake up the DOWN backends anymore.
+ */
+typedef struct network_backends_health network_backends_health;
+
+NETWORK_API network_backends_health *network_backends_health_new(chassis *chas, network_backends_t *backends);
+NETWORK_API void network_backends_health_free(network_backends_health *health);
+NETWORK_API void network_backends_health_set_interval(network_backends_health *health, guint interval, guint max_backoff);
+NETWORK_API void network_backends_health_set_thresholds(network_backends_health *health, guint rise, guint fall);
+NETWORK_API void network_backends_health_set_auth(network_backends_health *health, const gchar *username, const gchar *password);
+NETWORK_API void network_backends_health_set_query(network_backends_health *health, const gchar *query);
+NETWORK_API int network_backends_health_start(network_backends_health *health);
+NETWORK_API guint network_backends_health_probe_done(network_backends_health *health, guint backend_ndx, gboolean is_healthy);
+
+#endif
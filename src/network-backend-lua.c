@@ -17,6 +17,8 @@
  02110-1301  USA
 
  $%ENDLICENSE%$ */
+#include <math.h>
+
 #include <lua.h>
 
 #include "lua-env.h"
@@ -40,6 +42,13 @@
  *   address           => ip:port or unix-path of to the backend
  *   state             => int(BACKEND_STATE_UP|BACKEND_STATE_DOWN) 
  *   type              => int(BACKEND_TYPE_RW|BACKEND_TYPE_RO) 
+ *   weight            => share of the load, 0 for no new load
+ *   pending_queries   => queries waiting for their result
+ *   latency           => peak-EWMA of the query latency in microseconds
+ *   reset             => how connections from the pool are cleaned up: auto, reset-connection or change-user
+ *   replication_lag   => Seconds_Behind_Master of a RO backend, math.huge if the replication is stopped, nil if unknown
+ *   max_replication_lag => a RO backend that lags more seconds isn't chosen, 0 for no limit
+ *   is_lagging        => true if replication_lag is above max_replication_lag
  *
  * @return nil or requested information
  * @see backend_state_t backend_type_t
@@ -50,13 +59,35 @@ static int proxy_backend_get(lua_State *L) {
 	const char *key = luaL_checklstring(L, 2, &keysize);
 
 	if (strleq(key, keysize, C("connected_clients"))) {
-		lua_pushinteger(L, backend->connected_clients);
+		lua_pushinteger(L, g_atomic_int_get(&(backend->connected_clients)));
 	} else if (strleq(key, keysize, C("dst"))) {
-		network_address_lua_push(L, backend->addr);
+		network_address_lua_push(L, network_backend_get_address(backend));
 	} else if (strleq(key, keysize, C("state"))) {
 		lua_pushinteger(L, backend->state);
 	} else if (strleq(key, keysize, C("type"))) {
 		lua_pushinteger(L, backend->type);
+	} else if (strleq(key, keysize, C("weight"))) {
+		lua_pushinteger(L, backend->weight);
+	} else if (strleq(key, keysize, C("pending_queries"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(backend->pending_queries)));
+	} else if (strleq(key, keysize, C("latency"))) {
+		lua_pushinteger(L, network_backend_get_latency(backend));
+	} else if (strleq(key, keysize, C("reset"))) {
+		lua_pushstring(L, network_backend_get_reset_policy_name(backend));
+	} else if (strleq(key, keysize, C("replication_lag"))) {
+		gint lag = g_atomic_int_get(&(backend->replication_lag));
+
+		if (lag == NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN) {
+			lua_pushnil(L);
+		} else if (lag == NETWORK_BACKEND_REPLICATION_STOPPED) {
+			lua_pushnumber(L, HUGE_VAL);
+		} else {
+			lua_pushinteger(L, lag);
+		}
+	} else if (strleq(key, keysize, C("max_replication_lag"))) {
+		lua_pushinteger(L, backend->max_replication_lag);
+	} else if (strleq(key, keysize, C("is_lagging"))) {
+		lua_pushboolean(L, network_backend_is_lagging(backend));
 	} else if (strleq(key, keysize, C("uuid"))) {
 		if (backend->uuid->len) {
 			lua_pushlstring(L, S(backend->uuid));
@@ -86,6 +117,24 @@ static int proxy_backend_set(lua_State *L) {
 
 	if (strleq(key, keysize, C("state"))) {
 		backend->state = lua_tointeger(L, -1);
+	} else if (strleq(key, keysize, C("weight"))) {
+		lua_Integer weight = luaL_checkinteger(L, -1);
+
+		if (weight < 0) {
+			return luaL_error(L, "proxy.global.backends[...].%s has to be >= 0", key);
+		}
+		backend->weight = weight;
+	} else if (strleq(key, keysize, C("max_replication_lag"))) {
+		lua_Integer max_lag = luaL_checkinteger(L, -1);
+
+		if (max_lag < 0) {
+			return luaL_error(L, "proxy.global.backends[...].%s has to be >= 0", key);
+		}
+		backend->max_replication_lag = max_lag;
+	} else if (strleq(key, keysize, C("reset"))) {
+		if (0 != network_backend_set_reset_policy(backend, luaL_checkstring(L, -1))) {
+			return luaL_error(L, "proxy.global.backends[...].%s has to be auto, reset-connection or change-user", key);
+		}
 	} else if (strleq(key, keysize, C("uuid"))) {
 		if (lua_isstring(L, -1)) {
 			size_t s_len = 0;
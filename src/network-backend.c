@@ -23,12 +23,78 @@
 #include <glib.h>
 
 #include "network-backend.h"
+#include "chassis-event-thread.h"
 #include "chassis-plugin.h"
+#include "chassis-timings.h"
 #include "glib-ext.h"
 
 #define C(x) x, sizeof(x) - 1
 #define S(x) x->str, x->len
 
+#define BACKEND_TYPES (BACKEND_TYPE_RO + 1)
+
+/**
+ * number of random pairs network_backends_choose() looks at before
+ * it falls back to check all backends
+ */
+#define NETWORK_BACKENDS_CHOOSE_TRIES 4
+
+/**
+ * a new latency sample moves the EWMA by 1/2^NETWORK_BACKEND_LATENCY_DECAY_SHIFT
+ * of the difference if it is lower than the current EWMA
+ */
+#define NETWORK_BACKEND_LATENCY_DECAY_SHIFT 3
+
+struct network_backends_snapshot {
+	guint len;
+	network_backend_t **backends;   /**< the backends by their index */
+
+	guint type_len[BACKEND_TYPES];
+	guint *type_ndx[BACKEND_TYPES]; /**< the index of the backends of each type */
+};
+
+static network_backends_snapshot_t *network_backends_snapshot_new(GPtrArray *backends) {
+	network_backends_snapshot_t *snap;
+	guint i;
+
+	snap = g_new0(network_backends_snapshot_t, 1);
+	snap->len = backends->len;
+	snap->backends = g_new(network_backend_t *, backends->len + 1);
+
+	for (i = 0; i < BACKEND_TYPES; i++) {
+		snap->type_ndx[i] = g_new(guint, backends->len + 1);
+	}
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *backend = backends->pdata[i];
+
+		snap->backends[i] = backend;
+
+		if ((guint)backend->type < BACKEND_TYPES) {
+			snap->type_ndx[backend->type][snap->type_len[backend->type]++] = i;
+		}
+	}
+
+	return snap;
+}
+
+static void network_backends_snapshot_free(network_backends_snapshot_t *snap) {
+	guint i;
+
+	if (!snap) return;
+
+	for (i = 0; i < BACKEND_TYPES; i++) {
+		g_free(snap->type_ndx[i]);
+	}
+	g_free(snap->backends);
+
+	g_free(snap);
+}
+
+static network_backends_snapshot_t *network_backends_get_snapshot(network_backends_t *bs) {
+	return g_atomic_pointer_get(&(bs->snapshot));
+}
+
 /**
  * @deprecated: will be removed in 1.0
  * @see network_backend_new()
@@ -45,6 +111,9 @@ network_backend_t *network_backend_new() {
 	b->pool = network_connection_pool_new();
 	b->uuid = g_string_new(NULL);
 	b->addr = network_address_new();
+	b->weight = 1;
+	b->hostname = g_string_new(NULL);
+	b->replication_lag = NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN;
 
 	return b;
 }
@@ -64,10 +133,280 @@ void network_backend_free(network_backend_t *b) {
 
 	if (b->addr)     network_address_free(b->addr);
 	if (b->uuid)     g_string_free(b->uuid, TRUE);
+	if (b->hostname) g_string_free(b->hostname, TRUE);
+
+	g_slist_foreach(b->old_addrs, (GFunc)network_address_free, NULL);
+	g_slist_free(b->old_addrs);
 
 	g_free(b);
 }
 
+/**
+ * a query was sent to the backend
+ *
+ * @see network_backend_query_done()
+ */
+void network_backend_query_start(network_backend_t *b) {
+	g_atomic_int_inc(&(b->pending_queries));
+}
+
+/**
+ * the backend finished a query or the connection got closed while the query was pending
+ */
+void network_backend_query_done(network_backend_t *b) {
+	g_atomic_int_add(&(b->pending_queries), -1);
+}
+
+static gint network_backend_now(void) {
+	return chassis_get_rel_microseconds() / G_USEC_PER_SEC;
+}
+
+/**
+ * the latency EWMA, halved for each second without a new sample
+ *
+ * a backend that had a slow query and isn't picked anymore because of it 
+ * gets a chance again after some seconds
+ */
+static guint network_backend_get_latency_at(network_backend_t *b, gint now, gint latency_ewma) {
+	gint age = now - g_atomic_int_get(&(b->latency_updated));
+
+	if (age <= 0) return latency_ewma;
+	if (age >= 31) return 0;
+
+	return latency_ewma >> age;
+}
+
+guint network_backend_get_latency(network_backend_t *b) {
+	return network_backend_get_latency_at(b, network_backend_now(), g_atomic_int_get(&(b->latency_ewma)));
+}
+
+/**
+ * add a latency sample to the peak-EWMA of the backend
+ *
+ * a sample above the current EWMA replaces it right away, lower samples
+ * only move it slowly: a backend that gets slow (or is still warming up its
+ * caches) gets less load immediately and only gets it back over time.
+ */
+void network_backend_update_latency(network_backend_t *b, guint64 latency_usec) {
+	gint sample = MIN(latency_usec, G_MAXINT);
+	gint now = network_backend_now();
+	gint old_ewma, new_ewma;
+
+	do {
+		gint cur;
+
+		old_ewma = g_atomic_int_get(&(b->latency_ewma));
+		cur = network_backend_get_latency_at(b, now, old_ewma);
+
+		if (sample >= cur) {
+			new_ewma = sample;
+		} else {
+			new_ewma = cur - ((cur - sample) >> NETWORK_BACKEND_LATENCY_DECAY_SHIFT);
+		}
+	} while (!g_atomic_int_compare_and_exchange(&(b->latency_ewma), old_ewma, new_ewma));
+
+	g_atomic_int_set(&(b->latency_updated), now);
+}
+
+/**
+ * set the reset policy by its name
+ *
+ * - auto (default)
+ * - reset-connection
+ * - change-user
+ *
+ * @return 0 on success, -1 if the name is unknown
+ */
+int network_backend_set_reset_policy(network_backend_t *b, const gchar *policy) {
+	if (NULL == policy || 0 == strcmp(policy, "auto")) {
+		b->reset_policy = NETWORK_BACKEND_RESET_POLICY_AUTO;
+	} else if (0 == strcmp(policy, "reset-connection")) {
+		b->reset_policy = NETWORK_BACKEND_RESET_POLICY_RESET_CONNECTION;
+	} else if (0 == strcmp(policy, "change-user")) {
+		b->reset_policy = NETWORK_BACKEND_RESET_POLICY_CHANGE_USER;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+const gchar *network_backend_get_reset_policy_name(network_backend_t *b) {
+	switch (b->reset_policy) {
+	case NETWORK_BACKEND_RESET_POLICY_AUTO:
+		return "auto";
+	case NETWORK_BACKEND_RESET_POLICY_RESET_CONNECTION:
+		return "reset-connection";
+	case NETWORK_BACKEND_RESET_POLICY_CHANGE_USER:
+		return "change-user";
+	}
+
+	return NULL;
+}
+
+/**
+ * pick the cheapest way to hand the authed server connection from the pool to the client
+ *
+ * the client got the challenge of the server connection. If it sent the same username and
+ * scrambled password as the server connection was authed with, it knows the password and
+ * the connection only has to be cleaned up:
+ *
+ * - not at all, if the default-db and charset are the same and no session state was left
+ * - with COM_RESET_CONNECTION, if the server supports it (5.7.3 and later). It keeps the default-db.
+ *
+ * everything else needs a COM_CHANGE_USER which lets the server check the password
+ */
+network_backend_reset_t network_backend_get_reset(network_backend_t *b, network_socket *client, network_socket *server) {
+	if (b->reset_policy == NETWORK_BACKEND_RESET_POLICY_CHANGE_USER) return NETWORK_BACKEND_RESET_CHANGE_USER;
+
+	if (!server->response ||
+	    !g_string_equal(client->response->username, server->response->username) ||
+	    !g_string_equal(client->response->response, server->response->response) ||
+	    client->response->charset != server->response->charset ||
+	    !g_string_equal(client->default_db, server->default_db)) {
+		return NETWORK_BACKEND_RESET_CHANGE_USER;
+	}
+
+	if (b->reset_policy == NETWORK_BACKEND_RESET_POLICY_AUTO && !server->has_session_state) return NETWORK_BACKEND_RESET_NONE;
+
+	if (server->challenge && server->challenge->server_version >= 50703) return NETWORK_BACKEND_RESET_CONNECTION;
+
+	return NETWORK_BACKEND_RESET_CHANGE_USER;
+}
+
+/**
+ * the current address of the backend
+ *
+ * the resolver may replace it any time, the old address stays valid until the backend is freed
+ */
+network_address *network_backend_get_address(network_backend_t *b) {
+	return g_atomic_pointer_get((gpointer *)&(b->addr));
+}
+
+/**
+ * check if we know the address of the backend
+ *
+ * a hostname that is added at runtime is unresolved until the resolver looked it up
+ */
+gboolean network_backend_is_resolved(network_backend_t *b) {
+	return network_backend_get_address(b)->addr.common.sa_family != AF_UNSPEC;
+}
+
+/**
+ * check if a RO backend lags behind its master more than max_replication_lag seconds
+ *
+ * a backend with an unknown lag isn't lagging, a stopped replication always is
+ */
+gboolean network_backend_is_lagging(network_backend_t *b) {
+	gint lag = g_atomic_int_get(&(b->replication_lag));
+
+	if (b->type != BACKEND_TYPE_RO || b->max_replication_lag == 0) return FALSE;
+	if (lag == NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN) return FALSE;
+
+	return (guint)lag > b->max_replication_lag;
+}
+
+/**
+ * resolve the hostname of the backend and publish the new address if it moved
+ *
+ * called by the resolver, the only writer of b->addr, b->resolve_at and b->old_addrs
+ */
+static void network_backend_resolve(network_backends_t *bs, network_backend_t *b) {
+	network_address *old_addr = network_backend_get_address(b);
+	network_address *new_addr;
+
+	new_addr = network_address_new();
+
+	if (0 != network_address_set_address(new_addr, b->hostname->str)) {
+		network_address_free(new_addr);
+
+		b->resolve_at = network_backend_now() + NETWORK_BACKENDS_RESOLVE_RETRY;
+		return;
+	}
+
+	b->resolve_at = bs->resolve_interval ? network_backend_now() + bs->resolve_interval : G_MAXINT;
+
+	if (old_addr->len == new_addr->len &&
+	    0 == memcmp(&(old_addr->addr), &(new_addr->addr), new_addr->len)) {
+		network_address_free(new_addr);
+		return;
+	}
+
+	g_message("%s: backend %s resolves to %s now", G_STRLOC, b->hostname->str, new_addr->name->str);
+
+	b->old_addrs = g_slist_prepend(b->old_addrs, old_addr);
+	g_atomic_pointer_set((gpointer *)&(b->addr), new_addr);
+}
+
+/**
+ * the resolver thread
+ *
+ * looks up the hostnames of the backends with the blocking getaddrinfo() outside of the
+ * event-threads. It sleeps until the next hostname is due or network_backends_add() wakes
+ * it up and stops when it pops the backends themself.
+ */
+static gpointer network_backends_resolver_loop(gpointer _bs) {
+	network_backends_t *bs = _bs;
+	gint next_at = 0;
+
+	for (;;) {
+		GTimeVal wakeup;
+		gpointer item;
+		gint now;
+		guint i;
+
+		g_get_current_time(&wakeup);
+		now = network_backend_now();
+		wakeup.tv_sec += (next_at > now) ? MIN(next_at - now, NETWORK_BACKENDS_RESOLVE_INTERVAL) : 0;
+
+		if (next_at > now) {
+			item = g_async_queue_timed_pop(bs->resolve_queue, &wakeup);
+		} else {
+			item = g_async_queue_try_pop(bs->resolve_queue);
+		}
+
+		if (item == bs) break;
+
+		next_at = G_MAXINT;
+		for (i = 0; i < network_backends_count(bs); i++) {
+			network_backend_t *b = network_backends_get(bs, i);
+
+			if (b->hostname->len == 0) continue;
+
+			if (b->resolve_at <= network_backend_now()) network_backend_resolve(bs, b);
+
+			next_at = MIN(next_at, b->resolve_at);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * wake up the resolver and start it if it isn't running yet
+ *
+ * @return 0 on success, -1 if the thread couldn't be started
+ */
+static int network_backends_resolver_wakeup(network_backends_t *bs) {
+	GError *gerr = NULL;
+
+	g_mutex_lock(bs->backends_mutex);
+	if (NULL == bs->resolver) {
+		bs->resolver = g_thread_create(network_backends_resolver_loop, bs, TRUE, &gerr);
+	}
+	g_mutex_unlock(bs->backends_mutex);
+
+	if (gerr) {
+		g_critical("%s: starting the resolver failed: %s", G_STRLOC, gerr->message);
+		g_error_free(gerr);
+		return -1;
+	}
+
+	g_async_queue_push(bs->resolve_queue, bs->backends);
+
+	return 0;
+}
+
 network_backends_t *network_backends_new() {
 	network_backends_t *bs;
 
@@ -75,15 +414,26 @@ network_backends_t *network_backends_new() {
 
 	bs->backends = g_ptr_array_new();
 	bs->backends_mutex = g_mutex_new();
+	bs->wrr_mutex = g_mutex_new();
+	bs->snapshot = network_backends_snapshot_new(bs->backends);
+	bs->resolve_interval = NETWORK_BACKENDS_RESOLVE_INTERVAL;
+	bs->resolve_queue = g_async_queue_new();
 
 	return bs;
 }
 
 void network_backends_free(network_backends_t *bs) {
 	gsize i;
+	GSList *l;
 
 	if (!bs) return;
 
+	if (bs->resolver) {
+		g_async_queue_push(bs->resolve_queue, bs); /* stops the resolver */
+		g_thread_join(bs->resolver);
+	}
+	g_async_queue_unref(bs->resolve_queue);
+
 	g_mutex_lock(bs->backends_mutex);
 	for (i = 0; i < bs->backends->len; i++) {
 		network_backend_t *backend = bs->backends->pdata[i];
@@ -92,8 +442,15 @@ void network_backends_free(network_backends_t *bs) {
 	}
 	g_mutex_unlock(bs->backends_mutex);
 
+	for (l = bs->old_snapshots; l; l = l->next) {
+		network_backends_snapshot_free(l->data);
+	}
+	g_slist_free(bs->old_snapshots);
+	network_backends_snapshot_free(bs->snapshot);
+
 	g_ptr_array_free(bs->backends, TRUE);
 	g_mutex_free(bs->backends_mutex);
+	g_mutex_free(bs->wrr_mutex);
 
 	g_free(bs);
 }
@@ -104,12 +461,50 @@ void network_backends_free(network_backends_t *bs) {
  */
 int network_backends_add(network_backends_t *bs, /* const */ gchar *address, backend_type_t type) {
 	network_backend_t *new_backend;
+	gchar *weight_str;
+	gchar *addr_str;
 	guint i;
+	int ret;
 
 	new_backend = network_backend_new();
 	new_backend->type = type;
 
-	if (0 != network_address_set_address(new_backend->addr, address)) {
+	/* <address>@<weight> */
+	if (NULL != (weight_str = strrchr(address, '@'))) {
+		gchar *endptr = NULL;
+		guint64 weight;
+
+		weight = g_ascii_strtoull(weight_str + 1, &endptr, 10);
+		if (weight_str[1] == '\0' || *endptr != '\0' || weight > G_MAXINT) {
+			g_critical("%s: weight of backend %s has to be a number", G_STRLOC, address);
+			network_backend_free(new_backend);
+			return -1;
+		}
+		new_backend->weight = weight;
+
+		addr_str = g_strndup(address, weight_str - address);
+	} else {
+		addr_str = g_strdup(address);
+	}
+
+	if (!network_address_is_hostname(addr_str)) {
+		ret = network_address_set_address(new_backend->addr, addr_str);
+	} else if (NULL == chassis_event_thread_self()) {
+		/* at startup we can wait for the resolver, the resolver only re-resolves it */
+		g_string_assign(new_backend->hostname, addr_str);
+		new_backend->resolve_at = bs->resolve_interval ? network_backend_now() + bs->resolve_interval : G_MAXINT;
+
+		ret = network_address_set_address(new_backend->addr, addr_str);
+	} else {
+		/* don't block the event-thread, the backend is unusable until the resolver looked it up */
+		g_string_assign(new_backend->hostname, addr_str);
+		g_string_assign(new_backend->addr->name, addr_str);
+
+		ret = 0;
+	}
+	g_free(addr_str);
+
+	if (0 != ret) {
 		network_backend_free(new_backend);
 		return -1;
 	}
@@ -119,7 +514,8 @@ int network_backends_add(network_backends_t *bs, /* const */ gchar *address, bac
 	for (i = 0; i < bs->backends->len; i++) {
 		network_backend_t *old_backend = bs->backends->pdata[i];
 
-		if (strleq(S(old_backend->addr->name), S(new_backend->addr->name))) {
+		if ((new_backend->hostname->len && g_string_equal(old_backend->hostname, new_backend->hostname)) ||
+		    strleq(S(network_backend_get_address(old_backend)->name), S(new_backend->addr->name))) {
 			network_backend_free(new_backend);
 
 			g_mutex_unlock(bs->backends_mutex);
@@ -130,11 +526,17 @@ int network_backends_add(network_backends_t *bs, /* const */ gchar *address, bac
 
 
 	g_ptr_array_add(bs->backends, new_backend);
+
+	/* publish the new list, the readers may still use the old one */
+	bs->old_snapshots = g_slist_prepend(bs->old_snapshots, bs->snapshot);
+	g_atomic_pointer_set(&(bs->snapshot), network_backends_snapshot_new(bs->backends));
 	g_mutex_unlock(bs->backends_mutex);
 
 	g_message("added %s backend: %s", (type == BACKEND_TYPE_RW) ?
 			"read/write" : "read-only", address);
 
+	if (new_backend->hostname->len) return network_backends_resolver_wakeup(bs);
+
 	return 0;
 }
 
@@ -152,6 +554,9 @@ int network_backends_check(network_backends_t *bs) {
 	int backends_woken_up = 0;
 	gint64	t_diff;
 
+	/* the health checker marks the backends UP when they answer its probes */
+	if (bs->has_health_checker) return 0;
+
 	g_get_current_time(&now);
 	ge_gtimeval_diff(&bs->backend_last_check, &now, &t_diff);
 
@@ -181,7 +586,7 @@ int network_backends_check(network_backends_t *bs) {
 		if (now.tv_sec - cur->state_since.tv_sec > 4) {
 			g_debug("%s.%d: backend %s was down for more than 4 sec, waking it up", 
 					__FILE__, __LINE__,
-					cur->addr->name->str);
+					network_backend_get_address(cur)->name->str);
 
 			cur->state = BACKEND_STATE_UNKNOWN;
 			cur->state_since = now;
@@ -194,19 +599,203 @@ int network_backends_check(network_backends_t *bs) {
 }
 
 network_backend_t *network_backends_get(network_backends_t *bs, guint ndx) {
-	if (ndx >= network_backends_count(bs)) return NULL;
+	network_backends_snapshot_t *snap = network_backends_get_snapshot(bs);
+
+	if (ndx >= snap->len) return NULL;
 
 	/* FIXME: shouldn't we copy the backend or add ref-counting ? */	
-	return bs->backends->pdata[ndx];
+	return snap->backends[ndx];
 }
 
 guint network_backends_count(network_backends_t *bs) {
-	guint len;
+	return network_backends_get_snapshot(bs)->len;
+}
 
-	g_mutex_lock(bs->backends_mutex);
-	len = bs->backends->len;
-	g_mutex_unlock(bs->backends_mutex);
+/**
+ * a cheap per-thread random number (xorshift32)
+ *
+ * g_random_int() would serialize all threads on the lock of the global GRand
+ */
+static guint32 network_backends_random(void) {
+	static GStaticPrivate random_state = G_STATIC_PRIVATE_INIT;
+	guint32 *state;
+	guint32 x;
+
+	if (G_UNLIKELY(NULL == (state = g_static_private_get(&random_state)))) {
+		state = g_new(guint32, 1);
+		*state = g_random_int() | 1; /* the state must not be 0 */
+
+		g_static_private_set(&random_state, state, g_free);
+	}
+
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+/**
+ * set the balance policy by its name
+ *
+ * - sqf (default)
+ * - wrr
+ * - least-queries
+ * - ewma
+ *
+ * @return 0 on success, -1 if the name is unknown
+ */
+int network_backends_set_balance(network_backends_t *bs, const gchar *balance) {
+	if (NULL == balance || 0 == strcmp(balance, "sqf")) {
+		bs->balance = NETWORK_BACKENDS_BALANCE_SQF;
+	} else if (0 == strcmp(balance, "wrr")) {
+		bs->balance = NETWORK_BACKENDS_BALANCE_WRR;
+	} else if (0 == strcmp(balance, "least-queries")) {
+		bs->balance = NETWORK_BACKENDS_BALANCE_LEAST_QUERIES;
+	} else if (0 == strcmp(balance, "ewma")) {
+		bs->balance = NETWORK_BACKENDS_BALANCE_EWMA;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+static gboolean network_backend_is_usable(network_backend_t *backend) {
+	return backend->state != BACKEND_STATE_DOWN && backend->weight > 0 && network_backend_is_resolved(backend) &&
+		!network_backend_is_lagging(backend);
+}
+
+/**
+ * the load of a backend relative to its weight
+ */
+static gdouble network_backend_get_load(network_backend_t *backend, network_backends_balance_t balance, gint now) {
+	gdouble load;
+
+	switch (balance) {
+	case NETWORK_BACKENDS_BALANCE_LEAST_QUERIES:
+		load = g_atomic_int_get(&(backend->pending_queries));
+		break;
+	case NETWORK_BACKENDS_BALANCE_EWMA:
+		/* the expected time until a new query is done */
+		load = (gdouble)(network_backend_get_latency_at(backend, now, g_atomic_int_get(&(backend->latency_ewma))) + 1) * 
+			(g_atomic_int_get(&(backend->pending_queries)) + 1);
+		break;
+	default:
+		load = g_atomic_int_get(&(backend->connected_clients));
+		break;
+	}
+
+	return load / backend->weight;
+}
+
+/**
+ * the less loaded of the backend best_ndx and ndx
+ *
+ * @return best_ndx if backend ndx can't be used or has a higher load, ndx otherwise
+ */
+static gint network_backends_less_loaded(network_backends_t *bs, network_backends_snapshot_t *snap, gint best_ndx, guint ndx, gint now) {
+	network_backend_t *backend = snap->backends[ndx];
+
+	if (!network_backend_is_usable(backend)) return best_ndx;
+	if (best_ndx < 0) return ndx;
+
+	if (network_backend_get_load(backend, bs->balance, now) < 
+	    network_backend_get_load(snap->backends[best_ndx], bs->balance, now)) {
+		return ndx;
+	}
+
+	return best_ndx;
+}
+
+/**
+ * smooth weighted round-robin over the usable backends
+ *
+ * like nginx: each pick adds the weight of every usable backend to its current_weight,
+ * takes the backend with the highest current_weight and subtracts the total weight
+ * from it. The picks of a backend are spread out instead of coming in a burst
+ * (weights 5, 1, 1 give a a b a c a a, not a a a a a b c).
+ */
+static gint network_backends_choose_wrr(network_backends_t *bs, network_backends_snapshot_t *snap, backend_type_t type) {
+	guint *type_ndx = snap->type_ndx[type];
+	guint len = snap->type_len[type];
+	gint64 total_weight = 0;
+	gint best_ndx = -1;
+	guint i;
+
+	g_mutex_lock(bs->wrr_mutex);
+	for (i = 0; i < len; i++) {
+		network_backend_t *backend = snap->backends[type_ndx[i]];
+
+		if (!network_backend_is_usable(backend)) continue;
+
+		backend->current_weight += backend->weight;
+		total_weight += backend->weight;
+
+		if (best_ndx < 0 || backend->current_weight > snap->backends[best_ndx]->current_weight) {
+			best_ndx = type_ndx[i];
+		}
+	}
+
+	if (best_ndx >= 0) snap->backends[best_ndx]->current_weight -= total_weight;
+	g_mutex_unlock(bs->wrr_mutex);
+
+	return best_ndx;
+}
+
+/**
+ * choose a backend of the type that isn't down
+ *
+ * Unless the balance policy is NETWORK_BACKENDS_BALANCE_WRR, we take the less loaded 
+ * of two randomly picked backends (the "power of two choices"): it balances nearly as 
+ * good as checking all backends for the lowest load, costs the same for any number
+ * of backends and doesn't send the new connections of all threads to the same backend.
+ *
+ * If there are only 2 backends or the picked ones are down, all backends are checked.
+ *
+ * Backends with a weight of 0 and RO backends that lag too much are skipped.
+ *
+ * @param backend_ndx  set to the index of the backend if one is found
+ * @return the backend or NULL if all backends of the type are down
+ */
+network_backend_t *network_backends_choose(network_backends_t *bs, backend_type_t type, gint *backend_ndx) {
+	network_backends_snapshot_t *snap = network_backends_get_snapshot(bs);
+	guint *type_ndx;
+	guint len, i;
+	gint best_ndx = -1;
+	gint now;
+
+	if ((guint)type >= BACKEND_TYPES) return NULL;
+
+	len = snap->type_len[type];
+	type_ndx = snap->type_ndx[type];
+	now = (bs->balance == NETWORK_BACKENDS_BALANCE_EWMA) ? network_backend_now() : 0;
+
+	if (bs->balance == NETWORK_BACKENDS_BALANCE_WRR) {
+		best_ndx = network_backends_choose_wrr(bs, snap, type);
+	}
+
+	for (i = 0; bs->balance != NETWORK_BACKENDS_BALANCE_WRR && len > 2 && i < NETWORK_BACKENDS_CHOOSE_TRIES && best_ndx < 0; i++) {
+		guint a = network_backends_random() % len;
+		guint b = (a + 1 + network_backends_random() % (len - 1)) % len; /* never the same as a */
+
+		best_ndx = network_backends_less_loaded(bs, snap, best_ndx, type_ndx[a], now);
+		best_ndx = network_backends_less_loaded(bs, snap, best_ndx, type_ndx[b], now);
+	}
+
+	if (best_ndx < 0) {
+		/* few backends or most of them are down: check all of them */
+		for (i = 0; i < len; i++) {
+			best_ndx = network_backends_less_loaded(bs, snap, best_ndx, type_ndx[i], now);
+		}
+	}
+
+	if (best_ndx < 0) return NULL;
+
+	if (backend_ndx) *backend_ndx = best_ndx;
 
-	return len;
+	return snap->backends[best_ndx];
 }
 
@@ -43,8 +43,50 @@ typedef enum {
 	BACKEND_TYPE_RO
 } backend_type_t;
 
+/**
+ * how a connection from the connection pool is cleaned up before another client gets it
+ */
+typedef enum {
+	NETWORK_BACKEND_RESET_POLICY_AUTO,             /**< skip the reset if nothing changed, COM_RESET_CONNECTION if possible, COM_CHANGE_USER otherwise */
+	NETWORK_BACKEND_RESET_POLICY_RESET_CONNECTION, /**< always reset, COM_RESET_CONNECTION if possible */
+	NETWORK_BACKEND_RESET_POLICY_CHANGE_USER       /**< always COM_CHANGE_USER */
+} network_backend_reset_policy_t;
+
+/**
+ * the reset network_backend_get_reset() picked
+ */
+typedef enum {
+	NETWORK_BACKEND_RESET_NONE,        /**< the connection is authed as the client and has no session state */
+	NETWORK_BACKEND_RESET_CONNECTION,  /**< COM_RESET_CONNECTION */
+	NETWORK_BACKEND_RESET_CHANGE_USER  /**< COM_CHANGE_USER */
+} network_backend_reset_t;
+
+/**
+ * seconds until the hostname of a backend is resolved again
+ *
+ * getaddrinfo() doesn't tell us the TTL of the DNS record, we re-resolve at a fixed interval instead
+ */
+#define NETWORK_BACKENDS_RESOLVE_INTERVAL 60
+
+/**
+ * seconds until a failed resolve is retried
+ */
+#define NETWORK_BACKENDS_RESOLVE_RETRY 5
+
+/**
+ * the replication lag of a backend isn't known
+ *
+ * it isn't a slave, the lag wasn't sampled yet or we aren't allowed to sample it
+ */
+#define NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN (-1)
+
+/**
+ * the slave reports a Seconds_Behind_Master of NULL: the replication is stopped
+ */
+#define NETWORK_BACKEND_REPLICATION_STOPPED G_MAXINT
+
 typedef struct {
-	network_address *addr;
+	network_address *addr;   /**< replaced by the resolver if the hostname moves, use network_backend_get_address() */
    
 	backend_state_t state;   /**< UP or DOWN */
 	backend_type_t type;     /**< ReadWrite or ReadOnly */
@@ -53,9 +95,24 @@ typedef struct {
 
 	network_connection_pool *pool; /**< the pool of open connections */
 
-	guint connected_clients; /**< number of open connections to this backend for SQF */
+	volatile gint connected_clients; /**< number of open connections to this backend for SQF, updated atomically */
+
+	guint weight;            /**< share of the load relative to the other backends, 0 to take no new load */
+	gint64 current_weight;   /**< state of the smooth weighted round-robin, protected by the wrr_mutex of the backends */
+	volatile gint pending_queries; /**< queries sent to the backend that haven't finished yet */
+	volatile gint latency_ewma;    /**< peak-EWMA of the query latency in microseconds */
+	volatile gint latency_updated; /**< time of the last latency sample in seconds */
 
 	GString *uuid;           /**< the UUID of the backend */
+
+	network_backend_reset_policy_t reset_policy; /**< how connections from the pool are cleaned up */
+
+	GString *hostname;       /**< the address as configured if it has to be resolved, empty for IPs and unix-sockets */
+	gint resolve_at;         /**< second the hostname is resolved again, only used by the resolver */
+	GSList *old_addrs;       /**< the addresses the resolver replaced, a reader may still use them */
+
+	volatile gint replication_lag; /**< Seconds_Behind_Master of a RO backend as sampled by the health checker */
+	guint max_replication_lag;     /**< a RO backend that lags more seconds isn't chosen, 0 for no limit */
 } network_backend_t;
 
 typedef network_backend_t backend_t G_GNUC_DEPRECATED;
@@ -65,12 +122,59 @@ NETWORK_API void backend_free(network_backend_t *b) G_GNUC_DEPRECATED;
 
 NETWORK_API network_backend_t *network_backend_new();
 NETWORK_API void network_backend_free(network_backend_t *b);
-
+NETWORK_API void network_backend_query_start(network_backend_t *b);
+NETWORK_API void network_backend_query_done(network_backend_t *b);
+NETWORK_API void network_backend_update_latency(network_backend_t *b, guint64 latency_usec);
+NETWORK_API guint network_backend_get_latency(network_backend_t *b);
+NETWORK_API int network_backend_set_reset_policy(network_backend_t *b, const gchar *policy);
+NETWORK_API const gchar *network_backend_get_reset_policy_name(network_backend_t *b);
+NETWORK_API network_backend_reset_t network_backend_get_reset(network_backend_t *b, network_socket *client, network_socket *server);
+NETWORK_API network_address *network_backend_get_address(network_backend_t *b);
+NETWORK_API gboolean network_backend_is_resolved(network_backend_t *b);
+NETWORK_API gboolean network_backend_is_lagging(network_backend_t *b);
+
+/**
+ * how network_backends_choose() balances the load
+ */
+typedef enum {
+	NETWORK_BACKENDS_BALANCE_SQF,           /**< fewest connected clients (shortest queue first) */
+	NETWORK_BACKENDS_BALANCE_WRR,           /**< weighted round-robin */
+	NETWORK_BACKENDS_BALANCE_LEAST_QUERIES, /**< fewest pending queries */
+	NETWORK_BACKENDS_BALANCE_EWMA           /**< lowest peak-EWMA latency times pending queries */
+} network_backends_balance_t;
+
+/**
+ * an immutable copy of the list of backends
+ *
+ * @see network_backends_t
+ */
+typedef struct network_backends_snapshot network_backends_snapshot_t;
+
+/**
+ * the backends
+ *
+ * the backends are only added, never removed. Each network_backends_add()
+ * publishes a new snapshot of the backends which is read without taking
+ * the backends_mutex. The older snapshots are kept until the backends
+ * are freed as a reader may still use them.
+ */
 typedef struct {
-	GPtrArray *backends;
+	GPtrArray *backends;     /**< protected by the backends_mutex */
 	GMutex    *backends_mutex;
 	
 	GTimeVal backend_last_check;
+
+	gpointer snapshot;       /**< the current network_backends_snapshot_t, use g_atomic_pointer_get() */
+	GSList *old_snapshots;   /**< the snapshots that got replaced, protected by the backends_mutex */
+
+	network_backends_balance_t balance; /**< how to choose a backend */
+	GMutex *wrr_mutex;       /**< protects the current_weight of the backends */
+
+	guint resolve_interval;  /**< seconds until the hostnames are resolved again, 0 to resolve them only once */
+	GThread *resolver;       /**< resolves the hostnames of the backends, started with the first hostname */
+	GAsyncQueue *resolve_queue; /**< wakes up the resolver */
+
+	gboolean has_health_checker; /**< the DOWN backends are woken up by the probes of the health checker */
 } network_backends_t;
 
 NETWORK_API network_backends_t *network_backends_new();
@@ -79,6 +183,8 @@ NETWORK_API int network_backends_add(network_backends_t *backends, /* const */ g
 NETWORK_API int network_backends_check(network_backends_t *backends);
 NETWORK_API network_backend_t * network_backends_get(network_backends_t *backends, guint ndx);
 NETWORK_API guint network_backends_count(network_backends_t *backends);
+NETWORK_API int network_backends_set_balance(network_backends_t *backends, const gchar *balance);
+NETWORK_API network_backend_t *network_backends_choose(network_backends_t *backends, backend_type_t type, gint *backend_ndx);
 
 #endif /* _BACKEND_H_ */
 
@@ -63,12 +63,12 @@
  * @return nil or requested information
  */
 static int proxy_pool_queue_get(lua_State *L) {
-	GQueue *queue = *(GQueue **)luaL_checkself(L); 
+	guint idle_connections = *(guint *)luaL_checkself(L); 
 	gsize keysize = 0;
 	const char *key = luaL_checklstring(L, 2, &keysize);
 
 	if (strleq(key, keysize, C("cur_idle_connections"))) {
-		lua_pushinteger(L, queue ? queue->length : 0);
+		lua_pushinteger(L, idle_connections);
 	} else {
 		lua_pushnil(L);
 	}
@@ -95,10 +95,11 @@ static int proxy_pool_users_get(lua_State *L) {
 	network_connection_pool *pool = *(network_connection_pool **)luaL_checkself(L); 
 	const char *key = luaL_checkstring(L, 2); /** the username */
 	GString *s = g_string_new(key);
-	GQueue **q_p = NULL;
+	guint *idle_p = NULL;
 
-	q_p = lua_newuserdata(L, sizeof(*q_p)); 
-	*q_p = network_connection_pool_get_conns(pool, s, NULL);
+	/* the connections of the user are spread over the shards of the event-threads */
+	idle_p = lua_newuserdata(L, sizeof(*idle_p)); 
+	*idle_p = network_connection_pool_get_idle_count(pool, s);
 	g_string_free(s, TRUE);
 
 	network_connection_pool_queue_getmetatable(L);
@@ -125,6 +126,30 @@ static int proxy_pool_get(lua_State *L) {
 		lua_pushinteger(L, pool->max_idle_connections);
 	} else if (strleq(key, keysize, C("min_idle_connections"))) {
 		lua_pushinteger(L, pool->min_idle_connections);
+	} else if (strleq(key, keysize, C("cur_idle_connections"))) {
+		lua_pushinteger(L, network_connection_pool_get_idle_count(pool, NULL));
+	} else if (strleq(key, keysize, C("warming_connections"))) {
+		lua_pushinteger(L, network_connection_pool_get_warming_count(pool));
+	} else if (strleq(key, keysize, C("warmed_connections"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(pool->warmed_connections)));
+	} else if (strleq(key, keysize, C("trimmed_connections"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(pool->trimmed_connections)));
+	} else if (strleq(key, keysize, C("stolen_connections"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(pool->stolen_connections)));
+	} else if (strleq(key, keysize, C("pinged_connections"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(pool->pinged_connections)));
+	} else if (strleq(key, keysize, C("expired_connections"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(pool->expired_connections)));
+	} else if (strleq(key, keysize, C("skipped_resets"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(pool->skipped_resets)));
+	} else if (strleq(key, keysize, C("connection_resets"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(pool->connection_resets)));
+	} else if (strleq(key, keysize, C("change_user_resets"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(pool->change_user_resets)));
+	} else if (strleq(key, keysize, C("wait_timeout"))) {
+		lua_pushinteger(L, pool->wait_timeout);
+	} else if (strleq(key, keysize, C("max_lifetime"))) {
+		lua_pushinteger(L, pool->max_lifetime);
 	} else if (strleq(key, keysize, C("users"))) {
 		network_connection_pool **pool_p;
 
@@ -150,6 +175,16 @@ static int proxy_pool_set(lua_State *L) {
 		pool->max_idle_connections = lua_tointeger(L, -1);
 	} else if (strleq(key, keysize, C("min_idle_connections"))) {
 		pool->min_idle_connections = lua_tointeger(L, -1);
+	} else if (strleq(key, keysize, C("wait_timeout"))) {
+		if (lua_tointeger(L, -1) <= 0) {
+			return luaL_error(L, "proxy.backend[...].%s has to be > 0", key);
+		}
+		pool->wait_timeout = lua_tointeger(L, -1);
+	} else if (strleq(key, keysize, C("max_lifetime"))) {
+		if (lua_tointeger(L, -1) < 0) {
+			return luaL_error(L, "proxy.backend[...].%s has to be >= 0", key);
+		}
+		pool->max_lifetime = lua_tointeger(L, -1);
 	} else {
 		return luaL_error(L, "proxy.backend[...].%s is not writable", key);
 	}
@@ -167,11 +202,41 @@ int network_connection_pool_getmetatable(lua_State *L) {
 	return proxy_getmetatable(L, methods);
 }
 
+/**
+ * read the answer to the COM_PING of a idling connection
+ *
+ * @return 0 if the OK packet was read, 1 if we have to wait for more, -1 on error
+ */
+static int network_mysqld_con_idle_read_pong(int event_fd, int avail) {
+	unsigned char header[NET_HEADER_SIZE];
+	unsigned char packet[NET_HEADER_SIZE + 64];
+	int packet_len;
+
+	if (avail < NET_HEADER_SIZE) return 1;
+
+	if (NET_HEADER_SIZE != recv(event_fd, (void *)header, NET_HEADER_SIZE, MSG_PEEK)) return -1;
+
+	packet_len = NET_HEADER_SIZE + (header[0] | (header[1] << 8) | (header[2] << 16));
+
+	/* a OK packet is small */
+	if (packet_len > (int)sizeof(packet)) return -1;
+	if (avail < packet_len) return 1;
+
+	if (packet_len != recv(event_fd, (void *)packet, packet_len, 0)) return -1;
+
+	if (packet_len == NET_HEADER_SIZE || packet[NET_HEADER_SIZE] != MYSQLD_PACKET_OK) return -1;
+
+	return (avail == packet_len) ? 0 : -1;
+}
+
 /**
  * handle the events of a idling server connection in the pool 
  *
  * make sure we know about connection close from the server side
  * - wait_timeout
+ *
+ * and put the connection back into the pool when it answered the COM_PING
+ * of network_connection_pool_expire()
  */
 static void network_mysqld_con_idle_handle(int event_fd, short events, void *user_data) {
 	network_connection_pool_entry *pool_entry = user_data;
@@ -186,6 +251,23 @@ static void network_mysqld_con_idle_handle(int event_fd, short events, void *use
 		 */
 		if (ioctlsocket(event_fd, FIONREAD, &b)) {
 			g_critical("network_mysqld_con_idle_handle: ioctl(%d, FIONREAD, ...) failed: %s", event_fd, g_strerror(errno));
+		} else if (b != 0 && pool_entry->is_pinging) {
+			network_socket *sock = pool_entry->sock;
+
+			switch (network_mysqld_con_idle_read_pong(event_fd, b)) {
+			case 0:
+				network_connection_pool_pong(pool, pool_entry);
+				/* fall through: watch the idling connection again */
+			case 1:
+				event_set(&(sock->event), sock->fd, EV_READ, network_mysqld_con_idle_handle, pool_entry);
+				chassis_event_add_local(NULL, &(sock->event));
+				break;
+			default:
+				g_message("%s: the answer to COM_PING on fd %d is broken, closing the connection", G_STRLOC, event_fd);
+
+				network_connection_pool_remove(pool, pool_entry);
+				break;
+			}
 		} else if (b != 0) {
 			g_critical("network_mysqld_con_idle_handle: ioctl(%d, FIONREAD, ...) said there is something to read, oops: %d", event_fd, b);
 		} else {
@@ -198,13 +280,27 @@ static void network_mysqld_con_idle_handle(int event_fd, short events, void *use
 	}
 }
 
+/**
+ * add a authed server connection to the pool and watch it while it is idling
+ *
+ * the idle-handler is added to the event-base of the calling thread
+ */
+network_connection_pool_entry *network_connection_pool_lua_add_socket(chassis *srv, network_connection_pool *pool, network_socket *sock) {
+	network_connection_pool_entry *pool_entry;
+
+	pool_entry = network_connection_pool_add(pool, sock);
+
+	event_set(&(sock->event), sock->fd, EV_READ, network_mysqld_con_idle_handle, pool_entry);
+	chassis_event_add_local(srv, &(sock->event)); /* add a event, but stay in the same thread */
+
+	return pool_entry;
+}
 
 /**
  * move the con->server into connection pool and disconnect the 
  * proxy from its backend 
  */
 int network_connection_pool_lua_add_connection(network_mysqld_con *con) {
-	network_connection_pool_entry *pool_entry = NULL;
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 
 	/* con-server is already disconnected, got out */
@@ -214,12 +310,9 @@ int network_connection_pool_lua_add_connection(network_mysqld_con *con) {
 	con->server->is_authed = 1;
 
 	/* insert the server socket into the connection pool */
-	pool_entry = network_connection_pool_add(st->backend->pool, con->server);
-
-	event_set(&(con->server->event), con->server->fd, EV_READ, network_mysqld_con_idle_handle, pool_entry);
-	chassis_event_add_local(con->srv, &(con->server->event)); /* add a event, but stay in the same thread */
+	network_connection_pool_lua_add_socket(con->srv, st->backend->pool, con->server);
 	
-	st->backend->connected_clients--;
+	g_atomic_int_add(&(st->backend->connected_clients), -1);
 	st->backend = NULL;
 	st->backend_ndx = -1;
 	
@@ -280,7 +373,7 @@ network_socket *network_connection_pool_lua_swap(network_mysqld_con *con, int ba
 
 	/* connect to the new backend */
 	st->backend = backend;
-	st->backend->connected_clients++;
+	g_atomic_int_inc(&(st->backend->connected_clients));
 	st->backend_ndx = backend_ndx;
 
 	return send_sock;
@@ -24,11 +24,13 @@
 
 #include "network-socket.h"
 #include "network-mysqld.h"
+#include "network-conn-pool.h"
 
 #include "network-exports.h"
 
 NETWORK_API int network_connection_pool_getmetatable(lua_State *L);
 
+NETWORK_API network_connection_pool_entry *network_connection_pool_lua_add_socket(chassis *srv, network_connection_pool *pool, network_socket *sock);
 NETWORK_API int network_connection_pool_lua_add_connection(network_mysqld_con *con);
 NETWORK_API network_socket *network_connection_pool_lua_swap(network_mysqld_con *con, int backend_ndx);
 
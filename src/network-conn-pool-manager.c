@@ -0,0 +1,477 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "glib-ext.h"
+#include "string-len.h"
+
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-conn-pool.h"
+#include "network-conn-pool-lua.h"
+#include "network-conn-pool-manager.h"
+#include "network-backend-connector.h"
+#include "chassis-event-thread.h"
+#include "chassis-gtimeval.h"
+#include "chassis-mainloop.h"
+#include "chassis-timings.h"
+
+struct network_connection_pool_manager {
+	chassis *chas;
+	network_backends_t *backends;
+
+	network_backend_connector *connector; /**< the timers and the connections hold a ref on it */
+};
+
+/**
+ * the timer of the pool manager in a event-thread
+ */
+typedef struct {
+	struct event ev;
+
+	network_connection_pool_manager *manager;
+	chassis_event_thread_t *event_thread;
+
+	glong last_run;           /**< second of the last run, the timer-wheels of the pools are handled up to here */
+} network_connection_pool_manager_timer;
+
+/**
+ * the state of a connection the pool manager opens
+ */
+typedef struct {
+	network_connection_pool_manager *manager;
+	network_backend_t *backend;
+	network_connection_pool_shard *shard; /**< the shard of the event-thread the connection is opened for */
+} network_connection_pool_manager_con;
+
+network_connection_pool_manager *network_connection_pool_manager_new(chassis *chas, network_backends_t *backends) {
+	network_connection_pool_manager *manager;
+
+	manager = g_new0(network_connection_pool_manager, 1);
+	manager->chas = chas;
+	manager->backends = backends;
+	manager->connector = network_backend_connector_new(chas, manager, g_free);
+
+	return manager;
+}
+
+/**
+ * release the manager
+ *
+ * the timers of the event-threads and the connections that are being opened hold a
+ * reference of their own. The timers release it at their next run after the shutdown
+ * was triggered.
+ */
+void network_connection_pool_manager_free(network_connection_pool_manager *manager) {
+	if (!manager) return;
+
+	network_backend_connector_unref(manager->connector);
+}
+
+/**
+ * set the user the idling connections are opened for
+ *
+ * @param username the username, NULL to disable the opening of connections
+ * @param password the password in plain-text, may be NULL
+ */
+void network_connection_pool_manager_set_auth(network_connection_pool_manager *manager, const gchar *username, const gchar *password) {
+	network_backend_connector_set_auth(manager->connector, username, password);
+}
+
+static network_connection_pool_manager_con *network_connection_pool_manager_con_new(network_connection_pool_manager *manager, network_backend_t *backend, network_connection_pool_shard *shard) {
+	network_connection_pool_manager_con *st;
+
+	st = g_new0(network_connection_pool_manager_con, 1);
+	st->manager = manager;
+	st->backend = backend;
+	st->shard = shard;
+
+	return st;
+}
+
+static void network_connection_pool_manager_con_free(network_connection_pool_manager_con *st) {
+	if (!st) return;
+
+	g_free(st);
+}
+
+static gint network_connection_pool_manager_now(void) {
+	return chassis_get_rel_microseconds() / G_USEC_PER_SEC;
+}
+
+/**
+ * stop opening connections to the backend of the pool for a while
+ *
+ * all connections that are opened in parallel fail together, only the first one backs off further
+ *
+ * @return TRUE if the backoff was raised, FALSE if another connection did it already
+ */
+static gboolean network_connection_pool_manager_backoff(network_connection_pool *pool) {
+	gint now = network_connection_pool_manager_now();
+	gint retry_at = g_atomic_int_get(&(pool->warmup_retry_at));
+	gint backoff;
+
+	if (retry_at > now) return FALSE;
+
+	backoff = g_atomic_int_get(&(pool->warmup_backoff));
+	backoff = backoff ? MIN(backoff * 2, NETWORK_CONNECTION_POOL_MANAGER_MAX_RETRY) : NETWORK_CONNECTION_POOL_MANAGER_MIN_RETRY;
+
+	if (!g_atomic_int_compare_and_exchange(&(pool->warmup_retry_at), retry_at, now + backoff)) return FALSE;
+
+	g_atomic_int_set(&(pool->warmup_backoff), backoff);
+
+	return TRUE;
+}
+
+/**
+ * check if the pool manager backs off from the backend of the pool
+ */
+static gboolean network_connection_pool_manager_is_backing_off(network_connection_pool *pool) {
+	return g_atomic_int_get(&(pool->warmup_backoff)) > 0 &&
+		g_atomic_int_get(&(pool->warmup_retry_at)) > network_connection_pool_manager_now();
+}
+
+/**
+ * connect to the backend
+ *
+ * a failed connect marks the backend as DOWN, like the proxy does
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(pool_manager_connect_server) {
+	network_connection_pool_manager_con *st = con->plugin_con_state;
+
+	switch (network_backend_connector_connect(con, st->backend)) {
+	case NETWORK_SOCKET_SUCCESS:
+		if (st->backend->state != BACKEND_STATE_UP) {
+			st->backend->state = BACKEND_STATE_UP;
+			chassis_gtime_testset_now(&st->backend->state_since, NULL);
+		}
+
+		con->state = CON_STATE_READ_HANDSHAKE;
+		break;
+	case NETWORK_SOCKET_ERROR_RETRY:
+		/* wait until the socket is writable */
+		return NETWORK_SOCKET_ERROR_RETRY;
+	default:
+		g_message("%s: connect(%s) failed: %s. Marking the backend as down.",
+				G_STRLOC,
+				con->server->dst->name->str, g_strerror(errno));
+
+		st->backend->state = BACKEND_STATE_DOWN;
+		chassis_gtime_testset_now(&st->backend->state_since, NULL);
+
+		/* there is no client to send a error to, just close the connection */
+		con->state = CON_STATE_ERROR;
+		break;
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * answer the handshake of the backend with the configured user
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(pool_manager_read_handshake) {
+	network_connection_pool_manager_con *st = con->plugin_con_state;
+	network_socket *recv_sock = con->server;
+	network_mysqld_auth_challenge *challenge;
+
+	challenge = network_backend_connector_read_handshake(recv_sock);
+	if (!challenge) {
+		g_critical("%s: decoding the handshake of %s failed",
+				G_STRLOC,
+				recv_sock->dst->name->str);
+
+		con->state = CON_STATE_ERROR;
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	/* the challenge is sent to the clients that get this connection from the pool,
+	 * we can't handle compression and SSL */
+	challenge->capabilities &= ~(CLIENT_COMPRESS);
+	challenge->capabilities &= ~(CLIENT_SSL);
+
+	network_backend_connector_send_auth(st->manager->connector, recv_sock, challenge, CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS);
+
+	con->state = CON_STATE_SEND_AUTH;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * ask the backend for its wait_timeout once we are authed
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(pool_manager_read_auth_result) {
+	network_connection_pool_manager_con *st = con->plugin_con_state;
+	network_socket *recv_sock = con->server;
+
+	switch (con->auth_result_state) {
+	case MYSQLD_PACKET_OK:
+		network_queue_chunk_free(g_queue_pop_tail(recv_sock->recv_queue->chunks));
+
+		recv_sock->is_authed = 1;
+
+		g_atomic_int_set(&(st->backend->pool->warmup_backoff), 0);
+
+		/* the idling connections are pinged before they hit the wait_timeout */
+		network_mysqld_queue_reset(recv_sock);
+		network_mysqld_queue_append(recv_sock, recv_sock->send_queue, C("\003SELECT @@wait_timeout"));
+
+		con->state = CON_STATE_SEND_QUERY;
+		break;
+	case MYSQLD_PACKET_ERR:
+		/* wrong user or password, max_connections, a backend that is still starting up, ... */
+		if (network_connection_pool_manager_backoff(st->backend->pool)) {
+			g_critical("%s: %s refused the connections of the pool manager for user '%s', trying again in %d seconds",
+					G_STRLOC,
+					recv_sock->dst->name->str,
+					st->manager->connector->username->str,
+					g_atomic_int_get(&(st->backend->pool->warmup_backoff)));
+		}
+
+		con->state = CON_STATE_ERROR;
+		break;
+	case MYSQLD_PACKET_EOF:
+	default:
+		/* the backend asks for the old password hash */
+		if (network_connection_pool_manager_backoff(st->backend->pool)) {
+			g_critical("%s: %s asked for the pre-4.1 auth which isn't supported by the pool manager",
+					G_STRLOC,
+					recv_sock->dst->name->str);
+		}
+
+		con->state = CON_STATE_ERROR;
+		break;
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * learn the wait_timeout of the backend and move the connection into its pool
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(pool_manager_read_query_result) {
+	network_connection_pool_manager_con *st = con->plugin_con_state;
+	network_socket *recv_sock = con->server;
+	GQueue *chunks = recv_sock->recv_queue->chunks;
+	network_packet packet;
+	GString *chunk;
+	guint8 status;
+	int is_finished;
+	int err = 0;
+
+	packet.data = g_queue_peek_tail(chunks);
+	packet.offset = 0;
+
+	is_finished = network_mysqld_proto_get_query_result(&packet, con);
+	if (is_finished == -1) {
+		con->state = CON_STATE_ERROR;
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	if (is_finished == 0) return NETWORK_SOCKET_SUCCESS; /* wait for more */
+
+	packet.data = g_queue_peek_head(chunks);
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+
+	if (!err && status != MYSQLD_PACKET_ERR && chunks->length > 3) {
+		/* field-count, field-def, EOF, row */
+		GString *value = g_string_new(NULL);
+		guint64 wait_timeout;
+
+		packet.data = g_queue_peek_nth(chunks, 3);
+		packet.offset = 0;
+
+		err = err || network_mysqld_proto_skip_network_header(&packet);
+		err = err || network_mysqld_proto_get_lenenc_gstring(&packet, value);
+
+		if (!err && (wait_timeout = g_ascii_strtoull(value->str, NULL, 10)) > 0) {
+			st->backend->pool->wait_timeout = MIN(wait_timeout, G_MAXUINT);
+		}
+
+		g_string_free(value, TRUE);
+	} else {
+		g_message("%s: SELECT @@wait_timeout failed on %s, assuming %u seconds",
+				G_STRLOC,
+				recv_sock->dst->name->str,
+				st->backend->pool->wait_timeout);
+	}
+
+	while ((chunk = g_queue_pop_head(chunks))) network_queue_chunk_free(chunk);
+	recv_sock->recv_queue->len = 0;
+
+	network_mysqld_queue_reset(recv_sock);
+
+	/* the connection has no default-db, it only serves the clients of the pool user that don't ask for one */
+	network_connection_pool_lua_add_socket(con->srv, st->backend->pool, recv_sock);
+	con->server = NULL;
+
+	g_atomic_int_inc(&(st->backend->pool->warmed_connections));
+
+	con->state = CON_STATE_CLOSE_SERVER;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+NETWORK_MYSQLD_PLUGIN_PROTO(pool_manager_cleanup) {
+	network_connection_pool_manager_con *st = con->plugin_con_state;
+
+	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
+
+	g_atomic_int_add(&(st->shard->warming_connections), -1);
+
+	network_backend_connector_unref(st->manager->connector);
+
+	network_connection_pool_manager_con_free(st);
+
+	con->plugin_con_state = NULL;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * open a connection to the backend in the event-thread of the timer
+ *
+ * the connection is added to the pool by the event-thread and ends up in its shard
+ */
+static void network_connection_pool_manager_connect(network_connection_pool_manager_timer *timer, network_backend_t *backend, network_connection_pool_shard *shard) {
+	network_connection_pool_manager *manager = timer->manager;
+	network_mysqld_con *con;
+
+	con = network_mysqld_con_new();
+	con->plugin_con_state = network_connection_pool_manager_con_new(manager, backend, shard);
+
+	con->plugins.con_connect_server    = pool_manager_connect_server;
+	con->plugins.con_read_handshake    = pool_manager_read_handshake;
+	con->plugins.con_read_auth_result  = pool_manager_read_auth_result;
+	con->plugins.con_read_query_result = pool_manager_read_query_result;
+	con->plugins.con_cleanup           = pool_manager_cleanup;
+
+	network_backend_connector_start(manager->connector, con, timer->event_thread);
+}
+
+/**
+ * reserve up to NETWORK_CONNECTION_POOL_MANAGER_MAX_CONNECTS connections to open for the shard
+ *
+ * the connections that are opened by other event-threads sharing the shard are counted
+ * as idling already to not overshoot min_idle_connections.
+ */
+static guint network_connection_pool_manager_reserve(network_connection_pool_manager *manager, network_connection_pool_shard *shard) {
+	network_connection_pool *pool = shard->pool;
+	guint idle;
+	gint warming;
+	guint need;
+
+	idle = network_connection_pool_shard_get_idle_count(shard, manager->connector->username);
+
+	do {
+		warming = g_atomic_int_get(&(shard->warming_connections));
+
+		if (idle + warming >= pool->min_idle_connections) return 0;
+
+		need = MIN(pool->min_idle_connections - idle - warming, NETWORK_CONNECTION_POOL_MANAGER_MAX_CONNECTS);
+	} while (!g_atomic_int_compare_and_exchange(&(shard->warming_connections), warming, warming + need));
+
+	return need;
+}
+
+static void network_connection_pool_manager_timer_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_connection_pool_manager_timer *timer = user_data;
+	network_connection_pool_manager *manager = timer->manager;
+	network_backends_t *bs = manager->backends;
+	GTimeVal now;
+	guint i;
+
+	if (chassis_is_shutdown()) {
+		network_backend_connector_unref(manager->connector);
+		g_free(timer);
+
+		return;
+	}
+
+	g_get_current_time(&now);
+
+	for (i = 0; i < network_backends_count(bs); i++) {
+		network_backend_t *backend = network_backends_get(bs, i);
+		network_connection_pool *pool = backend->pool;
+		network_connection_pool_shard *shard = network_connection_pool_get_shard(pool);
+		guint need;
+
+		network_connection_pool_expire(pool, timer->event_thread->event_base, timer->last_run, now.tv_sec);
+		network_connection_pool_trim(pool, timer->event_thread->event_base);
+
+		if (NULL == manager->connector->username ||
+		    network_connection_pool_manager_is_backing_off(pool) ||
+		    backend->state == BACKEND_STATE_DOWN ||
+		    !network_backend_is_resolved(backend)) {
+			continue;
+		}
+
+		for (need = network_connection_pool_manager_reserve(manager, shard); need > 0; need--) {
+			network_connection_pool_manager_connect(timer, backend, shard);
+		}
+	}
+
+	timer->last_run = now.tv_sec;
+
+	evtimer_set(&(timer->ev), network_connection_pool_manager_timer_handle, timer);
+	chassis_event_add_to_thread(manager->chas, timer->event_thread, &(timer->ev), NETWORK_CONNECTION_POOL_MANAGER_INTERVAL);
+}
+
+/**
+ * start the timers of the pool manager in all event-threads
+ *
+ * @return 0 on success, -1 if there are no event-threads
+ */
+int network_connection_pool_manager_start(network_connection_pool_manager *manager) {
+	chassis *chas = manager->chas;
+	guint i;
+
+	if (!chas->threads || chas->threads->event_threads->len == 0) {
+		g_critical("%s: the event-threads aren't setup yet", G_STRLOC);
+		return -1;
+	}
+
+	for (i = 0; i < chas->threads->event_threads->len; i++) {
+		network_connection_pool_manager_timer *timer;
+
+		timer = g_new0(network_connection_pool_manager_timer, 1);
+		timer->manager = manager;
+		timer->event_thread = chas->threads->event_threads->pdata[i];
+
+		network_backend_connector_ref(manager->connector);
+
+		evtimer_set(&(timer->ev), network_connection_pool_manager_timer_handle, timer);
+		chassis_event_add_to_thread(chas, timer->event_thread, &(timer->ev), NETWORK_CONNECTION_POOL_MANAGER_INTERVAL);
+	}
+
+	return 0;
+}
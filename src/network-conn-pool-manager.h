@@ -0,0 +1,75 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_CONN_POOL_MANAGER_H_
+#define _NETWORK_CONN_POOL_MANAGER_H_
+
+#include <glib.h>
+
+#include "network-mysqld.h"
+#include "network-backend.h"
+
+#include "network-exports.h"
+
+/**
+ * seconds between two runs of the pool manager
+ */
+#define NETWORK_CONNECTION_POOL_MANAGER_INTERVAL 1
+
+/**
+ * max. connections a event-thread opens to a backend per run
+ */
+#define NETWORK_CONNECTION_POOL_MANAGER_MAX_CONNECTS 8
+
+/**
+ * seconds the pool manager waits before it opens connections to a backend that refused
+ * them, doubled after each refusal up to NETWORK_CONNECTION_POOL_MANAGER_MAX_RETRY
+ */
+#define NETWORK_CONNECTION_POOL_MANAGER_MIN_RETRY 5
+#define NETWORK_CONNECTION_POOL_MANAGER_MAX_RETRY 600
+
+/**
+ * keeps the connection pools of the backends between min_idle_connections and max_idle_connections
+ *
+ * Each event-thread runs a timer which handles the shard of the thread in each pool. It
+ *
+ * - pings the idling connections of this thread before they hit the wait_timeout of the
+ *   backend and closes them at the end of their max_lifetime
+ * - closes the idling connections above max_idle_connections that wait in this thread
+ * - opens and authenticates new connections as long as there are less than
+ *   min_idle_connections idling for the configured user in the shard. Each new connection
+ *   asks the backend for its wait_timeout. If a backend refuses them, the manager backs off
+ *   from that backend only.
+ *
+ * The connections are opened without a default-db: they only serve the clients of the
+ * configured user that don't ask for a default-db either.
+ *
+ * Without a username only the idling connections are trimmed: the proxy doesn't know
+ * the passwords of the clients and can't open connections on their behalf.
+ */
+typedef struct network_connection_pool_manager network_connection_pool_manager;
+
+NETWORK_API network_connection_pool_manager *network_connection_pool_manager_new(chassis *chas, network_backends_t *backends);
+NETWORK_API void network_connection_pool_manager_free(network_connection_pool_manager *manager);
+NETWORK_API void network_connection_pool_manager_set_auth(network_connection_pool_manager *manager, const gchar *username, const gchar *password);
+NETWORK_API int network_connection_pool_manager_start(network_connection_pool_manager *manager);
+
+#endif
@@ -23,8 +23,11 @@
 
 #include "network-conn-pool.h"
 #include "network-mysqld-packet.h"
+#include "chassis-event-thread.h"
 #include "glib-ext.h"
+#include "glib-ext-pool.h"
 #include "sys-pedantic.h"
+#include "string-len.h"
 
 /** @file
  * connection pools
@@ -34,8 +37,19 @@
  * - make sure we don't run out of seconds
  * - if the client is authed, we have to pick connection with the same user
  * - ...  
+ *
+ * Each entry knows its link in the queue of its user, adding, getting and removing a
+ * connection is O(1). The users are kept in a max-heap by their number of idling
+ * connections, taking a connection from the user with the most idling connections
+ * is O(log users).
+ *
+ * The pool is split into shards, one per event-thread. A connection is added to the
+ * shard of the thread it idles in, the threads only contend for a shard's mutex when
+ * they take a connection from the shard of another thread.
  */
 
+static GPool network_connection_pool_entry_pool = G_POOL_INIT("network_connection_pool_entry", network_connection_pool_entry);
+
 /**
  * create a empty connection pool entry
  *
@@ -44,7 +58,7 @@
 network_connection_pool_entry *network_connection_pool_entry_new(void) {
 	network_connection_pool_entry *e;
 
-	e = g_new0(network_connection_pool_entry, 1);
+	e = g_pool_alloc0(&network_connection_pool_entry_pool);
 
 	return e;
 }
@@ -65,26 +79,217 @@ void network_connection_pool_entry_free(network_connection_pool_entry *e, gboole
 		network_socket_free(sock);
 	}
 
-	g_free(e);
+	g_pool_free(&network_connection_pool_entry_pool, e);
+}
+
+static network_connection_pool_user *network_connection_pool_user_new(GString *name) {
+	network_connection_pool_user *user;
+
+	user = g_new0(network_connection_pool_user, 1);
+	user->name = g_string_dup(name);
+
+	return user;
 }
 
 /**
- * free all pool entries of the queue
+ * free the user and all its idling connections
  *
  * used as GDestroyFunc in the user-hash of the pool
  *
- * @param q a GQueue to free
- *
  * @see network_connection_pool_new
  * @see GDestroyFunc
  */
-static void g_queue_free_all(gpointer q) {
-	GQueue *queue = q;
+static void network_connection_pool_user_free(gpointer _user) {
+	network_connection_pool_user *user = _user;
 	network_connection_pool_entry *entry;
 
-	while ((entry = g_queue_pop_head(queue))) network_connection_pool_entry_free(entry, TRUE);
+	while ((entry = g_queue_pop_head(&(user->conns)))) network_connection_pool_entry_free(entry, TRUE);
+
+	g_string_free(user->name, TRUE);
+
+	g_free(user);
+}
+
+static void network_connection_pool_heap_set(network_connection_pool_shard *shard, guint ndx, network_connection_pool_user *user) {
+	shard->heap->pdata[ndx] = user;
+	user->heap_ndx = ndx;
+}
+
+/**
+ * restore the heap-order after the idling connections of the user changed
+ *
+ * the shard's mutex has to be held
+ */
+static void network_connection_pool_heap_update(network_connection_pool_shard *shard, network_connection_pool_user *user) {
+	guint ndx = user->heap_ndx;
+
+	/* move up */
+	while (ndx > 0) {
+		network_connection_pool_user *parent = shard->heap->pdata[(ndx - 1) / 2];
+
+		if (parent->conns.length >= user->conns.length) break;
+
+		network_connection_pool_heap_set(shard, ndx, parent);
+		ndx = (ndx - 1) / 2;
+	}
+
+	/* move down */
+	for (;;) {
+		guint child = 2 * ndx + 1;
+		network_connection_pool_user *bigger;
+
+		if (child >= shard->heap->len) break;
+
+		if (child + 1 < shard->heap->len &&
+		    ((network_connection_pool_user *)shard->heap->pdata[child + 1])->conns.length >
+		    ((network_connection_pool_user *)shard->heap->pdata[child])->conns.length) {
+			child++;
+		}
+
+		bigger = shard->heap->pdata[child];
+		if (bigger->conns.length <= user->conns.length) break;
+
+		network_connection_pool_heap_set(shard, ndx, bigger);
+		ndx = child;
+	}
+
+	network_connection_pool_heap_set(shard, ndx, user);
+}
+
+/**
+ * get the user, create it if it doesn't exist yet
+ *
+ * the shard's mutex has to be held
+ */
+static network_connection_pool_user *network_connection_pool_get_user(network_connection_pool_shard *shard, GString *username) {
+	network_connection_pool_user *user;
+
+	if (NULL != (user = g_hash_table_lookup(shard->users, username))) return user;
+
+	user = network_connection_pool_user_new(username);
+	g_hash_table_insert(shard->users, user->name, user);
 
-	g_queue_free(queue);
+	g_ptr_array_add(shard->heap, user);
+	user->heap_ndx = shard->heap->len - 1;
+
+	return user;
+}
+
+/**
+ * remove the user from the shard
+ *
+ * the user must not have idling connections anymore. The shard's mutex has to be held
+ */
+static void network_connection_pool_remove_user(network_connection_pool_shard *shard, network_connection_pool_user *user) {
+	network_connection_pool_user *last;
+
+	g_assert_cmpint(user->conns.length, ==, 0);
+
+	last = g_ptr_array_remove_index_fast(shard->heap, shard->heap->len - 1);
+	if (last != user) {
+		network_connection_pool_heap_set(shard, user->heap_ndx, last);
+		network_connection_pool_heap_update(shard, last);
+	}
+
+	g_hash_table_remove(shard->users, user->name);
+}
+
+/**
+ * get the second the entry is due in the timer-wheel
+ *
+ * it is either the time to ping the connection before it hits the wait_timeout of the
+ * backend or the end of its lifetime. Both are jittered to not have all connections
+ * expire at the same time.
+ */
+static glong network_connection_pool_entry_get_due(network_connection_pool *pool, network_connection_pool_entry *entry) {
+	network_socket *sock = entry->sock;
+	glong now = entry->added_ts.tv_sec;
+	glong due_at;
+
+	/* ping in the last quarter of the wait_timeout */
+	due_at = now + MAX(1, pool->wait_timeout * 3 / 4 + g_random_int_range(0, pool->wait_timeout / 8 + 1));
+
+	if (pool->max_lifetime && sock->pool_expires_at == 0) {
+		sock->pool_expires_at = now + pool->max_lifetime - g_random_int_range(0, pool->max_lifetime / 10 + 1);
+	}
+
+	if (sock->pool_expires_at && sock->pool_expires_at < due_at) {
+		due_at = sock->pool_expires_at;
+	}
+
+	/* the slots of the past are already handled */
+	return MAX(due_at, now + 1);
+}
+
+/**
+ * add the entry to the timer-wheel
+ *
+ * the shard's mutex has to be held
+ */
+static void network_connection_pool_wheel_add(network_connection_pool_shard *shard, network_connection_pool_entry *entry) {
+	GQueue *slot;
+
+	entry->due_at = network_connection_pool_entry_get_due(shard->pool, entry);
+
+	slot = &(shard->wheel[entry->due_at % NETWORK_CONNECTION_POOL_WHEEL_SLOTS]);
+	g_queue_push_tail(slot, entry);
+	entry->wheel_link = slot->tail;
+}
+
+/**
+ * remove the entry from the timer-wheel
+ *
+ * the shard's mutex has to be held
+ */
+static void network_connection_pool_wheel_remove(network_connection_pool_shard *shard, network_connection_pool_entry *entry) {
+	if (!entry->wheel_link) return;
+
+	g_queue_delete_link(&(shard->wheel[entry->due_at % NETWORK_CONNECTION_POOL_WHEEL_SLOTS]), entry->wheel_link);
+	entry->wheel_link = NULL;
+}
+
+/**
+ * add the entry to the idling connections of its user
+ *
+ * the shard's mutex has to be held
+ */
+static void network_connection_pool_link(network_connection_pool_shard *shard, network_connection_pool_entry *entry) {
+	network_connection_pool_user *user;
+
+	user = network_connection_pool_get_user(shard, entry->sock->response->username);
+
+	g_queue_push_tail(&(user->conns), entry);
+	entry->link = user->conns.tail;
+	entry->user = user;
+	g_atomic_int_inc(&(shard->idle_connections));
+
+	network_connection_pool_heap_update(shard, user);
+
+	network_connection_pool_wheel_add(shard, entry);
+}
+
+/**
+ * remove the entry from the idling connections of its user
+ *
+ * the shard's mutex has to be held
+ */
+static void network_connection_pool_unlink(network_connection_pool_shard *shard, network_connection_pool_entry *entry) {
+	network_connection_pool_user *user = entry->user;
+
+	network_connection_pool_wheel_remove(shard, entry);
+
+	if (!user) return;
+
+	g_queue_delete_link(&(user->conns), entry->link);
+	entry->link = NULL;
+	entry->user = NULL;
+	g_atomic_int_add(&(shard->idle_connections), -1);
+
+	if (user->conns.length == 0) {
+		network_connection_pool_remove_user(shard, user);
+	} else {
+		network_connection_pool_heap_update(shard, user);
+	}
 }
 
 /**
@@ -96,70 +301,478 @@ network_connection_pool *network_connection_pool_init(void) {
 }
 /**
  * init a connection pool
+ *
+ * the shards are created when the event-threads use them
  */
 network_connection_pool *network_connection_pool_new(void) {
 	network_connection_pool *pool;
 
 	pool = g_new0(network_connection_pool, 1);
 
-	pool->users = g_hash_table_new_full(g_hash_table_string_hash, g_hash_table_string_equal, g_hash_table_string_free, g_queue_free_all);
+	pool->wait_timeout = NETWORK_CONNECTION_POOL_DEFAULT_WAIT_TIMEOUT;
 
 	return pool;
 }
 
+static void network_connection_pool_waiter_unref(network_connection_pool_waiter *waiter) {
+	if (!g_atomic_int_dec_and_test(&(waiter->ref_count))) return;
+
+	g_string_free(waiter->username, TRUE);
+	g_string_free(waiter->default_db, TRUE);
+
+	g_free(waiter);
+}
+
+static network_connection_pool_shard *network_connection_pool_shard_new(network_connection_pool *pool) {
+	network_connection_pool_shard *shard;
+
+	shard = g_new0(network_connection_pool_shard, 1);
+	shard->pool = pool;
+	shard->users = g_hash_table_new_full(g_hash_table_string_hash, g_hash_table_string_equal, NULL, network_connection_pool_user_free);
+	shard->heap = g_ptr_array_new();
+	shard->mutex = g_mutex_new();
+
+	return shard;
+}
+
+static void network_connection_pool_shard_free(network_connection_pool_shard *shard) {
+	network_connection_pool_entry *entry;
+	network_connection_pool_waiter *waiter;
+	guint i;
+
+	if (!shard) return;
+
+	/* the entries are freed with the users */
+	for (i = 0; i < NETWORK_CONNECTION_POOL_WHEEL_SLOTS; i++) {
+		g_list_free(shard->wheel[i].head);
+	}
+
+	while ((entry = g_queue_pop_head(&(shard->pinging)))) network_connection_pool_entry_free(entry, TRUE);
+
+	while ((waiter = g_queue_pop_head(&(shard->waiters)))) {
+		waiter->link = NULL;
+		network_connection_pool_waiter_unref(waiter);
+	}
+
+	g_hash_table_destroy(shard->users);
+	g_ptr_array_free(shard->heap, TRUE);
+	g_mutex_free(shard->mutex);
+
+	g_free(shard);
+}
+
 /**
  * free all entries of the pool
  *
  */
 void network_connection_pool_free(network_connection_pool *pool) {
-	if (!pool) return;
+	guint i;
 
-	g_hash_table_foreach_remove(pool->users, g_hash_table_true, NULL);
+	if (!pool) return;
 
-	g_hash_table_destroy(pool->users);
+	for (i = 0; i < NETWORK_CONNECTION_POOL_MAX_SHARDS; i++) {
+		network_connection_pool_shard_free(pool->shards[i]);
+	}
 
 	g_free(pool);
 }
 
 /**
- * find the entry which has more than max_idle connections idling
- * 
- * @return TRUE for the first entry having more than _user_data idling connections
- * @see network_connection_pool_get_conns 
+ * get the shard of the calling thread
+ *
+ * threads that aren't event-threads (like the unit-tests) use the first shard
  */
-static gboolean find_idle_conns(gpointer UNUSED_PARAM(_key), gpointer _val, gpointer _user_data) {
-	guint min_idle_conns = *(gint *)_user_data;
-	GQueue *conns = _val;
+static guint network_connection_pool_get_shard_ndx(void) {
+	chassis_event_thread_t *event_thread = chassis_event_thread_self();
 
-	return (conns->length > min_idle_conns);
+	return event_thread ? event_thread->index % NETWORK_CONNECTION_POOL_MAX_SHARDS : 0;
 }
 
-GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *UNUSED_PARAM(default_db)) {
-	GQueue *conns = NULL;
+/**
+ * get the shard of the calling thread, create it on first use
+ */
+network_connection_pool_shard *network_connection_pool_get_shard(network_connection_pool *pool) {
+	guint ndx = network_connection_pool_get_shard_ndx();
+	network_connection_pool_shard *shard;
 
+	if (G_LIKELY(NULL != (shard = g_atomic_pointer_get(&(pool->shards[ndx]))))) return shard;
 
-	if (username && username->len > 0) {
-		conns = g_hash_table_lookup(pool->users, username);
+	shard = network_connection_pool_shard_new(pool);
+
+	/* event-threads that share the shard may race us */
+	if (!g_atomic_pointer_compare_and_exchange(&(pool->shards[ndx]), NULL, shard)) {
+		network_connection_pool_shard_free(shard);
+
+		shard = g_atomic_pointer_get(&(pool->shards[ndx]));
+	}
+
+	return shard;
+}
+
+/**
+ * find the user to take a idling connection from
+ * 
+ * @param username the user of the connection, NULL to take one from the user with the most
+ *   idling connections if it has more than min_idle_connections
+ *
+ * the shard's mutex has to be held
+ */
+static network_connection_pool_user *network_connection_pool_find_user(network_connection_pool_shard *shard, GString *username) {
+	network_connection_pool_user *user = NULL;
+
+	if (username) {
+		user = g_hash_table_lookup(shard->users, username);
 		/**
 		 * if we know this use, return a authed connection 
 		 */
 #ifdef DEBUG_CONN_POOL
-		g_debug("%s: (get_conns) get user-specific idling connection for '%s' -> %p", G_STRLOC, username->str, conns);
+		g_debug("%s: (get_conns) get user-specific idling connection for '%s' -> %p", G_STRLOC, username->str, user);
 #endif
-		if (conns) return conns;
+		return user;
 	}
 
 	/**
-	 * we don't have a entry yet, check the others if we have more than 
-	 * min_idle waiting
+	 * check the others if we have more than min_idle waiting
 	 */
+	if (shard->heap->len > 0) {
+		user = shard->heap->pdata[0];
 
-	conns = g_hash_table_find(pool->users, find_idle_conns, &(pool->min_idle_connections));
+		if (user->conns.length <= shard->pool->min_idle_connections) user = NULL;
+	}
 #ifdef DEBUG_CONN_POOL
-	g_debug("%s: (get_conns) try to find max-idling conns for user '%s' -> %p", G_STRLOC, username ? username->str : "", conns);
+	g_debug("%s: (get_conns) try to find max-idling conns -> %p", G_STRLOC, user);
 #endif
 
-	return conns;
+	return user;
+}
+
+/**
+ * get the idling connections of the user in the shard of the calling thread
+ *
+ * the queue may be changed by other event-threads as soon as we return 
+ *
+ * @deprecated the connections of the other shards aren't visible, use network_connection_pool_get_idle_count()
+ */
+GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *UNUSED_PARAM(default_db)) {
+	network_connection_pool_shard *shard = network_connection_pool_get_shard(pool);
+	network_connection_pool_user *user = NULL;
+
+	g_mutex_lock(shard->mutex);
+	if (username && username->len > 0) user = network_connection_pool_find_user(shard, username);
+	if (!user) user = network_connection_pool_find_user(shard, NULL);
+	g_mutex_unlock(shard->mutex);
+
+	return user ? &(user->conns) : NULL;
+}
+
+/**
+ * get the number of idling connections in a shard
+ *
+ * @param username the user of the connections, NULL for all users
+ */
+guint network_connection_pool_shard_get_idle_count(network_connection_pool_shard *shard, GString *username) {
+	network_connection_pool_user *user;
+	guint count;
+
+	if (!username) return g_atomic_int_get(&(shard->idle_connections));
+
+	g_mutex_lock(shard->mutex);
+	user = g_hash_table_lookup(shard->users, username);
+	count = user ? user->conns.length : 0;
+	g_mutex_unlock(shard->mutex);
+
+	return count;
+}
+
+/**
+ * get the number of idling connections of all shards
+ *
+ * @param username the user of the connections, NULL for all users
+ */
+guint network_connection_pool_get_idle_count(network_connection_pool *pool, GString *username) {
+	guint count = 0;
+	guint i;
+
+	for (i = 0; i < NETWORK_CONNECTION_POOL_MAX_SHARDS; i++) {
+		network_connection_pool_shard *shard = g_atomic_pointer_get(&(pool->shards[i]));
+
+		if (shard) count += network_connection_pool_shard_get_idle_count(shard, username);
+	}
+
+	return count;
+}
+
+/**
+ * get the number of connections the pool manager is opening in all shards
+ */
+guint network_connection_pool_get_warming_count(network_connection_pool *pool) {
+	guint count = 0;
+	guint i;
+
+	for (i = 0; i < NETWORK_CONNECTION_POOL_MAX_SHARDS; i++) {
+		network_connection_pool_shard *shard = g_atomic_pointer_get(&(pool->shards[i]));
+
+		if (shard) count += g_atomic_int_get(&(shard->warming_connections));
+	}
+
+	return count;
+}
+
+/**
+ * call the callback of a waiter that was woken up
+ *
+ * called in the event-thread of the waiter, releases the reference of the queue
+ */
+static void network_connection_pool_waiter_wakeup(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_connection_pool_waiter *waiter = user_data;
+
+	if (!waiter->is_cancelled) waiter->callback(waiter->user_data);
+
+	network_connection_pool_waiter_unref(waiter);
+}
+
+/**
+ * wake up the oldest waiter the added connection fits
+ *
+ * the waiters of the calling thread's shard are woken up first. Only one waiter is woken
+ * up per connection, the others keep waiting for the next one.
+ */
+static void network_connection_pool_wake(network_connection_pool *pool, network_socket *sock) {
+	guint local_ndx = network_connection_pool_get_shard_ndx();
+	guint i;
+
+	for (i = 0; i < NETWORK_CONNECTION_POOL_MAX_SHARDS; i++) {
+		guint ndx = (local_ndx + i) % NETWORK_CONNECTION_POOL_MAX_SHARDS;
+		network_connection_pool_shard *shard = g_atomic_pointer_get(&(pool->shards[ndx]));
+		network_connection_pool_waiter *waiter = NULL;
+		GList *link;
+
+		if (!shard || g_atomic_int_get(&(shard->waiting_clients)) == 0) continue;
+
+		g_mutex_lock(shard->mutex);
+		for (link = shard->waiters.head; link; link = link->next) {
+			network_connection_pool_waiter *cur = link->data;
+
+			if (cur->charset == sock->response->charset &&
+			    g_string_equal(cur->username, sock->response->username) &&
+			    g_string_equal(cur->default_db, sock->default_db)) {
+				waiter = cur;
+
+				g_queue_delete_link(&(shard->waiters), link);
+				waiter->link = NULL;
+				g_atomic_int_add(&(shard->waiting_clients), -1);
+				break;
+			}
+		}
+		g_mutex_unlock(shard->mutex);
+
+		if (!waiter) continue;
+
+		/* the reference of the queue is released by the wakeup */
+		chassis_event_active_in_thread(waiter->event_thread->chas, waiter->event_thread, &(waiter->wakeup_event));
+
+		return;
+	}
+}
+
+/**
+ * wait for the next idling connection that is authed as the user
+ *
+ * has to be called in a event-thread. The waiter is queued before the client looks into the
+ * pool (again), a connection that is added in between wakes it up.
+ *
+ * @param auth       the auth-response of the client
+ * @param default_db the current default-db of the client
+ * @param callback   called in the event-thread of the client once a connection was added
+ * @return the waiter, cancel it with network_connection_pool_waiter_cancel() in the same event-thread
+ */
+network_connection_pool_waiter *network_connection_pool_wait(network_connection_pool *pool,
+		network_mysqld_auth_response *auth,
+		GString *default_db,
+		void (*callback)(gpointer user_data),
+		gpointer user_data) {
+	network_connection_pool_shard *shard = network_connection_pool_get_shard(pool);
+	network_connection_pool_waiter *waiter;
+
+	waiter = g_new0(network_connection_pool_waiter, 1);
+	waiter->username = g_string_dup(auth->username);
+	waiter->charset = auth->charset;
+	waiter->default_db = g_string_dup(default_db);
+	waiter->callback = callback;
+	waiter->user_data = user_data;
+	waiter->event_thread = chassis_event_thread_self();
+	waiter->shard = shard;
+	waiter->ref_count = 2; /* the client and the queue */
+
+	g_assert(waiter->event_thread);
+
+	evtimer_set(&(waiter->wakeup_event), network_connection_pool_waiter_wakeup, waiter);
+
+	g_mutex_lock(shard->mutex);
+	g_queue_push_tail(&(shard->waiters), waiter);
+	waiter->link = shard->waiters.tail;
+	g_atomic_int_inc(&(shard->waiting_clients));
+	g_mutex_unlock(shard->mutex);
+
+	return waiter;
+}
+
+/**
+ * stop waiting and release the reference of the client
+ *
+ * a wakeup that is on its way to the event-thread doesn't call the callback anymore
+ */
+void network_connection_pool_waiter_cancel(network_connection_pool_waiter *waiter) {
+	network_connection_pool_shard *shard = waiter->shard;
+
+	waiter->is_cancelled = TRUE;
+
+	g_mutex_lock(shard->mutex);
+	if (waiter->link) {
+		g_queue_delete_link(&(shard->waiters), waiter->link);
+		waiter->link = NULL;
+		g_atomic_int_add(&(shard->waiting_clients), -1);
+
+		network_connection_pool_waiter_unref(waiter); /* the reference of the queue, the client still holds one */
+	}
+	g_mutex_unlock(shard->mutex);
+
+	network_connection_pool_waiter_unref(waiter);
+}
+
+/**
+ * check if the calling thread may take the idling connection as is
+ *
+ * the idle handler of the socket can only be removed by the event-thread that watches it.
+ * Connections that were added outside of a event-thread (like in the unit-tests) aren't watched.
+ */
+static gboolean network_connection_pool_entry_is_local(network_connection_pool_entry *entry, chassis_event_thread_t *self) {
+	return (entry->event_thread == NULL || entry->event_thread == self);
+}
+
+/**
+ * add the migrated connection to the shard of the event-thread that stole it
+ *
+ * called in the event-thread that stole the connection. The idle time of the connection
+ * starts again, if the backend closes it in the meantime the idle handler notices it.
+ *
+ * @see network_connection_pool_migrate_release()
+ */
+static void network_connection_pool_migrate_adopt(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_connection_pool_entry *entry = user_data;
+	network_socket *sock = entry->sock;
+	network_connection_pool_shard *shard = network_connection_pool_get_shard(entry->pool);
+	chassis_event_thread_t *self = entry->migrate_to;
+
+	g_assert(self == chassis_event_thread_self());
+
+	entry->shard = shard;
+	entry->event_thread = self;
+	entry->migrate_to = NULL;
+
+	g_get_current_time(&(entry->added_ts));
+
+	event_set(&(sock->event), sock->fd, EV_READ, entry->idle_handler, entry);
+	chassis_event_add_to_thread(self->chas, self, &(sock->event), 0);
+
+	g_mutex_lock(shard->mutex);
+	network_connection_pool_link(shard, entry);
+	g_mutex_unlock(shard->mutex);
+
+	network_connection_pool_wake(entry->pool, sock);
+}
+
+/**
+ * give up the idling socket and send it to the event-thread that stole it
+ *
+ * called in the event-thread that watches the socket. If the idle handler fired before,
+ * network_connection_pool_remove() ignored the unlinked entry and the socket is sent over
+ * anyway: the new thread's idle handler notices the closed connection.
+ *
+ * The socket is idling and writable, the write-event fires right away in the other thread.
+ */
+static void network_connection_pool_migrate_release(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_connection_pool_entry *entry = user_data;
+	network_socket *sock = entry->sock;
+
+	event_del(&(sock->event));
+	entry->idle_handler = sock->event.ev_callback;
+
+	event_set(&(sock->event), sock->fd, EV_WRITE, network_connection_pool_migrate_adopt, entry);
+	chassis_event_add_to_thread(entry->migrate_to->chas, entry->migrate_to, &(sock->event), 0);
+}
+
+/**
+ * move a idling connection of another event-thread into the shard of the calling event-thread
+ *
+ * the entry has to be unlinked already. The event-thread that watches the socket is asked
+ * to remove its idle handler, only then the socket is added to the shard of the calling thread.
+ * Until then the connection is invisible to all threads.
+ */
+static void network_connection_pool_migrate(network_connection_pool_entry *entry, chassis_event_thread_t *self) {
+	network_socket *sock = entry->sock;
+
+	entry->migrate_to = self;
+
+	event_set(&(entry->migrate_event), sock->fd, EV_WRITE, network_connection_pool_migrate_release, entry);
+	chassis_event_add_to_thread(self->chas, entry->event_thread, &(entry->migrate_event), 0);
+
+	g_atomic_int_inc(&(entry->pool->stolen_connections));
+}
+
+/**
+ * take the oldest idling connection of the user from the shards
+ *
+ * the shard of the calling thread is searched first, the shards of the other event-threads
+ * after it. Shards without idling connections are skipped without taking their mutex.
+ *
+ * A connection that idles in another event-thread can't be handed out right away, it is
+ * moved into the shard of the calling thread instead and the next request picks it up.
+ *
+ * @param username the user of the connection, NULL for the user with the most idling connections
+ * @param is_migrating set to TRUE if a connection is moved over
+ */
+static network_connection_pool_entry *network_connection_pool_take(network_connection_pool *pool, guint local_ndx, GString *username, gboolean *is_migrating) {
+	chassis_event_thread_t *self = chassis_event_thread_self();
+	guint i;
+
+	for (i = 0; i < NETWORK_CONNECTION_POOL_MAX_SHARDS; i++) {
+		guint ndx = (local_ndx + i) % NETWORK_CONNECTION_POOL_MAX_SHARDS;
+		network_connection_pool_shard *shard = g_atomic_pointer_get(&(pool->shards[ndx]));
+		network_connection_pool_entry *entry = NULL;
+		network_connection_pool_user *user;
+		gboolean is_local = FALSE;
+
+		if (!shard || g_atomic_int_get(&(shard->idle_connections)) == 0) continue;
+
+		g_mutex_lock(shard->mutex);
+		if (NULL != (user = network_connection_pool_find_user(shard, username))) {
+			entry = user->conns.head->data;
+			is_local = network_connection_pool_entry_is_local(entry, self);
+
+			if (is_local || self) {
+				network_connection_pool_unlink(shard, entry);
+			} else {
+				entry = NULL;
+			}
+		}
+		g_mutex_unlock(shard->mutex);
+
+		if (!entry) continue;
+
+		if (!is_local) {
+			network_connection_pool_migrate(entry, self);
+			*is_migrating = TRUE;
+
+			return NULL;
+		}
+
+		if (i > 0) g_atomic_int_inc(&(pool->stolen_connections));
+
+		return entry;
+	}
+
+	return NULL;
 }
 
 /**
@@ -168,6 +781,9 @@ GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString
  * make sure we have at lease <min-conns> for each user
  * if we have more, reuse a connect to reauth it to another user
  *
+ * A connection that idles in another event-thread is moved into the shard of the calling
+ * thread, NULL is returned meanwhile.
+ *
  * @param pool connection pool to get the connection from
  * @param username (optional) name of the auth connection
  * @param default_db (unused) unused name of the default-db
@@ -178,26 +794,23 @@ network_socket *network_connection_pool_get(network_connection_pool *pool,
 
 	network_connection_pool_entry *entry = NULL;
 	network_socket *sock = NULL;
-
-	GQueue *conns = network_connection_pool_get_conns(pool, username, NULL);
+	guint local_ndx = network_connection_pool_get_shard_ndx();
+	gboolean is_migrating = FALSE;
 
 	/**
 	 * if we know this use, return a authed connection 
 	 */
-	if (conns) {
-		entry = g_queue_pop_head(conns);
-
-		if (conns->length == 0) {
-			/**
-			 * all connections are gone, remove it from the hash
-			 */
-			g_hash_table_remove(pool->users, username);
-		}
+	if (username && username->len > 0) {
+		entry = network_connection_pool_take(pool, local_ndx, username, &is_migrating);
+	}
+
+	if (!entry && !is_migrating) {
+		entry = network_connection_pool_take(pool, local_ndx, NULL, &is_migrating);
 	}
 
 	if (!entry) {
 #ifdef DEBUG_CONN_POOL
-		g_debug("%s: (get) no entry for user '%s' -> %p", G_STRLOC, username ? username->str : "", conns);
+		g_debug("%s: (get) no entry for user '%s'", G_STRLOC, username ? username->str : "");
 #endif
 		return NULL;
 	}
@@ -217,30 +830,108 @@ network_socket *network_connection_pool_get(network_connection_pool *pool,
 }
 
 /**
- * add a connection to the connection pool
+ * get a connection that is authed as the user and can be used as is
  *
+ * unlike network_connection_pool_get() the connections of other users aren't taken as
+ * there is no way to re-auth them: the client's scramble only fits the challenge of the
+ * server connection it authed against. The default-db and the charset have to match too.
+ *
+ * The shard of the calling thread is searched first. A matching connection that idles in
+ * another event-thread is moved into the shard of the calling thread, NULL is returned meanwhile.
+ *
+ * @param auth       the auth-response of the client
+ * @param default_db the current default-db of the client
+ * @return NULL if no matching connection is idling
+ */
+network_socket *network_connection_pool_get_authed(network_connection_pool *pool,
+		network_mysqld_auth_response *auth,
+		GString *default_db) {
+	chassis_event_thread_t *self = chassis_event_thread_self();
+	guint local_ndx = network_connection_pool_get_shard_ndx();
+	guint i;
+
+	for (i = 0; i < NETWORK_CONNECTION_POOL_MAX_SHARDS; i++) {
+		guint ndx = (local_ndx + i) % NETWORK_CONNECTION_POOL_MAX_SHARDS;
+		network_connection_pool_shard *shard = g_atomic_pointer_get(&(pool->shards[ndx]));
+		network_connection_pool_entry *entry = NULL;
+		network_connection_pool_user *user;
+		network_socket *sock;
+		gboolean is_local = FALSE;
+
+		if (!shard || g_atomic_int_get(&(shard->idle_connections)) == 0) continue;
+
+		g_mutex_lock(shard->mutex);
+		if (NULL != (user = g_hash_table_lookup(shard->users, auth->username))) {
+			GList *link;
+
+			/* the connections of a user usually share the db and charset, the first one fits */
+			for (link = user->conns.head; link; link = link->next) {
+				network_connection_pool_entry *cur = link->data;
+
+				if (cur->sock->response->charset == auth->charset &&
+				    g_string_equal(cur->sock->default_db, default_db)) {
+					is_local = network_connection_pool_entry_is_local(cur, self);
+
+					if (!is_local && !self) continue;
+
+					entry = cur;
+					break;
+				}
+			}
+
+			if (entry) network_connection_pool_unlink(shard, entry);
+		}
+		g_mutex_unlock(shard->mutex);
+
+		if (!entry) continue;
+
+		if (!is_local) {
+			network_connection_pool_migrate(entry, self);
+
+			return NULL;
+		}
+
+		if (i > 0) g_atomic_int_inc(&(pool->stolen_connections));
+
+		sock = entry->sock;
+
+		network_connection_pool_entry_free(entry, FALSE);
+
+		/* remove the idle handler from the socket */
+		event_del(&(sock->event));
+
+		return sock;
+	}
+
+	return NULL;
+}
+
+/**
+ * add a connection to the shard of the calling thread
+ *
+ * the caller watches the idling socket in its event-base
  */
 network_connection_pool_entry *network_connection_pool_add(network_connection_pool *pool, network_socket *sock) {
+	network_connection_pool_shard *shard = network_connection_pool_get_shard(pool);
 	network_connection_pool_entry *entry;
-	GQueue *conns = NULL;
 
 	entry = network_connection_pool_entry_new();
 	entry->sock = sock;
 	entry->pool = pool;
+	entry->shard = shard;
+	entry->event_thread = chassis_event_thread_self();
 
 	g_get_current_time(&(entry->added_ts));
-	
+
 #ifdef DEBUG_CONN_POOL
-	g_debug("%s: (add) adding socket to pool for user '%s' -> %p", G_STRLOC, sock->username->str, sock);
+	g_debug("%s: (add) adding socket to pool for user '%s' -> %p", G_STRLOC, sock->response->username->str, sock);
 #endif
 
-	if (NULL == (conns = g_hash_table_lookup(pool->users, sock->response->username))) {
-		conns = g_queue_new();
+	g_mutex_lock(shard->mutex);
+	network_connection_pool_link(shard, entry);
+	g_mutex_unlock(shard->mutex);
 
-		g_hash_table_insert(pool->users, g_string_dup(sock->response->username), conns);
-	}
-
-	g_queue_push_tail(conns, entry);
+	network_connection_pool_wake(pool, sock);
 
 	return entry;
 }
@@ -248,17 +939,218 @@ network_connection_pool_entry *network_connection_pool_add(network_connection_po
 /**
  * remove the connection referenced by entry from the pool 
  */
-void network_connection_pool_remove(network_connection_pool *pool, network_connection_pool_entry *entry) {
-	network_socket *sock = entry->sock;
-	GQueue *conns;
+void network_connection_pool_remove(network_connection_pool *UNUSED_PARAM(pool), network_connection_pool_entry *entry) {
+	network_connection_pool_shard *shard = entry->shard;
 
-	if (NULL == (conns = g_hash_table_lookup(pool->users, sock->response->username))) {
+	g_mutex_lock(shard->mutex);
+	if (NULL == entry->link) {
+		/* not in the pool (anymore) */
+		g_mutex_unlock(shard->mutex);
 		return;
 	}
 
+	if (entry->is_pinging) {
+		g_queue_delete_link(&(shard->pinging), entry->link);
+		entry->link = NULL;
+	} else {
+		network_connection_pool_unlink(shard, entry);
+	}
+	g_mutex_unlock(shard->mutex);
+
 	network_connection_pool_entry_free(entry, TRUE);
+}
+
+/**
+ * close the idling connections of a user above max_idle_connections
+ *
+ * the oldest connections are closed first. Only the connections that wait for
+ * their events in event_base are closed: the events of a idling connection can
+ * only be removed by the thread that handles them.
+ *
+ * Only the users at the top of the heap can have more than max_idle_connections.
+ * The limit applies to the shard of the calling thread.
+ *
+ * @param event_base the event-base of the calling thread
+ * @return number of closed connections
+ */
+guint network_connection_pool_trim(network_connection_pool *pool, struct event_base *event_base) {
+	network_connection_pool_shard *shard = network_connection_pool_get_shard(pool);
+	GSList *users = NULL;
+	GSList *closing = NULL;
+	GArray *stack;
+	guint closed = 0;
+
+	if (pool->max_idle_connections == 0) return 0; /* no limit */
+
+	stack = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	g_mutex_lock(shard->mutex);
+	/* collect the users above the limit, their children in the heap have less connections */
+	if (shard->heap->len > 0) {
+		guint ndx = 0;
+
+		g_array_append_val(stack, ndx);
+	}
+	while (stack->len > 0) {
+		guint ndx = g_array_index(stack, guint, stack->len - 1);
+		network_connection_pool_user *user = shard->heap->pdata[ndx];
+		guint child;
+
+		g_array_set_size(stack, stack->len - 1);
+
+		if (user->conns.length <= pool->max_idle_connections) continue;
+
+		users = g_slist_prepend(users, user);
+
+		for (child = 2 * ndx + 1; child <= 2 * ndx + 2 && child < shard->heap->len; child++) {
+			g_array_append_val(stack, child);
+		}
+	}
+
+	while (users) {
+		network_connection_pool_user *user = users->data;
+		guint excess = user->conns.length - pool->max_idle_connections;
+		GList *link = user->conns.head;
+
+		/* unlinking the last connection of the user would free it, but we keep max_idle_connections */
+		while (link && excess > 0) {
+			network_connection_pool_entry *entry = link->data;
+
+			link = link->next;
+
+			if (entry->sock->event.ev_base != event_base) continue;
+
+			network_connection_pool_unlink(shard, entry);
+			excess--;
+
+			closing = g_slist_prepend(closing, entry);
+		}
+
+		users = g_slist_delete_link(users, users);
+	}
+	g_mutex_unlock(shard->mutex);
+
+	g_array_free(stack, TRUE);
+
+	/* close the connections outside of the lock */
+	while (closing) {
+		network_connection_pool_entry_free(closing->data, TRUE);
+
+		closing = g_slist_delete_link(closing, closing);
+		closed++;
+	}
+
+	if (closed) g_atomic_int_add(&(pool->trimmed_connections), closed);
 
-	g_queue_remove(conns, entry);
+	return closed;
 }
 
+/**
+ * handle the idling connections that are due in the timer-wheel
+ *
+ * Connections at the end of their lifetime are closed, the others get a COM_PING to 
+ * keep them below the wait_timeout of the backend. While the COM_PING is on its way,
+ * the connection isn't handed out.
+ *
+ * Each event-thread walks the slots of its shard between its last run and now and handles
+ * only the connections that wait for their events in its event_base.
+ *
+ * @param last_run the second of the last call in this event-thread, 0 on the first call
+ * @param now      the current time in seconds
+ * @return number of closed connections
+ * @see network_connection_pool_pong()
+ */
+guint network_connection_pool_expire(network_connection_pool *pool, struct event_base *event_base, glong last_run, glong now) {
+	network_connection_pool_shard *shard = network_connection_pool_get_shard(pool);
+	GSList *closing = NULL;
+	GSList *pinging = NULL;
+	guint closed = 0;
+	glong t;
+
+	/* one round over the wheel covers all slots */
+	if (last_run <= 0 || now - last_run > NETWORK_CONNECTION_POOL_WHEEL_SLOTS) {
+		last_run = now - NETWORK_CONNECTION_POOL_WHEEL_SLOTS;
+	}
+
+	g_mutex_lock(shard->mutex);
+	for (t = last_run + 1; t <= now; t++) {
+		GList *link = shard->wheel[t % NETWORK_CONNECTION_POOL_WHEEL_SLOTS].head;
+
+		while (link) {
+			network_connection_pool_entry *entry = link->data;
+			network_socket *sock = entry->sock;
+
+			link = link->next;
+
+			if (entry->due_at > now) continue; /* a later round */
+			if (sock->event.ev_base != event_base) continue; /* another thread's connection */
+
+			network_connection_pool_unlink(shard, entry);
+
+			if (sock->pool_expires_at && sock->pool_expires_at <= now) {
+				closing = g_slist_prepend(closing, entry);
+			} else {
+				entry->is_pinging = TRUE;
+				g_queue_push_tail(&(shard->pinging), entry);
+				entry->link = shard->pinging.tail;
+
+				pinging = g_slist_prepend(pinging, entry);
+			}
+		}
+	}
+	g_mutex_unlock(shard->mutex);
 
+	while (closing) {
+		network_connection_pool_entry_free(closing->data, TRUE);
+
+		closing = g_slist_delete_link(closing, closing);
+		closed++;
+	}
+
+	if (closed) g_atomic_int_add(&(pool->expired_connections), closed);
+
+	while (pinging) {
+		network_connection_pool_entry *entry = pinging->data;
+		network_socket *sock = entry->sock;
+
+		/* COM_PING is a single packet, the server answers with a OK packet */
+		network_queue_append(sock->send_queue, g_string_new_len(C("\x01\x00\x00\x00" "\x0e")));
+
+		if (NETWORK_SOCKET_SUCCESS == network_socket_write(sock, -1)) {
+			g_atomic_int_inc(&(pool->pinged_connections));
+		} else {
+			network_connection_pool_remove(pool, entry);
+		}
+
+		pinging = g_slist_delete_link(pinging, pinging);
+	}
+
+	return closed;
+}
+
+/**
+ * put a connection back into the pool after the backend answered its COM_PING
+ */
+int network_connection_pool_pong(network_connection_pool *pool, network_connection_pool_entry *entry) {
+	network_connection_pool_shard *shard = entry->shard;
+
+	g_mutex_lock(shard->mutex);
+	if (!entry->is_pinging || NULL == entry->link) {
+		g_mutex_unlock(shard->mutex);
+		return -1;
+	}
+
+	g_queue_delete_link(&(shard->pinging), entry->link);
+	entry->link = NULL;
+	entry->is_pinging = FALSE;
+
+	/* the backend restarted its wait_timeout */
+	g_get_current_time(&(entry->added_ts));
+
+	network_connection_pool_link(shard, entry);
+	g_mutex_unlock(shard->mutex);
+
+	network_connection_pool_wake(pool, entry->sock);
+
+	return 0;
+}
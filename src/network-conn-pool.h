@@ -26,28 +26,178 @@
 
 #include "network-socket.h"
 #include "network-exports.h"
+#include "chassis-event-thread.h"
 
+/**
+ * slots of the timer-wheel of the pool, one per second
+ */
+#define NETWORK_CONNECTION_POOL_WHEEL_SLOTS 64
+
+/**
+ * wait_timeout of the backends until we learned it (the default of the server)
+ */
+#define NETWORK_CONNECTION_POOL_DEFAULT_WAIT_TIMEOUT 28800
+
+/**
+ * shards of a pool, the event-threads above share them
+ */
+#define NETWORK_CONNECTION_POOL_MAX_SHARDS 32
+
+/**
+ * the idling connections of a user
+ */
 typedef struct {
-	GHashTable *users; /** GHashTable<GString, GQueue<network_connection_pool_entry>> */
-	
-	guint max_idle_connections;
-	guint min_idle_connections;
-} network_connection_pool;
+	GString *name;     /** the username */
+
+	GQueue conns;      /** the idling connections, oldest first */
+
+	guint heap_ndx;    /** position in network_connection_pool::heap */
+} network_connection_pool_user;
+
+typedef struct network_connection_pool network_connection_pool;
+
+/**
+ * the idling connections of the event-threads that map to the same shard
+ *
+ * each event-thread adds its connections to its own shard and looks there first,
+ * the shards of the other event-threads are only searched if it has no matching connection
+ */
+typedef struct {
+	network_connection_pool *pool; /** a pointer back to the pool */
+
+	GHashTable *users; /** GHashTable<GString, network_connection_pool_user> */
+
+	/**
+	 * max-heap of the users ordered by their number of idling connections
+	 *
+	 * a client whose user has no idling connections takes one from the top. Protected by the mutex.
+	 */
+	GPtrArray *heap;
+
+	GMutex *mutex;     /** protects the users, the timer-wheel and the pinging connections of the shard */
+
+	volatile gint idle_connections;    /** idling connections of all users, changed with the mutex held */
+	volatile gint warming_connections; /** connections the pool manager is opening for this shard right now */
+
+	/**
+	 * timer-wheel of the idling connections
+	 *
+	 * the entries are hashed by the second they are due: either the time they have to 
+	 * be pinged to not hit the wait_timeout or the end of their lifetime. Protected by the mutex.
+	 *
+	 * @see network_connection_pool_expire()
+	 */
+	GQueue wheel[NETWORK_CONNECTION_POOL_WHEEL_SLOTS];
+	GQueue pinging;      /** entries that wait for the response to their COM_PING, protected by the mutex */
+
+	GQueue waiters;      /** network_connection_pool_waiter's of the clients of the event-threads, oldest first. Protected by the mutex */
+	volatile gint waiting_clients;     /** length of the waiters, changed with the mutex held */
+} network_connection_pool_shard;
+
+struct network_connection_pool {
+	/**
+	 * the shards of the event-threads
+	 *
+	 * created on the first use of a event-thread, event-thread n uses shard n % NETWORK_CONNECTION_POOL_MAX_SHARDS
+	 */
+	volatile gpointer shards[NETWORK_CONNECTION_POOL_MAX_SHARDS]; /** network_connection_pool_shard, use g_atomic_pointer_get() */
+
+	guint max_idle_connections; /** per user and shard */
+	guint min_idle_connections; /** per user and shard */
+
+	volatile gint warmed_connections;  /** connections the pool manager opened */
+	volatile gint warmup_backoff;      /** seconds the pool manager waits after the backend refused its connections, 0 if it didn't */
+	volatile gint warmup_retry_at;     /** second the pool manager opens connections again after a refusal */
+	volatile gint trimmed_connections; /** idling connections the pool manager closed */
+	volatile gint stolen_connections;  /** idling connections taken from the shard of another event-thread */
+
+	guint wait_timeout;  /** seconds the backend keeps idling connections open, learned by the pool manager */
+	guint max_lifetime;  /** seconds a connection stays in the pool at most, 0 for no limit */
+
+	volatile gint pinged_connections;  /** idling connections that got pinged */
+	volatile gint expired_connections; /** idling connections that were closed at the end of their lifetime */
+
+	volatile gint skipped_resets;      /** connections handed to a client without a reset */
+	volatile gint connection_resets;   /** connections cleaned up with COM_RESET_CONNECTION */
+	volatile gint change_user_resets;  /** connections cleaned up with COM_CHANGE_USER */
+};
 
 typedef struct {
 	network_socket *sock;          /** the idling socket */
 	
 	network_connection_pool *pool; /** a pointer back to the pool */
+	network_connection_pool_shard *shard; /** the shard the entry was added to */
 
 	GTimeVal added_ts;             /** added at ... we want to make sure we don't hit wait_timeout */
+
+	glong due_at;                  /** second the entry is due in the timer-wheel */
+	GList *wheel_link;             /** link in pool->wheel[due_at % NETWORK_CONNECTION_POOL_WHEEL_SLOTS] */
+
+	gboolean is_pinging;           /** a COM_PING was sent, the entry is in pool->pinging */
+
+	network_connection_pool_user *user; /** the user the entry idles for, NULL if it isn't idling */
+	GList *link;                   /** link in user->conns or in pool->pinging, NULL if it isn't in the pool */
+
+	chassis_event_thread_t *event_thread; /** the event-thread that watches the idling socket, NULL if it isn't a event-thread */
+
+	chassis_event_thread_t *migrate_to;   /** the event-thread that stole the connection while it is moved over */
+	struct event migrate_event;           /** asks the event_thread to give up the idling socket */
+	void (*idle_handler)(int, short, void *); /** the handler of the idling socket, re-added by the migrate_to thread */
 } network_connection_pool_entry;
 
+/**
+ * a client that waits for a idling connection of its user
+ *
+ * the waiter is queued in the shard of the client's event-thread. The next connection of the
+ * user that is added to any shard of the pool wakes up the oldest waiter it fits: the callback
+ * is called in the event-thread of the client, unless the waiter was cancelled meanwhile.
+ *
+ * The waiter is freed with the last reference: one of the client until it cancels it, one of the
+ * queue until it is woken up.
+ *
+ * @see network_connection_pool_wait()
+ */
+typedef struct {
+	GString *username;             /** the connection has to fit the user, the charset and the default-db of the client */
+	guint8   charset;
+	GString *default_db;
+
+	void (*callback)(gpointer user_data); /** called in the event_thread once a fitting connection was added */
+	gpointer user_data;
+
+	chassis_event_thread_t *event_thread; /** the event-thread of the client */
+	struct event wakeup_event;     /** fired in the event_thread to call the callback */
+
+	gboolean is_cancelled;         /** the client doesn't wait anymore, only touched in the event_thread */
+
+	network_connection_pool_shard *shard; /** the shard the waiter is queued in */
+	GList *link;                   /** link in shard->waiters, NULL once it is woken up or cancelled. Protected by the shard's mutex */
+
+	volatile gint ref_count;
+} network_connection_pool_waiter;
+
 NETWORK_API network_socket *network_connection_pool_get(network_connection_pool *pool,
 		GString *username,
 		GString *default_db);
+NETWORK_API network_socket *network_connection_pool_get_authed(network_connection_pool *pool,
+		network_mysqld_auth_response *auth,
+		GString *default_db);
 NETWORK_API network_connection_pool_entry *network_connection_pool_add(network_connection_pool *pool, network_socket *sock);
 NETWORK_API void network_connection_pool_remove(network_connection_pool *pool, network_connection_pool_entry *entry);
-NETWORK_API GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *);
+NETWORK_API GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *) G_GNUC_DEPRECATED;
+NETWORK_API guint network_connection_pool_get_idle_count(network_connection_pool *pool, GString *username);
+NETWORK_API guint network_connection_pool_get_warming_count(network_connection_pool *pool);
+NETWORK_API network_connection_pool_shard *network_connection_pool_get_shard(network_connection_pool *pool);
+NETWORK_API guint network_connection_pool_shard_get_idle_count(network_connection_pool_shard *shard, GString *username);
+NETWORK_API guint network_connection_pool_trim(network_connection_pool *pool, struct event_base *event_base);
+NETWORK_API guint network_connection_pool_expire(network_connection_pool *pool, struct event_base *event_base, glong last_run, glong now);
+NETWORK_API int network_connection_pool_pong(network_connection_pool *pool, network_connection_pool_entry *entry);
+NETWORK_API network_connection_pool_waiter *network_connection_pool_wait(network_connection_pool *pool,
+		network_mysqld_auth_response *auth,
+		GString *default_db,
+		void (*callback)(gpointer user_data),
+		gpointer user_data);
+NETWORK_API void network_connection_pool_waiter_cancel(network_connection_pool_waiter *waiter);
 
 NETWORK_API network_connection_pool *network_connection_pool_init(void) G_GNUC_DEPRECATED;
 NETWORK_API network_connection_pool *network_connection_pool_new(void);
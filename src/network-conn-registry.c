@@ -0,0 +1,264 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+
+#include "network-conn-registry.h"
+
+/**
+ * the id of a connection
+ *
+ *   63       32 31   24 23        0
+ *   generation | shard | slot-index
+ */
+#define ID_SHARD_SHIFT 24
+#define ID_INDEX_MASK  ((1 << ID_SHARD_SHIFT) - 1)
+
+#define SLOT_NONE G_MAXUINT32
+
+typedef struct {
+	gpointer con;        /**< the connection, NULL if the slot is free */
+
+	guint32 generation;  /**< incremented each time the slot is taken */
+	guint32 next_free;   /**< next free slot if the slot is free */
+} network_connection_registry_slot;
+
+typedef struct {
+	GMutex *mutex;
+
+	GPtrArray *slabs;    /**< array(network_connection_registry_slot[NETWORK_CONNECTION_REGISTRY_SLAB_SIZE]) */
+	guint32 free_slot;   /**< head of the free-list */
+} network_connection_registry_shard;
+
+/**
+ * a registered connection, copied out of a shard for network_connection_registry_foreach()
+ */
+typedef struct {
+	guint64 id;
+	gpointer con;
+} network_connection_registry_entry;
+
+struct network_connection_registry {
+	network_connection_registry_shard shards[NETWORK_CONNECTION_REGISTRY_SHARDS];
+
+	volatile gint count;
+	volatile gint foreach_running; /**< network_connection_registry_foreach() calls that may still call back with removed connections */
+};
+
+network_connection_registry *network_connection_registry_new(void) {
+	network_connection_registry *reg;
+	guint i;
+
+	reg = g_new0(network_connection_registry, 1);
+
+	for (i = 0; i < NETWORK_CONNECTION_REGISTRY_SHARDS; i++) {
+		network_connection_registry_shard *shard = &(reg->shards[i]);
+
+		shard->mutex = g_mutex_new();
+		shard->slabs = g_ptr_array_new();
+		shard->free_slot = SLOT_NONE;
+	}
+
+	return reg;
+}
+
+/**
+ * free the registry
+ *
+ * the connections that are still registered are not freed
+ */
+void network_connection_registry_free(network_connection_registry *reg) {
+	guint i, j;
+
+	if (!reg) return;
+
+	for (i = 0; i < NETWORK_CONNECTION_REGISTRY_SHARDS; i++) {
+		network_connection_registry_shard *shard = &(reg->shards[i]);
+
+		for (j = 0; j < shard->slabs->len; j++) {
+			g_free(shard->slabs->pdata[j]);
+		}
+		g_ptr_array_free(shard->slabs, TRUE);
+		g_mutex_free(shard->mutex);
+	}
+
+	g_free(reg);
+}
+
+static network_connection_registry_slot *network_connection_registry_shard_get_slot(network_connection_registry_shard *shard, guint32 ndx) {
+	network_connection_registry_slot *slab;
+
+	if (ndx / NETWORK_CONNECTION_REGISTRY_SLAB_SIZE >= shard->slabs->len) return NULL;
+
+	slab = shard->slabs->pdata[ndx / NETWORK_CONNECTION_REGISTRY_SLAB_SIZE];
+
+	return &(slab[ndx % NETWORK_CONNECTION_REGISTRY_SLAB_SIZE]);
+}
+
+/**
+ * add a connection to the registry
+ *
+ * @param shard_ndx the shard to add the connection to, usually picked by the thread that owns the connection
+ * @return the id of the connection, 0 if the shard is full
+ */
+guint64 network_connection_registry_add(network_connection_registry *reg, guint shard_ndx, gpointer con) {
+	network_connection_registry_shard *shard;
+	network_connection_registry_slot *slot;
+	guint32 ndx;
+	guint64 id;
+
+	g_return_val_if_fail(con != NULL, 0);
+
+	shard_ndx %= NETWORK_CONNECTION_REGISTRY_SHARDS;
+	shard = &(reg->shards[shard_ndx]);
+
+	g_mutex_lock(shard->mutex);
+	if (shard->free_slot == SLOT_NONE) {
+		/* add a new slab and put its slots on the free-list */
+		network_connection_registry_slot *slab;
+		guint32 first = shard->slabs->len * NETWORK_CONNECTION_REGISTRY_SLAB_SIZE;
+		guint i;
+
+		if (first + NETWORK_CONNECTION_REGISTRY_SLAB_SIZE > ID_INDEX_MASK) {
+			g_mutex_unlock(shard->mutex);
+
+			g_critical("%s: shard %u of the connection registry is full", G_STRLOC, shard_ndx);
+			return 0;
+		}
+
+		slab = g_new0(network_connection_registry_slot, NETWORK_CONNECTION_REGISTRY_SLAB_SIZE);
+		for (i = 0; i < NETWORK_CONNECTION_REGISTRY_SLAB_SIZE; i++) {
+			slab[i].next_free = (i + 1 < NETWORK_CONNECTION_REGISTRY_SLAB_SIZE) ? first + i + 1 : SLOT_NONE;
+		}
+		g_ptr_array_add(shard->slabs, slab);
+
+		shard->free_slot = first;
+	}
+
+	ndx = shard->free_slot;
+	slot = network_connection_registry_shard_get_slot(shard, ndx);
+
+	shard->free_slot = slot->next_free;
+
+	slot->con = con;
+	slot->next_free = SLOT_NONE;
+	if (++slot->generation == 0) slot->generation = 1; /* id 0 is never handed out */
+
+	id = ((guint64)slot->generation << 32) | ((guint64)shard_ndx << ID_SHARD_SHIFT) | ndx;
+	g_mutex_unlock(shard->mutex);
+
+	g_atomic_int_inc(&(reg->count));
+
+	return id;
+}
+
+/**
+ * remove a connection from the registry
+ *
+ * @return TRUE if the id was registered
+ */
+gboolean network_connection_registry_remove(network_connection_registry *reg, guint64 id) {
+	network_connection_registry_shard *shard;
+	network_connection_registry_slot *slot;
+	guint32 ndx = id & ID_INDEX_MASK;
+	guint shard_ndx = (id >> ID_SHARD_SHIFT) & 0xff;
+	gboolean is_removed = FALSE;
+
+	if (shard_ndx >= NETWORK_CONNECTION_REGISTRY_SHARDS) return FALSE;
+
+	shard = &(reg->shards[shard_ndx]);
+
+	g_mutex_lock(shard->mutex);
+	slot = network_connection_registry_shard_get_slot(shard, ndx);
+	if (slot && slot->con && slot->generation == (guint32)(id >> 32)) {
+		slot->con = NULL;
+		slot->next_free = shard->free_slot;
+		shard->free_slot = ndx;
+
+		is_removed = TRUE;
+	}
+	g_mutex_unlock(shard->mutex);
+
+	if (is_removed) {
+		g_atomic_int_add(&(reg->count), -1);
+
+		/* a foreach may have copied the connection out before we removed it, the caller
+		 * frees the connection after we return. The callbacks are short, wait for them. */
+		while (g_atomic_int_get(&(reg->foreach_running)) > 0) g_thread_yield();
+	}
+
+	return is_removed;
+}
+
+guint network_connection_registry_count(network_connection_registry *reg) {
+	return g_atomic_int_get(&(reg->count));
+}
+
+/**
+ * call func for each registered connection
+ *
+ * the connections of a shard are copied out with its lock held, func is called after the
+ * lock is released: func may call into the registry and doesn't block the threads that add
+ * and remove connections. A connection that is removed meanwhile isn't freed before the
+ * foreach is done (network_connection_registry_remove() waits for it), but the thread that
+ * owns the connection may still change it. func must not remove connections.
+ */
+void network_connection_registry_foreach(network_connection_registry *reg, network_connection_registry_func func, gpointer user_data) {
+	GArray *entries;
+	guint i, j;
+
+	entries = g_array_new(FALSE, FALSE, sizeof(network_connection_registry_entry));
+
+	g_atomic_int_inc(&(reg->foreach_running));
+
+	for (i = 0; i < NETWORK_CONNECTION_REGISTRY_SHARDS; i++) {
+		network_connection_registry_shard *shard = &(reg->shards[i]);
+		guint32 ndx;
+
+		g_mutex_lock(shard->mutex);
+		for (ndx = 0; ndx < shard->slabs->len * NETWORK_CONNECTION_REGISTRY_SLAB_SIZE; ndx++) {
+			network_connection_registry_slot *slot = network_connection_registry_shard_get_slot(shard, ndx);
+			network_connection_registry_entry entry;
+
+			if (!slot->con) continue;
+
+			entry.id = ((guint64)slot->generation << 32) | ((guint64)i << ID_SHARD_SHIFT) | ndx;
+			entry.con = slot->con;
+
+			g_array_append_val(entries, entry);
+		}
+		g_mutex_unlock(shard->mutex);
+
+		for (j = 0; j < entries->len; j++) {
+			network_connection_registry_entry *entry = &g_array_index(entries, network_connection_registry_entry, j);
+
+			func(entry->id, entry->con, user_data);
+		}
+		g_array_set_size(entries, 0);
+	}
+
+	g_atomic_int_add(&(reg->foreach_running), -1);
+
+	g_array_free(entries, TRUE);
+}
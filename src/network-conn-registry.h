@@ -0,0 +1,67 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_CONN_REGISTRY_H_
+#define _NETWORK_CONN_REGISTRY_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * shards of the registry
+ *
+ * event-thread n (the main-thread is event-thread 0) uses shard n + 1, shard 0 is only used
+ * for connections that aren't pinned to a event-thread
+ */
+#define NETWORK_CONNECTION_REGISTRY_SHARDS 16
+
+/**
+ * slots per slab
+ */
+#define NETWORK_CONNECTION_REGISTRY_SLAB_SIZE 1024
+
+/**
+ * the registry of all connections
+ *
+ * Each shard has its own lock and a list of slabs with a free-list of
+ * slots, adding and removing a connection is O(1) and the threads don't
+ * contend for the same lock as long as each thread uses its own shard.
+ *
+ * A connection is identified by a 64bit id that stays the same for its
+ * lifetime and isn't reused: a slot gets a new generation each time it is
+ * reused.
+ */
+typedef struct network_connection_registry network_connection_registry;
+
+/**
+ * called for each connection in network_connection_registry_foreach()
+ */
+typedef void (*network_connection_registry_func)(guint64 id, gpointer con, gpointer user_data);
+
+NETWORK_API network_connection_registry *network_connection_registry_new(void);
+NETWORK_API void network_connection_registry_free(network_connection_registry *reg);
+NETWORK_API guint64 network_connection_registry_add(network_connection_registry *reg, guint shard, gpointer con);
+NETWORK_API gboolean network_connection_registry_remove(network_connection_registry *reg, guint64 id);
+NETWORK_API guint network_connection_registry_count(network_connection_registry *reg);
+NETWORK_API void network_connection_registry_foreach(network_connection_registry *reg, network_connection_registry_func func, gpointer user_data);
+
+#endif
@@ -20,6 +20,7 @@
  
 
 #include <string.h>
+#include <errno.h>
 
 #include "network-injection-lua.h"
 
@@ -381,6 +382,536 @@ static int proxy_resultset_fields_lua_push_ref(lua_State *L, GRef *ref) {
 	return 1;
 }
 
+/**
+ * a field of a row, points into the row-packet
+ */
+typedef struct {
+	gsize offset;     /**< start of the field in the row-packet */
+	gsize len;
+	gboolean is_null;
+} proxy_resultset_row_field;
+
+/**
+ * a row of the resultset that is decoded on demand
+ *
+ * the length-encoded fields are parsed up to the highest field that is asked for, the
+ * positions of the parsed fields are kept for the next access.
+ */
+typedef struct {
+	network_packet packet;          /**< the row-packet, .offset is where the next unparsed field starts */
+	guint fields_len;               /**< number of fields in .fields */
+	guint parsed_fields_len;        /**< number of fields that are parsed already */
+	proxy_resultset_row_field *fields;
+} proxy_resultset_row;
+
+/**
+ * point the row to a row-packet
+ *
+ * @return 0 if it is a row, 1 if it is the EOF or ERR packet after the rows, -1 on a protocol error
+ */
+static int proxy_resultset_row_set(proxy_resultset_row *row, GString *packet) {
+	network_mysqld_lenenc_type lenenc_type;
+	int err = 0;
+
+	row->packet.data = packet;
+	row->packet.offset = 0;
+	row->parsed_fields_len = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&row->packet);
+	err = err || network_mysqld_proto_peek_lenenc_type(&row->packet, &lenenc_type);
+	if (err) return -1;
+
+	switch (lenenc_type) {
+	case NETWORK_MYSQLD_LENENC_TYPE_ERR:
+		/* a ERR packet instead of more rows */
+	case NETWORK_MYSQLD_LENENC_TYPE_EOF:
+		return 1;
+	case NETWORK_MYSQLD_LENENC_TYPE_INT:
+	case NETWORK_MYSQLD_LENENC_TYPE_NULL:
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * get a field of the row
+ *
+ * @param ndx  index of the field, starting at 0
+ * @return 0 on success, -1 on a protocol error
+ */
+static int proxy_resultset_row_get_field(proxy_resultset_row *row, guint ndx, proxy_resultset_row_field **_field) {
+	g_assert(ndx < row->fields_len);
+
+	while (row->parsed_fields_len <= ndx) {
+		proxy_resultset_row_field *field = &row->fields[row->parsed_fields_len];
+		network_mysqld_lenenc_type lenenc_type;
+		guint64 field_len;
+		int err = 0;
+
+		err = err || network_mysqld_proto_peek_lenenc_type(&row->packet, &lenenc_type);
+		if (err) return -1;
+
+		switch (lenenc_type) {
+		case NETWORK_MYSQLD_LENENC_TYPE_NULL:
+			field->is_null = TRUE;
+			field->offset = row->packet.offset;
+			field->len = 0;
+
+			err = err || network_mysqld_proto_skip(&row->packet, 1);
+			break;
+		case NETWORK_MYSQLD_LENENC_TYPE_INT:
+			err = err || network_mysqld_proto_get_lenenc_int(&row->packet, &field_len);
+			err = err || !(field_len <= row->packet.data->len); /* just to check that we don't overrun by the addition */
+			err = err || !(row->packet.offset + field_len <= row->packet.data->len); /* check that we have enough string-bytes for the length-encoded string */
+			if (err) return -1;
+
+			field->is_null = FALSE;
+			field->offset = row->packet.offset;
+			field->len = field_len;
+
+			err = err || network_mysqld_proto_skip(&row->packet, field_len);
+			break;
+		default:
+			/* EOF and ERR should come up here */
+			err = 1;
+			break;
+		}
+		if (err) return -1;
+
+		row->parsed_fields_len++;
+	}
+
+	*_field = &row->fields[ndx];
+
+	return 0;
+}
+
+/**
+ * a cursor over the rows of a resultset
+ *
+ * the iterator moves the cursor to the next row and hands out the cursor itself: the
+ * scripts only pay for the fields they read
+ */
+typedef struct {
+	GRef *ref;                   /**< the resultset */
+	GList *next_row;             /**< the row-packet the next iteration moves to */
+	proxy_resultset_row row;     /**< the current row, .fields is allocated with the cursor */
+} proxy_resultset_cursor;
+
+/**
+ * get a field of the current row
+ *
+ * returns the field as string or nil if it is NULL
+ */
+static int proxy_resultset_cursor_get(lua_State *L) {
+	proxy_resultset_cursor *cursor = luaL_checkself(L);
+	proxy_resultset_row_field *field;
+	lua_Integer ndx;
+
+	if (lua_type(L, 2) != LUA_TNUMBER) {
+		lua_pushnil(L);
+
+		return 1;
+	}
+
+	ndx = lua_tointeger(L, 2);
+
+	/* no current row or out of range */
+	if (NULL == cursor->row.packet.data ||
+	    ndx < 1 || ndx > (lua_Integer)cursor->row.fields_len) {
+		lua_pushnil(L);
+
+		return 1;
+	}
+
+	if (0 != proxy_resultset_row_get_field(&cursor->row, ndx - 1, &field)) {
+		return luaL_error(L, "%s: row-data is invalid", G_STRLOC);
+	}
+
+	if (field->is_null) {
+		lua_pushnil(L);
+	} else {
+		lua_pushlstring(L, cursor->row.packet.data->str + field->offset, field->len);
+	}
+
+	return 1;
+}
+
+static int proxy_resultset_cursor_len(lua_State *L) {
+	proxy_resultset_cursor *cursor = luaL_checkself(L);
+
+	lua_pushinteger(L, cursor->row.fields_len);
+
+	return 1;
+}
+
+static int proxy_resultset_cursor_gc(lua_State *L) {
+	proxy_resultset_cursor *cursor = luaL_checkself(L);
+
+	g_ref_unref(cursor->ref);
+
+	return 0;
+}
+
+static const struct luaL_reg methods_proxy_resultset_cursor[] = {
+	{ "__index", proxy_resultset_cursor_get },
+	{ "__len", proxy_resultset_cursor_len },
+	{ "__gc", proxy_resultset_cursor_gc },
+	{ NULL, NULL },
+};
+
+/**
+ * move the cursor to the next row
+ *
+ * @return the cursor or nothing if there are no more rows
+ */
+static int proxy_resultset_cursor_iter(lua_State *L) {
+	proxy_resultset_cursor *cursor = lua_touserdata(L, lua_upvalueindex(1));
+
+	if (NULL == cursor->next_row) return 0;
+
+	switch (proxy_resultset_row_set(&cursor->row, cursor->next_row->data)) {
+	case 0:
+		break;
+	case 1:
+		cursor->next_row = NULL;
+		cursor->row.packet.data = NULL;
+
+		return 0;
+	default:
+		cursor->next_row = NULL;
+		cursor->row.packet.data = NULL;
+
+		return luaL_error(L, "%s: row-data is invalid", G_STRLOC);
+	}
+
+	cursor->next_row = cursor->next_row->next;
+
+	lua_pushvalue(L, lua_upvalueindex(1));
+
+	return 1;
+}
+
+static int proxy_resultset_cursor_lua_push(lua_State *L, GRef *ref) {
+	proxy_resultset_t *res = ref->udata;
+	proxy_resultset_cursor *cursor;
+
+	/* the cached fields are allocated with the cursor */
+	cursor = lua_newuserdata(L, sizeof(*cursor) + res->fields->len * sizeof(proxy_resultset_row_field));
+
+	g_ref_ref(ref);
+	cursor->ref = ref;
+	cursor->next_row = res->rows_chunk_head;
+	cursor->row.packet.data = NULL;
+	cursor->row.packet.offset = 0;
+	cursor->row.fields_len = res->fields->len;
+	cursor->row.parsed_fields_len = 0;
+	cursor->row.fields = (proxy_resultset_row_field *)(cursor + 1);
+
+	proxy_getmetatable(L, methods_proxy_resultset_cursor);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+typedef enum {
+	PROXY_RESULTSET_AGGREGATE_COUNT,
+	PROXY_RESULTSET_AGGREGATE_MIN,
+	PROXY_RESULTSET_AGGREGATE_MAX
+} proxy_resultset_aggregate_t;
+
+/**
+ * how the values of a column are compared by :min() and :max()
+ */
+typedef enum {
+	PROXY_RESULTSET_CMP_BYTES,    /**< byte-wise */
+	PROXY_RESULTSET_CMP_SIGNED,   /**< as gint64 */
+	PROXY_RESULTSET_CMP_UNSIGNED, /**< as guint64 */
+	PROXY_RESULTSET_CMP_DECIMAL,  /**< as decimal string, a DECIMAL has up to 65 digits */
+	PROXY_RESULTSET_CMP_DOUBLE    /**< as gdouble */
+} proxy_resultset_cmp_t;
+
+/**
+ * a value of a column, decoded for the comparison
+ */
+typedef struct {
+	const gchar *str;           /**< the text of the value in the row-packet */
+	gsize len;
+
+	gint64 i;
+	guint64 u;
+	gdouble d;
+
+	gboolean is_negative;       /**< DECIMAL: the sign, FALSE for a zero */
+	const gchar *int_digits;    /**< DECIMAL: the integer digits without leading zeros */
+	gsize int_len;
+	const gchar *frac_digits;   /**< DECIMAL: the fraction digits without trailing zeros */
+	gsize frac_len;
+} proxy_resultset_value;
+
+/**
+ * get the comparison for the text of a field of this type
+ */
+static proxy_resultset_cmp_t proxy_resultset_field_get_cmp(MYSQL_FIELD *field) {
+	switch (field->type) {
+	case MYSQL_TYPE_TINY:
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_LONG:
+	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_YEAR:
+		return (field->flags & UNSIGNED_FLAG) ? PROXY_RESULTSET_CMP_UNSIGNED : PROXY_RESULTSET_CMP_SIGNED;
+	case MYSQL_TYPE_DECIMAL:
+	case MYSQL_TYPE_NEWDECIMAL:
+		return PROXY_RESULTSET_CMP_DECIMAL;
+	case MYSQL_TYPE_FLOAT:
+	case MYSQL_TYPE_DOUBLE:
+		return PROXY_RESULTSET_CMP_DOUBLE;
+	default:
+		return PROXY_RESULTSET_CMP_BYTES;
+	}
+}
+
+/**
+ * split the text of a DECIMAL into its sign, integer and fraction digits
+ *
+ * @return 0 on success, -1 if it isn't a decimal number
+ */
+static int proxy_resultset_value_parse_decimal(proxy_resultset_value *v) {
+	const gchar *s = v->str;
+	const gchar *s_end = v->str + v->len;
+
+	v->is_negative = FALSE;
+	if (s < s_end && (*s == '-' || *s == '+')) {
+		v->is_negative = (*s == '-');
+		s++;
+	}
+
+	v->int_digits = s;
+	while (s < s_end && g_ascii_isdigit(*s)) s++;
+	v->int_len = s - v->int_digits;
+
+	v->frac_digits = s;
+	v->frac_len = 0;
+	if (s < s_end && *s == '.') {
+		v->frac_digits = ++s;
+		while (s < s_end && g_ascii_isdigit(*s)) s++;
+		v->frac_len = s - v->frac_digits;
+	}
+
+	if (s != s_end || v->int_len + v->frac_len == 0) return -1;
+
+	while (v->int_len > 0 && v->int_digits[0] == '0') {
+		v->int_digits++;
+		v->int_len--;
+	}
+	while (v->frac_len > 0 && v->frac_digits[v->frac_len - 1] == '0') v->frac_len--;
+
+	/* -0.00 is 0 */
+	if (v->int_len + v->frac_len == 0) v->is_negative = FALSE;
+
+	return 0;
+}
+
+/**
+ * decode the text of a value for the comparison
+ *
+ * @return 0 on success, -1 if the text doesn't fit the type of the column
+ */
+static int proxy_resultset_value_parse(proxy_resultset_cmp_t cmp, const gchar *str, gsize len, proxy_resultset_value *v) {
+	gchar num_str[64]; /* a DOUBLE has at most 23 chars, a BIGINT 20 */
+	gchar *num_end = NULL;
+
+	v->str = str;
+	v->len = len;
+
+	switch (cmp) {
+	case PROXY_RESULTSET_CMP_BYTES:
+		return 0;
+	case PROXY_RESULTSET_CMP_DECIMAL:
+		return proxy_resultset_value_parse_decimal(v);
+	default:
+		break;
+	}
+
+	if (len == 0 || len >= sizeof(num_str)) return -1;
+
+	memcpy(num_str, str, len);
+	num_str[len] = '\0';
+
+	errno = 0;
+	switch (cmp) {
+	case PROXY_RESULTSET_CMP_SIGNED:
+		v->i = g_ascii_strtoll(num_str, &num_end, 10);
+		break;
+	case PROXY_RESULTSET_CMP_UNSIGNED:
+		if (num_str[0] == '-') return -1; /* g_ascii_strtoull() would negate it */
+
+		v->u = g_ascii_strtoull(num_str, &num_end, 10);
+		break;
+	case PROXY_RESULTSET_CMP_DOUBLE:
+		v->d = g_ascii_strtod(num_str, &num_end);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+
+	if (num_end != num_str + len || errno == ERANGE) return -1;
+
+	return 0;
+}
+
+/**
+ * compare two decoded values of a column
+ *
+ * @return <0, 0 or >0 like memcmp()
+ */
+static int proxy_resultset_value_cmp(proxy_resultset_cmp_t cmp, proxy_resultset_value *a, proxy_resultset_value *b) {
+	int ret;
+
+	switch (cmp) {
+	case PROXY_RESULTSET_CMP_SIGNED:
+		return (a->i > b->i) - (a->i < b->i);
+	case PROXY_RESULTSET_CMP_UNSIGNED:
+		return (a->u > b->u) - (a->u < b->u);
+	case PROXY_RESULTSET_CMP_DOUBLE:
+		return (a->d > b->d) - (a->d < b->d);
+	case PROXY_RESULTSET_CMP_DECIMAL:
+		/* the sign, the number of integer digits, the integer digits and then the fraction */
+		if (a->is_negative != b->is_negative) return a->is_negative ? -1 : 1;
+
+		ret = (a->int_len > b->int_len) - (a->int_len < b->int_len);
+		if (ret == 0) ret = memcmp(a->int_digits, b->int_digits, a->int_len);
+		if (ret == 0) ret = memcmp(a->frac_digits, b->frac_digits, MIN(a->frac_len, b->frac_len));
+		if (ret == 0) ret = (a->frac_len > b->frac_len) - (a->frac_len < b->frac_len);
+
+		return a->is_negative ? -ret : ret;
+	case PROXY_RESULTSET_CMP_BYTES:
+		ret = memcmp(a->str, b->str, MIN(a->len, b->len));
+		if (ret == 0) ret = (a->len > b->len) - (a->len < b->len);
+
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * handle :count(), :min() and :max()
+ *
+ * walks the row-packets in C and only decodes the fields up to the column
+ *
+ * - :count() counts the rows, :count(ndx) the rows where the column isn't NULL
+ * - :min(ndx) and :max(ndx) compare integer columns as 64bit integers, DECIMALs digit-wise,
+ *   FLOAT and DOUBLE as double and the other columns byte-wise, NULLs are ignored.
+ *   A value that doesn't fit the type of its column raises a error.
+ */
+static int proxy_resultset_aggregate(lua_State *L, proxy_resultset_aggregate_t type) {
+	GRef *ref = *(GRef **)luaL_checkself(L);
+	proxy_resultset_t *res = ref->udata;
+	proxy_resultset_row row;
+	lua_Integer ndx = 0;
+	proxy_resultset_cmp_t cmp = PROXY_RESULTSET_CMP_BYTES;
+	proxy_resultset_value best;
+	gboolean has_best = FALSE;
+	lua_Integer count = 0;
+	GList *chunk;
+
+	if (!res->result_queue) {
+		return luaL_error(L, ".resultset's aggregations aren't available if 'resultset_is_needed ~= true'");
+	} else if (res->qstat.binary_encoded) {
+		return luaL_error(L, ".resultset's aggregations aren't available for prepared statements");
+	}
+
+	if (type != PROXY_RESULTSET_AGGREGATE_COUNT || !lua_isnoneornil(L, 2)) {
+		ndx = luaL_checkinteger(L, 2);
+	}
+
+	/* no resultset */
+	if (0 != parse_resultset_fields(res) || NULL == res->rows_chunk_head) {
+		lua_pushnil(L);
+
+		return 1;
+	}
+
+	if (ndx < 0 || ndx > (lua_Integer)res->fields->len) {
+		return luaL_argerror(L, 2, "no such column");
+	}
+
+	if (ndx > 0) {
+		cmp = proxy_resultset_field_get_cmp(res->fields->pdata[ndx - 1]);
+	}
+
+	/* only the fields up to the column get parsed */
+	row.fields_len = ndx;
+	row.fields = g_new(proxy_resultset_row_field, ndx > 0 ? ndx : 1);
+
+	for (chunk = res->rows_chunk_head; chunk; chunk = chunk->next) {
+		proxy_resultset_row_field *field = NULL;
+		proxy_resultset_value value;
+		int ret;
+
+		ret = proxy_resultset_row_set(&row, chunk->data);
+		if (ret == 1) break;
+
+		if (ret != 0 ||
+		    (ndx > 0 && 0 != proxy_resultset_row_get_field(&row, ndx - 1, &field))) {
+			g_free(row.fields);
+
+			return luaL_error(L, "%s: row-data is invalid", G_STRLOC);
+		}
+
+		if (ndx == 0) {
+			count++;
+			continue;
+		}
+
+		if (field->is_null) continue;
+
+		count++;
+
+		if (type == PROXY_RESULTSET_AGGREGATE_COUNT) continue;
+
+		if (0 != proxy_resultset_value_parse(cmp, row.packet.data->str + field->offset, field->len, &value)) {
+			g_free(row.fields);
+
+			return luaL_error(L, "%s: the value of column %d isn't a number", G_STRLOC, (int)ndx);
+		}
+
+		if (!has_best ||
+		    (type == PROXY_RESULTSET_AGGREGATE_MIN && proxy_resultset_value_cmp(cmp, &value, &best) < 0) ||
+		    (type == PROXY_RESULTSET_AGGREGATE_MAX && proxy_resultset_value_cmp(cmp, &value, &best) > 0)) {
+			best = value;
+			has_best = TRUE;
+		}
+	}
+
+	g_free(row.fields);
+
+	if (type == PROXY_RESULTSET_AGGREGATE_COUNT) {
+		lua_pushinteger(L, count);
+	} else if (has_best) {
+		lua_pushlstring(L, best.str, best.len); /* the packets are still around */
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static int proxy_resultset_count(lua_State *L) {
+	return proxy_resultset_aggregate(L, PROXY_RESULTSET_AGGREGATE_COUNT);
+}
+
+static int proxy_resultset_min(lua_State *L) {
+	return proxy_resultset_aggregate(L, PROXY_RESULTSET_AGGREGATE_MIN);
+}
+
+static int proxy_resultset_max(lua_State *L) {
+	return proxy_resultset_aggregate(L, PROXY_RESULTSET_AGGREGATE_MAX);
+}
+
 static int proxy_resultset_get(lua_State *L) {
 	GRef *ref = *(GRef **)luaL_checkself(L);
 	proxy_resultset_t *res = ref->udata;
@@ -419,6 +950,28 @@ static int proxy_resultset_get(lua_State *L) {
 				lua_pushnil(L);
 			}
 		}
+	} else if (strleq(key, keysize, C("cursor"))) {
+		if (!res->result_queue) {
+			luaL_error(L, ".resultset.cursor isn't available if 'resultset_is_needed ~= true'");
+		} else if (res->qstat.binary_encoded) {
+			luaL_error(L, ".resultset.cursor isn't available for prepared statements");
+		} else {
+			parse_resultset_fields(res); /* set up the ->rows_chunk_head pointer */
+
+			if (res->rows_chunk_head) {
+				proxy_resultset_cursor_lua_push(L, ref);
+
+				lua_pushcclosure(L, proxy_resultset_cursor_iter, 1);
+			} else {
+				lua_pushnil(L);
+			}
+		}
+	} else if (strleq(key, keysize, C("count"))) {
+		lua_pushcfunction(L, proxy_resultset_count);
+	} else if (strleq(key, keysize, C("min"))) {
+		lua_pushcfunction(L, proxy_resultset_min);
+	} else if (strleq(key, keysize, C("max"))) {
+		lua_pushcfunction(L, proxy_resultset_max);
 	} else if (strleq(key, keysize, C("row_count"))) {
 		lua_pushinteger(L, res->rows);
 	} else if (strleq(key, keysize, C("bytes"))) {
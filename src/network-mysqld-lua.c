@@ -34,6 +34,7 @@
 
 #include "network-backend.h"
 #include "glib-ext.h"
+#include "glib-ext-pool.h"
 #include "lua-env.h"
 
 #include "network-mysqld.h"
@@ -44,13 +45,16 @@
 #include "network-conn-pool.h"
 #include "network-conn-pool-lua.h"
 #include "network-injection-lua.h"
+#include "lua-shared-table.h"
 
 #define C(x) x, sizeof(x) - 1
 
+static GPool network_mysqld_con_lua_pool = G_POOL_INIT("network_mysqld_con_lua", network_mysqld_con_lua_t);
+
 network_mysqld_con_lua_t *network_mysqld_con_lua_new() {
 	network_mysqld_con_lua_t *st;
 
-	st = g_new0(network_mysqld_con_lua_t, 1);
+	st = g_pool_alloc0(&network_mysqld_con_lua_pool);
 
 	st->injected.queries = network_injection_queue_new();
 	
@@ -62,7 +66,10 @@ void network_mysqld_con_lua_free(network_mysqld_con_lua_t *st) {
 
 	network_injection_queue_free(st->injected.queries);
 
-	g_free(st);
+	/* the plugin cancelled the waiters */
+	if (st->pool_waiters) g_ptr_array_free(st->pool_waiters, TRUE);
+
+	g_pool_free(&network_mysqld_con_lua_pool, st);
 }
 
 
@@ -165,6 +172,101 @@ int network_mysqld_con_getmetatable(lua_State *L) {
  * 
  * @see lua_register_callback - for connection local setup
  */
+typedef struct {
+	guint64 id;
+	gchar *client;
+	network_mysqld_con_state_t state;
+	gint event_thread;
+} proxy_connection_info;
+
+static void proxy_connections_snapshot(guint64 id, gpointer _con, gpointer user_data) {
+	network_mysqld_con *con = _con;
+	GArray *infos = user_data;
+	proxy_connection_info info;
+
+	info.id = id;
+	info.client = (con->client && con->client->src) ? g_strdup(con->client->src->name->str) : NULL;
+	info.state = con->state;
+	info.event_thread = con->event_thread ? (gint)con->event_thread->index : -1;
+
+	g_array_append_val(infos, info);
+}
+
+/**
+ * get a snapshot of all connections
+ *
+ *   for i, con in ipairs(proxy.global.connections()) do
+ *     print(con.id, con.client, con.state, con.event_thread)
+ *   end
+ *
+ * the connections of all plugins are returned, listening sockets have no .client
+ */
+static int proxy_connections_get(lua_State *L) {
+	chassis_private *g = lua_touserdata(L, lua_upvalueindex(1));
+	GArray *infos;
+	guint i;
+
+	/* copy the fields out in the callbacks, the connections aren't freed meanwhile, and build the lua-table afterwards */
+	infos = g_array_new(FALSE, FALSE, sizeof(proxy_connection_info));
+	network_connection_registry_foreach(g->cons, proxy_connections_snapshot, infos);
+
+	lua_createtable(L, infos->len, 0);
+	for (i = 0; i < infos->len; i++) {
+		proxy_connection_info *info = &g_array_index(infos, proxy_connection_info, i);
+		gchar id_str[21];
+
+		lua_createtable(L, 0, 4);
+
+		/* a lua_Number can't hold all 64bit */
+		g_snprintf(id_str, sizeof(id_str), "%"G_GUINT64_FORMAT, info->id);
+		lua_pushstring(L, id_str);
+		lua_setfield(L, -2, "id");
+		if (info->client) {
+			lua_pushstring(L, info->client);
+			lua_setfield(L, -2, "client");
+		}
+		lua_pushstring(L, network_mysqld_con_state_get_name(info->state));
+		lua_setfield(L, -2, "state");
+		if (info->event_thread >= 0) {
+			lua_pushinteger(L, info->event_thread + 1);
+			lua_setfield(L, -2, "event_thread");
+		}
+
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	for (i = 0; i < infos->len; i++) {
+		g_free(g_array_index(infos, proxy_connection_info, i).client);
+	}
+	g_array_free(infos, TRUE);
+
+	return 1;
+}
+
+/**
+ * reference proxy.global of the global lua-scope, set it up if needed
+ *
+ * runs via lua_cpcall() with the lock of the global lua-scope held
+ *
+ * @see network_mysqld_lua_setup_global()
+ */
+static int network_mysqld_lua_ref_global(lua_State *S) {
+	int *ref = lua_touserdata(S, 1);
+
+	lua_getglobal(S, "proxy");
+	if (lua_isnil(S, -1)) {
+		lua_pop(S, 1);
+
+		network_mysqld_lua_init_global_fenv(S);
+
+		lua_getglobal(S, "proxy");
+	}
+	lua_getfield(S, -1, "global");
+	*ref = luaL_ref(S, LUA_REGISTRYINDEX);
+
+	return 0;
+}
+
 void network_mysqld_lua_setup_global(lua_State *L , chassis_private *g) {
 	network_backends_t **backends_p;
 
@@ -197,13 +299,53 @@ void network_mysqld_lua_setup_global(lua_State *L , chassis_private *g) {
 	 */
 	lua_getfield(L, -1, "global");
 
+	if (L != g->sc->L) {
+		/* a per-thread lua-state: keep .backends local and forward the rest
+		 * of proxy.global to the one of the global lua-scope */
+		if (0 == lua_getmetatable(L, -1)) {
+			lua_State *S = g->sc->L;
+			int ref = LUA_NOREF;
+			int err;
+
+			lua_pushnil(L);
+			lua_setfield(L, -2, "config"); /* proxy.global.config is shared too */
+
+			/* protected, a error must not leave the global lua-scope locked */
+			LOCK_LUA(g->sc);
+			if (0 != (err = lua_cpcall(S, network_mysqld_lua_ref_global, &ref))) {
+				g_critical("%s: setting up the shared proxy.global failed: %s",
+						G_STRLOC,
+						lua_isstring(S, -1) ? lua_tostring(S, -1) : "(no error message)");
+				lua_pop(S, 1);
+			}
+			UNLOCK_LUA(g->sc);
+
+			/* without the forward proxy.global stays local to this lua-state */
+			if (0 == err) lua_shared_table_forward(L, -1, g->shared, ref);
+		} else {
+			lua_pop(L, 1); /* already forwarded */
+		}
+	}
+
+	/* rawset() as a forwarded proxy.global would try to store them in the shared table */
+	lua_pushliteral(L, "backends");
 	backends_p = lua_newuserdata(L, sizeof(network_backends_t *));
 	*backends_p = g->backends;
 
 	network_backends_lua_getmetatable(L);
 	lua_setmetatable(L, -2);          /* tie the metatable to the table   (sp -= 1) */
 
-	lua_setfield(L, -2, "backends");
+	lua_rawset(L, -3);
+
+	/**
+	 * register proxy.global.connections()
+	 *
+	 * @see proxy_connections_get()
+	 */
+	lua_pushliteral(L, "connections");
+	lua_pushlightuserdata(L, g);
+	lua_pushcclosure(L, proxy_connections_get, 1);
+	lua_rawset(L, -3);
 
 	lua_pop(L, 2);  /* _G.proxy.global and _G.proxy */
 
@@ -252,7 +394,7 @@ int network_mysqld_lua_load_script(lua_scope *sc, const char *lua_script) {
  *
  * has to be called before any lua_pcall() is called to start a hook function
  *
- * - we use a global lua_State which is split into child-states with lua_newthread()
+ * - we use the lua_State of the connection's lua-scope which is split into child-states with lua_newthread()
  * - luaL_ref() moves the state into the registry and cleans up the global stack
  * - on connection close we call luaL_unref() to hand the thread to the GC
  *
@@ -270,7 +412,7 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 	network_mysqld_con_lua_t *st   = con->plugin_con_state;
 	chassis_private *g = con->srv->priv; 
 
-	lua_scope  *sc = g->sc;
+	lua_scope  *sc = con->sc;
 
 	GQueue **q_p;
 	network_mysqld_con **con_p;
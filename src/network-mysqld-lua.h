@@ -67,12 +67,21 @@ typedef struct {
 	network_backend_t *backend;
 	int backend_ndx;               /**< [lua] index into the backend-array */
 
+	network_backend_t *query_backend; /**< the backend we sent a query to and haven't seen the result yet */
+	guint64 ts_query_sent;         /**< microsec timestamp when the query was sent to the query_backend */
+
 	gboolean connection_close;     /**< [lua] set by the lua code to close a connection */
 
 	struct timeval interval;       /**< The interval to be used for evt_timer, currently unused. */
 	struct event evt_timer;        /**< The event structure used to implement the timer callback, currently unused. */
 
 	gboolean is_reconnecting;      /**< if true, critical messages concerning failed connect() calls are suppressed, as they are expected errors */
+
+	guint16 server_status;         /**< server-status of the last query-result, tells if we are in a transaction */
+	guint64 ts_wait_for_server;    /**< microsec timestamp since we wait for a idling server connection, 0 if we don't wait */
+	GPtrArray *pool_waiters;       /**< the network_connection_pool_waiter's of the pools we wait on, NULL if we never waited */
+	backend_type_t command_backend_type; /**< the type of backend the command we wait for a server connection for can run on */
+	gboolean keep_server;          /**< the next command needs the same server connection, like FOUND_ROWS() after SQL_CALC_FOUND_ROWS */
 } network_mysqld_con_lua_t;
 
 NETWORK_API network_mysqld_con_lua_t *network_mysqld_con_lua_new();
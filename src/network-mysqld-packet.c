@@ -30,14 +30,19 @@
 #include "network_mysqld_proto_binary.h"
 
 #include "glib-ext.h"
+#include "glib-ext-pool.h"
 
 #define C(x) x, sizeof(x) - 1
 #define S(x) x->str, x->len
 
+static GPool network_mysqld_com_query_result_pool = G_POOL_INIT("network_mysqld_com_query_result", network_mysqld_com_query_result_t);
+static GPool network_mysqld_auth_challenge_pool = G_POOL_INIT("network_mysqld_auth_challenge", network_mysqld_auth_challenge);
+static GPool network_mysqld_auth_response_pool = G_POOL_INIT("network_mysqld_auth_response", network_mysqld_auth_response);
+
 network_mysqld_com_query_result_t *network_mysqld_com_query_result_new() {
 	network_mysqld_com_query_result_t *com_query;
 
-	com_query = g_new0(network_mysqld_com_query_result_t, 1);
+	com_query = g_pool_alloc0(&network_mysqld_com_query_result_pool);
 	com_query->state = PARSE_COM_QUERY_INIT;
 	com_query->query_status = MYSQLD_PACKET_NULL; /* can have 3 values: NULL for unknown, OK for a OK packet, ERR for a error-packet */
 
@@ -47,7 +52,7 @@ network_mysqld_com_query_result_t *network_mysqld_com_query_result_new() {
 void network_mysqld_com_query_result_free(network_mysqld_com_query_result_t *udata) {
 	if (!udata) return;
 
-	g_free(udata);
+	g_pool_free(&network_mysqld_com_query_result_pool, udata);
 }
 
 /**
@@ -1068,7 +1073,7 @@ int network_mysqld_proto_append_eof_packet(GString *packet, network_mysqld_eof_p
 network_mysqld_auth_challenge *network_mysqld_auth_challenge_new() {
 	network_mysqld_auth_challenge *shake;
 
-	shake = g_new0(network_mysqld_auth_challenge, 1);
+	shake = g_pool_alloc0(&network_mysqld_auth_challenge_pool);
 	
 	shake->challenge = g_string_new("");
 	shake->capabilities = 
@@ -1086,7 +1091,7 @@ void network_mysqld_auth_challenge_free(network_mysqld_auth_challenge *shake) {
 	if (shake->server_version_str) g_free(shake->server_version_str);
 	if (shake->challenge)          g_string_free(shake->challenge, TRUE);
 
-	g_free(shake);
+	g_pool_free(&network_mysqld_auth_challenge_pool, shake);
 }
 
 void network_mysqld_auth_challenge_set_challenge(network_mysqld_auth_challenge *shake) {
@@ -1241,7 +1246,7 @@ int network_mysqld_proto_append_auth_challenge(GString *packet, network_mysqld_a
 network_mysqld_auth_response *network_mysqld_auth_response_new() {
 	network_mysqld_auth_response *auth;
 
-	auth = g_new0(network_mysqld_auth_response, 1);
+	auth = g_pool_alloc0(&network_mysqld_auth_response_pool);
 
 	/* we have to make sure scramble->buf is not-NULL to get
 	 * the "empty string" and not a "NULL-string"
@@ -1261,7 +1266,7 @@ void network_mysqld_auth_response_free(network_mysqld_auth_response *auth) {
 	if (auth->username)          g_string_free(auth->username, TRUE);
 	if (auth->database)          g_string_free(auth->database, TRUE);
 
-	g_free(auth);
+	g_pool_free(&network_mysqld_auth_response_pool, auth);
 }
 
 int network_mysqld_proto_get_auth_response(network_packet *packet, network_mysqld_auth_response *auth) {
@@ -49,6 +49,13 @@
 #define COM_STMT_RESET          COM_RESET_STMT
 #endif
 
+/**
+ * COM_RESET_CONNECTION was added in 5.7.3
+ */
+#if MYSQL_VERSION_ID < 50703
+#define COM_RESET_CONNECTION    (0x1f)
+#endif
+
 #define MYSQLD_PACKET_OK   (0)
 #define MYSQLD_PACKET_RAW  (0xfa) /* used for proxy.response.type only */
 #define MYSQLD_PACKET_NULL (0xfb) /* 0xfb */
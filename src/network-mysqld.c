@@ -72,6 +72,7 @@
 #include "chassis-event-thread.h"
 #include "lua-scope.h"
 #include "glib-ext.h"
+#include "glib-ext-pool.h"
 
 #if defined(HAVE_SYS_SDT_H) && defined(ENABLE_DTRACE)
 #include <sys/sdt.h>
@@ -125,14 +126,15 @@
 network_socket_retval_t plugin_call_cleanup(chassis *srv, network_mysqld_con *con) {
 	NETWORK_MYSQLD_PLUGIN_FUNC(func) = NULL;
 	network_socket_retval_t retval = NETWORK_SOCKET_SUCCESS;
+	lua_scope *sc = con->sc ? con->sc : srv->priv->sc;
 
 	func = con->plugins.con_cleanup;
 	
 	if (!func) return retval;
 
-	LOCK_LUA(srv->priv->sc);
+	LOCK_LUA(sc);
 	retval = (*func)(srv, con);
-	UNLOCK_LUA(srv->priv->sc);
+	UNLOCK_LUA(sc);
 
 	return retval;
 }
@@ -142,35 +144,64 @@ chassis_private *network_mysqld_priv_init(void) {
 
 	priv = g_new0(chassis_private, 1);
 
-	priv->cons = g_ptr_array_new();
+	priv->cons = network_connection_registry_new();
 	priv->sc = lua_scope_new();
+	priv->shared = lua_shared_tables_new(priv->sc);
 	priv->backends  = network_backends_new();
 
 	return priv;
 }
 
+static void network_mysqld_cons_snapshot(guint64 G_GNUC_UNUSED id, gpointer con, gpointer user_data) {
+	GPtrArray *cons = user_data;
+
+	g_ptr_array_add(cons, con);
+}
+
 void network_mysqld_priv_shutdown(chassis *chas, chassis_private *priv) {
+	GPtrArray *cons;
+	guint i;
+
 	if (!priv) return;
 
-	/* network_mysqld_con_free() changes the priv->cons directly
-	 *
-	 * always free the first element until all are gone 
+	/* network_mysqld_con_free() removes the connection from the registry,
+	 * take a snapshot first
 	 */
-	while (0 != priv->cons->len) {
-		network_mysqld_con *con = priv->cons->pdata[0];
+	cons = g_ptr_array_new();
+	network_connection_registry_foreach(priv->cons, network_mysqld_cons_snapshot, cons);
+
+	for (i = 0; i < cons->len; i++) {
+		network_mysqld_con *con = cons->pdata[i];
 
 		plugin_call_cleanup(chas, con);
 		network_mysqld_con_free(con);
 	}
+
+	g_ptr_array_free(cons, TRUE);
 }
 
-void network_mysqld_priv_free(chassis G_GNUC_UNUSED *chas, chassis_private *priv) {
+void network_mysqld_priv_free(chassis *chas, chassis_private *priv) {
+	guint i;
+
 	if (!priv) return;
 
-	g_ptr_array_free(priv->cons, TRUE);
+	network_connection_registry_free(priv->cons);
 
 	network_backends_free(priv->backends);
 
+	/* the per-thread lua-scopes reference the shared tables of the global lua-scope,
+	 * close them first */
+	for (i = 0; chas->threads && i < chas->threads->event_threads->len; i++) {
+		chassis_event_thread_t *event_thread = chas->threads->event_threads->pdata[i];
+
+		if (event_thread->sc) {
+			lua_scope_free(event_thread->sc);
+			event_thread->sc = NULL;
+		}
+	}
+
+	lua_shared_tables_free(priv->shared);
+
 	lua_scope_free(priv->sc);
 
 	g_free(priv);
@@ -191,6 +222,8 @@ int network_mysqld_init(chassis *srv) {
 }
 
 
+static GPool network_mysqld_con_pool = G_POOL_INIT("network_mysqld_con", network_mysqld_con);
+
 network_mysqld_con *network_mysqld_con_init() {
 	return network_mysqld_con_new();
 }
@@ -202,7 +235,7 @@ network_mysqld_con *network_mysqld_con_init() {
 network_mysqld_con *network_mysqld_con_new() {
 	network_mysqld_con *con;
 
-	con = g_new0(network_mysqld_con, 1);
+	con = g_pool_alloc0(&network_mysqld_con_pool);
 	con->timestamps = chassis_timestamps_new();
 	con->parse.command = -1;
 
@@ -210,9 +243,52 @@ network_mysqld_con *network_mysqld_con_new() {
 }
 
 void network_mysqld_add_connection(chassis *srv, network_mysqld_con *con) {
+	network_mysqld_add_connection_to_thread(srv, con, NULL);
+}
+
+/**
+ * add a connection and pin it to a event-thread
+ *
+ * @param event_thread the event-thread to pin the connection to, NULL for the least loaded one
+ */
+void network_mysqld_add_connection_to_thread(chassis *srv, network_mysqld_con *con, chassis_event_thread_t *event_thread) {
 	con->srv = srv;
+	con->sc = srv->priv->sc;
+
+	if (!event_thread && srv->threads && srv->threads->event_threads->len > 0) {
+		event_thread = chassis_event_threads_get_least_loaded(srv->threads);
+	}
+
+	if (event_thread) {
+		g_atomic_int_inc(&(event_thread->connections));
+
+		con->event_thread = event_thread;
+
+		if (srv->lua_per_thread) {
+			if (!g_atomic_pointer_get((gpointer *)&(event_thread->sc))) {
+				lua_scope *sc;
+				lua_State *L;
+
+				sc = lua_scope_new();
+
+				/* store the pointer to the chassis in the Lua registry */
+				L = sc->L;
+				lua_pushlightuserdata(L, (void*)srv);
+				lua_setfield(L, LUA_REGISTRYINDEX, CHASSIS_LUA_REGISTRY_KEY);
+
+				/* the acceptors, the reuseport listeners and the pool timers may add connections
+				 * to the same thread concurrently: only the first scope gets published */
+				if (!g_atomic_pointer_compare_and_exchange((gpointer *)&(event_thread->sc), NULL, sc)) {
+					lua_scope_free(sc);
+				}
+			}
 
-	g_ptr_array_add(srv->priv->cons, con);
+			con->sc = g_atomic_pointer_get((gpointer *)&(event_thread->sc));
+		}
+	}
+
+	/* each event-thread has its own shard of the registry, shard 0 is only used if there are no event-threads */
+	con->id = network_connection_registry_add(srv->priv->cons, event_thread ? event_thread->index + 1 : 0, con);
 }
 
 /**
@@ -225,6 +301,9 @@ void network_mysqld_add_connection(chassis *srv, network_mysqld_con *con) {
 void network_mysqld_con_free(network_mysqld_con *con) {
 	if (!con) return;
 
+	/* remove it first, network_connection_registry_foreach() must not see a half-freed connection */
+	if (con->id) network_connection_registry_remove(con->srv->priv->cons, con->id);
+
 	if (con->parse.data && con->parse.data_free) {
 		con->parse.data_free(con->parse.data);
 	}
@@ -232,12 +311,11 @@ void network_mysqld_con_free(network_mysqld_con *con) {
 	if (con->server) network_socket_free(con->server);
 	if (con->client) network_socket_free(con->client);
 
-	/* we are still in the conns-array */
+	if (con->event_thread && !con->is_listening) g_atomic_int_add(&(con->event_thread->connections), -1);
 
-	g_ptr_array_remove_fast(con->srv->priv->cons, con);
 	chassis_timestamps_free(con->timestamps);
 
-	g_free(con);
+	g_pool_free(&network_mysqld_con_pool, con);
 }
 
 #if 0 
@@ -285,6 +363,32 @@ int network_mysqld_queue_sync(network_socket *dst, network_socket *src) {
 	return 0;
 }
 
+/**
+ * track the packet-id of a packet we send and fix it if it is out of sequence
+ */
+static void network_mysqld_queue_patch_packet_id(network_socket *sock, GString *data) {
+	guint8  packet_id;
+
+	packet_id  = network_mysqld_proto_get_packet_id(data);
+
+	if (sock->packet_id_is_reset) {
+		/* the ->last_packet_id is undefined, accept what we get */
+		sock->last_packet_id = packet_id;
+		sock->packet_id_is_reset = FALSE;
+	} else if (packet_id != (guint8)(sock->last_packet_id + 1)) {
+		sock->last_packet_id++;
+#if 0
+		g_critical("%s: packet-id %d doesn't match for socket's last packet %d, patching it",
+				G_STRLOC,
+				packet_id,
+				sock->last_packet_id);
+#endif
+		network_mysqld_proto_set_packet_id(data, sock->last_packet_id);
+	} else {
+		sock->last_packet_id++;
+	}
+}
+
 /**
  * appends a raw MySQL packet to the queue 
  *
@@ -294,7 +398,6 @@ int network_mysqld_queue_sync(network_socket *dst, network_socket *src) {
  */
 int network_mysqld_queue_append_raw(network_socket *sock, network_queue *queue, GString *data) {
 	guint32 packet_len;
-	guint8  packet_id;
 
 	/* check that the length header is valid */
 	if (queue != sock->send_queue &&
@@ -309,26 +412,10 @@ int network_mysqld_queue_append_raw(network_socket *sock, network_queue *queue,
 	g_assert_cmpint(data->len, >=, 4);
 
 	packet_len = network_mysqld_proto_get_packet_len(data);
-	packet_id  = network_mysqld_proto_get_packet_id(data);
 
 	g_assert_cmpint(packet_len, ==, data->len - 4);
 
-	if (sock->packet_id_is_reset) {
-		/* the ->last_packet_id is undefined, accept what we get */
-		sock->last_packet_id = packet_id;
-		sock->packet_id_is_reset = FALSE;
-	} else if (packet_id != (guint8)(sock->last_packet_id + 1)) {
-		sock->last_packet_id++;
-#if 0
-		g_critical("%s: packet-id %d doesn't match for socket's last packet %d, patching it",
-				G_STRLOC,
-				packet_id,
-				sock->last_packet_id);
-#endif
-		network_mysqld_proto_set_packet_id(data, sock->last_packet_id);
-	} else {
-		sock->last_packet_id++;
-	}
+	network_mysqld_queue_patch_packet_id(sock, data);
 
 	network_queue_append(queue, data);
 
@@ -513,57 +600,76 @@ int network_mysqld_con_send_error_pre41(network_socket *con, const char *errmsg,
 
 
 /**
- * get a full packet from the raw queue and move it to the packet queue 
+ * recv() into the recv-buffer of the socket
+ *
+ * sizes the recv-buffer by --network-read-buffer-size
+ */
+static network_socket_retval_t network_mysqld_socket_read(chassis *chas, network_socket *sock) {
+	if (!sock->recv_buf_size && chas->network_read_buffer_size > 0) {
+		sock->recv_buf_size = chas->network_read_buffer_size;
+	}
+
+	return network_socket_read(sock);
+}
+
+/**
+ * get a full packet from the recv-buffer and move it to the packet queue 
  */
 network_socket_retval_t network_mysqld_con_get_packet(chassis G_GNUC_UNUSED*chas, network_socket *con) {
 	GString *packet = NULL;
 	GString header;
-	char header_str[NET_HEADER_SIZE + 1] = "";
 	guint32 packet_len;
 	guint8  packet_id;
+	gsize unparsed;
+
+	unparsed = con->recv_buf ? con->recv_buf->data->len - con->recv_buf_offset : 0;
 
 	/** 
-	 * read the packet header (4 bytes)
+	 * read the packet header (4 bytes) straight from the recv-buffer
 	 */
-	header.str = header_str;
-	header.allocated_len = sizeof(header_str);
-	header.len = 0;
-
-	/* read the packet len if the leading packet */
-	if (!network_queue_peek_string(con->recv_queue_raw, NET_HEADER_SIZE, &header)) {
+	if (unparsed < NET_HEADER_SIZE) {
 		/* too small */
 
 		return NETWORK_SOCKET_WAIT_FOR_EVENT;
 	}
 
+	header.str = con->recv_buf->data->str + con->recv_buf_offset;
+	header.allocated_len = NET_HEADER_SIZE;
+	header.len = NET_HEADER_SIZE;
+
 	packet_len = network_mysqld_proto_get_packet_len(&header);
 	packet_id  = network_mysqld_proto_get_packet_id(&header);
 
-	/* move the packet from the raw queue to the recv-queue */
-	if ((packet = network_queue_pop_string(con->recv_queue_raw, packet_len + NET_HEADER_SIZE, NULL))) {
-#ifdef NETWORK_DEBUG_TRACE_IO
-		/* to trace the data we received from the socket, enable this */
-		g_debug_hexdump(G_STRLOC, S(packet));
-#endif
+	if (unparsed < packet_len + NET_HEADER_SIZE) {
+		/* make sure the whole packet fits into the recv-buffer */
+		network_socket_recv_buf_reserve(con, packet_len + NET_HEADER_SIZE);
 
-		if (con->packet_id_is_reset) {
-			con->last_packet_id = packet_id;
-			con->packet_id_is_reset = FALSE;
-		} else if (packet_id != (guint8)(con->last_packet_id + 1)) {
-			g_critical("%s: received packet-id %d, but expected %d ... out of sync.",
-					G_STRLOC,
-					packet_id,
-					con->last_packet_id + 1);
-			return NETWORK_SOCKET_ERROR;
-		} else {
-			con->last_packet_id = packet_id;
-		}
-	
-		network_queue_append(con->recv_queue, packet);
-	} else {
 		return NETWORK_SOCKET_WAIT_FOR_EVENT;
 	}
 
+	if (con->packet_id_is_reset) {
+		con->last_packet_id = packet_id;
+		con->packet_id_is_reset = FALSE;
+	} else if (packet_id != (guint8)(con->last_packet_id + 1)) {
+		g_critical("%s: received packet-id %d, but expected %d ... out of sync.",
+				G_STRLOC,
+				packet_id,
+				con->last_packet_id + 1);
+		return NETWORK_SOCKET_ERROR;
+	} else {
+		con->last_packet_id = packet_id;
+	}
+
+	/* move the packet from the recv-buffer to the recv-queue */
+	packet = network_socket_recv_buf_pop(con, packet_len + NET_HEADER_SIZE);
+
+#ifdef NETWORK_DEBUG_TRACE_IO
+	/* to trace the data we received from the socket, enable this */
+	g_debug_hexdump(G_STRLOC, S(packet));
+#endif
+
+	network_queue_append(con->recv_queue, packet);
+
 	return NETWORK_SOCKET_SUCCESS;
 }
 
@@ -573,8 +679,15 @@ network_socket_retval_t network_mysqld_con_get_packet(chassis G_GNUC_UNUSED*chas
  * the packet is added to the con->recv_queue and contains a full mysql packet
  * with packet-header and everything 
  */
-network_socket_retval_t network_mysqld_read(chassis G_GNUC_UNUSED*chas, network_socket *con) {
-	switch (network_socket_read(con)) {
+network_socket_retval_t network_mysqld_read(chassis *chas, network_socket *con) {
+	network_socket_retval_t ret;
+
+	/* the packet may already be in the recv-buffer */
+	if (NETWORK_SOCKET_WAIT_FOR_EVENT != (ret = network_mysqld_con_get_packet(chas, con))) {
+		return ret;
+	}
+
+	switch (network_mysqld_socket_read(chas, con)) {
 	case NETWORK_SOCKET_WAIT_FOR_EVENT:
 		return NETWORK_SOCKET_WAIT_FOR_EVENT;
 	case NETWORK_SOCKET_ERROR:
@@ -589,6 +702,118 @@ network_socket_retval_t network_mysqld_read(chassis G_GNUC_UNUSED*chas, network_
 	return network_mysqld_con_get_packet(chas, con);
 }
 
+/**
+ * forward the rows of a resultset from the recv-buffer of the server to the client
+ *
+ * if nobody wants to see the resultset, there is no need to move each row through
+ * the recv-queue and the read_query_result hook. We only look at the packet-headers
+ * and the first byte of each packet to find the end of the rows and move all the
+ * complete rows we have as one chunk to the send-queue of the client.
+ *
+ * the last packet (EOF or ERR) is left in the recv-buffer for the plugin.
+ *
+ * @return NETWORK_SOCKET_SUCCESS if the packets left in the recv-buffer have to be handled by the plugin,
+ *         NETWORK_SOCKET_WAIT_FOR_EVENT if we have to wait for more rows
+ */
+static network_socket_retval_t network_mysqld_con_forward_rows(chassis *srv, network_mysqld_con *con) {
+	network_socket *recv_sock = con->server;
+	network_socket *send_sock = con->client;
+	network_mysqld_com_query_result_t *com_query = con->parse.data;
+	gboolean use_binary_row_data;
+
+	if (!con->resultset_fast_forward || con->resultset_is_needed || !send_sock) return NETWORK_SOCKET_SUCCESS;
+
+	switch (con->parse.command) {
+	case COM_QUERY:
+	case COM_PROCESS_INFO:
+		use_binary_row_data = FALSE;
+		break;
+	case COM_STMT_EXECUTE:
+		use_binary_row_data = TRUE;
+		break;
+	default:
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	/* we only skip over the rows, the field-defs and the EOF/ERR go through the plugin */
+	if (!com_query || com_query->state != PARSE_COM_QUERY_RESULT) return NETWORK_SOCKET_SUCCESS;
+
+	for (;;) {
+		gsize unparsed;
+		gsize run_len = 0;
+		gboolean is_row = TRUE;
+
+		unparsed = recv_sock->recv_buf ? recv_sock->recv_buf->data->len - recv_sock->recv_buf_offset : 0;
+
+		while (unparsed - run_len >= NET_HEADER_SIZE &&
+		       send_sock->send_queue->len + run_len <= 64 * 1024) {
+			GString view;
+			network_packet packet;
+			guint32 packet_len;
+			guint8  packet_id;
+			guint8  status;
+
+			view.str = recv_sock->recv_buf->data->str + recv_sock->recv_buf_offset + run_len;
+			view.len = NET_HEADER_SIZE;
+			view.allocated_len = 0;
+
+			packet_len = network_mysqld_proto_get_packet_len(&view);
+			packet_id  = network_mysqld_proto_get_packet_id(&view);
+
+			if (unparsed - run_len < packet_len + NET_HEADER_SIZE) break; /* incomplete */
+
+			if (packet_len == 0) {
+				is_row = FALSE;
+				break;
+			}
+
+			status = view.str[NET_HEADER_SIZE];
+
+			if (status == MYSQLD_PACKET_ERR ||
+			    (status == MYSQLD_PACKET_EOF && packet_len + NET_HEADER_SIZE == 9)) {
+				is_row = FALSE;
+				break;
+			}
+
+			/* let network_mysqld_con_get_packet() complain about it */
+			if (!recv_sock->packet_id_is_reset && packet_id != (guint8)(recv_sock->last_packet_id + 1)) {
+				is_row = FALSE;
+				break;
+			}
+			recv_sock->last_packet_id = packet_id;
+			recv_sock->packet_id_is_reset = FALSE;
+
+			view.len = packet_len + NET_HEADER_SIZE;
+
+			network_mysqld_queue_patch_packet_id(send_sock, &view);
+
+			/* track the rows and bytes like the plugin would */
+			packet.data = &view;
+			packet.offset = NET_HEADER_SIZE;
+			network_mysqld_proto_get_com_query_result(&packet, com_query, use_binary_row_data);
+
+			run_len += view.len;
+		}
+
+		/* nothing to forward, let the plugin handle it */
+		if (run_len == 0) return NETWORK_SOCKET_SUCCESS;
+
+		network_queue_append(send_sock->send_queue, network_socket_recv_buf_pop(recv_sock, run_len));
+
+		/* the next packet isn't a row or the client has enough to chew on */
+		if (!is_row || send_sock->send_queue->len > 64 * 1024) return NETWORK_SOCKET_SUCCESS;
+
+		switch (network_mysqld_socket_read(srv, recv_sock)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			return NETWORK_SOCKET_WAIT_FOR_EVENT;
+		default:
+			return NETWORK_SOCKET_ERROR;
+		}
+	}
+}
+
 network_socket_retval_t network_mysqld_write(chassis G_GNUC_UNUSED*chas, network_socket *con) {
 	network_socket_retval_t ret;
 
@@ -610,6 +835,7 @@ network_socket_retval_t network_mysqld_write(chassis G_GNUC_UNUSED*chas, network
 network_socket_retval_t plugin_call(chassis *srv, network_mysqld_con *con, int state) {
 	network_socket_retval_t ret;
 	NETWORK_MYSQLD_PLUGIN_FUNC(func) = NULL;
+	lua_scope *sc = con->sc ? con->sc : srv->priv->sc;
 
 	switch (state) {
 	case CON_STATE_INIT:
@@ -774,9 +1000,9 @@ network_socket_retval_t plugin_call(chassis *srv, network_mysqld_con *con, int s
 	}
 	if (!func) return NETWORK_SOCKET_SUCCESS;
 
-	LOCK_LUA(srv->priv->sc);
+	LOCK_LUA(sc);
 	ret = (*func)(srv, con);
-	UNLOCK_LUA(srv->priv->sc);
+	UNLOCK_LUA(sc);
 
 	return ret;
 }
@@ -847,53 +1073,33 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 	g_assert(con);
 
 	if (events == EV_READ) {
-		int b = -1;
+		network_socket *sock = NULL;
 
 		/* a valid read event resets timeouts */
 		con->timeout_count = 0;
 
+		if (con->client && event_fd == con->client->fd) {
+			sock = con->client;
+		} else if (con->server && event_fd == con->server->fd) {
+			sock = con->server;
+		} else {
+			g_error("%s.%d: neither nor", __FILE__, __LINE__);
+		}
+
 		/**
-		 * check how much data there is to read
+		 * read what is there right away
 		 *
-		 * ioctl()
-		 * - returns 0 if connection is closed
-		 * - or -1 and ECONNRESET on solaris
-		 *   or -1 and EPIPE on HP/UX
+		 * the states pick the packets from the recv-buffer and recv() only themselves
+		 * if they need more. recv() returning 0 (or ECONNRESET on solaris) tells us 
+		 * that the connection is closed.
 		 */
-		if (ioctl(event_fd, FIONREAD, &b) == -1) {
-			switch (errno) {
-			case E_NET_CONNRESET: /* solaris */
-			case EPIPE: /* hp/ux */
-				if (con->client && event_fd == con->client->fd) {
-					/* the client closed the connection, let's keep the server side open */
-					con->state = CON_STATE_CLOSE_CLIENT;
-				} else if (con->server && event_fd == con->server->fd && con->com_quit_seen) {
-					con->state = CON_STATE_CLOSE_SERVER;
-				} else {
-					/* server side closed on use, oops, close both sides */
-					con->state = CON_STATE_ERROR;
-				}
-				break;
-			default:
-				g_critical("%s: ioctl(%d, FIONREAD, ...) failed: %s",
-						G_STRLOC, event_fd, g_strerror(errno));
-
-				con->state = CON_STATE_ERROR;
-				break;
-			}
-		} else if (b != 0) {
-			if (con->client && event_fd == con->client->fd) {
-				con->client->to_read = b;
-			} else if (con->server && event_fd == con->server->fd) {
-				con->server->to_read = b;
-			} else {
-				g_error("%s.%d: neither nor", __FILE__, __LINE__);
-			}
-		} else { /* Linux */
-			if (con->client && event_fd == con->client->fd) {
+		if (NETWORK_SOCKET_ERROR == network_mysqld_socket_read(srv, sock)) {
+			con->state = CON_STATE_ERROR;
+		} else if (sock->is_eof) {
+			if (sock == con->client) {
 				/* the client closed the connection, let's keep the server side open */
 				con->state = CON_STATE_CLOSE_CLIENT;
-			} else if (con->server && event_fd == con->server->fd && con->com_quit_seen) {
+			} else if (con->com_quit_seen) {
 				con->state = CON_STATE_CLOSE_SERVER;
 			} else {
 				/* server side closed on use, oops, close both sides */
@@ -906,7 +1112,7 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 
 #define WAIT_FOR_EVENT(ev_struct, ev_type, timeout) \
 	event_set(&(ev_struct->event), ev_struct->fd, ev_type, network_mysqld_con_handle, user_data); \
-	chassis_event_add_timeout(srv, &(ev_struct->event), \
+	chassis_event_add_to_thread(srv, con->event_thread, &(ev_struct->event), \
 		timeout?timeout:srv->network_timeout); 
 
 	/**
@@ -1367,9 +1573,25 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 
 			recv_sock = con->client;
 
-			g_assert(events == 0 || event_fd == recv_sock->fd);
+			g_assert(events == 0 || event_fd == -1 || event_fd == recv_sock->fd);
+
+			/* the retry-timer of a plugin that waits for a server connection fired. The client's fd
+			 * isn't watched meanwhile, check if the client closed the connection */
+			if (event_fd == -1 && events == EV_TIMEOUT) {
+				if (NETWORK_SOCKET_ERROR == network_mysqld_socket_read(srv, recv_sock)) {
+					con->state = CON_STATE_ERROR;
+					break;
+				} else if (recv_sock->is_eof) {
+					con->state = CON_STATE_CLOSE_CLIENT;
+					break;
+				}
+			}
 
-			do { 
+			/* a plugin that waited for a server connection left the query in the recv-queue */
+			last_packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
+
+			while (NULL == last_packet.data ||
+			       last_packet.data->len == PACKET_LEN_MAX + NET_HEADER_SIZE) { /* read all chunks of the overlong data */
 				switch (network_mysqld_read(srv, recv_sock)) {
 				case NETWORK_SOCKET_SUCCESS:
 					break;
@@ -1386,7 +1608,7 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
 
 				last_packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
-			} while (last_packet.data->len == PACKET_LEN_MAX + NET_HEADER_SIZE); /* read all chunks of the overlong data */
+			}
 
 			if (con->server &&
 			    con->server->challenge &&
@@ -1417,6 +1639,22 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			switch (plugin_call(srv, con, con->state)) {
 			case NETWORK_SOCKET_SUCCESS:
 				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT: {
+				/* the plugin has no server connection for the query yet, it calls us again once
+				 * it has one. The timer only ends the wait after the network-timeout.
+				 *
+				 * only wait for the timer: a client that pipelines the next query or closes the
+				 * connection keeps its fd readable and a EV_READ would fire again right away. */
+				struct timeval retry;
+
+				retry.tv_sec = srv->network_timeout;
+				retry.tv_usec = 0;
+
+				evtimer_set(&(recv_sock->event), network_mysqld_con_handle, user_data);
+				event_base_set(con->event_thread->event_base, &(recv_sock->event));
+				event_add(&(recv_sock->event), &retry);
+				NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query_retry");
+				return; }
 			default:
 				g_critical("%s.%d: plugin_call(CON_STATE_READ_QUERY) failed", __FILE__, __LINE__);
 
@@ -1513,6 +1751,23 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 
 				g_assert(events == 0 || event_fd == recv_sock->fd);
 
+				switch (network_mysqld_con_forward_rows(srv, con)) {
+				case NETWORK_SOCKET_SUCCESS:
+					if (!con->resultset_is_needed && con->client && con->client->send_queue->len > 64 * 1024) {
+						con->state = CON_STATE_SEND_QUERY_RESULT;
+					}
+					break;
+				case NETWORK_SOCKET_WAIT_FOR_EVENT:
+					WAIT_FOR_EVENT(con->server, EV_READ, 0);
+					NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query_result");
+					return;
+				default:
+					g_critical("%s.%d: network_mysqld_con_forward_rows(CON_STATE_READ_QUERY_RESULT) returned an error", __FILE__, __LINE__);
+					con->state = CON_STATE_ERROR;
+					break;
+				}
+				if (con->state != ostate) break;
+
 				switch (network_mysqld_read(srv, recv_sock)) {
 				case NETWORK_SOCKET_SUCCESS:
 					break;
@@ -1826,9 +2081,11 @@ void network_mysqld_con_accept(int G_GNUC_UNUSED event_fd, short events, void *u
 
 	NETWORK_MYSQLD_CON_TRACK_TIME(client_con, "accept");
 
-	network_mysqld_add_connection(listen_con->srv, client_con);
+	/* a SO_REUSEPORT listener has a listen-socket in each event-thread: keep the
+	 * connection in the thread that accepted it */
+	network_mysqld_add_connection_to_thread(listen_con->srv, client_con,
+			listen_con->server->reuseport ? listen_con->event_thread : NULL);
 
-	
 	/**
 	 * inherit the config to the new connection 
 	 */
@@ -1841,6 +2098,78 @@ void network_mysqld_con_accept(int G_GNUC_UNUSED event_fd, short events, void *u
 	return;
 }
 
+/**
+ * keep a listen-connection out of the load of its event-thread
+ *
+ * chassis_event_threads_get_least_loaded() would otherwise skip the threads that have a listen-socket
+ */
+static void network_mysqld_con_set_listening(network_mysqld_con *con) {
+	if (con->is_listening) return;
+
+	if (con->event_thread) g_atomic_int_add(&(con->event_thread->connections), -1);
+
+	con->is_listening = TRUE;
+}
+
+/**
+ * start accepting on a listen-connection
+ *
+ * if the listen-socket is a SO_REUSEPORT socket, each event-thread gets its own 
+ * listen-socket on the same address and accepts the connections the kernel hands
+ * to it. The new connections stay in the event-thread that accepted them.
+ *
+ * Otherwise all connections are accepted in the main-thread.
+ *
+ * @param listen_con a listen-connection with a bound listen-socket, the plugin-hooks and the config
+ * @return 0 on success, -1 on error
+ */
+int network_mysqld_con_listen(chassis *chas, network_mysqld_con *listen_con) {
+	network_socket *listen_sock = listen_con->server;
+	guint i;
+
+	network_mysqld_con_set_listening(listen_con);
+
+	if (!listen_sock->reuseport) {
+		event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, listen_con);
+		event_base_set(chas->event_base, &(listen_sock->event));
+		event_add(&(listen_sock->event), NULL);
+
+		return 0;
+	}
+
+	for (i = 0; i < chas->threads->event_threads->len; i++) {
+		chassis_event_thread_t *event_thread = chas->threads->event_threads->pdata[i];
+		network_mysqld_con *con;
+		network_socket *sock;
+
+		if (event_thread == listen_con->event_thread) continue; /* already has the listen-socket */
+
+		con = network_mysqld_con_new();
+		network_mysqld_add_connection_to_thread(chas, con, event_thread);
+		network_mysqld_con_set_listening(con);
+		con->plugins = listen_con->plugins;
+		con->config  = listen_con->config;
+
+		sock = network_socket_new();
+		sock->reuseport = TRUE;
+		con->server = sock;
+
+		network_address_copy(sock->dst, listen_sock->dst);
+
+		if (0 != network_socket_bind(sock)) {
+			return -1;
+		}
+
+		event_set(&(sock->event), sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
+		chassis_event_add_to_thread(chas, event_thread, &(sock->event), 0);
+	}
+
+	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, listen_con);
+	chassis_event_add_to_thread(chas, listen_con->event_thread, &(listen_sock->event), 0);
+
+	return 0;
+}
+
 /**
  * @todo move to network_mysqld_proto
  */
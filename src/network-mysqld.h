@@ -50,11 +50,14 @@
 
 #include "network-socket.h"
 #include "network-conn-pool.h"
+#include "network-conn-registry.h"
 #include "chassis-plugin.h"
 #include "chassis-mainloop.h"
+#include "chassis-event-thread.h"
 #include "chassis-timings.h"
 #include "sys-pedantic.h"
 #include "lua-scope.h"
+#include "lua-shared-table.h"
 #include "network-backend.h"
 #include "lua-registry-keys.h"
 
@@ -294,6 +297,39 @@ struct network_mysqld_con {
 	 */
 	chassis *srv; /* our srv object */
 
+	/**
+	 * The id of the connection in the connection registry (chassis_private::cons).
+	 *
+	 * Set by network_mysqld_add_connection(), 0 if the connection isn't registered.
+	 */
+	guint64 id;
+
+	/**
+	 * The event-thread that handles the events of this connection.
+	 *
+	 * Set by network_mysqld_add_connection() to the least loaded event-thread or to the
+	 * event-thread that accepted it on a SO_REUSEPORT listen-socket, the connection
+	 * stays on it for its lifetime.
+	 */
+	chassis_event_thread_t *event_thread;
+
+	/**
+	 * The connection only holds a listen-socket.
+	 *
+	 * Set by network_mysqld_con_listen(). It isn't counted in the connections of its
+	 * event-thread: they only count the connections that keep the thread busy.
+	 */
+	gboolean is_listening;
+
+	/**
+	 * The lua-scope the plugin callbacks of this connection run in.
+	 *
+	 * Set by network_mysqld_add_connection(). It is the global lua-scope unless
+	 * chassis::lua_per_thread is set, in which case it is the lua-scope of the
+	 * connection's event-thread.
+	 */
+	lua_scope *sc;
+
 	/**
 	 * A boolean flag indicating that this connection should only be used to accept incoming connections.
 	 * 
@@ -320,6 +356,15 @@ struct network_mysqld_con {
 	 */
 	gboolean resultset_is_finished;
 
+	/**
+	 * Flag indicating that the plugin doesn't need to see the rows of a resultset that isn't needed.
+	 *
+	 * If set to TRUE and resultset_is_needed is FALSE, the rows are forwarded from the recv-buffer of
+	 * the server to the client in one go and only the packet-headers are looked at. The con_read_query_result
+	 * hook is only called for the packets before and after the rows.
+	 */
+	gboolean resultset_fast_forward;
+
 	/**
 	 * Flag indicating that we have received a COM_QUIT command.
 	 * 
@@ -367,6 +412,7 @@ NETWORK_API void network_mysqld_con_free(network_mysqld_con *con);
  * should be socket 
  */
 NETWORK_API void network_mysqld_con_accept(int event_fd, short events, void *user_data); /** event handler for accept() */
+NETWORK_API int network_mysqld_con_listen(chassis *chas, network_mysqld_con *listen_con);
 
 NETWORK_API int network_mysqld_con_send_ok(network_socket *con);
 NETWORK_API int network_mysqld_con_send_ok_full(network_socket *con, guint64 affected_rows, guint64 insert_id, guint16 server_status, guint16 warnings);
@@ -386,15 +432,17 @@ NETWORK_API network_socket_retval_t network_mysqld_write_len(chassis *srv, netwo
 NETWORK_API network_socket_retval_t network_mysqld_con_get_packet(chassis G_GNUC_UNUSED*chas, network_socket *con);
 
 struct chassis_private {
-	GPtrArray *cons;                          /**< array(network_mysqld_con) */
+	network_connection_registry *cons;        /**< all connections, network_connection_registry(network_mysqld_con) */
 
-	lua_scope *sc;
+	lua_scope *sc;                            /**< the global lua-scope */
+	lua_shared_tables_t *shared;              /**< tables of the global lua-scope shared with the per-thread lua-scopes */
 
 	network_backends_t *backends;
 };
 
 NETWORK_API int network_mysqld_init(chassis *srv);
 NETWORK_API void network_mysqld_add_connection(chassis *srv, network_mysqld_con *con);
+NETWORK_API void network_mysqld_add_connection_to_thread(chassis *srv, network_mysqld_con *con, chassis_event_thread_t *event_thread);
 NETWORK_API void network_mysqld_con_handle(int event_fd, short events, void *user_data);
 NETWORK_API int network_mysqld_queue_append(network_socket *sock, network_queue *queue, const char *data, size_t len);
 NETWORK_API int network_mysqld_queue_append_raw(network_socket *sock, network_queue *queue, GString *data);
@@ -24,6 +24,21 @@
 #endif
 
 #include "network-queue.h"
+#include "glib-ext-pool.h"
+
+/**
+ * a chunk that points into a network_queue_buf
+ *
+ * it is a GString for all the code that reads the chunks. The .allocated_len
+ * of 0 (a real GString has at least room for the \0) marks it as slice.
+ */
+typedef struct {
+	GString str; /* has to be the first member */
+
+	network_queue_buf *buf;
+} network_queue_slice;
+
+static GPool network_queue_pool = G_POOL_INIT("network_queue", network_queue);
 
 #ifndef DISABLE_DEPRECATED_DECL
 network_queue *network_queue_init() {
@@ -34,7 +49,7 @@ network_queue *network_queue_init() {
 network_queue *network_queue_new() {
 	network_queue *queue;
 
-	queue = g_new0(network_queue, 1);
+	queue = g_pool_alloc0(&network_queue_pool);
 
 	queue->chunks = g_queue_new();
 	
@@ -46,11 +61,11 @@ void network_queue_free(network_queue *queue) {
 
 	if (!queue) return;
 
-	while ((packet = g_queue_pop_head(queue->chunks))) g_string_free(packet, TRUE);
+	while ((packet = g_queue_pop_head(queue->chunks))) network_queue_chunk_free(packet);
 
 	g_queue_free(queue->chunks);
 
-	g_free(queue);
+	g_pool_free(&network_queue_pool, queue);
 }
 
 int network_queue_append(network_queue *queue, GString *s) {
@@ -122,7 +137,7 @@ GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString
 	while ((chunk = g_queue_peek_head(queue->chunks))) {
 		gsize we_have = we_want < (chunk->len - queue->offset) ? we_want : (chunk->len - queue->offset);
 
-		if (!dest && (queue->offset == 0) && (chunk->len == steal_len)) {
+		if (!dest && (queue->offset == 0) && (chunk->len == steal_len) && !network_queue_chunk_is_slice(chunk)) {
 			/* optimize the common case that we want to have to full chunk
 			 *
 			 * if dest is null, we can remove the GString from the queue and return it directly without
@@ -145,7 +160,7 @@ GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString
 
 		if (chunk->len == queue->offset) {
 			/* the chunk is done, remove it */
-			g_string_free(g_queue_pop_head(queue->chunks), TRUE);
+			network_queue_chunk_free(g_queue_pop_head(queue->chunks));
 			queue->offset = 0;
 		} else {
 			break;
@@ -155,4 +170,80 @@ GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString
 	return dest;
 }
 
+network_queue_buf *network_queue_buf_new(gsize size) {
+	network_queue_buf *buf;
+
+	buf = g_slice_new(network_queue_buf);
+	buf->data = g_string_sized_new(size);
+	buf->ref_count = 1;
+
+	return buf;
+}
+
+network_queue_buf *network_queue_buf_ref(network_queue_buf *buf) {
+	g_atomic_int_inc(&(buf->ref_count));
+
+	return buf;
+}
+
+void network_queue_buf_unref(network_queue_buf *buf) {
+	if (!buf) return;
+
+	if (!g_atomic_int_dec_and_test(&(buf->ref_count))) return;
+
+	g_string_free(buf->data, TRUE);
+	g_slice_free(network_queue_buf, buf);
+}
+
+/**
+ * check if slices still reference the buffer
+ *
+ * the owner of a shared buffer may append to it, but must not move or resize it
+ */
+gboolean network_queue_buf_is_shared(network_queue_buf *buf) {
+	return g_atomic_int_get(&(buf->ref_count)) > 1;
+}
+
+/**
+ * create a chunk that references len bytes of buf at offset
+ *
+ * the slice holds a reference on the buffer until it is freed with network_queue_chunk_free()
+ */
+GString *network_queue_slice_new(network_queue_buf *buf, gsize offset, gsize len) {
+	network_queue_slice *slice;
+
+	g_assert_cmpint(offset + len, <=, buf->data->len);
+
+	slice = g_slice_new(network_queue_slice);
+	slice->str.str = buf->data->str + offset;
+	slice->str.len = len;
+	slice->str.allocated_len = 0;
+	slice->buf = network_queue_buf_ref(buf);
+
+	return &(slice->str);
+}
+
+gboolean network_queue_chunk_is_slice(GString *chunk) {
+	return chunk->allocated_len == 0;
+}
+
+/**
+ * free a chunk of a network_queue
+ *
+ * works for GStrings and slices
+ */
+void network_queue_chunk_free(GString *chunk) {
+	network_queue_slice *slice;
 
+	if (!chunk) return;
+
+	if (!network_queue_chunk_is_slice(chunk)) {
+		g_string_free(chunk, TRUE);
+		return;
+	}
+
+	slice = (network_queue_slice *)chunk;
+
+	network_queue_buf_unref(slice->buf);
+	g_slice_free(network_queue_slice, slice);
+}
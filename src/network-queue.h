@@ -26,7 +26,24 @@
 
 #include <glib.h>
 
-/* a input or output stream */
+/**
+ * a refcounted buffer the chunks of a network_queue can reference
+ *
+ * the network_socket recv()s into it and cuts the packets out of it as slices
+ * without copying them
+ */
+typedef struct {
+	GString *data;
+
+	volatile gint ref_count;
+} network_queue_buf;
+
+/* a input or output stream
+ *
+ * the chunks are GStrings. A chunk may also be a slice of a network_queue_buf (see
+ * network_queue_slice_new()) which can be read and modified in place, but not 
+ * resized. Chunks have to be freed with network_queue_chunk_free().
+ */
 typedef struct {
 	GQueue *chunks;
 
@@ -41,4 +58,13 @@ NETWORK_API int network_queue_append(network_queue *queue, GString *chunk);
 NETWORK_API GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString *dest);
 NETWORK_API GString *network_queue_peek_string(network_queue *queue, gsize peek_len, GString *dest);
 
+NETWORK_API network_queue_buf *network_queue_buf_new(gsize size);
+NETWORK_API network_queue_buf *network_queue_buf_ref(network_queue_buf *buf);
+NETWORK_API void network_queue_buf_unref(network_queue_buf *buf);
+NETWORK_API gboolean network_queue_buf_is_shared(network_queue_buf *buf);
+
+NETWORK_API GString *network_queue_slice_new(network_queue_buf *buf, gsize offset, gsize len);
+NETWORK_API gboolean network_queue_chunk_is_slice(GString *chunk);
+NETWORK_API void network_queue_chunk_free(GString *chunk);
+
 #endif
@@ -92,6 +92,9 @@
 #include "network-mysqld-packet.h"
 #include "string-len.h"
 #include "glib-ext.h"
+#include "glib-ext-pool.h"
+
+static GPool network_socket_pool = G_POOL_INIT("network_socket", network_socket);
 
 #ifndef DISABLE_DEPRECATED_DECL
 network_socket *network_socket_init() {
@@ -102,11 +105,10 @@ network_socket *network_socket_init() {
 network_socket *network_socket_new() {
 	network_socket *s;
 	
-	s = g_new0(network_socket, 1);
+	s = g_pool_alloc0(&network_socket_pool);
 
 	s->send_queue = network_queue_new();
 	s->recv_queue = network_queue_new();
-	s->recv_queue_raw = network_queue_new();
 
 	s->default_db = g_string_new(NULL);
 	s->fd           = -1;
@@ -124,7 +126,7 @@ void network_socket_free(network_socket *s) {
 
 	network_queue_free(s->send_queue);
 	network_queue_free(s->recv_queue);
-	network_queue_free(s->recv_queue_raw);
+	network_queue_buf_unref(s->recv_buf);
 
 	if (s->response) network_mysqld_auth_response_free(s->response);
 	if (s->challenge) network_mysqld_auth_challenge_free(s->challenge);
@@ -140,7 +142,7 @@ void network_socket_free(network_socket *s) {
 
 	g_string_free(s->default_db, TRUE);
 
-	g_free(s);
+	g_pool_free(&network_socket_pool, s);
 }
 
 /**
@@ -531,6 +533,23 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 						g_strerror(errno), errno);
 				return NETWORK_SOCKET_ERROR;
 			}
+
+			if (con->reuseport) {
+#ifdef SO_REUSEPORT
+				if (0 != setsockopt(con->fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val))) {
+					g_critical("%s: setsockopt(%s, SOL_SOCKET, SO_REUSEPORT) failed: %s (%d)", 
+							G_STRLOC,
+							con->dst->name->str,
+							g_strerror(errno), errno);
+					return NETWORK_SOCKET_ERROR;
+				}
+#else
+				g_critical("%s: SO_REUSEPORT isn't supported on this platform, can't bind %s",
+						G_STRLOC,
+						con->dst->name->str);
+				return NETWORK_SOCKET_ERROR;
+#endif
+			}
 		}
 
 		if (-1 == bind(con->fd, &con->dst->addr.common, con->dst->len)) {
@@ -575,57 +594,162 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 }
 
 /**
- * read a data from the socket
+ * make sure the recv-buffer can hold len bytes of unparsed data
+ *
+ * used when a packet is larger than the recv-buffer. If slices still 
+ * reference the recv-buffer the unparsed data is moved to a new one.
+ */
+void network_socket_recv_buf_reserve(network_socket *sock, gsize len) {
+	network_queue_buf *buf = sock->recv_buf;
+	gsize buf_size = sock->recv_buf_size ? sock->recv_buf_size : NETWORK_SOCKET_RECV_BUF_SIZE;
+	gsize unparsed;
+	gsize needed;
+
+	if (!buf) {
+		sock->recv_buf = network_queue_buf_new(MAX(len, buf_size));
+		return;
+	}
+
+	unparsed = buf->data->len - sock->recv_buf_offset;
+	needed = MAX(len, unparsed + 1); /* at least one byte to recv() into */
+
+	/* there is enough room behind the unparsed data */
+	if (sock->recv_buf_offset + needed < buf->data->allocated_len) return;
+
+	if (network_queue_buf_is_shared(buf)) {
+		network_queue_buf *new_buf;
+
+		new_buf = network_queue_buf_new(MAX(needed, buf_size));
+		g_string_append_len(new_buf->data, buf->data->str + sock->recv_buf_offset, unparsed);
+
+		network_queue_buf_unref(buf);
+		sock->recv_buf = new_buf;
+		sock->recv_buf_offset = 0;
+
+		return;
+	}
+
+	/* move the unparsed data to the front */
+	if (sock->recv_buf_offset > 0) {
+		if (unparsed > 0) g_memmove(buf->data->str, buf->data->str + sock->recv_buf_offset, unparsed);
+		g_string_truncate(buf->data, unparsed);
+		sock->recv_buf_offset = 0;
+	}
+
+	if (buf->data->allocated_len <= needed) {
+		/* grow the buffer without changing its content */
+		g_string_set_size(buf->data, needed);
+		g_string_truncate(buf->data, unparsed);
+	}
+}
+
+/**
+ * mark len bytes of the recv-buffer as parsed
+ *
+ * if the buffer is empty afterwards it is reset. If it got grown for a 
+ * large packet or slices still reference it, it is released.
+ */
+void network_socket_recv_buf_consume(network_socket *sock, gsize len) {
+	network_queue_buf *buf = sock->recv_buf;
+	gsize buf_size = sock->recv_buf_size ? sock->recv_buf_size : NETWORK_SOCKET_RECV_BUF_SIZE;
+
+	g_assert(buf);
+	g_assert_cmpint(sock->recv_buf_offset + len, <=, buf->data->len);
+
+	sock->recv_buf_offset += len;
+
+	if (sock->recv_buf_offset == buf->data->len) {
+		if (network_queue_buf_is_shared(buf) ||
+		    buf->data->allocated_len > 4 * buf_size) {
+			network_queue_buf_unref(buf);
+			sock->recv_buf = NULL;
+		} else {
+			g_string_truncate(buf->data, 0);
+		}
+		sock->recv_buf_offset = 0;
+	}
+}
+
+/**
+ * cut a packet of len bytes from the front of the recv-buffer 
+ *
+ * @return a slice of the recv-buffer if ->recv_slices is set, a copy otherwise
+ */
+GString *network_socket_recv_buf_pop(network_socket *sock, gsize len) {
+	GString *chunk;
+
+	if (sock->recv_slices) {
+		chunk = network_queue_slice_new(sock->recv_buf, sock->recv_buf_offset, len);
+	} else {
+		chunk = g_string_new_len(sock->recv_buf->data->str + sock->recv_buf_offset, len);
+	}
+
+	network_socket_recv_buf_consume(sock, len);
+
+	return chunk;
+}
+
+/**
+ * read data from the socket
+ *
+ * recv()s as much as fits into the recv-buffer of the socket. If the peer
+ * closed the connection ->is_eof is set.
  *
  * @param sock the socket
+ * @return NETWORK_SOCKET_SUCCESS if we read something, NETWORK_SOCKET_WAIT_FOR_EVENT if
+ *   there was nothing to read or the connection got closed, NETWORK_SOCKET_ERROR on error
  */
 network_socket_retval_t network_socket_read(network_socket *sock) {
+	GString *buf;
 	gssize len;
+	gsize room;
 
-	if (sock->to_read > 0) {
-		GString *packet = g_string_sized_new(sock->to_read);
+	network_socket_recv_buf_reserve(sock, 0);
+	buf = sock->recv_buf->data;
 
-		g_queue_push_tail(sock->recv_queue_raw->chunks, packet);
+	room = buf->allocated_len - 1 - buf->len;
+	if (room == 0) {
+		/* the buffer is full and has to be parsed first */
+		return NETWORK_SOCKET_SUCCESS;
+	}
 
-		if (sock->socket_type == SOCK_STREAM) {
-			len = recv(sock->fd, packet->str, sock->to_read, 0);
-		} else {
-			/* UDP */
-			network_socklen_t dst_len = sizeof(sock->dst->addr.common);
-			len = recvfrom(sock->fd, packet->str, sock->to_read, 0, &(sock->dst->addr.common), &(dst_len));
-			sock->dst->len = dst_len;
-		}
-		if (-1 == len) {
+	if (sock->socket_type == SOCK_STREAM) {
+		len = recv(sock->fd, buf->str + buf->len, room, 0);
+	} else {
+		/* UDP */
+		network_socklen_t dst_len = sizeof(sock->dst->addr.common);
+		len = recvfrom(sock->fd, buf->str + buf->len, room, 0, &(sock->dst->addr.common), &(dst_len));
+		sock->dst->len = dst_len;
+	}
+	if (-1 == len) {
 #ifdef _WIN32
-			errno = WSAGetLastError();
+		errno = WSAGetLastError();
 #endif
-			switch (errno) {
-			case E_NET_CONNABORTED:
-			case E_NET_CONNRESET: /** nothing to read, let's let ioctl() handle the close for us */
-			case E_NET_WOULDBLOCK: /** the buffers are empty, try again later */
-			case EAGAIN:     
-				return NETWORK_SOCKET_WAIT_FOR_EVENT;
-			default:
-				g_debug("%s: recv() failed: %s (errno=%d)", G_STRLOC, g_strerror(errno), errno);
-				return NETWORK_SOCKET_ERROR;
-			}
-		} else if (len == 0) {
-			/**
-			 * connection close
-			 *
-			 * let's call the ioctl() and let it handle it for use
-			 */
+		switch (errno) {
+		case E_NET_CONNABORTED:
+		case E_NET_CONNRESET: /** the peer is gone */
+			sock->is_eof = TRUE;
 			return NETWORK_SOCKET_WAIT_FOR_EVENT;
+		case E_NET_WOULDBLOCK: /** the buffers are empty, try again later */
+		case EAGAIN:     
+			return NETWORK_SOCKET_WAIT_FOR_EVENT;
+		default:
+			g_debug("%s: recv() failed: %s (errno=%d)", G_STRLOC, g_strerror(errno), errno);
+			return NETWORK_SOCKET_ERROR;
 		}
-
-		sock->to_read -= len;
-		sock->recv_queue_raw->len += len;
-#if 0
-		sock->recv_queue_raw->offset = 0; /* offset into the first packet */
-#endif
-		packet->len = len;
+	} else if (len == 0 && sock->socket_type == SOCK_STREAM) {
+		/**
+		 * connection close
+		 */
+		sock->is_eof = TRUE;
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
 	}
 
+	g_string_set_size(buf, buf->len + len);
+
+	/* keep the ->to_read of network_socket_to_read() in sync */
+	sock->to_read = sock->to_read > len ? sock->to_read - len : 0;
+
 	return NETWORK_SOCKET_SUCCESS;
 }
 
@@ -723,7 +847,7 @@ static network_socket_retval_t network_socket_write_writev(network_socket *con,
 			/* to trace the data we sent to the socket, enable this */
 			g_debug_hexdump(G_STRLOC, S(s));
 #endif
-			g_string_free(s, TRUE);
+			network_queue_chunk_free(s);
 			
 			g_queue_delete_link(con->send_queue->chunks, chunk);
 
@@ -787,7 +911,7 @@ static network_socket_retval_t network_socket_write_send(network_socket *con, in
 		con->send_queue->offset += len;
 
 		if (con->send_queue->offset == s->len) {
-			g_string_free(s, TRUE);
+			network_queue_chunk_free(s);
 			
 			g_queue_delete_link(con->send_queue->chunks, chunk);
 			con->send_queue->offset = 0;
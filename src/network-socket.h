@@ -64,6 +64,8 @@
 #define CHAS_NET_KEEPALIVE_WAIT	10 /* in seconds */
 #define CHAS_NET_KEEPALIVE_ABORT	30 /* in seconds */
 
+#define NETWORK_SOCKET_RECV_BUF_SIZE	16384 /* default size of network_socket::recv_buf */
+
 typedef enum {
 	NETWORK_SOCKET_SUCCESS,
 	NETWORK_SOCKET_WAIT_FOR_EVENT,
@@ -83,13 +85,27 @@ typedef struct {
 
 	int socket_type; /**< SOCK_STREAM or SOCK_DGRAM for now */
 
+	gboolean reuseport; /**< set SO_REUSEPORT on bind() to let several sockets listen on the same address */
+
 	guint8   last_packet_id; /**< internal tracking of the packet_id's the automaticly set the next good packet-id */
 	gboolean packet_id_is_reset; /**< internal tracking of the packet_id sequencing */
 
 	network_queue *recv_queue;
-	network_queue *recv_queue_raw;
 	network_queue *send_queue;
 
+	/**
+	 * the raw data we received
+	 *
+	 * network_socket_read() recv()s as much as fits into the buffer, 
+	 * the unparsed data starts at recv_buf_offset. The buffer is reused as
+	 * long as no slices reference it.
+	 */
+	network_queue_buf *recv_buf;
+	gsize    recv_buf_offset;
+	gsize    recv_buf_size;  /**< size to allocate the recv_buf with, 0 for NETWORK_SOCKET_RECV_BUF_SIZE */
+	gboolean recv_slices;    /**< put slices of the recv_buf into the recv_queue instead of copies */
+	gboolean is_eof;         /**< the peer closed the connection */
+
 	off_t header_read;
 	off_t to_read;
 	
@@ -102,6 +118,9 @@ typedef struct {
 	network_mysqld_auth_response  *response;
 
 	gboolean is_authed;           /** did a client already authed this connection */
+	gboolean has_session_state;   /** a command that was sent may have left session state (variables, temp-tables, locks, ...) on the server connection */
+
+	glong pool_expires_at;        /** the connection pool closes the idling connection after this time (in seconds), 0 if not set yet */
 
 	/**
 	 * store the default-db of the socket
@@ -118,6 +137,9 @@ NETWORK_API void network_socket_free(network_socket *s);
 NETWORK_API network_socket_retval_t network_socket_write(network_socket *con, int send_chunks);
 NETWORK_API network_socket_retval_t network_socket_read(network_socket *con);
 NETWORK_API network_socket_retval_t network_socket_to_read(network_socket *sock);
+NETWORK_API void network_socket_recv_buf_reserve(network_socket *sock, gsize len);
+NETWORK_API void network_socket_recv_buf_consume(network_socket *sock, gsize len);
+NETWORK_API GString *network_socket_recv_buf_pop(network_socket *sock, gsize len);
 NETWORK_API network_socket_retval_t network_socket_set_non_blocking(network_socket *sock);
 NETWORK_API network_socket_retval_t network_socket_connect(network_socket *con);
 NETWORK_API network_socket_retval_t network_socket_connect_finish(network_socket *sock);
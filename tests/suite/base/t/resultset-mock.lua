@@ -102,6 +102,24 @@ function read_query(packet)
 				}
 			}
 		}
+	elseif query == 'SELECT min_max()' then
+		-- numbers that don't compare right as double or byte-wise
+		proxy.response = {
+			type = proxy.MYSQLD_PACKET_OK,
+			resultset = { 
+				fields = { 
+					{ name = "f1", type = proxy.MYSQL_TYPE_LONGLONG },
+					{ name = "f2", type = proxy.MYSQL_TYPE_NEWDECIMAL },
+					{ name = "f3", type = proxy.MYSQL_TYPE_DOUBLE },
+				},
+				rows = {
+					{ "9007199254740992", "-3.1", "1.5" },
+					{ "9007199254740993", "-12.50", "-2e10" },
+					{ "-5", "100.00", "0.25" },
+					{ "10", "99.999", "0.5" },
+				}
+			}
+		}
 	elseif query == 'INSERT INTO test.t1 VALUES ( 1 )' then
 		-- we need a long string, more than 255 chars
 		proxy.response = {
@@ -78,6 +78,25 @@ function read_query_result(inj)
 					tostring(row[3]))
 			end
 
+			-- the cursor decodes the same row on demand, even if the fields are read out of order
+			local cursor_res = ""
+			for row in res.cursor do
+				assert(#row == 3)
+
+				local f3, f1, f2 = row[3], row[1], row[2]
+				cursor_res = ("%s,%s,%s"):format(
+					tostring(f1),
+					tostring(f2),
+					tostring(f3))
+			end
+			assert(cursor_res == test_res)
+
+			-- the aggregations skip the NULLs
+			assert(res:count() == 1)
+			assert(res:count(2) == 0)
+			assert(res:max(1) == "1")
+			assert(res:min(2) == nil)
+
 			-- return the string to mysqltest (should be 1,nil,1)
 			proxy.response = {
 				type = proxy.MYSQLD_PACKET_OK,
@@ -91,6 +110,22 @@ function read_query_result(inj)
 				}
 			}
 			return proxy.PROXY_SEND_RESULT
+		elseif inj.query == string.char(proxy.COM_QUERY) .. "SELECT min_max()" then
+			-- BIGINTs beyond 2^53 and DECIMALs are compared exactly
+			proxy.response = {
+				type = proxy.MYSQLD_PACKET_OK,
+				resultset = {
+					fields = { 
+						{ name = "min1" }, { name = "max1" },
+						{ name = "min2" }, { name = "max2" },
+						{ name = "min3" }, { name = "max3" },
+					},
+					rows = {
+						{ res:min(1), res:max(1), res:min(2), res:max(2), res:min(3), res:max(3) }
+					}
+				}
+			}
+			return proxy.PROXY_SEND_RESULT
 		elseif inj.query == string.char(proxy.COM_QUERY) .. "SELECT row_count(1), bytes()" then
 			-- convert a OK packet with affected rows into a resultset
 			assert(res.affected_rows == nil)
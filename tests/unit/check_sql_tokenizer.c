@@ -44,19 +44,19 @@
  *  
  */
 START_TEST(test_tokenizer) {
-	GPtrArray *tokens = NULL;
+	sql_tokens *tokens = NULL;
 	gsize i;
 
 	tokens = sql_tokens_new();
 
 	sql_tokenizer(tokens, C("SELEcT \"qq-end\"\"\", \"\"\"qq-start\", \"'\"`qq-mixed''\" FROM a AS `b`, `ABC``FOO` "));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 #define T(t_id, t_text) \
 		g_assert_cmpint(token->token_id, ==, t_id); \
-		g_assert_cmpstr(token->text->str, ==, t_text); 
+		g_assert_cmpstr(sql_token_get_text(tokens, token), ==, t_text); 
 
 		switch (i) {
 		case 0: T(TK_SQL_SELECT, "SELEcT"); break;
@@ -76,7 +76,7 @@ START_TEST(test_tokenizer) {
 			 /**
 			  * a self-writing test-case 
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			break;
 		}
 	}
@@ -90,19 +90,19 @@ START_TEST(test_tokenizer) {
  *  
  */
 START_TEST(test_table_name_underscore) {
-	GPtrArray *tokens = NULL;
+	sql_tokens *tokens = NULL;
 	gsize i;
 
 	tokens = sql_tokens_new();
 
 	sql_tokenizer(tokens, C("SELEcT * FROM __test_table "));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 #define T(t_id, t_text) \
 		g_assert_cmpint(token->token_id, ==, t_id); \
-		g_assert_cmpstr(token->text->str, ==, t_text);
+		g_assert_cmpstr(sql_token_get_text(tokens, token), ==, t_text);
 
 		switch (i) {
 		case 0: T(TK_SQL_SELECT, "SELEcT"); break;
@@ -114,7 +114,7 @@ START_TEST(test_table_name_underscore) {
 			 /**
 			  * a self-writing test-case 
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			break;
 		}
 	}
@@ -144,18 +144,18 @@ START_TEST(test_token2name) {
  */
 START_TEST(test_simple_dashdashcomment) {
 	gsize i;
-	GPtrArray *tokens = NULL;
+	sql_tokens *tokens = NULL;
 	
 	tokens = sql_tokens_new();
 	
 	sql_tokenizer(tokens, C("-- comment"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 		
 #define T(t_id, t_text) \
 g_assert_cmpint(token->token_id, ==, t_id); \
-g_assert_cmpstr(token->text->str, ==, t_text); 
+g_assert_cmpstr(sql_token_get_text(tokens, token), ==, t_text); 
 
 		switch (i) {
 		case 0: T(TK_COMMENT, "comment"); break;
@@ -173,18 +173,18 @@ g_assert_cmpstr(token->text->str, ==, t_text);
  */
 START_TEST(test_dashdashcomment) {
 	gsize i;
-	GPtrArray *tokens = NULL;
+	sql_tokens *tokens = NULL;
 	
 	tokens = sql_tokens_new();
 	
 	sql_tokenizer(tokens, C("--  comment\nSELECT 1 FROM dual"));
 	
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 		
 #define T(t_id, t_text) \
 g_assert_cmpint(token->token_id, ==, t_id); \
-g_assert_cmpstr(token->text->str, ==, t_text); 
+g_assert_cmpstr(sql_token_get_text(tokens, token), ==, t_text); 
 		
 		switch (i) {
 			case 0: T(TK_COMMENT, " comment"); break;	/* note the leading whitespace here! */
@@ -206,18 +206,18 @@ g_assert_cmpstr(token->text->str, ==, t_text);
  */
 START_TEST(test_doubleminus) {
 	gsize i;
-	GPtrArray *tokens = NULL;
+	sql_tokens *tokens = NULL;
 	
 	tokens = sql_tokens_new();
 	
 	sql_tokenizer(tokens, C("SELECT 1--1 FROM DUAL"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 #define T(t_id, t_text) \
 g_assert_cmpint(token->token_id, ==, t_id); \
-g_assert_cmpstr(token->text->str, ==, t_text); 
+g_assert_cmpstr(sql_token_get_text(tokens, token), ==, t_text); 
 	
 		switch (i) {
 			case 0: T(TK_SQL_SELECT, "SELECT"); break;
@@ -241,7 +241,7 @@ g_assert_cmpstr(token->text->str, ==, t_text);
  */
 START_TEST(test_startstate_reset_quoted) {
 	gsize i;
-	GPtrArray *tokens = NULL;
+	sql_tokens *tokens = NULL;
 	
 	tokens = sql_tokens_new();
 	/* EOF encountered while sql-tokenizer is in QUOTED start state */
@@ -252,12 +252,12 @@ START_TEST(test_startstate_reset_quoted) {
 	/* valid query, fails with an assertion when bug 36506 is unfixed */
 	sql_tokenizer(tokens, C("SELECT \"foo\""));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 		
 #define T(t_id, t_text) \
 g_assert_cmpint(token->token_id, ==, t_id); \
-g_assert_cmpstr(token->text->str, ==, t_text); 
+g_assert_cmpstr(sql_token_get_text(tokens, token), ==, t_text); 
 		
 		switch (i) {
 			case 0: T(TK_SQL_SELECT, "SELECT"); break;
@@ -277,7 +277,7 @@ g_assert_cmpstr(token->text->str, ==, t_text);
  */
 START_TEST(test_startstate_reset_comment) {
 	gsize i;
-	GPtrArray *tokens = NULL;
+	sql_tokens *tokens = NULL;
 	
 	/* test for C-style comments */
 	
@@ -290,12 +290,12 @@ START_TEST(test_startstate_reset_comment) {
 	/* valid query, fails with an assertion when bug 36506 is unfixed */
 	sql_tokenizer(tokens, C("SELECT /*foo*/ 1"));
 	
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 		
 #define T(t_id, t_text) \
 g_assert_cmpint(token->token_id, ==, t_id); \
-g_assert_cmpstr(token->text->str, ==, t_text); 
+g_assert_cmpstr(sql_token_get_text(tokens, token), ==, t_text); 
 		
 		switch (i) {
 			case 0: T(TK_SQL_SELECT, "SELECT"); break;
@@ -319,12 +319,12 @@ g_assert_cmpstr(token->text->str, ==, t_text);
 	/* valid query, fails with an assertion when bug 36506 is unfixed */
 	sql_tokenizer(tokens, C("SELECT -- foo\n1"));
 	
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 		
 #define T(t_id, t_text) \
 g_assert_cmpint(token->token_id, ==, t_id); \
-g_assert_cmpstr(token->text->str, ==, t_text); 
+g_assert_cmpstr(sql_token_get_text(tokens, token), ==, t_text); 
 		
 		switch (i) {
 			case 0: T(TK_SQL_SELECT, "SELECT"); break;
@@ -364,6 +364,19 @@ void test_tokenizer_keywords() {
 	/* check that some SQL commands are not keywords */
 	g_assert_cmpint(sql_token_get_id_len(C("COMMIT")), ==, TK_LITERAL);
 	g_assert_cmpint(sql_token_get_id_len(C("TRUNCATE")), ==, TK_LITERAL);
+
+	/* the keywords are case-insensitive */
+	g_assert_cmpint(sql_token_get_id_len(C("select")), ==, TK_SQL_SELECT);
+	g_assert_cmpint(sql_token_get_id_len(C("SeLeCt")), ==, TK_SQL_SELECT);
+	g_assert_cmpint(sql_token_get_id_len(C("sql_calc_found_rows")), ==, TK_SQL_SQL_CALC_FOUND_ROWS);
+
+	/* prefixes, suffixes and look-alikes of keywords are literals */
+	g_assert_cmpint(sql_token_get_id_len(C("SELEC")), ==, TK_LITERAL);
+	g_assert_cmpint(sql_token_get_id_len(C("SELECTS")), ==, TK_LITERAL);
+	g_assert_cmpint(sql_token_get_id_len(C("SELECT\x7f")), ==, TK_LITERAL);
+	g_assert_cmpint(sql_token_get_id_len(C("S\xc5LECT")), ==, TK_LITERAL);
+	g_assert_cmpint(sql_token_get_id_len(C("")), ==, TK_LITERAL);
+	g_assert_cmpint(sql_token_get_id_len(C("THIS_IS_A_VERY_LONG_LITERAL_NAME_THAT_IS_NO_KEYWORD")), ==, TK_LITERAL);
 }
 
 /**
@@ -377,20 +390,20 @@ void test_tokenizer_keywords() {
  * - 1e1 is a float ("1e1")
  */
 void test_literal_digit() {
-	GPtrArray *tokens = NULL;
+	sql_tokens *tokens = NULL;
 	gsize i;
 
 #define T(t_id, t_text) \
 		g_assert_cmpstr(sql_token_get_name(token->token_id, NULL), ==, sql_token_get_name(t_id, NULL)); \
-		g_assert_cmpstr(token->text->str, ==, t_text);
+		g_assert_cmpstr(sql_token_get_text(tokens, token), ==, t_text);
 
 	/* e1 is a literal ("e1") */
 	tokens = sql_tokens_new();
 
 	sql_tokenizer(tokens, C("e1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_LITERAL, "e1"); break;
@@ -398,7 +411,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -409,8 +422,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("1e"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_LITERAL, "1e"); break;
@@ -418,7 +431,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -429,8 +442,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("1e + 1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_LITERAL, "1e"); break;
@@ -440,7 +453,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -451,8 +464,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("1e+1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_FLOAT, "1e+1"); break;
@@ -460,7 +473,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -471,8 +484,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("1e1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_FLOAT, "1e1"); break;
@@ -480,7 +493,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -491,8 +504,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("1e+1e"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_FLOAT, "1e+1"); break;
@@ -501,7 +514,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -512,8 +525,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("1.1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_FLOAT, "1.1"); break;
@@ -521,7 +534,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -532,8 +545,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("1.1e+1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_FLOAT, "1.1e+1"); break;
@@ -541,7 +554,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -555,8 +568,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C(".1t"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_FLOAT, ".1"); break;
@@ -565,7 +578,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -576,8 +589,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("t1.1t"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_LITERAL, "t1"); break;
@@ -587,7 +600,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -598,8 +611,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("e1.1e"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_LITERAL, "e1"); break;
@@ -609,7 +622,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -620,8 +633,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("e1.1e + 1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_LITERAL, "e1"); break;
@@ -633,7 +646,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -644,8 +657,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("e1 . 1e + 1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_LITERAL, "e1"); break;
@@ -657,7 +670,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -669,8 +682,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("e1 . 1e+1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_LITERAL, "e1"); break;
@@ -680,7 +693,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -691,8 +704,8 @@ void test_literal_digit() {
 
 	sql_tokenizer(tokens, C("e1.1e+1"));
 
-	for (i = 0; i < tokens->len; i++) {
-		sql_token *token = tokens->pdata[i];
+	for (i = 0; i < sql_tokens_get_len(tokens); i++) {
+		sql_token *token = sql_tokens_index(tokens, i);
 
 		switch (i) {
 		case 0: T(TK_LITERAL, "e1"); break;
@@ -704,7 +717,7 @@ void test_literal_digit() {
 			 /**
 			  * a self-writing test-case
 			  */
-			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), token->text->str);
+			printf("case %"G_GSIZE_FORMAT": T(%s, \"%s\"); break;\n", i, sql_token_get_name(token->token_id, NULL), sql_token_get_text(tokens, token));
 			g_assert_not_reached();
 		}
 	}
@@ -714,8 +727,218 @@ void test_literal_digit() {
 
 }
 
+#define TOKENIZER_THREADS 4
+#define TOKENIZER_ROUNDS 1000
+
+static gpointer test_tokenizer_threads_worker(gpointer G_GNUC_UNUSED data) {
+	gint i;
+
+	for (i = 0; i < TOKENIZER_ROUNDS; i++) {
+		sql_tokens *tokens = sql_tokens_new();
+
+		/* a unterminated string */
+		g_assert_cmpint(0, ==, sql_tokenizer(tokens, C("SELECT 'abc")));
+		g_assert_cmpint(sql_tokens_get_len(tokens), ==, 2);
+		sql_tokens_free(tokens);
+
+		tokens = sql_tokens_new();
+		g_assert_cmpint(0, ==, sql_tokenizer(tokens, C("/* c */ SELECT `a`.b, 'x''y' FROM t1 WHERE id = 1.5e+1")));
+		g_assert_cmpint(sql_tokens_get_len(tokens), ==, 13);
+		g_assert_cmpint(sql_tokens_index(tokens, 0)->token_id, ==, TK_COMMENT);
+		g_assert_cmpint(sql_tokens_index(tokens, 1)->token_id, ==, TK_SQL_SELECT);
+		g_assert_cmpstr(sql_token_get_text(tokens, sql_tokens_index(tokens, 6)), ==, "x'y");
+		g_assert_cmpint(sql_tokens_index(tokens, 12)->token_id, ==, TK_FLOAT);
+		sql_tokens_free(tokens);
+	}
+
+	return NULL;
+}
+
+/**
+ * @test the threads tokenize in parallel and don't see each others state
+ */
+void test_tokenizer_threads() {
+	GThread *threads[TOKENIZER_THREADS];
+	gint i;
+
+	for (i = 0; i < TOKENIZER_THREADS; i++) {
+		threads[i] = g_thread_create(test_tokenizer_threads_worker, NULL, TRUE, NULL);
+		g_assert(threads[i]);
+	}
+
+	for (i = 0; i < TOKENIZER_THREADS; i++) {
+		g_thread_join(threads[i]);
+	}
+}
+
+/**
+ * normalize a query and check that the fingerprint is the hash of the normalized query
+ */
+static void test_normalize_query(const gchar *query, gsize query_len, const gchar *expected) {
+	sql_tokens *tokens = sql_tokens_new();
+	GString *normalized = g_string_new(NULL);
+	guint64 fingerprint;
+
+	g_assert_cmpint(0, ==, sql_tokenizer(tokens, query, query_len));
+
+	fingerprint = sql_tokens_normalize(tokens, normalized);
+	g_assert_cmpstr(normalized->str, ==, expected);
+	g_assert(fingerprint == sql_tokens_fingerprint(tokens));
+
+	g_string_free(normalized, TRUE);
+	sql_tokens_free(tokens);
+}
+
+/**
+ * @test the tokens are normalized like normalize() of proxy.tokenizer does
+ */
+void test_tokenizer_normalize() {
+	test_normalize_query(C("select 1"), "SELECT ? ");
+	test_normalize_query(C("select count(*) from mysql.user"), "SELECT COUNT( * ) FROM `mysql` . `user` ");
+	test_normalize_query(C("/* comment */select /*! 1 */"), "SELECT /*! 1 */ ");
+	test_normalize_query(C("SELECT @i := 1"), "SELECT @i := ? ");
+	test_normalize_query(C("commit"), "COMMIT ");
+	test_normalize_query(C("start transaction"), "START TRANSACTION ");
+	test_normalize_query(C("begin transaction"), "BEGIN `transaction` ");
+	test_normalize_query(C("CREATE TABLE commit ( id int )"), "CREATE TABLE `commit` ( `id` INT ) ");
+}
+
+/**
+ * @test queries that only differ in their constants have the same fingerprint
+ */
+void test_tokenizer_fingerprint() {
+	sql_tokens *tokens_a = sql_tokens_new();
+	sql_tokens *tokens_b = sql_tokens_new();
+	sql_tokens *tokens_c = sql_tokens_new();
+
+	sql_tokenizer(tokens_a, C("SELECT * FROM t1 WHERE id = 1 AND name = 'foo'"));
+	sql_tokenizer(tokens_b, C("select * /* comment */ from t1 where id = 42 and name = \"bar\""));
+	sql_tokenizer(tokens_c, C("SELECT * FROM t2 WHERE id = 1 AND name = 'foo'"));
+
+	g_assert(sql_tokens_fingerprint(tokens_a) == sql_tokens_fingerprint(tokens_b));
+	g_assert(sql_tokens_fingerprint(tokens_a) != sql_tokens_fingerprint(tokens_c));
+
+	sql_tokens_free(tokens_a);
+	sql_tokens_free(tokens_b);
+	sql_tokens_free(tokens_c);
+}
+
+/**
+ * @test the texts of the tokens share one NUL-terminated buffer
+ */
+void test_tokenizer_text() {
+	sql_tokens *tokens = sql_tokens_new();
+	GString *normalized = g_string_new(NULL);
+	sql_token *token;
+
+	sql_tokenizer(tokens, C("SELECT 'a''b', `c` FROM t1"));
+	g_assert_cmpint(sql_tokens_get_len(tokens), ==, 6);
+
+	/* the quoted string grew after its token was added */
+	token = sql_tokens_index(tokens, 1);
+	g_assert_cmpint(token->token_id, ==, TK_STRING);
+	g_assert_cmpint(token->text_len, ==, 3);
+	g_assert_cmpstr(sql_token_get_text(tokens, token), ==, "a'b");
+
+	token = sql_tokens_index(tokens, 3);
+	g_assert_cmpint(token->token_id, ==, TK_LITERAL);
+	g_assert_cmpstr(sql_token_get_text(tokens, token), ==, "c");
+
+	/* unset tokens are skipped */
+	sql_tokens_index(tokens, 3)->is_unset = TRUE;
+	sql_tokens_index(tokens, 2)->is_unset = TRUE;
+	sql_tokens_normalize(tokens, normalized);
+	g_assert_cmpstr(normalized->str, ==, "SELECT ? FROM `t1` ");
+
+	g_string_free(normalized, TRUE);
+	sql_tokens_free(tokens);
+}
+
+/**
+ * tokenize a query and check if it is a read
+ */
+static void test_is_read_query(const gchar *query, gsize query_len, gboolean is_read, gboolean calc_found_rows) {
+	sql_tokens *tokens = sql_tokens_new();
+	gboolean got_calc_found_rows;
+
+	g_assert_cmpint(0, ==, sql_tokenizer(tokens, query, query_len));
+
+	g_assert_cmpint(sql_tokens_is_read(tokens, &got_calc_found_rows), ==, is_read);
+	g_assert_cmpint(got_calc_found_rows, ==, calc_found_rows);
+
+	sql_tokens_free(tokens);
+}
+
+/**
+ * @test only the SELECTs that don't lock, write or depend on the previous write are reads
+ */
+void test_tokenizer_is_read() {
+	sql_tokens *tokens = sql_tokens_new();
+
+	test_is_read_query(C("SELECT * FROM t1"), TRUE, FALSE);
+	test_is_read_query(C("/* comment */ select id FROM t1 WHERE id = 1"), TRUE, FALSE);
+	test_is_read_query(C("SELECT * FROM t1 FOR UPDATE"), FALSE, FALSE);
+	test_is_read_query(C("SELECT * FROM t1 LOCK IN SHARE MODE"), FALSE, FALSE);
+	test_is_read_query(C("SELECT * INTO OUTFILE '/tmp/t1' FROM t1"), FALSE, FALSE);
+	test_is_read_query(C("SELECT id INTO @id FROM t1"), FALSE, FALSE);
+	test_is_read_query(C("SELECT LAST_INSERT_ID()"), FALSE, FALSE);
+	test_is_read_query(C("select last_insert_id ()"), FALSE, FALSE);
+	test_is_read_query(C("SELECT @@insert_id"), FALSE, FALSE);
+	test_is_read_query(C("SELECT SQL_CALC_FOUND_ROWS * FROM t1 LIMIT 10"), TRUE, TRUE);
+	test_is_read_query(C("SELECT SQL_CALC_FOUND_ROWS * FROM t1 LIMIT 10 FOR UPDATE"), FALSE, TRUE);
+	test_is_read_query(C("INSERT INTO t1 SELECT * FROM t2"), FALSE, FALSE);
+	test_is_read_query(C("UPDATE t1 SET id = 1"), FALSE, FALSE);
+
+	/* calc_found_rows may be NULL */
+	sql_tokenizer(tokens, C("SELECT SQL_CALC_FOUND_ROWS 1"));
+	g_assert(sql_tokens_is_read(tokens, NULL));
+
+	sql_tokens_free(tokens);
+}
+
+/**
+ * tokenize a query and check if it leaves session state
+ */
+static void test_session_state_query(const gchar *query, gsize query_len, gboolean has_session_state) {
+	sql_tokens *tokens = sql_tokens_new();
+
+	g_assert_cmpint(0, ==, sql_tokenizer(tokens, query, query_len));
+
+	g_assert_cmpint(sql_tokens_has_session_state(tokens), ==, has_session_state);
+
+	sql_tokens_free(tokens);
+}
+
+/**
+ * @test the statements that leave session state are found behind comments and any whitespace
+ */
+void test_tokenizer_has_session_state() {
+	test_session_state_query(C("SELECT * FROM t1"), FALSE);
+	test_session_state_query(C("SELECT 'user@example.com', @@version"), FALSE);
+	test_session_state_query(C("SET autocommit = 0"), FALSE);
+	test_session_state_query(C("set  @@autocommit=1"), FALSE);
+	test_session_state_query(C("DROP TEMPORARY TABLE t1"), FALSE);
+	test_session_state_query(C("CREATE TABLE t1 (id INT)"), FALSE);
+
+	test_session_state_query(C("USE db"), TRUE);
+	test_session_state_query(C("/* x */ USE db"), TRUE);
+	test_session_state_query(C("-- x\nuse db"), TRUE);
+	test_session_state_query(C("CREATE TEMPORARY TABLE t (id INT)"), TRUE);
+	test_session_state_query(C("/*x*/CREATE TEMPORARY TABLE t (id INT)"), TRUE);
+	test_session_state_query(C("CREATE  TEMPORARY\tTABLE t (id INT)"), TRUE);
+	test_session_state_query(C("  \n SET NAMES utf8"), TRUE);
+	test_session_state_query(C("SET SESSION sql_mode = ''"), TRUE);
+	test_session_state_query(C("/* x */ LOCK TABLES t1 READ"), TRUE);
+	test_session_state_query(C("prepare stmt FROM 'SELECT 1'"), TRUE);
+	test_session_state_query(C("HANDLER t1 OPEN"), TRUE);
+	test_session_state_query(C("SELECT GET_LOCK('a', 10)"), TRUE);
+	test_session_state_query(C("SELECT @a := 1"), TRUE);
+	test_session_state_query(C("/*!40101 SET NAMES utf8 */"), TRUE);
+}
 
 int main(int argc, char **argv) {
+	g_thread_init(NULL);
+
 	g_test_init(&argc, &argv, NULL);
 	g_test_bug_base("http://bugs.mysql.com/");
 
@@ -731,6 +954,12 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/tokenizer_startstate_reset_comment", test_startstate_reset_comment);
 
 	g_test_add_func("/core/tokenizer_literal_digit", test_literal_digit);
+	g_test_add_func("/core/tokenizer_threads", test_tokenizer_threads);
+	g_test_add_func("/core/tokenizer_normalize", test_tokenizer_normalize);
+	g_test_add_func("/core/tokenizer_fingerprint", test_tokenizer_fingerprint);
+	g_test_add_func("/core/tokenizer_text", test_tokenizer_text);
+	g_test_add_func("/core/tokenizer_is_read", test_tokenizer_is_read);
+	g_test_add_func("/core/tokenizer_has_session_state", test_tokenizer_has_session_state);
 
 	return g_test_run();
 }
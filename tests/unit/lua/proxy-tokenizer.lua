@@ -44,6 +44,17 @@ function TestScript:testNormalize()
 	assertEquals(norm_query, "SET `GLOBAL` `unknown` . `unknown` = ? ")
 end
 
+---
+-- test if queries of the same class get the same fingerprint
+function TestScript:testFingerprint()
+	local fp = tokenizer.fingerprint("SELECT * FROM t1 WHERE id = 1")
+
+	assertEquals(#fp, 16)
+	assertEquals(tokenizer.fingerprint("select * from t1 /* comment */ where id = 42"), fp)
+	assertEquals(tokenizer.fingerprint(tokenizer.tokenize("SELECT * FROM t1 WHERE id = 2")), fp)
+	assertNotEquals(tokenizer.fingerprint("SELECT * FROM t2 WHERE id = 1"), fp)
+end
+
 ---
 -- test if we can access the fields step-by-step and out-of-range
 function TestScript:testFields()
@@ -0,0 +1,172 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "glib-ext-pool.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+typedef struct {
+	gint a;
+	gchar b[60];
+} t_pool_obj;
+
+static GPool t_pool = G_POOL_INIT("t_pool_obj", t_pool_obj);
+
+/**
+ * get a counter of the t_pool through g_pools_get_stats()
+ */
+static guint t_pool_get_stat(const char *name) {
+	GHashTable *stats_hash;
+	gchar *key;
+	guint value;
+
+	stats_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	g_pools_get_stats(stats_hash);
+
+	key = g_strdup_printf("t_pool_obj_pool_%s", name);
+	value = GPOINTER_TO_UINT(g_hash_table_lookup(stats_hash, key));
+	g_free(key);
+
+	g_hash_table_destroy(stats_hash);
+
+	return value;
+}
+
+/**
+ * @test freed objects are reused and handed out zero'ed
+ */
+void t_g_pool_reuse() {
+	t_pool_obj *obj, *obj2;
+	gint hits;
+
+	obj = g_pool_alloc0(&t_pool);
+	g_assert(obj);
+	g_assert_cmpint(obj->a, ==, 0);
+
+	obj->a = 42;
+	g_pool_free(&t_pool, obj);
+
+	hits = t_pool_get_stat("hits");
+
+	obj2 = g_pool_alloc0(&t_pool);
+	g_assert(obj2 == obj);
+	g_assert_cmpint(obj2->a, ==, 0);
+	g_assert_cmpint(t_pool_get_stat("hits"), ==, hits + 1);
+
+	g_pool_free(&t_pool, obj2);
+}
+
+/**
+ * @test free-lists of a thread that are full go to the depot and are picked up again
+ */
+void t_g_pool_depot() {
+	t_pool_obj *objs[G_POOL_THREAD_CACHE_SIZE * 2 + 1];
+	guint i;
+	gint hits;
+
+	for (i = 0; i < G_N_ELEMENTS(objs); i++) {
+		objs[i] = g_pool_alloc0(&t_pool);
+	}
+	for (i = 0; i < G_N_ELEMENTS(objs); i++) {
+		g_pool_free(&t_pool, objs[i]);
+	}
+	g_assert_cmpint(t_pool.depot_len, >, 0);
+
+	hits = t_pool_get_stat("hits");
+
+	for (i = 0; i < G_N_ELEMENTS(objs); i++) {
+		objs[i] = g_pool_alloc0(&t_pool);
+	}
+	g_assert_cmpint(t_pool_get_stat("hits"), ==, hits + G_N_ELEMENTS(objs));
+	g_assert_cmpint(t_pool.depot_len, ==, 0);
+
+	for (i = 0; i < G_N_ELEMENTS(objs); i++) {
+		g_pool_free(&t_pool, objs[i]);
+	}
+}
+
+/**
+ * @test the stats of the used pools are exposed
+ */
+void t_g_pool_stats() {
+	gpointer obj;
+	guint allocs, frees;
+
+	allocs = t_pool_get_stat("alloc");
+	frees  = t_pool_get_stat("free");
+
+	obj = g_pool_alloc0(&t_pool);
+	g_pool_free(&t_pool, obj);
+
+	g_assert_cmpint(t_pool_get_stat("alloc"), ==, allocs + 1);
+	g_assert_cmpint(t_pool_get_stat("free"), ==, frees + 1);
+	g_assert_cmpint(t_pool_get_stat("alloc"), ==, t_pool_get_stat("free"));
+}
+
+static gpointer t_g_pool_stats_thread(gpointer G_GNUC_UNUSED user_data) {
+	gpointer obj;
+
+	obj = g_pool_alloc0(&t_pool);
+	g_pool_free(&t_pool, obj);
+
+	return NULL;
+}
+
+/**
+ * @test the counters of a thread are kept after it exited
+ */
+void t_g_pool_stats_thread_exit() {
+	GThread *thr;
+	guint allocs, frees;
+
+	allocs = t_pool_get_stat("alloc");
+	frees  = t_pool_get_stat("free");
+
+	thr = g_thread_create(t_g_pool_stats_thread, NULL, TRUE, NULL);
+	g_assert(thr);
+	g_thread_join(thr);
+
+	g_assert_cmpint(t_pool_get_stat("alloc"), ==, allocs + 1);
+	g_assert_cmpint(t_pool_get_stat("free"), ==, frees + 1);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/glib-ext/pool/reuse", t_g_pool_reuse);
+	g_test_add_func("/glib-ext/pool/depot", t_g_pool_depot);
+	g_test_add_func("/glib-ext/pool/stats", t_g_pool_stats);
+	g_test_add_func("/glib-ext/pool/stats_thread_exit", t_g_pool_stats_thread_exit);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -80,6 +80,18 @@ void t_network_address_resolve() {
 	network_address_free(addr);
 }
 
+/**
+ * @test only hostnames have to be looked up by the resolver
+ */
+void t_network_address_is_hostname() {
+	g_assert(!network_address_is_hostname("127.0.0.1:3306"));
+	g_assert(!network_address_is_hostname("127.0.0.1"));
+	g_assert(!network_address_is_hostname(":4040"));
+	g_assert(!network_address_is_hostname("/tmp/mysql.sock"));
+
+	g_assert(network_address_is_hostname("localhost:3306"));
+	g_assert(network_address_is_hostname("db.example.com"));
+}
 
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
@@ -88,6 +100,7 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/network_address_new", t_network_address_new);
 	g_test_add_func("/core/network_address_set", t_network_address_set);
 	g_test_add_func("/core/network_address_resolve", t_network_address_resolve);
+	g_test_add_func("/core/network_address_is_hostname", t_network_address_is_hostname);
 
 	return g_test_run();
 }
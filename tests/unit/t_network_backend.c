@@ -20,6 +20,9 @@
 #include <glib.h>
 
 #include "network-backend.h"
+#include "network-mysqld-packet.h"
+#include "chassis-event-thread.h"
+#include "chassis-mainloop.h"
 
 #if GLIB_CHECK_VERSION(2, 16, 0)
 #define C(x) x, sizeof(x) - 1
@@ -125,9 +128,620 @@ void t_network_backends_check() {
 	g_assert_cmpint(0, ==, network_backends_check(backends));
 	g_assert_cmpint(BACKEND_STATE_DOWN, ==, backend->state);
 
+	/* with a health checker only its probes wake up the backend */
+	backends->has_health_checker = TRUE;
+	backends->backend_last_check.tv_sec -= 1;
+
+	g_assert_cmpint(0, ==, network_backends_check(backends));
+	g_assert_cmpint(BACKEND_STATE_DOWN, ==, backend->state);
+
 	network_backends_free(backends);
 }
 
+/**
+ * @test network_backends_choose() only picks backends of the type which aren't down
+ */
+void t_network_backends_choose() {
+	network_backends_t *backends;
+	network_backend_t *backend;
+	gint ndx = -1;
+	guint i;
+
+	backends = network_backends_new();
+	g_assert(backends);
+
+	/* no backends */
+	g_assert(NULL == network_backends_choose(backends, BACKEND_TYPE_RW, &ndx));
+	g_assert_cmpint(ndx, ==, -1);
+
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3307", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3308", BACKEND_TYPE_RW), ==, 0);
+
+	/* the less loaded of the 2 RW backends */
+	network_backends_get(backends, 0)->connected_clients = 2;
+	network_backends_get(backends, 2)->connected_clients = 1;
+
+	g_assert(network_backends_get(backends, 2) == network_backends_choose(backends, BACKEND_TYPE_RW, &ndx));
+	g_assert_cmpint(ndx, ==, 2);
+
+	g_assert(network_backends_get(backends, 1) == network_backends_choose(backends, BACKEND_TYPE_RO, &ndx));
+	g_assert_cmpint(ndx, ==, 1);
+
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3309", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3310", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_count(backends), ==, 5);
+
+	/* only one RW backend is up, we have to find it */
+	network_backends_get(backends, 0)->state = BACKEND_STATE_DOWN;
+	network_backends_get(backends, 2)->state = BACKEND_STATE_DOWN;
+	network_backends_get(backends, 4)->state = BACKEND_STATE_DOWN;
+
+	for (i = 0; i < 100; i++) {
+		backend = network_backends_choose(backends, BACKEND_TYPE_RW, &ndx);
+
+		g_assert(backend == network_backends_get(backends, 3));
+		g_assert_cmpint(ndx, ==, 3);
+	}
+
+	/* all RW backends are down */
+	network_backends_get(backends, 3)->state = BACKEND_STATE_DOWN;
+	g_assert(NULL == network_backends_choose(backends, BACKEND_TYPE_RW, &ndx));
+
+	network_backends_free(backends);
+}
+
+/**
+ * @test RO backends that lag more than their max_replication_lag aren't chosen
+ */
+void t_network_backends_choose_lagging() {
+	network_backends_t *backends;
+	network_backend_t *backend;
+	gint ndx = -1;
+
+	backends = network_backends_new();
+	g_assert(backends);
+
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3307", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3308", BACKEND_TYPE_RO), ==, 0);
+
+	backend = network_backends_get(backends, 1);
+	network_backends_get(backends, 2)->connected_clients = 1;
+
+	/* no limit */
+	backend->replication_lag = 100;
+	g_assert(!network_backend_is_lagging(backend));
+	g_assert(backend == network_backends_choose(backends, BACKEND_TYPE_RO, &ndx));
+
+	/* the less loaded backend lags too much */
+	backend->max_replication_lag = 10;
+	g_assert(network_backend_is_lagging(backend));
+	g_assert(network_backends_get(backends, 2) == network_backends_choose(backends, BACKEND_TYPE_RO, &ndx));
+	g_assert_cmpint(ndx, ==, 2);
+
+	/* a unknown lag is fine, a stopped replication isn't */
+	backend->replication_lag = NETWORK_BACKEND_REPLICATION_LAG_UNKNOWN;
+	g_assert(!network_backend_is_lagging(backend));
+
+	backend->replication_lag = NETWORK_BACKEND_REPLICATION_STOPPED;
+	g_assert(network_backend_is_lagging(backend));
+
+	backend->replication_lag = 10;
+	g_assert(!network_backend_is_lagging(backend));
+
+	/* the limit only applies to the RO backends */
+	backend = network_backends_get(backends, 0);
+	backend->replication_lag = 100;
+	backend->max_replication_lag = 10;
+	g_assert(!network_backend_is_lagging(backend));
+
+	network_backends_free(backends);
+}
+
+/**
+ * @test the weighted round-robin follows the weights of the backends
+ */
+void t_network_backends_choose_wrr() {
+	network_backends_t *backends;
+	guint picked[3] = { 0, 0, 0 };
+	gint ndx = -1;
+	guint i;
+
+	g_log_set_always_fatal(G_LOG_FATAL_MASK);
+	backends = network_backends_new();
+
+	g_assert_cmpint(network_backends_set_balance(backends, "round-robin"), ==, -1);
+	g_assert_cmpint(network_backends_set_balance(backends, "wrr"), ==, 0);
+
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306@3", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3307", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3308@0", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3309@x", BACKEND_TYPE_RW), ==, -1);
+
+	/* the weight isn't part of the address */
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306", BACKEND_TYPE_RW), ==, -1);
+
+	g_assert_cmpint(network_backends_get(backends, 0)->weight, ==, 3);
+	g_assert_cmpint(network_backends_get(backends, 1)->weight, ==, 1);
+
+	for (i = 0; i < 400; i++) {
+		g_assert(NULL != network_backends_choose(backends, BACKEND_TYPE_RW, &ndx));
+		picked[ndx]++;
+	}
+
+	g_assert_cmpint(picked[0], ==, 300);
+	g_assert_cmpint(picked[1], ==, 100);
+	g_assert_cmpint(picked[2], ==, 0);
+
+	network_backends_free(backends);
+}
+
+/**
+ * @test the weighted round-robin spreads the picks of a backend instead of sending them in a burst
+ */
+void t_network_backends_choose_wrr_smooth() {
+	network_backends_t *backends;
+	gint expected[] = { 0, 0, 1, 0, 2, 0, 0 };
+	gint ndx = -1;
+	guint i;
+
+	backends = network_backends_new();
+
+	g_assert_cmpint(network_backends_set_balance(backends, "wrr"), ==, 0);
+
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306@5", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3307", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3308", BACKEND_TYPE_RW), ==, 0);
+
+	/* the sequence repeats after the sum of the weights */
+	for (i = 0; i < 2 * G_N_ELEMENTS(expected); i++) {
+		g_assert(NULL != network_backends_choose(backends, BACKEND_TYPE_RW, &ndx));
+		g_assert_cmpint(ndx, ==, expected[i % G_N_ELEMENTS(expected)]);
+	}
+
+	network_backends_free(backends);
+}
+
+/**
+ * @test the latency jumps up to a slower sample and only slowly goes down again
+ */
+void t_network_backend_update_latency() {
+	network_backend_t *b;
+
+	b = network_backend_new();
+
+	g_assert_cmpint(network_backend_get_latency(b), ==, 0);
+
+	/* check the EWMA itself, network_backend_get_latency() halves it if we cross a second */
+	network_backend_update_latency(b, 8000);
+	g_assert_cmpint(b->latency_ewma, ==, 8000);
+
+	network_backend_update_latency(b, 0);
+	g_assert_cmpint(b->latency_ewma, <, 8000);
+	g_assert_cmpint(b->latency_ewma, >, 3000);
+
+	network_backend_update_latency(b, 20000);
+	g_assert_cmpint(b->latency_ewma, ==, 20000);
+	g_assert_cmpint(network_backend_get_latency(b), <=, 20000);
+
+	network_backend_query_start(b);
+	g_assert_cmpint(b->pending_queries, ==, 1);
+	network_backend_query_done(b);
+	g_assert_cmpint(b->pending_queries, ==, 0);
+
+	network_backend_free(b);
+}
+
+/**
+ * @test a pooled connection is only handed out without a reset if the client authed like it and it is clean
+ */
+void t_network_backend_get_reset() {
+	network_backend_t *b;
+	network_socket *client, *server;
+
+	b = network_backend_new();
+
+	client = network_socket_new();
+	client->response = network_mysqld_auth_response_new();
+	g_string_assign(client->response->username, "a");
+	g_string_assign(client->response->response, "scramble");
+	g_string_assign(client->default_db, "db");
+
+	server = network_socket_new();
+	server->challenge = network_mysqld_auth_challenge_new();
+	server->challenge->server_version = 50520;
+	server->response = network_mysqld_auth_response_copy(client->response);
+	g_string_assign(server->default_db, "db");
+
+	g_assert_cmpint(b->reset_policy, ==, NETWORK_BACKEND_RESET_POLICY_AUTO);
+	g_assert_cmpint(network_backend_get_reset(b, client, server), ==, NETWORK_BACKEND_RESET_NONE);
+
+	/* the session has state, but the server doesn't know COM_RESET_CONNECTION */
+	server->has_session_state = TRUE;
+	g_assert_cmpint(network_backend_get_reset(b, client, server), ==, NETWORK_BACKEND_RESET_CHANGE_USER);
+
+	server->challenge->server_version = 50703;
+	g_assert_cmpint(network_backend_get_reset(b, client, server), ==, NETWORK_BACKEND_RESET_CONNECTION);
+	server->has_session_state = FALSE;
+
+	/* COM_RESET_CONNECTION keeps the default-db */
+	g_string_assign(client->default_db, "other");
+	g_assert_cmpint(network_backend_get_reset(b, client, server), ==, NETWORK_BACKEND_RESET_CHANGE_USER);
+	g_string_assign(client->default_db, "db");
+
+	/* another password: let the server check it */
+	g_string_assign(client->response->response, "other");
+	g_assert_cmpint(network_backend_get_reset(b, client, server), ==, NETWORK_BACKEND_RESET_CHANGE_USER);
+	g_string_assign(client->response->response, "scramble");
+
+	g_assert_cmpint(network_backend_set_reset_policy(b, "reset-connection"), ==, 0);
+	g_assert_cmpint(network_backend_get_reset(b, client, server), ==, NETWORK_BACKEND_RESET_CONNECTION);
+
+	g_assert_cmpint(network_backend_set_reset_policy(b, "change-user"), ==, 0);
+	g_assert_cmpint(network_backend_get_reset(b, client, server), ==, NETWORK_BACKEND_RESET_CHANGE_USER);
+	g_assert_cmpstr(network_backend_get_reset_policy_name(b), ==, "change-user");
+
+	g_assert_cmpint(network_backend_set_reset_policy(b, "unknown"), ==, -1);
+
+	network_socket_free(client);
+	network_socket_free(server);
+	network_backend_free(b);
+}
+
+static network_socket *t_pool_socket_new(struct event_base *event_base, const char *username) {
+	network_socket *sock;
+
+	sock = network_socket_new();
+	sock->response = network_mysqld_auth_response_new();
+	g_string_assign(sock->response->username, username);
+
+	/* the pool only trims the connections that idle in the event-base of the caller */
+	event_base_set(event_base, &(sock->event));
+
+	return sock;
+}
+
+/**
+ * @test only the oldest idling connections above max_idle_connections of the caller's event-base are closed
+ */
+void t_network_connection_pool_trim() {
+	network_connection_pool *pool;
+	struct event_base *base_a, *base_b;
+	GString *username = g_string_new("a");
+	guint i;
+
+	base_a = event_base_new();
+	base_b = event_base_new();
+
+	pool = network_connection_pool_new();
+
+	network_connection_pool_add(pool, t_pool_socket_new(base_b, "a"));
+	for (i = 0; i < 3; i++) {
+		network_connection_pool_add(pool, t_pool_socket_new(base_a, "a"));
+	}
+	network_connection_pool_add(pool, t_pool_socket_new(base_a, "b"));
+
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, username), ==, 4);
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, NULL), ==, 5);
+
+	/* no limit */
+	g_assert_cmpint(network_connection_pool_trim(pool, base_a), ==, 0);
+
+	pool->max_idle_connections = 2;
+	g_assert_cmpint(network_connection_pool_trim(pool, base_a), ==, 2);
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, username), ==, 2);
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, NULL), ==, 3);
+	g_assert_cmpint(pool->trimmed_connections, ==, 2);
+
+	/* the connection of base_b is the oldest one, but base_a can't close it */
+	network_socket_free(network_connection_pool_get(pool, username, NULL));
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, username), ==, 1);
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, NULL), ==, 2);
+
+	network_connection_pool_free(pool);
+
+	event_base_free(base_a);
+	event_base_free(base_b);
+	g_string_free(username, TRUE);
+}
+
+/**
+ * @test idling connections are closed at the end of their lifetime by the thread they idle in
+ */
+void t_network_connection_pool_expire() {
+	network_connection_pool *pool;
+	struct event_base *base_a, *base_b;
+	GTimeVal now;
+	guint i;
+
+	base_a = event_base_new();
+	base_b = event_base_new();
+
+	pool = network_connection_pool_new();
+	pool->max_lifetime = 10;
+
+	g_get_current_time(&now);
+
+	for (i = 0; i < 3; i++) {
+		network_connection_pool_add(pool, t_pool_socket_new(base_a, "a"));
+	}
+	network_connection_pool_add(pool, t_pool_socket_new(base_b, "a"));
+
+	/* the lifetime is jittered, but not more than 10% */
+	g_assert_cmpint(network_connection_pool_expire(pool, base_a, now.tv_sec, now.tv_sec + 5), ==, 0);
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, NULL), ==, 4);
+
+	g_assert_cmpint(network_connection_pool_expire(pool, base_a, now.tv_sec + 5, now.tv_sec + 11), ==, 3);
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, NULL), ==, 1);
+	g_assert_cmpint(pool->expired_connections, ==, 3);
+
+	/* the first run of a thread walks all slots */
+	g_assert_cmpint(network_connection_pool_expire(pool, base_b, 0, now.tv_sec + 11), ==, 1);
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, NULL), ==, 0);
+
+	network_connection_pool_free(pool);
+
+	event_base_free(base_a);
+	event_base_free(base_b);
+}
+
+/**
+ * @test a client without idling connections of its own takes one from the user with the most idling connections
+ */
+void t_network_connection_pool_get() {
+	network_connection_pool *pool;
+	network_connection_pool_entry *entry;
+	network_socket *sock;
+	struct event_base *base;
+	GString *username = g_string_new("c");
+	guint i;
+
+	base = event_base_new();
+
+	pool = network_connection_pool_new();
+	pool->min_idle_connections = 1;
+
+	network_connection_pool_add(pool, t_pool_socket_new(base, "a"));
+	for (i = 0; i < 3; i++) {
+		network_connection_pool_add(pool, t_pool_socket_new(base, "b"));
+	}
+	entry = network_connection_pool_add(pool, t_pool_socket_new(base, "a"));
+
+	/* we aren't a event-thread, all connections are in the first shard */
+	g_assert(entry->shard == network_connection_pool_get_shard(pool));
+	g_assert(entry->shard == pool->shards[0]);
+
+	sock = network_connection_pool_get(pool, username, NULL);
+	g_assert(sock);
+	g_assert_cmpstr(sock->response->username->str, ==, "b");
+	network_socket_free(sock);
+
+	/* both have 2 idling connections now, removing one of "a" makes "b" the top of the heap */
+	network_connection_pool_remove(pool, entry);
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, NULL), ==, 3);
+
+	sock = network_connection_pool_get(pool, username, NULL);
+	g_assert(sock);
+	g_assert_cmpstr(sock->response->username->str, ==, "b");
+	network_socket_free(sock);
+
+	/* nobody has more than min_idle_connections */
+	g_assert(NULL == network_connection_pool_get(pool, username, NULL));
+	g_assert_cmpint(pool->stolen_connections, ==, 0);
+
+	network_connection_pool_free(pool);
+
+	event_base_free(base);
+	g_string_free(username, TRUE);
+}
+
+/**
+ * @test only a idling connection of the same user, default-db and charset is handed out
+ */
+void t_network_connection_pool_get_authed() {
+	network_connection_pool *pool;
+	network_mysqld_auth_response *auth;
+	network_socket *sock;
+	struct event_base *base;
+	GString *default_db = g_string_new("db");
+
+	base = event_base_new();
+
+	pool = network_connection_pool_new();
+
+	sock = t_pool_socket_new(base, "a");
+	sock->response->charset = 8;
+	g_string_assign(sock->default_db, "db");
+	network_connection_pool_add(pool, sock);
+	network_connection_pool_add(pool, t_pool_socket_new(base, "b"));
+
+	auth = network_mysqld_auth_response_new();
+	auth->charset = 8;
+
+	/* unknown user */
+	g_string_assign(auth->username, "c");
+	g_assert(NULL == network_connection_pool_get_authed(pool, auth, default_db));
+
+	/* other charset */
+	g_string_assign(auth->username, "a");
+	auth->charset = 33;
+	g_assert(NULL == network_connection_pool_get_authed(pool, auth, default_db));
+	auth->charset = 8;
+
+	/* other default-db */
+	g_string_assign(default_db, "other");
+	g_assert(NULL == network_connection_pool_get_authed(pool, auth, default_db));
+	g_string_assign(default_db, "db");
+
+	sock = network_connection_pool_get_authed(pool, auth, default_db);
+	g_assert(sock);
+	g_assert_cmpstr(sock->response->username->str, ==, "a");
+	network_socket_free(sock);
+
+	/* it is gone now and isn't stolen from the user "b" */
+	g_assert(NULL == network_connection_pool_get_authed(pool, auth, default_db));
+	g_assert_cmpint(network_connection_pool_get_idle_count(pool, NULL), ==, 1);
+	g_assert_cmpint(pool->stolen_connections, ==, 0);
+
+	network_connection_pool_free(pool);
+	network_mysqld_auth_response_free(auth);
+
+	event_base_free(base);
+	g_string_free(default_db, TRUE);
+}
+
+/**
+ * a function to call in a event-thread
+ *
+ * @see t_event_thread_call()
+ */
+typedef struct {
+	void (*func)(gpointer data);
+	gpointer data;
+
+	volatile gint is_done;
+} t_event_thread_call_t;
+
+static void t_event_thread_call_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	t_event_thread_call_t *call = user_data;
+
+	call->func(call->data);
+
+	g_atomic_int_set(&(call->is_done), 1);
+}
+
+/**
+ * call a function in a running event-thread and wait for it
+ *
+ * @param fd a writable socket, its write-event fires right away in the event-thread
+ */
+static void t_event_thread_call(chassis_event_thread_t *event_thread, int fd, void (*func)(gpointer), gpointer data) {
+	t_event_thread_call_t call;
+	struct event ev;
+
+	call.func = func;
+	call.data = data;
+	call.is_done = 0;
+
+	event_set(&ev, fd, EV_WRITE, t_event_thread_call_handle, &call);
+	chassis_event_add_to_thread(NULL, event_thread, &ev, 0);
+
+	while (!g_atomic_int_get(&(call.is_done))) g_usleep(1000);
+}
+
+typedef struct {
+	network_connection_pool *pool;
+	GString *username;
+
+	network_socket *sock;            /** the socket that idles in the first event-thread */
+	network_connection_pool_entry *entry;
+
+	network_socket *got;             /** the socket network_connection_pool_get() handed out */
+} t_pool_steal_t;
+
+static void t_pool_steal_idle_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void G_GNUC_UNUSED *user_data) {
+	/* the other end of the socketpair neither writes nor closes while the test runs */
+	g_assert_not_reached();
+}
+
+static void t_pool_steal_add(gpointer data) {
+	t_pool_steal_t *steal = data;
+	network_socket *sock = steal->sock;
+
+	steal->entry = network_connection_pool_add(steal->pool, sock);
+
+	event_set(&(sock->event), sock->fd, EV_READ, t_pool_steal_idle_handle, steal->entry);
+	chassis_event_add_local(NULL, &(sock->event));
+}
+
+static void t_pool_steal_get(gpointer data) {
+	t_pool_steal_t *steal = data;
+
+	steal->got = network_connection_pool_get(steal->pool, steal->username, NULL);
+}
+
+/**
+ * @test a connection that idles in another event-thread is moved over by its own thread before it is handed out
+ */
+void t_network_connection_pool_steal() {
+	chassis_event_threads_t *threads;
+	chassis_event_thread_t *thread_a, *thread_b;
+	network_connection_pool_shard *shard_b;
+	t_pool_steal_t steal;
+	int sock_fds[2];
+	int call_fds[2];
+	guint i;
+
+	g_assert_cmpint(0, ==, evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, sock_fds));
+	g_assert_cmpint(0, ==, evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, call_fds));
+
+	threads = chassis_event_threads_new();
+	for (i = 0; i < 2; i++) {
+		chassis_event_thread_t *event_thread = chassis_event_thread_new();
+
+		chassis_event_threads_init_thread(threads, event_thread, NULL);
+		chassis_event_threads_add(threads, event_thread);
+
+		event_thread->thr = g_thread_create((GThreadFunc)chassis_event_thread_loop, event_thread, TRUE, NULL);
+		g_assert(event_thread->thr);
+	}
+	thread_a = threads->event_threads->pdata[0];
+	thread_b = threads->event_threads->pdata[1];
+
+	steal.pool = network_connection_pool_new();
+	steal.username = g_string_new("a");
+	steal.sock = network_socket_new();
+	steal.sock->fd = sock_fds[0];
+	steal.sock->response = network_mysqld_auth_response_new();
+	g_string_assign(steal.sock->response->username, "a");
+	steal.got = NULL;
+
+	/* the connection idles in the shard and event-base of thread a */
+	t_event_thread_call(thread_a, call_fds[0], t_pool_steal_add, &steal);
+	g_assert(steal.entry->shard == steal.pool->shards[0]);
+	g_assert(steal.entry->event_thread == thread_a);
+	g_assert(steal.sock->event.ev_base == thread_a->event_base);
+
+	/* thread b can't take it directly, it is moved over instead */
+	t_event_thread_call(thread_b, call_fds[0], t_pool_steal_get, &steal);
+	g_assert(steal.got == NULL);
+	g_assert_cmpint(steal.pool->stolen_connections, ==, 1);
+	g_assert_cmpint(network_connection_pool_shard_get_idle_count(steal.pool->shards[0], NULL), ==, 0);
+
+	/* wait until thread a released it and thread b adopted it */
+	for (i = 0; i < 5000; i++) {
+		shard_b = g_atomic_pointer_get(&(steal.pool->shards[1]));
+
+		if (shard_b && network_connection_pool_shard_get_idle_count(shard_b, NULL) == 1) break;
+
+		g_usleep(1000);
+	}
+	g_assert(shard_b);
+	g_assert_cmpint(network_connection_pool_shard_get_idle_count(shard_b, NULL), ==, 1);
+	g_assert(steal.entry->shard == shard_b);
+	g_assert(steal.entry->event_thread == thread_b);
+	g_assert(steal.sock->event.ev_base == thread_b->event_base);
+
+	/* now it is handed out from the local shard */
+	t_event_thread_call(thread_b, call_fds[0], t_pool_steal_get, &steal);
+	g_assert(steal.got == steal.sock);
+	g_assert_cmpint(steal.pool->stolen_connections, ==, 1);
+	g_assert_cmpint(network_connection_pool_get_idle_count(steal.pool, NULL), ==, 0);
+
+	network_socket_free(steal.got);
+	network_connection_pool_free(steal.pool);
+	g_string_free(steal.username, TRUE);
+
+	/* the event-threads check for the shutdown once a second */
+	chassis_set_shutdown();
+	chassis_event_threads_free(threads);
+
+	closesocket(sock_fds[1]);
+	closesocket(call_fds[0]);
+	closesocket(call_fds[1]);
+}
+
 int main(int argc, char **argv) {
 #ifdef WIN32
 	WSADATA wsaData;
@@ -148,6 +762,17 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/network_backend_new", t_network_backend_new);
 	g_test_add_func("/core/network_backends_add", t_network_backends_add);
 	g_test_add_func("/core/network_backends_check", t_network_backends_check);
+	g_test_add_func("/core/network_backends_choose", t_network_backends_choose);
+	g_test_add_func("/core/network_backends_choose_lagging", t_network_backends_choose_lagging);
+	g_test_add_func("/core/network_backends_choose_wrr", t_network_backends_choose_wrr);
+	g_test_add_func("/core/network_backends_choose_wrr_smooth", t_network_backends_choose_wrr_smooth);
+	g_test_add_func("/core/network_backend_update_latency", t_network_backend_update_latency);
+	g_test_add_func("/core/network_backend_get_reset", t_network_backend_get_reset);
+	g_test_add_func("/core/network_connection_pool_trim", t_network_connection_pool_trim);
+	g_test_add_func("/core/network_connection_pool_expire", t_network_connection_pool_expire);
+	g_test_add_func("/core/network_connection_pool_get", t_network_connection_pool_get);
+	g_test_add_func("/core/network_connection_pool_get_authed", t_network_connection_pool_get_authed);
+	g_test_add_func("/core/network_connection_pool_steal", t_network_connection_pool_steal);
 
 	return g_test_run();
 }
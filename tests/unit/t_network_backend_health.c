@@ -0,0 +1,183 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <glib.h>
+
+#include "network-backend.h"
+#include "network-backend-health.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+/**
+ * a backend in the UNKNOWN state is UP after the first successful probe
+ */
+void t_network_backends_health_unknown() {
+	network_backends_t *backends;
+	network_backends_health *health;
+	network_backend_t *backend;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306", BACKEND_TYPE_RW), ==, 0);
+	backend = network_backends_get(backends, 0);
+
+	health = network_backends_health_new(NULL, backends);
+	network_backends_health_set_interval(health, 2, 10);
+	network_backends_health_set_thresholds(health, 2, 3);
+
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UNKNOWN);
+
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UP);
+
+	network_backends_health_free(health);
+	network_backends_free(backends);
+}
+
+/**
+ * fall failed probes mark a backend as DOWN, its probes back off up to max_backoff
+ * and rise successful probes mark it as UP again
+ */
+void t_network_backends_health_rise_fall() {
+	network_backends_t *backends;
+	network_backends_health *health;
+	network_backend_t *backend;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306", BACKEND_TYPE_RW), ==, 0);
+	backend = network_backends_get(backends, 0);
+
+	health = network_backends_health_new(NULL, backends);
+	network_backends_health_set_interval(health, 2, 10);
+	network_backends_health_set_thresholds(health, 2, 3);
+
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UP);
+
+	/* fall = 3 */
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UP);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UP);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_DOWN);
+
+	/* the backoff doubles up to max_backoff */
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 4);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 8);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 10);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 10);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_DOWN);
+
+	/* rise = 2, a passed probe is followed up after the interval */
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_DOWN);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UP);
+
+	/* the backoff starts over */
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 2);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 2);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_DOWN);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 4);
+
+	network_backends_health_free(health);
+	network_backends_free(backends);
+}
+
+/**
+ * a failed probe between the successful ones restarts the rise
+ */
+void t_network_backends_health_flapping() {
+	network_backends_t *backends;
+	network_backends_health *health;
+	network_backend_t *backend;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306", BACKEND_TYPE_RW), ==, 0);
+	backend = network_backends_get(backends, 0);
+
+	health = network_backends_health_new(NULL, backends);
+	network_backends_health_set_interval(health, 2, 10);
+	network_backends_health_set_thresholds(health, 2, 1);
+
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_DOWN);
+
+	/* the passed probe is followed up after the interval, the backoff keeps growing */
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, FALSE), ==, 8);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_DOWN);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UP);
+
+	network_backends_health_free(health);
+	network_backends_free(backends);
+}
+
+/**
+ * a backend the proxy marked as DOWN has to rise before it is UP again
+ */
+void t_network_backends_health_marked_down() {
+	network_backends_t *backends;
+	network_backends_health *health;
+	network_backend_t *backend;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306", BACKEND_TYPE_RW), ==, 0);
+	backend = network_backends_get(backends, 0);
+
+	health = network_backends_health_new(NULL, backends);
+	network_backends_health_set_interval(health, 2, 10);
+	network_backends_health_set_thresholds(health, 2, 3);
+
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UP);
+
+	/* a connect() of a client failed */
+	backend->state = BACKEND_STATE_DOWN;
+
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_DOWN);
+	g_assert_cmpint(network_backends_health_probe_done(health, 0, TRUE), ==, 2);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UP);
+
+	network_backends_health_free(health);
+	network_backends_free(backends);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_backends_health_unknown", t_network_backends_health_unknown);
+	g_test_add_func("/core/network_backends_health_rise_fall", t_network_backends_health_rise_fall);
+	g_test_add_func("/core/network_backends_health_flapping", t_network_backends_health_flapping);
+	g_test_add_func("/core/network_backends_health_marked_down", t_network_backends_health_marked_down);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,145 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-conn-registry.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+static void t_count_cons(guint64 G_GNUC_UNUSED id, gpointer con, gpointer user_data) {
+	GHashTable *seen = user_data;
+
+	g_hash_table_insert(seen, con, con);
+}
+
+/**
+ * @test connections can be added and removed by their id
+ */
+void t_network_connection_registry_add_remove() {
+	network_connection_registry *reg;
+	int cons[3];
+	guint64 ids[3];
+	GHashTable *seen;
+
+	reg = network_connection_registry_new();
+
+	ids[0] = network_connection_registry_add(reg, 0, &cons[0]);
+	ids[1] = network_connection_registry_add(reg, 0, &cons[1]);
+	ids[2] = network_connection_registry_add(reg, 3, &cons[2]);
+	g_assert(ids[0] != 0);
+	g_assert(ids[0] != ids[1]);
+	g_assert(ids[1] != ids[2]);
+	g_assert_cmpint(network_connection_registry_count(reg), ==, 3);
+
+	seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+	network_connection_registry_foreach(reg, t_count_cons, seen);
+	g_assert_cmpint(g_hash_table_size(seen), ==, 3);
+	g_hash_table_destroy(seen);
+
+	g_assert_cmpint(TRUE, ==, network_connection_registry_remove(reg, ids[1]));
+	g_assert_cmpint(FALSE, ==, network_connection_registry_remove(reg, ids[1])); /* already removed */
+	g_assert_cmpint(network_connection_registry_count(reg), ==, 2);
+
+	seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+	network_connection_registry_foreach(reg, t_count_cons, seen);
+	g_assert_cmpint(g_hash_table_size(seen), ==, 2);
+	g_assert(NULL == g_hash_table_lookup(seen, &cons[1]));
+	g_hash_table_destroy(seen);
+
+	g_assert_cmpint(TRUE, ==, network_connection_registry_remove(reg, ids[0]));
+	g_assert_cmpint(TRUE, ==, network_connection_registry_remove(reg, ids[2]));
+	g_assert_cmpint(network_connection_registry_count(reg), ==, 0);
+
+	network_connection_registry_free(reg);
+}
+
+static void t_add_con(guint64 G_GNUC_UNUSED id, gpointer con, gpointer user_data) {
+	network_connection_registry *reg = user_data;
+
+	g_assert(0 != network_connection_registry_add(reg, 0, con));
+}
+
+/**
+ * @test the callback of a foreach can call into the registry, even for the same shard
+ */
+void t_network_connection_registry_foreach_unlocked() {
+	network_connection_registry *reg;
+	int con;
+
+	reg = network_connection_registry_new();
+
+	g_assert(0 != network_connection_registry_add(reg, 0, &con));
+
+	/* the added connection isn't part of the copied entries */
+	network_connection_registry_foreach(reg, t_add_con, reg);
+	g_assert_cmpint(network_connection_registry_count(reg), ==, 2);
+
+	network_connection_registry_free(reg);
+}
+
+/**
+ * @test a reused slot gets a new id, the old id stays invalid
+ */
+void t_network_connection_registry_reuse() {
+	network_connection_registry *reg;
+	int con_a, con_b;
+	guint64 id_a, id_b;
+	guint i;
+
+	reg = network_connection_registry_new();
+
+	id_a = network_connection_registry_add(reg, 1, &con_a);
+	g_assert_cmpint(TRUE, ==, network_connection_registry_remove(reg, id_a));
+
+	id_b = network_connection_registry_add(reg, 1, &con_b);
+	g_assert(id_a != id_b);
+	g_assert_cmpint(FALSE, ==, network_connection_registry_remove(reg, id_a));
+	g_assert_cmpint(TRUE, ==, network_connection_registry_remove(reg, id_b));
+
+	/* more connections than fit into one slab */
+	for (i = 0; i < NETWORK_CONNECTION_REGISTRY_SLAB_SIZE + 1; i++) {
+		g_assert(0 != network_connection_registry_add(reg, 1, &con_a));
+	}
+	g_assert_cmpint(network_connection_registry_count(reg), ==, NETWORK_CONNECTION_REGISTRY_SLAB_SIZE + 1);
+
+	network_connection_registry_free(reg);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_connection_registry_add_remove", t_network_connection_registry_add_remove);
+	g_test_add_func("/core/network_connection_registry_reuse", t_network_connection_registry_reuse);
+	g_test_add_func("/core/network_connection_registry_foreach_unlocked", t_network_connection_registry_foreach_unlocked);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
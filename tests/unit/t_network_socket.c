@@ -60,6 +60,101 @@ void test_network_socket_new() {
 	network_socket_free(sock);
 }
 
+/**
+ * @test the recv-buffer keeps the unparsed data when it grows and is reset when it is empty
+ */
+void test_network_socket_recv_buf() {
+	network_socket *sock;
+
+	sock = network_socket_new();
+	sock->recv_buf_size = 16;
+
+	network_socket_recv_buf_reserve(sock, 0);
+	g_assert(sock->recv_buf);
+	g_assert_cmpint(sock->recv_buf->data->allocated_len, >, 16);
+
+	g_string_append_len(sock->recv_buf->data, C("123456"));
+	network_socket_recv_buf_consume(sock, 2);
+	g_assert_cmpint(sock->recv_buf_offset, ==, 2);
+
+	/* a large packet: the unparsed data is moved to the front */
+	network_socket_recv_buf_reserve(sock, 1024);
+	g_assert_cmpint(sock->recv_buf_offset, ==, 0);
+	g_assert_cmpint(sock->recv_buf->data->allocated_len, >, 1024);
+	g_assert_cmpstr(sock->recv_buf->data->str, ==, "3456");
+
+	/* once it is parsed the grown buffer is released */
+	network_socket_recv_buf_consume(sock, 4);
+	g_assert(sock->recv_buf == NULL);
+	g_assert_cmpint(sock->recv_buf_offset, ==, 0);
+
+	network_socket_free(sock);
+}
+
+/**
+ * @test slices reference the recv-buffer, it isn't reused while they are alive
+ */
+void test_network_socket_recv_buf_slices() {
+	network_socket *sock;
+	network_queue_buf *buf;
+	GString *s1, *s2;
+
+	sock = network_socket_new();
+	sock->recv_slices = TRUE;
+
+	network_socket_recv_buf_reserve(sock, 0);
+	buf = sock->recv_buf;
+	g_string_append_len(buf->data, C("123456"));
+
+	s1 = network_socket_recv_buf_pop(sock, 2);
+	g_assert(network_queue_chunk_is_slice(s1));
+	g_assert_cmpint(s1->len, ==, 2);
+	g_assert(s1->str == buf->data->str); /* no copy */
+	g_assert(network_queue_buf_is_shared(buf));
+
+	/* the socket drops its reference once everything is parsed */
+	s2 = network_socket_recv_buf_pop(sock, 4);
+	g_assert(sock->recv_buf == NULL);
+	g_assert(0 == memcmp(s2->str, "3456", 4));
+
+	network_queue_chunk_free(s1);
+	g_assert(0 == memcmp(s2->str, "3456", 4)); /* s2 keeps the buffer alive */
+	network_queue_chunk_free(s2);
+
+	network_socket_free(sock);
+}
+
+/**
+ * @test slices are copied when they are popped from a queue
+ */
+void test_network_queue_slices() {
+	network_queue *q;
+	network_queue_buf *buf;
+	GString *s;
+
+	buf = network_queue_buf_new(16);
+	g_string_append_len(buf->data, C("123456"));
+
+	q = network_queue_new();
+	network_queue_append(q, network_queue_slice_new(buf, 0, 3));
+	network_queue_append(q, network_queue_slice_new(buf, 3, 3));
+	network_queue_buf_unref(buf);
+	g_assert_cmpint(q->len, ==, 6);
+
+	s = network_queue_pop_string(q, 3, NULL);
+	g_assert(s);
+	g_assert(!network_queue_chunk_is_slice(s));
+	g_assert_cmpstr(s->str, ==, "123");
+	g_string_free(s, TRUE);
+
+	s = network_queue_peek_string(q, 3, NULL);
+	g_assert(s);
+	g_assert_cmpstr(s->str, ==, "456");
+	g_string_free(s, TRUE);
+
+	network_queue_free(q);
+}
+
 void test_network_queue_append() {
 	network_queue *q;
 
@@ -248,6 +343,7 @@ void t_network_socket_connect(void) {
 	g_assert_cmpint(3, ==, client_connected->to_read);
 	g_assert_cmpint(NETWORK_SOCKET_SUCCESS, ==, network_socket_read(client_connected)); /* read all */
 	g_assert_cmpint(0, ==, client_connected->to_read);
+	g_assert_cmpint(3, ==, client_connected->recv_buf->data->len);
 	
 	network_socket_free(client);
 	client = NULL;
@@ -255,6 +351,8 @@ void t_network_socket_connect(void) {
 	/* try to read from closed socket */
 	g_assert_cmpint(NETWORK_SOCKET_SUCCESS, ==, network_socket_to_read(client_connected));
 	g_assert_cmpint(0, ==, client_connected->to_read);
+	g_assert_cmpint(NETWORK_SOCKET_WAIT_FOR_EVENT, ==, network_socket_read(client_connected));
+	g_assert(client_connected->is_eof);
 
 	network_socket_free(client_connected);
 	network_socket_free(sock);
@@ -430,11 +528,14 @@ int main(int argc, char **argv) {
 	g_test_bug_base("http://bugs.mysql.com/");
 
 	g_test_add_func("/core/network_socket_new", test_network_socket_new);
+	g_test_add_func("/core/network_socket_recv_buf", test_network_socket_recv_buf);
+	g_test_add_func("/core/network_socket_recv_buf_slices", test_network_socket_recv_buf_slices);
 	g_test_add_func("/core/network_socket_bind", t_network_socket_bind);
 	g_test_add_func("/core/network_socket_connect", t_network_socket_connect);
 	g_test_add_func("/core/network_queue_append", test_network_queue_append);
 	g_test_add_func("/core/network_queue_peek_string", test_network_queue_peek_string);
 	g_test_add_func("/core/network_queue_pop_string", test_network_queue_pop_string);
+	g_test_add_func("/core/network_queue_slices", test_network_queue_slices);
 #ifndef WIN32
 	g_test_add_func("/core/network_socket_is_local_unix",t_network_socket_is_local_unix);
 